@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "program_generator.h"
+#include "lexer.h"
+#include "parser.h"
+#include "statement_parser.h"
+#include "expression_parser.h"
+#include "codegen.h"
+#include "memory_stats.h"
+
+namespace {
+
+struct Options {
+    std::vector<ProgramShape> shapes;
+    size_t bytes = 1 << 20;
+    uint64_t seed = 1;
+    int repetitions = 10;
+    int warmup = 1;
+    std::string format = "text";
+    std::string outputFile;
+    std::string baselineFile;
+    std::string emitFile;
+    std::string label;
+};
+
+// Timings of one phase on one generated program
+struct Result {
+    std::string shape;
+    std::string phase;
+    size_t bytes;
+    size_t tokens;
+    std::vector<double> samples; // Nanoseconds, sorted
+    double median;
+    double mean;
+    double stddev;
+    uint64_t allocations;      // Per repetition
+    uint64_t allocatedBytes;
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--shape=mixed|identifiers|comments|nesting|procedures|expressions|all]"
+              << " [--size=BYTES[K|M]] [--seed=N] [--repetitions=N] [--warmup=N]"
+              << " [--format=text|csv|json] [--output=FILE] [--baseline=FILE.csv] [--label=TEXT] [--emit=FILE]\n";
+}
+
+// Run body warmup + repetitions times, timing each repetition; setup runs untimed before each call
+Result measure(const Options& options, const std::function<void()>& setup, const std::function<void()>& body) {
+    Result result;
+    for (int i = 0; i < options.warmup + options.repetitions; i++) {
+        setup();
+        AllocationSample before = MemoryStats::read();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto end = std::chrono::steady_clock::now();
+        AllocationSample allocated = MemoryStats::read() - before;
+        if (i >= options.warmup) {
+            result.samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        }
+        result.allocations = allocated.allocations;
+        result.allocatedBytes = allocated.allocatedBytes;
+    }
+
+    std::sort(result.samples.begin(), result.samples.end());
+    size_t count = result.samples.size();
+    result.median = count % 2 ? result.samples[count / 2]
+                              : (result.samples[count / 2 - 1] + result.samples[count / 2]) / 2;
+    double sum = 0;
+    for (double sample : result.samples) sum += sample;
+    result.mean = sum / count;
+    double squares = 0;
+    for (double sample : result.samples) squares += (sample - result.mean) * (sample - result.mean);
+    result.stddev = count > 1 ? std::sqrt(squares / (count - 1)) : 0.0;
+    return result;
+}
+
+// Benchmark each phase, and the three together, on one generated program
+std::vector<Result> benchmarkShape(const Options& options, ProgramShape shape) {
+    GeneratorOptions generatorOptions;
+    generatorOptions.shape = shape;
+    generatorOptions.targetBytes = options.bytes;
+    generatorOptions.seed = options.seed;
+    std::string source = ProgramGenerator(generatorOptions).generate();
+
+    // Reference run, also used as input for the later phases
+    std::vector<Token> tokens = Lexer(source).tokenize();
+    Diagnostics diagnostics;
+    std::shared_ptr<ASTNode> ast = Parser(tokens, diagnostics).parse();
+    if (diagnostics.hasErrors()) {
+        std::cerr << "Warning: generated " << ProgramGenerator::shapeName(shape) << " program has "
+                  << diagnostics.getErrorCount() << " parse errors\n";
+    }
+
+    std::vector<Result> results;
+    std::vector<Token> scratch;
+    std::shared_ptr<ASTNode> parsed;
+    std::string code;
+
+    results.push_back(measure(options, [] {}, [&] {
+        scratch = Lexer(source).tokenize();
+    }));
+    results.back().phase = "lex";
+
+    results.push_back(measure(options, [&] { scratch = tokens; parsed.reset(); }, [&] {
+        Diagnostics parseDiagnostics;
+        parsed = Parser(std::move(scratch), parseDiagnostics).parse();
+    }));
+    results.back().phase = "parse";
+
+    results.push_back(measure(options, [&] { code.clear(); }, [&] {
+        code = CodeGenerator().generateCode(ast);
+    }));
+    results.back().phase = "codegen";
+
+    results.push_back(measure(options, [&] { parsed.reset(); code.clear(); }, [&] {
+        Diagnostics pipelineDiagnostics;
+        parsed = Parser(Lexer(source).tokenize(), pipelineDiagnostics).parse();
+        code = CodeGenerator().generateCode(parsed);
+    }));
+    results.back().phase = "total";
+
+    for (auto& result : results) {
+        result.shape = ProgramGenerator::shapeName(shape);
+        result.bytes = source.size();
+        result.tokens = tokens.size();
+    }
+    return results;
+}
+
+double megabytesPerSecond(const Result& result) {
+    return result.bytes / (result.median / 1e9) / 1e6;
+}
+
+double tokensPerSecond(const Result& result) {
+    return result.tokens / (result.median / 1e9);
+}
+
+// Median times from an earlier --format=csv run, keyed by shape and phase
+std::map<std::string, double> readBaseline(const std::string& filename) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(filename);
+    std::string line;
+    std::getline(in, line); // Header
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ',')) fields.push_back(field);
+        if (fields.size() >= 8) baseline[fields[1] + "/" + fields[2]] = std::stod(fields[7]);
+    }
+    return baseline;
+}
+
+void writeText(std::ostream& out, const std::vector<Result>& results, const std::map<std::string, double>& baseline) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-12s %-8s %10s %10s %12s %12s %8s %10s %14s %10s %12s%s\n", "shape", "phase",
+             "bytes", "tokens", "median ms", "mean ms", "stddev%", "MB/s", "tokens/s", "allocs", "alloc KB",
+             baseline.empty() ? "" : "  vs baseline");
+    out << line;
+    for (const auto& result : results) {
+        std::string change;
+        auto it = baseline.find(result.shape + "/" + result.phase);
+        if (it != baseline.end()) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "  %+.1f%%", (result.median / it->second - 1) * 100);
+            change = buffer;
+        }
+        snprintf(line, sizeof(line), "%-12s %-8s %10zu %10zu %12.3f %12.3f %8.1f %10.1f %14.0f %10llu %12.1f%s\n",
+                 result.shape.c_str(), result.phase.c_str(), result.bytes, result.tokens, result.median / 1e6,
+                 result.mean / 1e6, 100 * result.stddev / result.mean, megabytesPerSecond(result),
+                 tokensPerSecond(result), static_cast<unsigned long long>(result.allocations),
+                 result.allocatedBytes / 1024.0, change.c_str());
+        out << line;
+    }
+}
+
+void writeCsv(std::ostream& out, const std::vector<Result>& results, const Options& options) {
+    out << "label,shape,phase,bytes,tokens,repetitions,min_ns,median_ns,mean_ns,stddev_ns,mb_per_s,tokens_per_s,"
+        << "allocations,allocated_bytes\n";
+    for (const auto& result : results) {
+        out << options.label << "," << result.shape << "," << result.phase << "," << result.bytes << ","
+            << result.tokens << "," << result.samples.size() << "," << static_cast<uint64_t>(result.samples.front())
+            << "," << static_cast<uint64_t>(result.median) << "," << static_cast<uint64_t>(result.mean) << ","
+            << static_cast<uint64_t>(result.stddev) << "," << megabytesPerSecond(result) << ","
+            << tokensPerSecond(result) << "," << result.allocations << "," << result.allocatedBytes << "\n";
+    }
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results, const Options& options) {
+    out << "{\"label\": \"" << options.label << "\", \"seed\": " << options.seed
+        << ", \"repetitions\": " << options.repetitions << ", \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        out << "  {\"shape\": \"" << result.shape << "\", \"phase\": \"" << result.phase
+            << "\", \"bytes\": " << result.bytes << ", \"tokens\": " << result.tokens << ", \"samples_ns\": [";
+        for (size_t j = 0; j < result.samples.size(); j++) {
+            out << (j ? ", " : "") << static_cast<uint64_t>(result.samples[j]);
+        }
+        out << "], \"median_ns\": " << static_cast<uint64_t>(result.median)
+            << ", \"mean_ns\": " << static_cast<uint64_t>(result.mean)
+            << ", \"stddev_ns\": " << static_cast<uint64_t>(result.stddev)
+            << ", \"mb_per_s\": " << megabytesPerSecond(result)
+            << ", \"tokens_per_s\": " << tokensPerSecond(result)
+            << ", \"allocations\": " << result.allocations
+            << ", \"allocated_bytes\": " << result.allocatedBytes << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') == std::string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--shape=", 0) == 0) {
+            ProgramShape shape;
+            if (value == "all") {
+                options.shapes.clear();
+            } else if (ProgramGenerator::parseShape(value, shape)) {
+                options.shapes.push_back(shape);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg.rfind("--size=", 0) == 0) {
+            options.bytes = ProgramGenerator::parseSize(value);
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::stoull(value);
+        } else if (arg.rfind("--repetitions=", 0) == 0) {
+            options.repetitions = std::max(1, std::stoi(value));
+        } else if (arg.rfind("--warmup=", 0) == 0) {
+            options.warmup = std::max(0, std::stoi(value));
+        } else if (arg.rfind("--format=", 0) == 0) {
+            options.format = value;
+        } else if (arg.rfind("--output=", 0) == 0) {
+            options.outputFile = value;
+        } else if (arg.rfind("--baseline=", 0) == 0) {
+            options.baselineFile = value;
+        } else if (arg.rfind("--label=", 0) == 0) {
+            options.label = value;
+        } else if (arg.rfind("--emit=", 0) == 0) {
+            options.emitFile = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.shapes.empty()) {
+        for (int shape = 0; shape <= static_cast<int>(ProgramShape::EXPRESSIONS); shape++) {
+            options.shapes.push_back(static_cast<ProgramShape>(shape));
+        }
+    }
+
+    // Only write the generated program, e.g. to feed it to the compiler itself
+    if (!options.emitFile.empty()) {
+        GeneratorOptions generatorOptions;
+        generatorOptions.shape = options.shapes.front();
+        generatorOptions.targetBytes = options.bytes;
+        generatorOptions.seed = options.seed;
+        std::ofstream out(options.emitFile);
+        out << ProgramGenerator(generatorOptions).generate();
+        return out ? 0 : 1;
+    }
+
+    // Allocation counts are taken from every run; counting costs the same on every commit
+    MemoryStats::enable();
+    std::vector<Result> results;
+    for (ProgramShape shape : options.shapes) {
+        auto shapeResults = benchmarkShape(options, shape);
+        results.insert(results.end(), shapeResults.begin(), shapeResults.end());
+    }
+
+    std::ofstream file;
+    if (!options.outputFile.empty()) {
+        file.open(options.outputFile);
+        if (!file) {
+            std::cerr << "Error: Could not open file " << options.outputFile << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = options.outputFile.empty() ? std::cout : file;
+    if (options.format == "csv") {
+        writeCsv(out, results, options);
+    } else if (options.format == "json") {
+        writeJson(out, results, options);
+    } else {
+        std::map<std::string, double> baseline;
+        if (!options.baselineFile.empty()) baseline = readBaseline(options.baselineFile);
+        writeText(out, results, baseline);
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "program_generator.h"
+#include "document.h"
+
+namespace {
+
+struct Options {
+    ProgramShape shape = ProgramShape::MIXED;
+    size_t bytes = 1 << 20;
+    uint64_t seed = 1;
+    int edits = 1000;
+};
+
+// Latencies of one kind of edit, in nanoseconds, with how much each one re-parsed
+struct Result {
+    std::string kind;
+    std::vector<double> samples; // Sorted
+    size_t maxRelexed = 0;
+    size_t maxReparsed = 0;
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--shape=mixed|identifiers|comments|nesting|procedures|expressions]"
+              << " [--size=BYTES[K|M]] [--seed=N] [--edits=N]\n";
+}
+
+// Sample at the given fraction of the sorted samples, by nearest rank
+double percentile(const std::vector<double>& samples, double fraction) {
+    size_t rank = static_cast<size_t>(fraction * samples.size() + 0.5);
+    return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// The same splitmix64 generator as ProgramGenerator, so edits do not depend on the standard library
+uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Time one applyEdit and note how much of the document it re-lexed and re-parsed
+void timeEdit(Document& document, size_t start, size_t end, const std::string& replacement, Result& result) {
+    auto begin = std::chrono::steady_clock::now();
+    document.applyEdit(start, end, replacement);
+    auto finish = std::chrono::steady_clock::now();
+    result.samples.push_back(std::chrono::duration<double, std::nano>(finish - begin).count());
+    result.maxRelexed = std::max(result.maxRelexed, document.getRelexedTokenCount());
+    result.maxReparsed = std::max(result.maxReparsed, document.getReparsedStatementCount());
+}
+
+// Apply random single-byte inserts, deletes and replacements, each followed by the edit
+// that undoes it, as when typing a character and deleting it again
+std::vector<Result> benchmarkEdits(const Options& options, size_t& lines, size_t& statements) {
+    GeneratorOptions generatorOptions;
+    generatorOptions.shape = options.shape;
+    generatorOptions.targetBytes = options.bytes;
+    generatorOptions.seed = options.seed;
+    std::string source = ProgramGenerator(generatorOptions).generate();
+    lines = std::count(source.begin(), source.end(), '\n');
+
+    Document document(source);
+    statements = document.getStatementCount();
+    std::vector<Result> results(4);
+    results[0].kind = "edit";
+    results[1].kind = "revert";
+    results[2].kind = "end edit";
+    results[3].kind = "end revert";
+
+    // Characters that change how the text around them lexes or parses
+    static const std::string inserted = "aZ7_ ;()<-+*\n\"";
+    uint64_t state = ~options.seed; // Not the program's sequence
+    for (int i = 0; i < options.edits; i++) {
+        const std::string& text = document.getText();
+        size_t position = nextRandom(state) % text.size();
+        std::string removed;
+        std::string replacement;
+        switch (nextRandom(state) % 3) {
+        case 0: // Insert
+            replacement = std::string(1, inserted[nextRandom(state) % inserted.size()]);
+            break;
+        case 1: // Delete
+            removed = text.substr(position, 1);
+            break;
+        default: // Replace
+            removed = text.substr(position, 1);
+            replacement = std::string(1, inserted[nextRandom(state) % inserted.size()]);
+            break;
+        }
+        timeEdit(document, position, position + removed.size(), replacement, results[0]);
+        timeEdit(document, position, position + replacement.size(), removed, results[1]);
+    }
+
+    // Break the 'end' of a block, which leaves it open until a later one closes it
+    std::vector<size_t> ends;
+    for (size_t position = source.find("end "); position != std::string::npos;
+         position = source.find("end ", position + 1)) {
+        ends.push_back(position);
+    }
+    for (int i = 0; i < options.edits && !ends.empty(); i++) {
+        size_t position = ends[nextRandom(state) % ends.size()];
+        timeEdit(document, position, position + 1, "", results[2]);
+        timeEdit(document, position, position, "e", results[3]);
+    }
+    if (document.getText() != source) {
+        std::cerr << "Error: reverting the edits did not restore the program\n";
+    }
+
+    Result all;
+    all.kind = "all";
+    for (const auto& result : results) {
+        all.samples.insert(all.samples.end(), result.samples.begin(), result.samples.end());
+        all.maxRelexed = std::max(all.maxRelexed, result.maxRelexed);
+        all.maxReparsed = std::max(all.maxReparsed, result.maxReparsed);
+    }
+    results.push_back(all);
+    for (auto& result : results) std::sort(result.samples.begin(), result.samples.end());
+    return results;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') == std::string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--shape=", 0) == 0) {
+            if (!ProgramGenerator::parseShape(value, options.shape)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg.rfind("--size=", 0) == 0) {
+            options.bytes = ProgramGenerator::parseSize(value);
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::stoull(value);
+        } else if (arg.rfind("--edits=", 0) == 0) {
+            options.edits = std::max(1, std::stoi(value));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    size_t lines = 0;
+    size_t statements = 0;
+    std::vector<Result> results = benchmarkEdits(options, lines, statements);
+
+    std::cout << ProgramGenerator::shapeName(options.shape) << " program: " << lines << " lines, " << statements
+              << " top-level statements\n";
+    char line[200];
+    snprintf(line, sizeof(line), "%-10s %8s %10s %10s %10s %10s %10s %12s %12s\n", "kind", "edits", "median ms",
+             "p90 ms", "p99 ms", "max ms", "mean ms", "max relexed", "max reparsed");
+    std::cout << line;
+    for (const auto& result : results) {
+        double sum = 0;
+        for (double sample : result.samples) sum += sample;
+        snprintf(line, sizeof(line), "%-10s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f %12zu %12zu\n",
+                 result.kind.c_str(), result.samples.size(), percentile(result.samples, 0.5) / 1e6,
+                 percentile(result.samples, 0.9) / 1e6, percentile(result.samples, 0.99) / 1e6,
+                 result.samples.back() / 1e6, sum / result.samples.size() / 1e6, result.maxRelexed,
+                 result.maxReparsed);
+        std::cout << line;
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "program_generator.h"
+#include "codegen.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "memory_stats.h"
+#include "parser.h"
+
+namespace {
+
+struct Options {
+    ProgramShape shape = ProgramShape::MIXED;
+    size_t bytes = 4 << 10;
+    int programs = 64;
+    double seconds = 2;
+    std::vector<unsigned> threads;
+    bool partialEvaluation = true;
+};
+
+// Compiles finished by every thread of one run
+struct Result {
+    std::string mode;
+    unsigned threads = 0;
+    uint64_t compiles = 0;
+    uint64_t bytes = 0;
+    uint64_t allocations = 0;
+    double seconds = 0;
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--shape=mixed|identifiers|comments|nesting|procedures|expressions]"
+              << " [--size=BYTES[K|M]] [--programs=N] [--seconds=S] [--threads=N]... [--no-partial-evaluation]\n";
+}
+
+// Compile with a new lexer, parser and code generator each time, as the command line compiler does
+size_t compileFresh(const Options& options, const std::string& source) {
+    Diagnostics diagnostics;
+    std::shared_ptr<ASTNode> ast = Parser(Lexer(source).tokenize(), diagnostics).parse();
+    CodeGenerator generator;
+    generator.setPartialEvaluation(options.partialEvaluation);
+    return generator.generateCode(ast).size();
+}
+
+// Compile the programs round-robin on every thread until the time is up. Each
+// thread starts at a different program, so they do not walk them in lockstep.
+Result run(const Options& options, const std::vector<std::string>& programs, const std::string& mode,
+           unsigned threadCount) {
+    std::atomic<bool> started{false};
+    std::atomic<bool> stopped{false};
+    std::vector<Result> perThread(threadCount);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            CompilerContext context;
+            CompileOptions compileOptions;
+            compileOptions.partialEvaluation = options.partialEvaluation;
+            context.setOptions(compileOptions);
+            Result& result = perThread[t];
+            while (!started.load(std::memory_order_acquire)) std::this_thread::yield();
+            AllocationSample before = MemoryStats::read();
+            size_t next = t * programs.size() / threadCount;
+            while (!stopped.load(std::memory_order_relaxed)) {
+                const std::string& source = programs[next];
+                next = (next + 1) % programs.size();
+                if (mode == "context") {
+                    context.compile(source);
+                } else {
+                    compileFresh(options, source);
+                }
+                result.compiles++;
+                result.bytes += source.size();
+            }
+            result.allocations = (MemoryStats::read() - before).allocations;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    started.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stopped.store(true, std::memory_order_relaxed);
+    for (auto& thread : threads) thread.join();
+
+    Result total;
+    total.mode = mode;
+    total.threads = threadCount;
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const Result& result : perThread) {
+        total.compiles += result.compiles;
+        total.bytes += result.bytes;
+        total.allocations += result.allocations;
+    }
+    return total;
+}
+
+void writeText(std::ostream& out, const std::vector<Result>& results) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-8s %8s %12s %14s %10s %14s %10s\n", "mode", "threads", "compiles",
+             "compiles/s", "MB/s", "allocs/compile", "speedup");
+    out << line;
+    double base = 0;
+    for (const auto& result : results) {
+        double rate = result.compiles / result.seconds;
+        if (base == 0) base = rate;
+        snprintf(line, sizeof(line), "%-8s %8u %12llu %14.0f %10.1f %14.1f %9.2fx\n", result.mode.c_str(),
+                 result.threads, static_cast<unsigned long long>(result.compiles), rate,
+                 result.bytes / result.seconds / 1e6,
+                 result.compiles ? static_cast<double>(result.allocations) / result.compiles : 0.0, rate / base);
+        out << line;
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') == std::string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--shape=", 0) == 0) {
+            if (!ProgramGenerator::parseShape(value, options.shape)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg.rfind("--size=", 0) == 0) {
+            options.bytes = ProgramGenerator::parseSize(value);
+        } else if (arg.rfind("--programs=", 0) == 0) {
+            options.programs = std::max(1, std::stoi(value));
+        } else if (arg.rfind("--seconds=", 0) == 0) {
+            options.seconds = std::stod(value);
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads.push_back(std::max(1, std::stoi(value)));
+        } else if (arg == "--no-partial-evaluation") {
+            options.partialEvaluation = false;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.threads.empty()) {
+        options.threads.push_back(1);
+        unsigned cores = std::thread::hardware_concurrency();
+        if (cores > 1) options.threads.push_back(cores);
+    }
+
+    // Programs with different seeds, so the threads do not all compile the same one
+    std::vector<std::string> programs;
+    for (int i = 0; i < options.programs; i++) {
+        GeneratorOptions generatorOptions;
+        generatorOptions.shape = options.shape;
+        generatorOptions.targetBytes = options.bytes;
+        generatorOptions.seed = i + 1;
+        programs.push_back(ProgramGenerator(generatorOptions).generate());
+    }
+
+    MemoryStats::enable();
+    std::vector<Result> results;
+    for (const char* mode : {"fresh", "context"}) {
+        for (unsigned threads : options.threads) {
+            results.push_back(run(options, programs, mode, threads));
+        }
+    }
+    writeText(std::cout, results);
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include "program_generator.h"
+
+namespace {
+
+const char* const shapeNames[] = {"mixed", "identifiers", "comments", "nesting", "procedures", "expressions"};
+
+const char* const words[] = {
+    "total", "count", "index", "value", "result", "offset", "buffer", "length", "sample", "reading",
+    "average", "maximum", "minimum", "previous", "current", "pending", "scaled", "temporary"
+};
+
+const char* const commentWords[] = {
+    "compute", "the", "running", "total", "for", "each", "entry", "and", "keep", "track", "of",
+    "largest", "value", "seen", "so", "far", "before", "printing", "result", "update", "counter"
+};
+
+}
+
+// Constructor for the ProgramGenerator class
+ProgramGenerator::ProgramGenerator(const GeneratorOptions& options)
+    : options(options), state(options.seed) {}
+
+// Look up a shape by its command-line name
+bool ProgramGenerator::parseShape(const std::string& name, ProgramShape& shape) {
+    for (size_t i = 0; i < sizeof(shapeNames) / sizeof(shapeNames[0]); i++) {
+        if (name == shapeNames[i]) {
+            shape = static_cast<ProgramShape>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Command-line name of a shape
+const char* ProgramGenerator::shapeName(ProgramShape shape) {
+    return shapeNames[static_cast<size_t>(shape)];
+}
+
+// Parse a byte count with an optional K or M suffix, as the benchmarks' --size= takes it
+size_t ProgramGenerator::parseSize(const std::string& text) {
+    size_t size = std::stoul(text);
+    char suffix = text.empty() ? '\0' : text.back();
+    if (suffix == 'K' || suffix == 'k') size <<= 10;
+    if (suffix == 'M' || suffix == 'm') size <<= 20;
+    return size;
+}
+
+// splitmix64
+uint64_t ProgramGenerator::next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Random number in [0, bound)
+int ProgramGenerator::below(int bound) {
+    return static_cast<int>(next() % static_cast<uint64_t>(bound));
+}
+
+// True with the given probability
+bool ProgramGenerator::chance(int percent) {
+    return below(100) < percent;
+}
+
+// Name of the variable with an index; long camel-case names for ProgramShape::IDENTIFIERS
+std::string ProgramGenerator::variableName(int index) const {
+    if (options.shape != ProgramShape::IDENTIFIERS) {
+        return "v" + std::to_string(index);
+    }
+    const int wordCount = static_cast<int>(sizeof(words) / sizeof(words[0]));
+    std::string second = words[(index / wordCount) % wordCount];
+    second[0] = static_cast<char>(second[0] - 'a' + 'A');
+    return words[index % wordCount] + second + "Reading" + std::to_string(index);
+}
+
+// Name of a random declared variable
+std::string ProgramGenerator::variable() {
+    return variableName(below(variableCount));
+}
+
+// Indentation for a nesting depth
+void ProgramGenerator::indent(int depth) {
+    out.append(static_cast<size_t>(depth) * 4, ' ');
+}
+
+// Global declarations, some with initializers
+void ProgramGenerator::declarations(int count) {
+    int first = variableCount;
+    variableCount += count;
+    for (int i = first; i < variableCount; i++) {
+        out += "declare " + variableName(i);
+        if (chance(50)) out += " <- " + std::to_string(below(100));
+        out += ";\n";
+    }
+    out += "\n";
+}
+
+// Arithmetic over variables and numbers, evaluated left to right
+void ProgramGenerator::expression(int terms) {
+    static const char* const operators[] = {" + ", " - ", " * "};
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) out += operators[below(3)];
+        if (chance(70)) {
+            out += variable();
+        } else {
+            out += std::to_string(below(1000));
+        }
+    }
+}
+
+// Parenthesized comparison
+void ProgramGenerator::condition() {
+    static const char* const comparisons[] = {" < ", " > ", " = ", " <= ", " >= ", " != "};
+    out += "(";
+    expression(options.shape == ProgramShape::EXPRESSIONS ? 4 + below(12) : 1 + below(2));
+    out += comparisons[below(6)];
+    out += std::to_string(below(100));
+    out += ")";
+}
+
+// Line or block comment
+void ProgramGenerator::comment(int depth) {
+    const size_t wordCount = sizeof(commentWords) / sizeof(commentWords[0]);
+    bool lineComment = chance(60);
+    int lines = lineComment ? 1 : 1 + below(options.shape == ProgramShape::COMMENTS ? 8 : 3);
+    indent(depth);
+    out += lineComment ? "//" : "/*";
+    for (int line = 0; line < lines; line++) {
+        if (line > 0) {
+            out += "\n";
+            indent(depth);
+            out += "  ";
+        }
+        int length = 4 + below(10);
+        for (int i = 0; i < length; i++) {
+            out += " ";
+            out += commentWords[below(static_cast<int>(wordCount))];
+        }
+    }
+    out += lineComment ? "\n" : " */\n";
+}
+
+// One statement at a nesting depth; compound statements stop at maxDepth
+void ProgramGenerator::statement(int depth, int maxDepth) {
+    bool nesting = options.shape == ProgramShape::NESTING;
+    int roll = below(100);
+    if (depth < maxDepth && (nesting ? roll < 92 : roll < 15)) {
+        if (chance(50)) {
+            // if / elseif / else
+            indent(depth);
+            out += "if ";
+            condition();
+            out += " then\n";
+            block(depth + 1, maxDepth, nesting ? 1 + below(2) : 1 + below(4));
+            int elseifs = chance(40) ? 1 + below(3) : 0;
+            for (int i = 0; i < elseifs; i++) {
+                indent(depth);
+                out += "elseif ";
+                condition();
+                out += " then\n";
+                block(depth + 1, nesting ? depth + 1 : maxDepth, 1 + below(3));
+            }
+            if (chance(50)) {
+                indent(depth);
+                out += "else\n";
+                block(depth + 1, nesting ? depth + 1 : maxDepth, 1 + below(3));
+            }
+            indent(depth);
+            out += "end if;\n";
+        } else {
+            indent(depth);
+            out += "while ";
+            condition();
+            out += " loop\n";
+            block(depth + 1, maxDepth, nesting ? 1 + below(2) : 1 + below(4));
+            indent(depth);
+            out += "end loop;\n";
+        }
+        return;
+    }
+
+    if (options.shape == ProgramShape::COMMENTS || chance(10)) {
+        comment(depth);
+    }
+    roll = below(100);
+    indent(depth);
+    if (procedureCount > 0 && roll < (options.shape == ProgramShape::PROCEDURES ? 40 : 10)) {
+        // Call a procedure, either on its own or for its result
+        std::string call = "proc" + std::to_string(below(procedureCount)) + "(" + variable() + ", " + variable() + ")";
+        if (chance(50)) {
+            out += variable() + " <- " + call + ";\n";
+        } else {
+            out += call + ";\n";
+        }
+    } else if (roll < 85) {
+        out += variable() + " <- ";
+        int terms;
+        switch (options.shape) {
+            case ProgramShape::EXPRESSIONS: terms = 20 + below(180); break;
+            case ProgramShape::IDENTIFIERS: terms = 3 + below(6); break;
+            default: terms = 1 + below(5); break;
+        }
+        expression(terms);
+        out += ";\n";
+    } else if (chance(70)) {
+        out += "put(" + variable() + ");\n";
+    } else {
+        out += "put(\"value\");\n";
+    }
+}
+
+// Statements inside a compound statement. When generating deep nesting only
+// the first may nest further, so the program grows linearly with depth.
+void ProgramGenerator::block(int depth, int maxDepth, int statements) {
+    for (int i = 0; i < statements; i++) {
+        statement(depth, i == 0 || options.shape != ProgramShape::NESTING ? maxDepth : depth);
+    }
+}
+
+// Procedure with two parameters that works on globals and returns a value
+void ProgramGenerator::procedure() {
+    if (options.shape == ProgramShape::COMMENTS || chance(30)) comment(0);
+    int first = below(variableCount);
+    int second = (first + 1 + below(variableCount - 1)) % variableCount; // Parameter names must differ
+    out += "procedure proc" + std::to_string(procedureCount) + "(" + variableName(first) + ", " +
+           variableName(second) + ")\n";
+    out += "begin\n";
+    block(1, 3, 2 + below(6));
+    out += "    return ";
+    expression(1 + below(3));
+    out += ";\n";
+    out += "end procedure;\n\n";
+    procedureCount++;
+}
+
+// Generate a program of about targetBytes
+std::string ProgramGenerator::generate() {
+    out.clear();
+    out.reserve(options.targetBytes + 4096);
+    state = options.seed;
+    variableCount = 0;
+    procedureCount = 0;
+
+    declarations(options.shape == ProgramShape::IDENTIFIERS ? 400 : 40);
+    int maxDepth = options.shape == ProgramShape::NESTING ? options.maxDepth : 3;
+    int procedurePercent = options.shape == ProgramShape::PROCEDURES ? 60 : 3;
+    while (out.size() < options.targetBytes) {
+        if (chance(procedurePercent)) {
+            procedure();
+        } else {
+            statement(0, maxDepth);
+        }
+    }
+    return out;
+}
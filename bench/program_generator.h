@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// What a generated program mostly consists of
+enum class ProgramShape {
+    MIXED,       // A bit of everything, roughly like hand-written code
+    IDENTIFIERS, // Many variables with long names
+    COMMENTS,    // More comment text than code
+    NESTING,     // Deeply nested if/while blocks
+    PROCEDURES,  // Many small procedures and calls
+    EXPRESSIONS  // Long arithmetic expressions
+};
+
+struct GeneratorOptions {
+    ProgramShape shape = ProgramShape::MIXED;
+    size_t targetBytes = 1 << 20; // Generation stops at the first statement boundary past this
+    uint64_t seed = 1;
+    int maxDepth = 24;            // Nesting depth for ProgramShape::NESTING
+};
+
+// Generates valid PseudoLang programs for benchmarking. The output depends
+// only on the options: the random generator is implemented here rather than
+// taken from <random>, whose distributions differ between standard libraries.
+class ProgramGenerator {
+public:
+    explicit ProgramGenerator(const GeneratorOptions& options);
+
+    std::string generate();
+
+    static bool parseShape(const std::string& name, ProgramShape& shape);
+    static const char* shapeName(ProgramShape shape);
+    static size_t parseSize(const std::string& text);
+
+private:
+    GeneratorOptions options;
+    uint64_t state;
+    std::string out;
+    int variableCount = 0;
+    int procedureCount = 0;
+
+    uint64_t next();
+    int below(int bound);
+    bool chance(int percent);
+
+    std::string variableName(int index) const;
+    std::string variable();
+    void indent(int depth);
+    void declarations(int count);
+    void expression(int terms);
+    void condition();
+    void statement(int depth, int maxDepth);
+    void block(int depth, int maxDepth, int statements);
+    void procedure();
+    void comment(int depth);
+};
@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "lexer.h"
+#include "parser.h"
+#include "statement_parser.h"
+#include "expression_parser.h"
+#include "codegen.h"
+
+namespace {
+
+const unsigned runTimeoutSeconds = 120; // A run taking longer is stopped and reported as TIMEOUT
+
+// A way of turning generated code into an executable
+struct Backend {
+    std::string name;
+    std::string compiler;
+    std::vector<std::string> flags;
+    CodeTarget target = CodeTarget::CPP;
+};
+
+struct Options {
+    std::string corpus = "bench/corpus";
+    std::string workDirectory;
+    std::vector<std::string> backendNames;
+    std::vector<std::string> programNames;
+    int repetitions = 3;
+    std::vector<int> threadCounts; // $PSEUDO_THREADS values to run each program with, none to leave it unset
+    std::string format = "text";
+};
+
+struct ProcessResult {
+    bool succeeded;     // Exited with status 0
+    int exitStatus;     // -1 when stopped by a signal
+    bool timedOut;      // Stopped after runTimeoutSeconds
+    double seconds;
+    long peakRssKb;
+};
+
+struct Result {
+    std::string program;
+    std::string backend;
+    int threads = 0;           // $PSEUDO_THREADS of the runs, 0 when unset
+    bool compiled = false;
+    double compileSeconds = 0;
+    long binaryBytes = 0;
+    double runSeconds = 0;     // Fastest repetition
+    long peakRssKb = 0;        // Largest over the repetitions
+    std::string outputStatus;  // "ok", "WRONG", "CRASH", "TIMEOUT" or "no expected"
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--corpus=DIR] [--backend=NAME]... [--program=NAME]..."
+              << " [--repetitions=N] [--threads=N]... [--work-dir=DIR] [--format=text|csv]\n";
+}
+
+// Check if a program can be found on PATH
+bool onPath(const std::string& program) {
+    const char* path = getenv("PATH");
+    if (!path) return false;
+    std::stringstream directories(path);
+    std::string directory;
+    while (std::getline(directories, directory, ':')) {
+        if (access((directory + "/" + program).c_str(), X_OK) == 0) return true;
+    }
+    return false;
+}
+
+// Optimization levels of every C++ compiler found, and of gcc with the C target
+std::vector<Backend> availableBackends() {
+    std::vector<Backend> backends;
+    for (const char* compiler : {"g++", "clang++"}) {
+        if (!onPath(compiler)) continue;
+        for (const char* level : {"-O0", "-O2", "-O3"}) {
+            backends.push_back({std::string(compiler) + " " + level, compiler, {level}});
+        }
+    }
+    if (onPath("gcc")) {
+        for (const char* level : {"-O0", "-O2"}) {
+            backends.push_back({std::string("gcc ") + level + " C", "gcc", {level}, CodeTarget::C});
+        }
+        backends.push_back({"gcc -O2 C static", "gcc",
+                            {"-O2", "-static", "-nostartfiles", "-fno-stack-protector", "-DPL_NO_LIBC"},
+                            CodeTarget::C});
+    }
+    return backends;
+}
+
+// Run a program to completion, optionally sending its stdout and stderr to files. With a time
+// limit, the alarm set before exec stops it when the limit is reached.
+ProcessResult runProcess(const std::vector<std::string>& arguments, const std::string& stdoutPath,
+                         const std::string& stderrPath = "", unsigned timeLimit = 0) {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open(stdoutPath.empty() ? "/dev/null" : stdoutPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        if (!stderrPath.empty() && (fd = open(stderrPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        if (timeLimit > 0) alarm(timeLimit);
+        std::vector<char*> argv;
+        for (const auto& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    ProcessResult result{false, -1, false, 0, 0};
+    if (pid < 0) return result;
+    int status = 0;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.succeeded = result.exitStatus == 0;
+    result.timedOut = WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM;
+    result.peakRssKb = usage.ru_maxrss;
+    return result;
+}
+
+std::string readFile(const std::string& path, bool& found) {
+    std::ifstream in(path, std::ios::binary);
+    found = static_cast<bool>(in);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// "fnv1a64 <hex> <bytes>" line used in .expected files for long outputs
+std::string digestLine(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "fnv1a64 %016llx %zu\n", static_cast<unsigned long long>(hash), text.size());
+    return line;
+}
+
+// Compare program output against the .expected file, which holds either the output or its digest
+std::string checkOutput(const std::string& outputPath, const std::string& expectedPath) {
+    bool found;
+    std::string expected = readFile(expectedPath, found);
+    if (!found) return "no expected";
+    std::string output = readFile(outputPath, found);
+    bool matches = expected.compare(0, 8, "fnv1a64 ") == 0 ? digestLine(output) == expected : output == expected;
+    return matches ? "ok" : "WRONG";
+}
+
+// Translate a PseudoLang file to C++ or C with the current front end and code generator
+bool translate(const std::string& sourcePath, const std::string& codePath, CodeTarget target) {
+    bool found;
+    std::string source = readFile(sourcePath, found);
+    if (!found) return false;
+
+    Diagnostics diagnostics;
+    Lexer lexer(source);
+    auto ast = Parser(lexer.tokenize(), diagnostics).parse();
+    if (diagnostics.hasErrors()) {
+        std::cerr << sourcePath << ":\n";
+        diagnostics.render(std::cerr, DiagnosticFormat::TEXT);
+        return false;
+    }
+    if (target == CodeTarget::C) {
+        reportCTargetErrors(ast, diagnostics);
+        if (diagnostics.hasErrors()) return false;
+    }
+    CodeGenerator generator;
+    generator.setTarget(target);
+    std::ofstream out(codePath);
+    out << generator.generateCode(ast);
+    return static_cast<bool>(out);
+}
+
+// Names of the corpus programs (without .pseudo), sorted
+std::vector<std::string> listPrograms(const std::string& directory) {
+    std::vector<std::string> programs;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return programs;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 7 && name.compare(name.size() - 7, 7, ".pseudo") == 0) {
+            programs.push_back(name.substr(0, name.size() - 7));
+        }
+    }
+    closedir(dir);
+    std::sort(programs.begin(), programs.end());
+    return programs;
+}
+
+std::string fileName(const std::string& text) {
+    std::string name;
+    for (char c : text) name += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    return name;
+}
+
+// Build a program with a backend and time it, once per thread count asked for
+void benchmark(const Options& options, const std::string& program, const std::string& codePath,
+               const Backend& backend, std::vector<Result>& results) {
+    Result result;
+    result.program = program;
+    result.backend = backend.name;
+
+    std::string executable = options.workDirectory + "/" + program + "_" + fileName(backend.name);
+    std::vector<std::string> command = {backend.compiler};
+    command.insert(command.end(), backend.flags.begin(), backend.flags.end());
+    if (backend.target == CodeTarget::C) {
+        command.insert(command.end(), {"-x", "c", "-std=c99", codePath, "-o", executable});
+    } else {
+        command.insert(command.end(), {codePath, "-o", executable, "-pthread"});
+    }
+    ProcessResult compile = runProcess(command, "");
+    result.compileSeconds = compile.seconds;
+    result.compiled = compile.succeeded;
+    if (!compile.succeeded) {
+        result.outputStatus = "NO BUILD";
+        results.push_back(result);
+        return;
+    }
+
+    struct stat info;
+    if (stat(executable.c_str(), &info) == 0) result.binaryBytes = info.st_size;
+
+    // A program with a .error file is expected to stop with exit status 1 and that on stderr
+    std::string outputPath = executable + ".out";
+    std::string errorPath = executable + ".err";
+    bool expectsError;
+    std::string expectedError = readFile(options.corpus + "/" + program + ".error", expectsError);
+    std::vector<int> threadCounts = options.threadCounts.empty() ? std::vector<int>{0} : options.threadCounts;
+    for (int threads : threadCounts) {
+        Result run = result;
+        run.threads = threads;
+        if (threads > 0) setenv("PSEUDO_THREADS", std::to_string(threads).c_str(), 1);
+        run.outputStatus = "ok";
+        for (int i = 0; i < options.repetitions; i++) {
+            ProcessResult process = runProcess({executable}, outputPath, errorPath, runTimeoutSeconds);
+            bool found;
+            bool stopped = expectsError ? process.exitStatus == 1 && readFile(errorPath, found) == expectedError
+                                        : process.succeeded;
+            if (!stopped) {
+                bool wrongError = expectsError && process.exitStatus == 1;
+                run.outputStatus = process.timedOut ? "TIMEOUT" : wrongError ? "WRONG" : "CRASH";
+                break;
+            }
+            run.runSeconds = i == 0 ? process.seconds : std::min(run.runSeconds, process.seconds);
+            run.peakRssKb = std::max(run.peakRssKb, process.peakRssKb);
+        }
+        unsetenv("PSEUDO_THREADS");
+        if (run.outputStatus == "ok") {
+            run.outputStatus = checkOutput(outputPath, options.corpus + "/" + program + ".expected");
+        }
+        results.push_back(run);
+    }
+}
+
+// Backend column, with the thread count when the runs set one
+std::string backendLabel(const Result& result) {
+    return result.threads > 0 ? result.backend + " t" + std::to_string(result.threads) : result.backend;
+}
+
+void writeText(std::ostream& out, const std::vector<Result>& results) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-14s %-16s %11s %11s %11s %9s %11s  %s\n", "program", "backend", "compile ms",
+             "binary KB", "run ms", "speedup", "peak RSS KB", "output");
+    out << line;
+    const Result* reference = nullptr;
+    for (const auto& result : results) {
+        // Speedup is relative to the first backend and thread count measured for the same program
+        if (!reference || reference->program != result.program) reference = &result;
+        char speedup[16] = "";
+        if (result.runSeconds > 0 && reference->runSeconds > 0) {
+            snprintf(speedup, sizeof(speedup), "%.2fx", reference->runSeconds / result.runSeconds);
+        }
+        snprintf(line, sizeof(line), "%-14s %-16s %11.1f %11.1f %11.2f %9s %11ld  %s\n", result.program.c_str(),
+                 backendLabel(result).c_str(), result.compileSeconds * 1e3, result.binaryBytes / 1024.0,
+                 result.runSeconds * 1e3, speedup, result.peakRssKb, result.outputStatus.c_str());
+        out << line;
+    }
+}
+
+void writeCsv(std::ostream& out, const std::vector<Result>& results) {
+    out << "program,backend,compile_ms,binary_bytes,run_ms,peak_rss_kb,output\n";
+    for (const auto& result : results) {
+        out << result.program << "," << backendLabel(result) << "," << result.compileSeconds * 1e3 << ","
+            << result.binaryBytes << "," << result.runSeconds * 1e3 << "," << result.peakRssKb << ","
+            << result.outputStatus << "\n";
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') == std::string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--corpus=", 0) == 0) {
+            options.corpus = value;
+        } else if (arg.rfind("--backend=", 0) == 0) {
+            options.backendNames.push_back(value);
+        } else if (arg.rfind("--program=", 0) == 0) {
+            options.programNames.push_back(value);
+        } else if (arg.rfind("--repetitions=", 0) == 0) {
+            options.repetitions = std::max(1, std::stoi(value));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threadCounts.push_back(std::max(1, std::stoi(value)));
+        } else if (arg.rfind("--work-dir=", 0) == 0) {
+            options.workDirectory = value;
+        } else if (arg.rfind("--format=", 0) == 0) {
+            options.format = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Backend> backends;
+    for (const auto& backend : availableBackends()) {
+        if (options.backendNames.empty() ||
+            std::find(options.backendNames.begin(), options.backendNames.end(), backend.name) !=
+                options.backendNames.end()) {
+            backends.push_back(backend);
+        }
+    }
+    if (backends.empty()) {
+        std::cerr << "Error: No matching C++ compiler found\n";
+        return 1;
+    }
+
+    if (options.workDirectory.empty()) {
+        char pattern[] = "/tmp/pseudo-runtime-XXXXXX";
+        if (!mkdtemp(pattern)) {
+            std::cerr << "Error: Could not create a work directory\n";
+            return 1;
+        }
+        options.workDirectory = pattern;
+    }
+    std::vector<std::string> programs =
+        options.programNames.empty() ? listPrograms(options.corpus) : options.programNames;
+
+    std::vector<Result> results;
+    for (const auto& program : programs) {
+        std::string sourcePath = options.corpus + "/" + program + ".pseudo";
+        std::string cppPath = options.workDirectory + "/" + program + ".cpp";
+        if (!translate(sourcePath, cppPath, CodeTarget::CPP)) {
+            std::cerr << "Error: Could not translate " << program << "\n";
+            continue;
+        }
+        // Programs that need the C++ runtime are only built by the C++ backends
+        std::string cPath = options.workDirectory + "/" + program + ".c";
+        bool translatedToC = translate(sourcePath, cPath, CodeTarget::C);
+        for (const auto& backend : backends) {
+            if (backend.target == CodeTarget::C && !translatedToC) continue;
+            benchmark(options, program, backend.target == CodeTarget::C ? cPath : cppPath, backend, results);
+        }
+    }
+
+    if (options.format == "csv") {
+        writeCsv(std::cout, results);
+    } else {
+        writeText(std::cout, results);
+    }
+    for (const auto& result : results) {
+        if (result.outputStatus != "ok" && result.outputStatus != "no expected") return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "program_generator.h"
+#include "diagnostics.h"
+#include "memory_stats.h"
+#include "stream_compiler.h"
+
+namespace {
+
+struct Options {
+    std::vector<ProgramShape> shapes;
+    std::vector<size_t> sizes;
+    uint64_t seed = 1;
+    double maxGrowth = 4;
+};
+
+// Heap use of one --stream compile
+struct Result {
+    std::string shape;
+    size_t bytes = 0;
+    int64_t peakBytes = 0;     // Highest live bytes during the compile, over what was live before it
+    int64_t retainedBytes = 0; // Still held by the compiler when it is done
+    double seconds = 0;
+    bool compiled = false;
+};
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--shape=mixed|identifiers|comments|nesting|procedures|expressions]..."
+              << " [--size=BYTES[K|M]]... [--seed=N] [--max-growth=F]\n";
+}
+
+// Discards the C++, so only the compiler's own memory is measured
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c == traits_type::eof() ? 0 : c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+Result measure(const Options& options, ProgramShape shape, size_t bytes) {
+    GeneratorOptions generatorOptions;
+    generatorOptions.shape = shape;
+    generatorOptions.targetBytes = bytes;
+    generatorOptions.seed = options.seed;
+    std::istringstream input(ProgramGenerator(generatorOptions).generate());
+    NullBuffer buffer;
+    std::ostream output(&buffer);
+    Diagnostics diagnostics;
+
+    Result result;
+    result.shape = ProgramGenerator::shapeName(shape);
+    result.bytes = input.str().size();
+    int64_t before = MemoryStats::read().liveBytes();
+    MemoryStats::swapPeak();
+    auto start = std::chrono::steady_clock::now();
+    {
+        StreamCompiler compiler(input, output, diagnostics);
+        result.compiled = compiler.compile() && !diagnostics.hasErrors();
+        result.retainedBytes = MemoryStats::read().liveBytes() - before;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.peakBytes = MemoryStats::peakLiveBytes() - before;
+    return result;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') == std::string::npos ? "" : arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--shape=", 0) == 0) {
+            ProgramShape shape;
+            if (!ProgramGenerator::parseShape(value, shape)) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.shapes.push_back(shape);
+        } else if (arg.rfind("--size=", 0) == 0) {
+            options.sizes.push_back(ProgramGenerator::parseSize(value));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::stoull(value);
+        } else if (arg.rfind("--max-growth=", 0) == 0) {
+            options.maxGrowth = std::stod(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.shapes.empty()) {
+        for (int shape = 0; shape <= static_cast<int>(ProgramShape::EXPRESSIONS); shape++) {
+            options.shapes.push_back(static_cast<ProgramShape>(shape));
+        }
+    }
+    if (options.sizes.empty()) options.sizes = {1 << 20, 4 << 20, 16 << 20};
+    std::sort(options.sizes.begin(), options.sizes.end());
+
+    MemoryStats::enable();
+    char line[160];
+    snprintf(line, sizeof(line), "%-12s %10s %12s %14s %8s %10s\n", "shape", "input MB", "peak KB", "retained KB",
+             "growth", "seconds");
+    std::cout << line;
+    bool failed = false;
+    for (ProgramShape shape : options.shapes) {
+        int64_t smallest = 0;
+        for (size_t bytes : options.sizes) {
+            Result result = measure(options, shape, bytes);
+            if (smallest == 0) smallest = std::max<int64_t>(result.peakBytes, 1);
+            double growth = static_cast<double>(result.peakBytes) / smallest;
+            snprintf(line, sizeof(line), "%-12s %10.1f %12lld %14lld %7.2fx %10.2f%s\n", result.shape.c_str(),
+                     result.bytes / 1e6, static_cast<long long>(result.peakBytes / 1024),
+                     static_cast<long long>(result.retainedBytes / 1024), growth, result.seconds,
+                     !result.compiled ? "  FAILED" : growth > options.maxGrowth ? "  GROWS" : "");
+            std::cout << line;
+            failed = failed || !result.compiled || growth > options.maxGrowth;
+        }
+    }
+    return failed ? 1 : 0;
+}
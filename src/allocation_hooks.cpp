@@ -0,0 +1,62 @@
+#include "memory_stats.h"
+#include <cstdlib>
+#include <new>
+
+// The replacement global operator new and delete that feed MemoryStats. Only
+// the command line compiler and the benchmarks link this file; the library
+// leaves it out, so it does not replace the allocator of programs embedding it.
+
+namespace {
+
+// operator new semantics on top of an allocation function: retry through the new handler, then throw
+template <typename Allocate>
+void* allocateOrThrow(Allocate allocate) {
+    for (;;) {
+        if (void* pointer = allocate()) {
+            MemoryStats::countAllocation(pointer);
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void deallocate(void* pointer) {
+    if (!pointer) return;
+    MemoryStats::countFree(pointer);
+    free(pointer);
+}
+
+}
+
+// The replacement allocation functions. The array and nothrow forms call these
+// by default, so every allocation of the program comes through here. The sized
+// deletes are replaced too, as g++ warns when only the unsized ones are.
+void* operator new(std::size_t size) {
+    return allocateOrThrow([size] { return malloc(size ? size : 1); });
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocateOrThrow([size, alignment] {
+        void* pointer = nullptr;
+        size_t align = static_cast<size_t>(alignment) < sizeof(void*) ? sizeof(void*) : static_cast<size_t>(alignment);
+        return posix_memalign(&pointer, align, size ? size : 1) == 0 ? pointer : nullptr;
+    });
+}
+
+void operator delete(void* pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    deallocate(pointer);
+}
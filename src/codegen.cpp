@@ -2,7 +2,338 @@
 #include "parser.h"
 #include "statement_parser.h"
 #include "expression_parser.h"
+#include "partial_evaluator.h"
+#include "trace.h"
+#include "runtime.h"
+#include <algorithm>
+#include <climits>
 #include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Thresholds for using a profile
+const uint64_t minimumBranchSamples = 100; // Evaluations before an arm gets a likely/unlikely hint
+const double likelyShare = 0.9;            // Taken at least this often: [[likely]], at most 1 - this: [[unlikely]]
+const uint64_t minimumHotCalls = 1000;     // Calls made at a site before it can be inlined
+const double hotCallShare = 0.1;           // Share of all calls a site must make to be inlined
+const size_t maximumInlineNodes = 64;      // Largest procedure body copied for inlining
+
+// Lowering of if/elseif chains that test one variable against constants
+const size_t minimumSwitchArms = 3;        // Shorter chains stay as if statements
+const long long switchDensity = 3;         // A switch may span up to this many values per arm
+
+// Bounds checks of array loops
+const size_t maximumVersionedNodes = 256;  // Largest loop body copied to get a version without checks
+
+// Unrolling of counted loops
+const long long maximumUnrolledTrips = 8;    // Loops with more constant trips stay loops
+const long long maximumUnrolledNodes = 128;  // Largest total size of the copies of the body
+
+// The variable and constant of a "variable = number" condition
+bool equalityTest(const ASTNode& condition, std::string& variable, std::string& value) {
+    if (condition.type != ASTNodeType::BINARY_OP || condition.token.type != TokenType::EQUAL ||
+        condition.children.size() != 2) {
+        return false;
+    }
+    const ASTNode& left = *condition.children[0];
+    const ASTNode& right = *condition.children[1];
+    if (left.type == ASTNodeType::IDENTIFIER && right.type == ASTNodeType::NUMBER) {
+        variable = left.token.lexeme;
+        value = right.token.lexeme;
+        return true;
+    }
+    if (left.type == ASTNodeType::NUMBER && right.type == ASTNodeType::IDENTIFIER) {
+        variable = right.token.lexeme;
+        value = left.token.lexeme;
+        return true;
+    }
+    return false;
+}
+
+// Check if the conditions all test one variable against different int constants, so at
+// most one of them can be true and their order does not matter
+bool equalityChain(const std::vector<std::shared_ptr<ASTNode>>& conditions, std::string& variable,
+                   std::vector<long long>& values) {
+    variable.clear();
+    values.clear();
+    std::unordered_set<long long> seen;
+    for (const auto& condition : conditions) {
+        std::string name;
+        std::string value;
+        if (!equalityTest(*condition, name, value)) return false;
+        if (!variable.empty() && name != variable) return false;
+        variable = name;
+        long long number;
+        try {
+            number = std::stoll(value);
+        } catch (const std::out_of_range&) {
+            return false;
+        }
+        if (number > INT_MAX || !seen.insert(number).second) return false;
+        values.push_back(number);
+    }
+    return true;
+}
+
+// All procedure calls in a tree
+void collectCalls(const std::shared_ptr<ASTNode>& node, std::vector<const ASTNode*>& calls) {
+    if (!node) return;
+    if (node->type == ASTNodeType::PROCEDURE_CALL) calls.push_back(node.get());
+    for (const auto& child : node->children) collectCalls(child, calls);
+}
+
+// Check if a tree has a node of the given type
+bool containsType(const std::shared_ptr<ASTNode>& node, ASTNodeType type) {
+    if (!node) return false;
+    if (node->type == type) return true;
+    return std::any_of(node->children.begin(), node->children.end(),
+                       [type](const std::shared_ptr<ASTNode>& child) { return containsType(child, type); });
+}
+
+// Check if an expression reads the array called name, whole or by element
+bool mentionsArray(const ASTNode& node, const std::string& name) {
+    if ((node.type == ASTNodeType::ARRAY_REFERENCE || node.type == ASTNodeType::INDEX) && node.token.lexeme == name) {
+        return true;
+    }
+    return std::any_of(node.children.begin(), node.children.end(),
+                       [&name](const std::shared_ptr<ASTNode>& child) { return child && mentionsArray(*child, name); });
+}
+
+// Check if storing an array expression straight into target would overwrite elements that are
+// still to be read. Operations run innermost-left first, and every later one reads its right
+// operand after target already holds a partial result.
+bool overwritesOperand(const ASTNode& value, const std::string& target) {
+    const ASTNode* node = &value;
+    while (node->type == ASTNodeType::BINARY_OP && node->children[0]->type == ASTNodeType::BINARY_OP &&
+           findArrayOperand(node->children[0])) {
+        if (mentionsArray(*node->children[1], target)) return true;
+        node = node->children[0].get();
+    }
+    return false;
+}
+
+// Runtime operation for an arithmetic operator
+const char* arrayOperation(TokenType type) {
+    switch (type) {
+        case TokenType::PLUS: return "pl::Op::ADD";
+        case TokenType::MINUS: return "pl::Op::SUB";
+        case TokenType::STAR: return "pl::Op::MUL";
+        default: return "pl::Op::DIV";
+    }
+}
+
+// Check if a loop bound has no side effects and depends only on variables (collected in names)
+// and array lengths
+bool invariantBound(const ASTNode& bound, std::vector<std::string>& names) {
+    switch (bound.type) {
+        case ASTNodeType::NUMBER:
+            return true;
+        case ASTNodeType::IDENTIFIER:
+            names.push_back(bound.token.lexeme);
+            return true;
+        case ASTNodeType::BINARY_OP:
+            return invariantBound(*bound.children[0], names) && invariantBound(*bound.children[1], names);
+        case ASTNodeType::ARRAY_FUNCTION:
+            return bound.token.lexeme == "length" && bound.children[0]->type == ASTNodeType::ARRAY_REFERENCE;
+        default:
+            return false;
+    }
+}
+
+// Value of an expression of int constants, evaluated left to right like the generated code
+bool constantValue(const ASTNode& node, long long& value) {
+    if (node.type == ASTNodeType::NUMBER) {
+        try {
+            value = std::stoll(node.token.lexeme);
+        } catch (const std::out_of_range&) {
+            return false;
+        }
+        return value <= INT_MAX;
+    }
+    long long left;
+    long long right;
+    if (node.type != ASTNodeType::BINARY_OP || !constantValue(*node.children[0], left) ||
+        !constantValue(*node.children[1], right)) {
+        return false;
+    }
+    switch (node.token.type) {
+        case TokenType::PLUS: value = left + right; break;
+        case TokenType::MINUS: value = left - right; break;
+        case TokenType::STAR: value = left * right; break;
+        case TokenType::SLASH:
+            if (right == 0) return false;
+            value = left / right;
+            break;
+        default: return false;
+    }
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+// Check if a tree has a for loop whose step is not a constant, which the runtime checks for 0
+bool containsRuntimeStep(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return false;
+    long long step;
+    if ((node->type == ASTNodeType::FOR_STATEMENT || node->type == ASTNodeType::PARALLEL_FOR_STATEMENT) &&
+        node->children.size() >= 5 && node->children[3]->type != ASTNodeType::REDUCTION &&
+        !(constantValue(*node->children[3], step) && step != 0)) {
+        return true;
+    }
+    return std::any_of(node->children.begin(), node->children.end(), containsRuntimeStep);
+}
+
+// Check if a statement stores a constant in a variable: "declare x;", "declare x <- c;" or "x <- c;"
+bool storesConstant(const ASTNode& statement, std::string& variable, long long& value) {
+    if (statement.type == ASTNodeType::DECLARATION) {
+        value = 0;
+        if (statement.children.size() >= 2 && !constantValue(*statement.children[1], value)) return false;
+    } else if (statement.type == ASTNodeType::ASSIGNMENT && statement.children[0]->type == ASTNodeType::IDENTIFIER) {
+        if (!constantValue(*statement.children[1], value)) return false;
+    } else {
+        return false;
+    }
+    variable = statement.children[0]->token.lexeme;
+    return true;
+}
+
+// Check if a statement is "variable <- variable + c" with a positive constant c, the step
+bool isIncrement(const ASTNode& statement, const std::string& variable, long long& step) {
+    if (statement.type != ASTNodeType::ASSIGNMENT || statement.children[0]->type != ASTNodeType::IDENTIFIER ||
+        statement.children[0]->token.lexeme != variable) {
+        return false;
+    }
+    const ASTNode& value = *statement.children[1];
+    if (value.type != ASTNodeType::BINARY_OP || value.token.type != TokenType::PLUS) return false;
+    const ASTNode* constant = nullptr;
+    for (int side = 0; side < 2; side++) {
+        const ASTNode& operand = *value.children[side];
+        const ASTNode& other = *value.children[1 - side];
+        if (operand.type == ASTNodeType::IDENTIFIER && operand.token.lexeme == variable &&
+            other.type == ASTNodeType::NUMBER) {
+            constant = &other;
+        }
+    }
+    return constant && constantValue(*constant, step) && step > 0;
+}
+
+// What a loop body does that matters for dropping its bounds checks
+struct LoopFacts {
+    std::unordered_map<std::string, int> assignments; // Variable assignments by name
+    std::unordered_set<std::string> declared;         // Names declared inside, which shadow outer ones
+    std::set<std::string> indexedArrays;              // Arrays indexed by exactly the loop variable
+    bool calls = false;
+};
+
+void scanLoopBody(const std::shared_ptr<ASTNode>& node, const std::string& variable, LoopFacts& facts) {
+    if (!node) return;
+    switch (node->type) {
+        case ASTNodeType::ASSIGNMENT:
+            if (node->children[0]->type == ASTNodeType::IDENTIFIER) facts.assignments[node->children[0]->token.lexeme]++;
+            break;
+        case ASTNodeType::DECLARATION:
+        case ASTNodeType::ARRAY_DECLARATION:
+            facts.declared.insert(node->children[0]->token.lexeme);
+            break;
+        case ASTNodeType::PROCEDURE_CALL:
+            facts.calls = true;
+            break;
+        case ASTNodeType::INDEX:
+            if (node->children[0]->type == ASTNodeType::IDENTIFIER && node->children[0]->token.lexeme == variable) {
+                facts.indexedArrays.insert(node->token.lexeme);
+            }
+            break;
+        default:
+            break;
+    }
+    for (const auto& child : node->children) scanLoopBody(child, variable, facts);
+}
+
+// The calls a procedure makes to itself
+struct SelfCalls {
+    std::unordered_set<const ASTNode*> tail;                        // Made by going back to the start of the body
+    std::vector<std::pair<const ASTNode*, DiagnosticCode>> remaining; // Left as calls, with the reason
+};
+
+// Sort the calls below node to the procedure with the given name and number of parameters.
+// "return name(...)" becomes a jump unless it is in a loop, where continue would go round that
+// loop, or the procedure spawns tasks, whose sync must only wait for the tasks of its own call.
+void findSelfCalls(const ASTNode& node, const std::string& name, size_t parameters, bool inLoop, bool tasks,
+                   SelfCalls& calls) {
+    const ASTNode* call = nullptr;
+    if (node.type == ASTNodeType::RETURN_STATEMENT && !node.children.empty() &&
+        node.children[0]->type == ASTNodeType::PROCEDURE_CALL && node.children[0]->token.lexeme == name &&
+        node.children[0]->children.size() == parameters) {
+        call = node.children[0].get();
+        if (tasks) {
+            calls.remaining.push_back({call, DiagnosticCode::RECURSIVE_CALL_WITH_TASKS});
+        } else if (inLoop) {
+            calls.remaining.push_back({call, DiagnosticCode::RECURSIVE_CALL_IN_LOOP});
+        } else {
+            calls.tail.insert(call);
+        }
+    } else if (node.type == ASTNodeType::PROCEDURE_CALL && node.token.lexeme == name) {
+        calls.remaining.push_back({&node, DiagnosticCode::RECURSIVE_CALL_NOT_TAIL});
+    }
+    inLoop = inLoop || node.type == ASTNodeType::WHILE_STATEMENT || node.type == ASTNodeType::FOR_STATEMENT ||
+             node.type == ASTNodeType::PARALLEL_FOR_STATEMENT;
+    for (const auto& child : (call ? *call : node).children) {
+        if (child) findSelfCalls(*child, name, parameters, inLoop, tasks, calls);
+    }
+}
+
+// Sort the calls a procedure definition makes to itself
+SelfCalls findSelfCalls(const std::shared_ptr<ASTNode>& procedure) {
+    size_t parameters = 0;
+    for (size_t i = 1; i < procedure->children.size() - 1; i++) {
+        if (procedure->children[i]->type == ASTNodeType::PARAMETER) parameters++;
+    }
+    const auto& body = procedure->children.back();
+    bool tasks = containsType(body, ASTNodeType::SPAWN_STATEMENT) || containsType(body, ASTNodeType::SYNC_STATEMENT);
+    SelfCalls calls;
+    findSelfCalls(*body, procedure->children[0]->token.lexeme, parameters, false, tasks, calls);
+    return calls;
+}
+
+}
+
+// Report arrays, channels, spawn and sync, which only the C++ runtime has
+void reportCTargetErrors(const std::shared_ptr<ASTNode>& node, Diagnostics& diagnostics) {
+    if (!node) return;
+    switch (node->type) {
+        case ASTNodeType::ARRAY_DECLARATION:
+            diagnostics.report(DiagnosticCode::C_TARGET_ARRAY, node->children[0]->token);
+            break;
+        case ASTNodeType::CHANNEL_DECLARATION:
+            diagnostics.report(DiagnosticCode::C_TARGET_CHANNEL, node->children[0]->token);
+            break;
+        case ASTNodeType::SPAWN_STATEMENT:
+        case ASTNodeType::SYNC_STATEMENT:
+            diagnostics.report(DiagnosticCode::C_TARGET_TASK, node->token);
+            break;
+        default:
+            break;
+    }
+    for (const auto& child : node->children) reportCTargetErrors(child, diagnostics);
+}
+
+// Report the calls procedures make to themselves that are not turned into jumps
+void reportRecursiveCalls(const std::shared_ptr<ASTNode>& node, Diagnostics& diagnostics) {
+    if (!node) return;
+    for (const auto& child : node->children) {
+        if (!child || child->type != ASTNodeType::PROCEDURE || child->children.size() < 2) continue;
+        for (const auto& call : findSelfCalls(child).remaining) diagnostics.report(call.second, call.first->token);
+    }
+}
+
+// Mark statements with their lines in sourceName, written as a C string literal
+void CodeGenerator::setLineMarkers(const std::string& sourceName, bool recordColumns) {
+    recordingLineColumns = recordColumns;
+    markedSource.clear();
+    for (char c : sourceName) {
+        if (c == '"' || c == '\\') markedSource += '\\';
+        markedSource += c;
+    }
+}
 
 // Get the current indentation level
 std::string CodeGenerator::getIndent() const {
@@ -12,7 +343,19 @@ std::string CodeGenerator::getIndent() const {
 // Main code generation method
 std::string CodeGenerator::generateCode(const std::shared_ptr<ASTNode>& node) {
     if (!node) return "";
-    
+    if (!perfBreakdown && !allocationBreakdown) return generateNodeCode(node);
+
+    size_t key = static_cast<size_t>(node->type);
+    if (perfBreakdown) perfBreakdown->enter(key);
+    if (allocationBreakdown) allocationBreakdown->enter(key);
+    std::string code = generateNodeCode(node);
+    if (allocationBreakdown) allocationBreakdown->leave();
+    if (perfBreakdown) perfBreakdown->leave();
+    return code;
+}
+
+// Dispatch on the node type
+std::string CodeGenerator::generateNodeCode(const std::shared_ptr<ASTNode>& node) {
     switch (node->type) {
         case ASTNodeType::PROGRAM:
             return generateProgramCode(node);
@@ -24,6 +367,10 @@ std::string CodeGenerator::generateCode(const std::shared_ptr<ASTNode>& node) {
             return generateIfStatementCode(node);
         case ASTNodeType::WHILE_STATEMENT:
             return generateWhileStatementCode(node);
+        case ASTNodeType::FOR_STATEMENT:
+            return generateForStatementCode(node);
+        case ASTNodeType::PARALLEL_FOR_STATEMENT:
+            return generateParallelForCode(node);
         case ASTNodeType::PUT_STATEMENT:
             return generatePutStatementCode(node);
         case ASTNodeType::BINARY_OP:
@@ -41,21 +388,157 @@ std::string CodeGenerator::generateCode(const std::shared_ptr<ASTNode>& node) {
         case ASTNodeType::STRING:
             return "\"" + node->token.lexeme + "\"";
         case ASTNodeType::IDENTIFIER:
+        case ASTNodeType::ARRAY_REFERENCE:
             return node->token.lexeme;
+        case ASTNodeType::ARRAY_DECLARATION:
+            return generateArrayDeclarationCode(node);
+        case ASTNodeType::INDEX:
+            return generateIndexCode(node);
+        case ASTNodeType::ARRAY_FUNCTION:
+            return generateArrayFunctionCode(node);
+        case ASTNodeType::SPAWN_STATEMENT:
+            return generateSpawnStatementCode(node);
+        case ASTNodeType::SYNC_STATEMENT:
+            return "pl_tasks.sync();\n";
+        case ASTNodeType::CHANNEL_DECLARATION:
+            return generateChannelDeclarationCode(node);
+        case ASTNodeType::SEND_STATEMENT:
+            return node->token.lexeme + ".send(" + generateKeptCode(node->children[0]) + ", " +
+                   std::to_string(node->token.line) + ");\n";
+        case ASTNodeType::RECEIVE:
+            return node->token.lexeme + ".receive(" + std::to_string(node->token.line) + ")";
+        case ASTNodeType::FOR_EACH_STATEMENT:
+            return generateForEachCode(node);
+        case ASTNodeType::YIELD_STATEMENT:
+            return generateYieldCode(node);
         default:
             return "";
     }
 }
 
+// Register an instrumented place in the source
+size_t CodeGenerator::addProfileSite(ProfileSiteKind kind, const Token& token) {
+    profileSites.push_back({kind, token.line, token.column});
+    return profileSites.size() - 1;
+}
+
+// Reference to a site's counters in the generated program
+std::string CodeGenerator::profileSiteCode(size_t site) const {
+    return "pl_profile::sites[" + std::to_string(site) + "]";
+}
+
+// Pick the calls that go to an always-inlined copy of their procedure: sites that make a
+// large share of all calls, to small procedures that do not call themselves
+void CodeGenerator::planInlining(const std::shared_ptr<ASTNode>& program) {
+    hotCalls.clear();
+    inlinedProcedures.clear();
+    if (!profile) return;
+
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> procedures;
+    for (const auto& child : program->children) {
+        if (child->type == ASTNodeType::PROCEDURE && child->children.size() >= 2) {
+            procedures[child->children[0]->token.lexeme] = child;
+        }
+    }
+
+    std::vector<const ASTNode*> calls;
+    collectCalls(program, calls);
+    uint64_t totalCalls = 0;
+    for (const ASTNode* call : calls) {
+        const ProfileSite* site = profile->find(ProfileSiteKind::CALL, call->token.line, call->token.column);
+        if (site) totalCalls += site->entries;
+    }
+
+    for (const ASTNode* call : calls) {
+        const ProfileSite* site = profile->find(ProfileSiteKind::CALL, call->token.line, call->token.column);
+        if (!site || site->entries < minimumHotCalls || site->entries < hotCallShare * totalCalls) continue;
+        auto procedure = procedures.find(call->token.lexeme);
+        if (procedure == procedures.end()) continue;
+
+        const auto& body = procedure->second->children.back();
+        std::vector<const ASTNode*> bodyCalls;
+        collectCalls(body, bodyCalls);
+        bool recursive = std::any_of(bodyCalls.begin(), bodyCalls.end(),
+                                     [&](const ASTNode* inner) { return inner->token.lexeme == call->token.lexeme; });
+        if (recursive || memoizedProcedures.count(call->token.lexeme) || countNodes(body) > maximumInlineNodes) {
+            continue;
+        }
+
+        hotCalls.insert(call);
+        inlinedProcedures.insert(call->token.lexeme);
+    }
+}
+
+// Order the arms of an if statement by how often they were taken, when the conditions are
+// mutually exclusive, and hint the arms that are almost always or almost never taken
+void CodeGenerator::applyBranchProfile(std::vector<IfArm>& arms) const {
+    const ProfileSite* first = profile->find(ProfileSiteKind::BRANCH, arms[0].token->line, arms[0].token->column);
+    if (!first) return;
+    for (auto& arm : arms) {
+        const ProfileSite* site = profile->find(arm.kind, arm.token->line, arm.token->column);
+        arm.taken = site ? site->events : 0;
+    }
+
+    // The else arm, if any, stays last
+    size_t conditional = arms.back().condition ? arms.size() : arms.size() - 1;
+    std::vector<std::shared_ptr<ASTNode>> conditions;
+    for (size_t i = 0; i < conditional; i++) conditions.push_back(arms[i].condition);
+    std::string variable;
+    std::vector<long long> values;
+    if (conditional > 1 && equalityChain(conditions, variable, values)) {
+        std::stable_sort(arms.begin(), arms.begin() + conditional,
+                         [](const IfArm& a, const IfArm& b) { return a.taken > b.taken; });
+    }
+
+    // Each condition is evaluated only when the ones before it were false
+    uint64_t reaching = first->entries;
+    for (size_t i = 0; i < conditional; i++) {
+        if (reaching >= minimumBranchSamples) {
+            double share = static_cast<double>(arms[i].taken) / reaching;
+            if (share >= likelyShare) arms[i].expected = 1;
+            if (share <= 1 - likelyShare) arms[i].expected = 0;
+        }
+        reaching -= std::min(reaching, arms[i].taken);
+    }
+}
+
 // Helper methods for specific node types in whole program
 std::string CodeGenerator::generateProgramCode(const std::shared_ptr<ASTNode>& node) {
+    // The site table goes before the code, so it is generated once every site is known
+    profileSites.clear();
+    if (instrumented) addProfileSite(ProfileSiteKind::PROGRAM, Token(TokenType::UNKNOWN, "", 0, 0));
+    planMemoization(node);
+    planInlining(node);
+    coreRuntimeEmitted = false;
+    arrayRuntimeEmitted = false;
+    parallelRuntimeEmitted = false;
+    taskRuntimeEmitted = false;
+    memoRuntimeEmitted = false;
+    checkedRuntimeEmitted = false;
+    previousMainStore = ConstantStore();
+    lineColumns.clear();
+
+    // Main program statements, including initializers of global declarations. What they compute
+    // without input is computed now, unless the program is run for a profile of its code. The
+    // widths of checked arithmetic follow from what is left, and globals and procedures need them.
+    std::vector<std::shared_ptr<ASTNode>> mainStatements;
+    std::vector<std::shared_ptr<ASTNode>> procedures;
+    for (const auto& child : node->children) {
+        (child->type == ASTNodeType::PROCEDURE ? procedures : mainStatements).push_back(child);
+    }
+    const ProcedureEffectsMap& effects = sharedEffects ? *sharedEffects : procedureEffects;
+    if (!instrumented && partialEvaluation) mainStatements = evaluatePartially(mainStatements, procedures, effects);
+    arithmetic = checked ? analyzeRanges(node, mainStatements) : CheckedArithmetic();
+
     std::stringstream code;
-    code << "#include <iostream>\n\n";
+    if (!instrumented) code << generatePreludeCode();
+    code << generateRuntimeCode(node);
     
     // Forward declarations and global variables
     for (const auto& child : node->children) {
-        if (child->type == ASTNodeType::DECLARATION) {
-            code << "int " << child->children[0]->token.lexeme << ";\n";
+        if (child->type == ASTNodeType::DECLARATION || child->type == ASTNodeType::ARRAY_DECLARATION ||
+            child->type == ASTNodeType::CHANNEL_DECLARATION) {
+            code << generateGlobalDeclarationCode(child);
         }
     }
     code << "\n";
@@ -63,32 +546,177 @@ std::string CodeGenerator::generateProgramCode(const std::shared_ptr<ASTNode>& n
     // Function declarations
     for (const auto& child : node->children) {
         if (child->type == ASTNodeType::PROCEDURE) {
-            code << generateProcedureCode(child);
+            code << generateCode(child);
         }
     }
     
-    code << "int main() {\n";
-    indentLevel++;
+    code << generateMainBeginCode();
     
-    // Main program statements (excluding declarations and procedures)
-    for (const auto& child : node->children) {
-        if (child->type != ASTNodeType::DECLARATION && 
-            child->type != ASTNodeType::PROCEDURE) {
-            code << getIndent() << generateCode(child);
-        }
+    CommonSubexpressions plan = findCommonSubexpressions(mainStatements);
+    commonTemporaries.clear();
+    for (size_t i = 0; i < mainStatements.size(); i++) {
+        code << generateMainStatementCode(mainStatements[i], &plan, i);
     }
+    commonTemporaries.clear();
     
+    code << generateMainEndCode();
+    if (instrumented) return generatePreludeCode() + generateProfileRuntime(profileSites) + code.str();
+    return code.str();
+}
+
+// A #line marker that makes what follows line token.line of the source, when markers are on
+std::string CodeGenerator::generateLineMarker(const Token& token) {
+    if (markedSource.empty() || token.line <= 0) return "";
+    if (recordingLineColumns) lineColumns.emplace(token.line, token.column);
+    return "#line " + std::to_string(token.line) + " \"" + markedSource + "\"\n";
+}
+
+// Code that starts every generated program
+std::string CodeGenerator::generatePreludeCode() {
+    if (target == CodeTarget::C) return generateCRuntime() + (checked ? generateCCheckedRuntime() : "");
+    if (!runtimeHeader.empty()) return "#include \"" + runtimeHeader + "\"\n\n";
+    return "#include <iostream>\n\n";
+}
+
+// Support code a statement needs that was not generated yet: the array runtime before the first
+// array, the parallel runtime before the first parallel loop and the task runtime before the first
+// channel, spawn or sync, and the checked arithmetic first when the program is built with it. The
+// core runtime comes before any of them, or before the first for loop with a step that is not constant.
+// Instrumented programs run parallel loops sequentially, and spawned calls as they are spawned,
+// so their counters are not shared between threads.
+std::string CodeGenerator::generateRuntimeCode(const std::shared_ptr<ASTNode>& node) {
+    if (target == CodeTarget::C) return "";
+    bool arrays = !arrayRuntimeEmitted && containsType(node, ASTNodeType::ARRAY_DECLARATION);
+    bool parallel = !parallelRuntimeEmitted && !instrumented &&
+                    containsType(node, ASTNodeType::PARALLEL_FOR_STATEMENT);
+    bool tasks = !taskRuntimeEmitted && (containsType(node, ASTNodeType::CHANNEL_DECLARATION) ||
+                                         containsType(node, ASTNodeType::SPAWN_STATEMENT) ||
+                                         containsType(node, ASTNodeType::SYNC_STATEMENT));
+    bool memo = !memoRuntimeEmitted && !memoizedProcedures.empty();
+    bool checks = !checkedRuntimeEmitted && checked;
+    bool steps = !coreRuntimeEmitted && containsRuntimeStep(node);
+    std::string code;
+    if ((arrays || parallel || tasks || checks || steps) && !coreRuntimeEmitted) {
+        coreRuntimeEmitted = true;
+        code += generateCoreRuntime();
+    }
+    if (checks) {
+        checkedRuntimeEmitted = true;
+        code += generateCheckedRuntime();
+    }
+    if (arrays) {
+        arrayRuntimeEmitted = true;
+        code += generateArrayRuntime();
+    }
+    if (parallel) {
+        parallelRuntimeEmitted = true;
+        code += generateParallelRuntime();
+    }
+    if (tasks) {
+        taskRuntimeEmitted = true;
+        code += generateTaskRuntime();
+    }
+    if (memo) {
+        memoRuntimeEmitted = true;
+        code += generateMemoRuntime();
+    }
+    // The flags still say what main needs when the header has every part
+    return runtimeHeader.empty() ? code : "";
+}
+
+// Decide which procedures of a program, or which one procedure, get a cache of their results.
+// Procedures are planned in the order they are defined, as whether one is pure depends on the
+// procedures it calls. Only pure procedures are memoized: those marked memo, and those that call
+// themselves more than once, whose number of calls grows exponentially with the depth of the
+// recursion but not the number of different calls.
+void CodeGenerator::planMemoization(const std::shared_ptr<ASTNode>& node) {
+    if (node->type == ASTNodeType::PROGRAM) {
+        procedureEffects = ProcedureEffectsMap();
+        memoizedProcedures.clear();
+        for (const auto& child : node->children) planMemoization(child);
+        return;
+    }
+    if (node->type != ASTNodeType::PROCEDURE || node->children.size() < 2) return;
+    const std::string& name = node->children[0]->token.lexeme;
+    const ProcedureEffects* effects = nullptr;
+    if (sharedEffects) {
+        auto found = sharedEffects->procedures.find(name);
+        if (found == sharedEffects->procedures.end()) return;
+        effects = &found->second;
+    } else {
+        effects = &(procedureEffects.procedures[name] = analyzeProcedure(*node, procedureEffects));
+    }
+    if (effects->writes || !effects->reads.empty()) return;
+    if (node->token.type == TokenType::MEMO || findSelfCalls(node).remaining.size() >= 2) {
+        memoizedProcedures.insert(name);
+    }
+}
+
+// Global variable for a top-level declaration. Global arrays get their storage when the declaration runs.
+std::string CodeGenerator::generateGlobalDeclarationCode(const std::shared_ptr<ASTNode>& node) {
+    const std::string& name = node->children[0]->token.lexeme;
+    if (node->type == ASTNodeType::ARRAY_DECLARATION) return "pl::Array " + name + "(\"" + name + "\");\n";
+    if (node->type == ASTNodeType::CHANNEL_DECLARATION) return "pl::Channel " + name + "(\"" + name + "\");\n";
+    return integerType(arithmetic.wideGlobals.count(name) > 0) + " " + name + ";\n";
+}
+
+// Opening of the generated main function. Programs with the task runtime get the group of the
+// calls main spawns, which waits for them before main returns.
+std::string CodeGenerator::generateMainBeginCode() {
+    std::string code = target == CodeTarget::C ? "int main(void) {\n" : "int main() {\n";
+    if (instrumented) code += "    pl_profile::Timer pl_timer(" + profileSiteCode(0) + ");\n";
+    if (instrumented && taskRuntimeEmitted) code += "    pl::serialTasks = true;\n";
+    if (taskRuntimeEmitted) code += "    pl::TaskGroup pl_tasks;\n";
+    return code;
+}
+
+// A top-level statement inside main, after the temporaries plan says to compute before it. Global
+// declarations only contribute their initializer, which runs in program order like any other statement.
+std::string CodeGenerator::generateMainStatementCode(const std::shared_ptr<ASTNode>& node,
+                                                     const CommonSubexpressions* plan, size_t index) {
+    std::stringstream code;
+    precedingStore = previousMainStore;
+    statementLine = node->token.line;
+    code << generateLineMarker(node->token);
+    indentLevel++;
+    if (plan) code << generateTemporariesCode(*plan, index);
+    if (node->type == ASTNodeType::DECLARATION) {
+        if (node->children.size() >= 2) {
+            code << getIndent() << node->children[0]->token.lexeme << " = "
+                 << generateCode(node->children[1]) << ";\n";
+        }
+    } else if (node->type == ASTNodeType::ARRAY_DECLARATION) {
+        const std::string& name = node->children[0]->token.lexeme;
+        code << getIndent() << name << ".allocate(" << generateCode(node->children[1]) << ", "
+             << node->token.line << ");\n";
+        if (node->children.size() >= 3) {
+            code << getIndent() << generateArrayAssignmentCode(name, node->children[2], node->token.line);
+        }
+    } else if (node->type == ASTNodeType::CHANNEL_DECLARATION) {
+        code << getIndent() << node->children[0]->token.lexeme << ".allocate(" << generateCode(node->children[1])
+             << ", " << node->token.line << ");\n";
+    } else {
+        code << getIndent() << generateCode(node);
+        if (node->type == ASTNodeType::PROCEDURE_CALL) code << ";\n";
+    }
     indentLevel--;
-    code << "    return 0;\n}\n";
+    previousMainStore = ConstantStore();
+    storesConstant(*node, previousMainStore.variable, previousMainStore.value);
     return code.str();
 }
 
+// Closing of the generated main function; C programs write out their buffered output
+std::string CodeGenerator::generateMainEndCode() {
+    if (target == CodeTarget::C) return "    pl_flush();\n    return 0;\n}\n";
+    return "    return 0;\n}\n";
+}
+
 // Helper methods for specific node types in declarations 
 std::string CodeGenerator::generateDeclarationCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
     if (node->children.size() >= 1) {
         std::string varName = node->children[0]->token.lexeme;
-        code << "int " << varName;
+        code << integerType(arithmetic.wideVariables.count(node.get()) > 0) << " " << varName;
         if (node->children.size() >= 2) {
             code << " = " << generateCode(node->children[1]);
         } else {
@@ -104,8 +732,11 @@ std::string CodeGenerator::generateDeclarationCode(const std::shared_ptr<ASTNode
 std::string CodeGenerator::generateAssignmentCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
     if (node->children.size() >= 2) {
-        code << node->children[0]->token.lexeme << " = "
-             << generateCode(node->children[1]) << ";\n";
+        const auto& target = node->children[0];
+        if (target->type == ASTNodeType::ARRAY_REFERENCE) {
+            return generateArrayAssignmentCode(target->token.lexeme, node->children[1], node->token.line);
+        }
+        code << generateCode(target) << " = " << generateKeptCode(node->children[1], node.get()) << ";\n";
     }
     return code.str();
 }
@@ -114,31 +745,49 @@ std::string CodeGenerator::generateAssignmentCode(const std::shared_ptr<ASTNode>
 std::string CodeGenerator::generateIfStatementCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
     if (node->children.size() >= 2) {
-        code << "if (" << generateCode(node->children[0]) << ") {\n";
-        indentLevel++;
-        code << getIndent() << generateCode(node->children[1]);
-        indentLevel--;
-        code << getIndent() << "}\n";
-        
-        // Handle ELSEIF blocks
+        std::vector<IfArm> arms;
+        arms.push_back({node->children[0], node->children[1], &node->token, ProfileSiteKind::BRANCH});
         size_t i = 2;
         while (i < node->children.size() && 
                node->children[i]->type == ASTNodeType::ELSEIF_STATEMENT) {
-            code << getIndent() << "else if (" 
-                 << generateCode(node->children[i]->children[0]) << ") {\n";
-            indentLevel++;
-            code << getIndent() << generateCode(node->children[i]->children[1]);
-            indentLevel--;
-            code << getIndent() << "}\n";
+            const auto& arm = node->children[i];
+            arms.push_back({arm->children[0], arm->children[1], &arm->token, ProfileSiteKind::ELSEIF});
             i++;
         }
-        
-        // Handle ELSE block
         if (i < node->children.size() && 
             node->children[i]->type == ASTNodeType::ELSE_STATEMENT) {
-            code << getIndent() << "else {\n";
+            const auto& arm = node->children[i];
+            arms.push_back({nullptr, arm->children[0], &arm->token, ProfileSiteKind::ELSE});
+        }
+
+        // Instrumented builds keep the chain so every condition has its counters
+        if (!instrumented) {
+            std::string switchCode = generateSwitchCode(arms);
+            if (!switchCode.empty()) return switchCode;
+        }
+        if (profile) applyBranchProfile(arms);
+
+        for (size_t k = 0; k < arms.size(); k++) {
+            const IfArm& arm = arms[k];
+
+            // Instrumented conditions count their evaluation, and each arm counts being taken
+            std::string site = instrumented ? profileSiteCode(addProfileSite(arm.kind, *arm.token)) : "";
+            statementLine = arm.token->line;
+            if (k > 0) code << getIndent() << "else";
+            // C has no [[likely]], so the hint goes on the condition instead
+            if (arm.condition) {
+                std::string condition = generateCode(arm.condition);
+                if (arm.expected >= 0 && target == CodeTarget::C) {
+                    condition = "__builtin_expect(!!(" + condition + "), " + std::to_string(arm.expected) + ")";
+                }
+                code << (k > 0 ? " if (" : "if (") << (instrumented ? site + ".entries++, " : "") << condition << ")";
+            }
+            if (arm.expected >= 0 && target == CodeTarget::CPP) code << (arm.expected ? " [[likely]]" : " [[unlikely]]");
+            code << " {\n";
             indentLevel++;
-            code << getIndent() << generateCode(node->children[i]->children[0]);
+            if (instrumented && !arm.condition) code << getIndent() << site << ".entries++;\n";
+            if (instrumented) code << getIndent() << site << ".events++;\n";
+            code << getIndent() << generateCode(arm.block);
             indentLevel--;
             code << getIndent() << "}\n";
         }
@@ -146,33 +795,532 @@ std::string CodeGenerator::generateIfStatementCode(const std::shared_ptr<ASTNode
     return code.str();
 }
 
+// An if/elseif chain comparing one variable with constants. Constants close enough together
+// become a switch that compilers turn into a jump table; others are found by a binary search
+// that sets the arm number, followed by a switch on that. Returns "" for other chains.
+std::string CodeGenerator::generateSwitchCode(const std::vector<IfArm>& arms) {
+    size_t conditional = arms.back().condition ? arms.size() : arms.size() - 1;
+    if (conditional < minimumSwitchArms) return "";
+    std::vector<std::shared_ptr<ASTNode>> conditions;
+    for (size_t i = 0; i < conditional; i++) conditions.push_back(arms[i].condition);
+    std::string variable;
+    std::vector<long long> values;
+    if (!equalityChain(conditions, variable, values)) return "";
+
+    std::stringstream code;
+    long long low = *std::min_element(values.begin(), values.end());
+    long long high = *std::max_element(values.begin(), values.end());
+    bool dense = high - low < switchDensity * static_cast<long long>(conditional);
+    if (dense) {
+        code << "switch (" << variable << ") {\n";
+    } else {
+        std::vector<std::pair<long long, size_t>> cases;
+        for (size_t i = 0; i < conditional; i++) cases.emplace_back(values[i], i);
+        std::sort(cases.begin(), cases.end());
+        code << "{\n";
+        indentLevel++;
+        code << getIndent() << "int pl_arm = -1;\n";
+        code << getIndent() << generateArmSearchCode(variable, cases, 0, cases.size());
+        code << getIndent() << "switch (pl_arm) {\n";
+    }
+
+    for (size_t i = 0; i < arms.size(); i++) {
+        if (arms[i].condition) {
+            code << getIndent() << "case " << (dense ? values[i] : static_cast<long long>(i)) << ": {\n";
+        } else {
+            code << getIndent() << "default: {\n";
+        }
+        indentLevel++;
+        code << getIndent() << generateCode(arms[i].block);
+        code << getIndent() << "break;\n";
+        indentLevel--;
+        code << getIndent() << "}\n";
+    }
+    code << getIndent() << "}\n";
+
+    if (!dense) {
+        indentLevel--;
+        code << getIndent() << "}\n";
+    }
+    return code.str();
+}
+
+// Binary search over sorted (constant, arm) pairs that sets pl_arm to the matching arm
+std::string CodeGenerator::generateArmSearchCode(const std::string& variable,
+                                                 const std::vector<std::pair<long long, size_t>>& cases,
+                                                 size_t begin, size_t end) {
+    std::stringstream code;
+    if (end - begin <= 2) {
+        for (size_t i = begin; i < end; i++) {
+            if (i > begin) code << getIndent() << "else ";
+            code << "if (" << variable << " == " << cases[i].first << ") pl_arm = " << cases[i].second << ";\n";
+        }
+        return code.str();
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    code << "if (" << variable << " < " << cases[middle].first << ") {\n";
+    indentLevel++;
+    code << getIndent() << generateArmSearchCode(variable, cases, begin, middle);
+    indentLevel--;
+    code << getIndent() << "} else {\n";
+    indentLevel++;
+    code << getIndent() << generateArmSearchCode(variable, cases, middle, end);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
 // Helper methods for specific node types in while statements
 std::string CodeGenerator::generateWhileStatementCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
     if (node->children.size() >= 2) {
-        code << "while (" << generateCode(node->children[0]) << ") {\n";
+        if (!instrumented) {
+            CountedLoop loop;
+            if (matchCountedWhile(node, loop)) return generateCountedLoopCode(loop);
+            code << "while (" << generateCode(node->children[0]) << ") {\n";
+            indentLevel++;
+            code << getIndent() << generateCode(node->children[1]);
+            indentLevel--;
+            code << getIndent() << "}\n";
+            return code.str();
+        }
+
+        // Time the whole loop in its own scope and count every trip
+        size_t index = addProfileSite(ProfileSiteKind::LOOP, node->token);
+        std::string site = profileSiteCode(index);
+        code << "{\n";
+        indentLevel++;
+        code << getIndent() << "pl_profile::Timer pl_timer" << index << "(" << site << ");\n";
+        code << getIndent() << "while (" << generateCode(node->children[0]) << ") {\n";
         indentLevel++;
+        code << getIndent() << site << ".events++;\n";
         code << getIndent() << generateCode(node->children[1]);
         indentLevel--;
         code << getIndent() << "}\n";
+        indentLevel--;
+        code << getIndent() << "}\n";
+    }
+    return code.str();
+}
+
+// Helper methods for specific node types in for statements
+std::string CodeGenerator::generateForStatementCode(const std::shared_ptr<ASTNode>& node) {
+    std::stringstream code;
+    if (node->children.size() >= 4) {
+        CountedLoop loop = makeCountedFor(node);
+        if (!instrumented) return generateCountedLoopCode(loop);
+
+        // Time the whole loop in its own scope and count every trip
+        size_t index = addProfileSite(ProfileSiteKind::LOOP, node->token);
+        std::string site = profileSiteCode(index);
+        code << "{\n";
+        indentLevel++;
+        code << getIndent() << "pl_profile::Timer pl_timer" << index << "(" << site << ");\n";
+        std::string setVariable;
+        code << getIndent()
+             << generateCountedLoopHeader(loop, generateCode(loop.start), generateCode(loop.bound), setVariable)
+             << " {\n";
+        indentLevel++;
+        code << getIndent() << setVariable;
+        code << getIndent() << site << ".events++;\n";
+        code << getIndent() << generateCode(loop.body);
+        indentLevel--;
+        code << getIndent() << "}\n";
+        indentLevel--;
+        code << getIndent() << "}\n";
+    }
+    return code.str();
+}
+
+// A parallel for becomes a lambda over a range of trips that pl::parallelFor runs on chunks.
+// Inside it each reduction variable is a local starting at the operator's identity; the
+// chunk's value is stored for the runtime to combine, and the total is folded into the
+// variable after the loop. Instrumented and C programs run it as a plain for loop. Checked programs
+// combine 64-bit partials, and run it as a plain for loop too when its variable needs 64 bits or it
+// multiplies, as a product of partials can overflow where the loop would not.
+std::string CodeGenerator::generateParallelForCode(const std::shared_ptr<ASTNode>& node) {
+    std::vector<const ASTNode*> reductions;
+    std::shared_ptr<ASTNode> step;
+    for (size_t i = 3; i + 1 < node->children.size(); i++) {
+        if (node->children[i]->type == ASTNodeType::REDUCTION) {
+            reductions.push_back(node->children[i].get());
+        } else {
+            step = node->children[i];
+        }
+    }
+    bool multiplies = std::any_of(reductions.begin(), reductions.end(),
+                                  [](const ASTNode* reduction) { return reduction->token.type != TokenType::PLUS; });
+    if (instrumented || target == CodeTarget::C ||
+        (checked && (multiplies || arithmetic.wideVariables.count(node.get())))) {
+        return generateForStatementCode(node);
+    }
+    const std::string& variable = node->children[0]->token.lexeme;
+    std::string number = std::to_string(++temporaries);
+    std::string from = "pl_from" + number;
+    std::string to = "pl_to" + number;
+    std::string stride = "pl_step" + number;
+    std::string combines = "pl_combine" + number;
+    std::string results = "pl_result" + number;
+    std::string partial = integerType(checked);
+
+    std::stringstream code;
+    code << "{\n";
+    indentLevel++;
+    code << getIndent() << "int " << from << " = " << generateCode(node->children[1]) << ";\n";
+    code << getIndent() << "int " << to << " = " << generateCode(node->children[2]) << ";\n";
+    code << getIndent() << "int " << stride << " = " << (step ? generateCode(step) : "1") << ";\n";
+    if (!reductions.empty()) {
+        code << getIndent() << "const pl::Combine " << combines << "[] = {";
+        for (size_t r = 0; r < reductions.size(); r++) {
+            code << (r ? ", " : "")
+                 << (reductions[r]->token.type == TokenType::PLUS ? "pl::Combine::ADD" : "pl::Combine::MUL");
+        }
+        code << "};\n";
+        code << getIndent() << partial << " " << results << "[" << reductions.size() << "];\n";
+    }
+    code << getIndent() << "pl::parallelFor(pl::tripCount(" << from << ", " << to << ", " << stride << ", "
+         << node->token.line << "), " << reductions.size() << ", "
+         << (reductions.empty() ? "nullptr" : combines) << ", " << (reductions.empty() ? "nullptr" : results)
+         << ",\n";
+    indentLevel++;
+    code << getIndent() << "[&](long long pl_first" << number << ", long long pl_last" << number << ", "
+         << partial << "*" << (reductions.empty() ? "" : " pl_partial" + number) << ") {\n";
+    indentLevel++;
+    for (const ASTNode* reduction : reductions) {
+        code << getIndent() << partial << " " << reduction->children[0]->token.lexeme << " = "
+             << (reduction->token.type == TokenType::PLUS ? "0" : "1") << ";\n";
+    }
+    code << getIndent() << "for (long long pl_trip" << number << " = pl_first" << number << "; pl_trip" << number
+         << " < pl_last" << number << "; pl_trip" << number << "++) {\n";
+    indentLevel++;
+    code << getIndent() << "int " << variable << " = static_cast<int>(" << from << " + pl_trip" << number << " * "
+         << stride << ");\n";
+    code << getIndent() << generateCode(node->children.back());
+    indentLevel--;
+    code << getIndent() << "}\n";
+    for (size_t r = 0; r < reductions.size(); r++) {
+        code << getIndent() << "pl_partial" << number << "[" << r << "] = "
+             << reductions[r]->children[0]->token.lexeme << ";\n";
+    }
+    indentLevel--;
+    code << getIndent() << "}" << (checked ? ", " + std::to_string(node->token.line) : "") << ");\n";
+    indentLevel--;
+    for (size_t r = 0; r < reductions.size(); r++) {
+        const std::string& name = reductions[r]->children[0]->token.lexeme;
+        if (checked) {
+            code << getIndent() << name << " = PL_ADD(int64_t, " << name << ", " << results << "[" << r << "], "
+                 << node->token.line << ");\n";
+            continue;
+        }
+        code << getIndent() << name << " = " << name << (reductions[r]->token.type == TokenType::PLUS ? " + " : " * ")
+             << results << "[" << r << "];\n";
+    }
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
+// Recognize "while i < bound loop ... i <- i + c; end loop;" where the final increment is the only
+// assignment to i. Such a loop is the counted loop "for (; i < bound; i += c)" over the rest of the body,
+// unless the increment is checked.
+bool CodeGenerator::matchCountedWhile(const std::shared_ptr<ASTNode>& node, CountedLoop& loop) const {
+    const auto& condition = node->children[0];
+    const auto& body = node->children[1];
+    if (condition->type != ASTNodeType::BINARY_OP ||
+        (condition->token.type != TokenType::LESS && condition->token.type != TokenType::LESS_EQUAL) ||
+        condition->children[0]->type != ASTNodeType::IDENTIFIER || body->children.empty()) {
+        return false;
+    }
+    std::string variable = condition->children[0]->token.lexeme;
+    long long step;
+    const auto& increment = body->children.back();
+    if (!isIncrement(*increment, variable, step) || arithmetic.wideValues.count(increment.get()) ||
+        arithmetic.checkedOperations.count(increment->children[1].get())) {
+        return false;
+    }
+
+    LoopFacts facts;
+    scanLoopBody(body, variable, facts);
+    if (facts.assignments[variable] != 1 || facts.declared.count(variable)) return false;
+
+    loop.node = node.get();
+    loop.variable = variable;
+    loop.bound = condition->children[1];
+    loop.stepValue = step;
+    loop.inclusive = condition->token.type == TokenType::LESS_EQUAL;
+    loop.body = makeNode(ASTNodeType::BLOCK, body->token);
+    loop.body->children.assign(body->children.begin(), body->children.end() - 1);
+    return true;
+}
+
+// The counted loop of a for statement
+CodeGenerator::CountedLoop CodeGenerator::makeCountedFor(const std::shared_ptr<ASTNode>& node) const {
+    CountedLoop loop;
+    loop.node = node.get();
+    loop.variable = node->children[0]->token.lexeme;
+    loop.start = node->children[1];
+    loop.bound = node->children[2];
+    loop.body = node->children.back();
+    if (node->children.size() >= 5 && node->children[3]->type != ASTNodeType::REDUCTION) {
+        long long step;
+        if (constantValue(*node->children[3], step) && step != 0) {
+            loop.stepValue = step;
+        } else {
+            loop.step = node->children[3];
+        }
+    }
+    return loop;
+}
+
+// Trip count and first value of a loop whose start, bound and step are constants. A while loop's
+// start is known when the statement before it stored a constant in the variable, and its body
+// must not call procedures, which could change the variable too.
+bool CodeGenerator::countTrips(const CountedLoop& loop, long long& trips, long long& start) const {
+    long long bound;
+    if (loop.step || !constantValue(*loop.bound, bound)) return false;
+    if (loop.start) {
+        if (!constantValue(*loop.start, start)) return false;
+    } else {
+        std::vector<const ASTNode*> calls;
+        collectCalls(loop.body, calls);
+        if (precedingStore.variable != loop.variable || !calls.empty()) return false;
+        start = precedingStore.value;
+    }
+
+    long long step = loop.stepValue;
+    long long last = loop.inclusive ? bound : bound - (step > 0 ? 1 : -1);
+    if (step > 0) {
+        trips = start <= last ? (last - start) / step + 1 : 0;
+    } else {
+        trips = start >= last ? (start - last) / -step + 1 : 0;
+    }
+    return true;
+}
+
+// Arrays indexed by the loop variable whose bounds checks one test before the loop can replace:
+// the variable only grows from its start, stays within the bound, and the bound does not change.
+// A for loop evaluates its bound once and owns its variable; a while loop must not assign the
+// bound's variables or call procedures, which could change them.
+std::vector<std::string> CodeGenerator::findUncheckedArrays(const CountedLoop& loop) const {
+    std::vector<std::string> arrays;
+    if (loop.step || loop.stepValue <= 0 || countNodes(loop.body) > maximumVersionedNodes) return arrays;
+
+    LoopFacts facts;
+    scanLoopBody(loop.body, loop.variable, facts);
+    if (!loop.start) {
+        std::vector<std::string> boundNames;
+        if (facts.calls || !invariantBound(*loop.bound, boundNames)) return arrays;
+        for (const auto& name : boundNames) {
+            if (facts.assignments.count(name) || facts.declared.count(name)) return arrays;
+        }
+    }
+    for (const auto& array : facts.indexedArrays) {
+        if (!facts.declared.count(array)) arrays.push_back(array);
+    }
+    return arrays;
+}
+
+// A counted loop: unrolled when it has a few constant trips, otherwise a canonical C++ for loop
+// that compilers can compute the trip count of, with a second copy without bounds checks for
+// when a test before the loop shows its array indexes stay in bounds
+std::string CodeGenerator::generateCountedLoopCode(const CountedLoop& loop) {
+    long long trips;
+    long long first;
+    if (countTrips(loop, trips, first) && trips >= 1 && trips <= maximumUnrolledTrips &&
+        trips * static_cast<long long>(countNodes(loop.body)) <= maximumUnrolledNodes) {
+        return generateUnrolledLoopCode(loop, trips, first);
+    }
+
+    std::stringstream code;
+    std::vector<std::string> arrays = findUncheckedArrays(loop);
+    std::string start = loop.start ? generateCode(loop.start) : "";
+    std::string bound = generateCode(loop.bound);
+    std::string setVariable;
+    if (arrays.empty()) {
+        code << generateCountedLoopHeader(loop, start, bound, setVariable) << " {\n";
+        indentLevel++;
+        if (!setVariable.empty()) code << getIndent() << setVariable;
+        code << getIndent() << generateCode(loop.body);
+        indentLevel--;
+        code << getIndent() << "}\n";
+        return code.str();
+    }
+
+    // A for loop's range is evaluated once, before the test
+    if (loop.start) {
+        std::string number = std::to_string(++temporaries);
+        code << "{\n";
+        indentLevel++;
+        std::string type = integerType(arithmetic.wideVariables.count(loop.node) > 0);
+        code << getIndent() << type << " pl_from" << number << " = " << start << ";\n";
+        code << getIndent() << type << " pl_to" << number << " = " << bound << ";\n";
+        start = "pl_from" + number;
+        bound = "pl_to" + number;
+        code << getIndent();
+    }
+
+    // The variable only grows from its value here and stays below (or at) the bound while the body runs
+    const char* fits = loop.inclusive ? " < " : " <= ";
+    code << "if (" << (loop.start ? start : loop.variable) << " >= 0";
+    for (const auto& array : arrays) code << " && " << bound << fits << array << ".length()";
+    code << ") {\n";
+
+    auto checked = uncheckedIndexes;
+    for (const auto& array : arrays) uncheckedIndexes.insert({array, loop.variable});
+    indentLevel++;
+    code << getIndent() << generateCountedLoopHeader(loop, start, bound, setVariable) << " {\n";
+    indentLevel++;
+    if (!setVariable.empty()) code << getIndent() << setVariable;
+    code << getIndent() << generateCode(loop.body);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    indentLevel--;
+    uncheckedIndexes = checked;
+
+    code << getIndent() << "} else {\n";
+    indentLevel++;
+    code << getIndent() << generateCountedLoopHeader(loop, start, bound, setVariable) << " {\n";
+    indentLevel++;
+    if (!setVariable.empty()) code << getIndent() << setVariable;
+    code << getIndent() << generateCode(loop.body);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    indentLevel--;
+    code << getIndent() << "}\n";
+
+    if (loop.start) {
+        indentLevel--;
+        code << getIndent() << "}\n";
     }
     return code.str();
 }
 
+// "for (...)" of a counted loop. A while loop's bound is evaluated on every trip, as before. A for
+// loop counts its trips in 64 bits from its start, bound and step, evaluated once in that order, and
+// setVariable gets the statement that sets its variable at the start of each trip, so the variable never
+// steps past the bound, which may be the largest int. A step that is not constant is checked for 0
+// when the loop starts. When locals is given, the for loop's variable and locals are only assigned,
+// and their names and types added to it for declaring before the loop.
+std::string CodeGenerator::generateCountedLoopHeader(const CountedLoop& loop, const std::string& start,
+                                                     const std::string& bound, std::string& setVariable,
+                                                     std::vector<std::pair<std::string, std::string>>* locals) {
+    const std::string& variable = loop.variable;
+    setVariable.clear();
+    if (!loop.start) {
+        return "for (; " + variable + (loop.inclusive ? " <= " : " < ") + bound + "; " + variable + " += " +
+               std::to_string(loop.stepValue) + ")";
+    }
+
+    std::string number = std::to_string(++temporaries);
+    std::string trip = "pl_trip" + number;
+    std::string trips = "pl_trips" + number;
+    std::string from = "pl_from" + number;
+    std::string to = "pl_to" + number;
+    std::string step = loop.step ? "pl_step" + number : std::to_string(loop.stepValue);
+    bool wide = arithmetic.wideVariables.count(loop.node) > 0;
+    std::string type = integerType(wide);
+    if (locals) {
+        locals->push_back({variable, type});
+        for (const std::string* local : {&trip, &from, &to, &trips}) locals->push_back({*local, "long long"});
+        if (loop.step) locals->push_back({step, "long long"});
+    }
+
+    std::string header = "for (" + std::string(locals ? "" : "long long ") + trip + " = 0, " + from + " = " + start +
+                         ", " + to + " = " + bound;
+    if (loop.step) header += ", " + step + " = " + generateCode(loop.step);
+    header += ", " + trips + " = ";
+    if (loop.step || wide) {
+        // 64-bit distances may not fit in a long long, so the runtime counts them unsigned
+        header += std::string(target == CodeTarget::C ? "pl_trip_count(" : "pl::tripCount(") + from + ", " + to +
+                  ", " + step + ", " + std::to_string(loop.node->token.line) + ")";
+    } else {
+        bool up = loop.stepValue > 0;
+        std::string distance = up ? to + " - " + from : from + " - " + to;
+        std::string stride = std::to_string(up ? loop.stepValue : -loop.stepValue);
+        header += from + (up ? " <= " : " >= ") + to + " ? " +
+                  (stride == "1" ? distance : "(" + distance + ") / " + stride) + " + 1 : 0";
+    }
+    header += "; " + trip + " < " + trips + "; " + trip + "++)";
+
+    // A 64-bit variable is computed unsigned, as the trip times the step may not fit in a long long
+    std::string value = loop.stepValue == 1 && !loop.step ? from + " + " + trip : from + " + " + trip + " * " + step;
+    if (wide) {
+        const char* unsignedType = "(unsigned long long)";
+        value = unsignedType + from + " + " + unsignedType + trip + " * " + unsignedType + step;
+    }
+    value = target == CodeTarget::C ? "(" + type + ")(" + value + ")" : "static_cast<" + type + ">(" + value + ")";
+    setVariable = (locals ? "" : type + " ") + variable + " = " + value + ";\n";
+    return header;
+}
+
+// A loop with a few constant trips as one copy of the body per trip, with the variable set
+// before each. A while loop's variable is left at the value the loop would have ended with.
+std::string CodeGenerator::generateUnrolledLoopCode(const CountedLoop& loop, long long trips, long long start) {
+    std::stringstream code;
+    bool scoped = std::any_of(loop.body->children.begin(), loop.body->children.end(),
+                              [](const std::shared_ptr<ASTNode>& child) {
+                                  return child->type == ASTNodeType::DECLARATION ||
+                                         child->type == ASTNodeType::ARRAY_DECLARATION;
+                              });
+    code << "{\n";
+    indentLevel++;
+    for (long long trip = 0; trip < trips; trip++) {
+        long long value = start + trip * loop.stepValue;
+        if (trip == 0 && loop.start) {
+            code << getIndent() << integerType(arithmetic.wideVariables.count(loop.node) > 0) << " " << loop.variable
+                 << " = " << value << ";\n";
+        } else if (trip > 0) {
+            code << getIndent() << loop.variable << " = " << value << ";\n";
+        }
+        if (scoped) {
+            code << getIndent() << "{\n";
+            indentLevel++;
+        }
+        code << getIndent() << generateCode(loop.body);
+        if (scoped) {
+            indentLevel--;
+            code << getIndent() << "}\n";
+        }
+    }
+    if (!loop.start) code << getIndent() << loop.variable << " = " << start + trips * loop.stepValue << ";\n";
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
 // Helper methods for specific node types in put statements
 std::string CodeGenerator::generatePutStatementCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
     if (!node->children.empty()) {
-        code << "std::cout << " << generateCode(node->children[0]) << " << std::endl;\n";
+        const auto& value = node->children[0];
+        if (target == CodeTarget::C) {
+            code << (value->type == ASTNodeType::STRING ? "pl_put_string(" : "pl_put_int(") << generateCode(value)
+                 << ");\n";
+            return code.str();
+        }
+        code << "std::cout << "
+             << (findArrayOperand(value) ? generateArrayValueCode(value, node->token.line) : generateCode(value))
+             << " << std::endl;\n";
     }
     return code.str();
 }
 
 // Helper methods for specific node types in binary operations
 std::string CodeGenerator::generateBinaryOpCode(const std::shared_ptr<ASTNode>& node) {
+    auto temporary = commonTemporaries.find(node.get());
+    if (temporary != commonTemporaries.end()) return temporary->second;
     std::stringstream code;
     if (node->children.size() >= 2) {
-        code << "(" << generateCode(node->children[0]);
+        if (arithmetic.checkedOperations.count(node.get())) {
+            return generateCheckedOperationCode(node, arithmetic.wideOperations.count(node.get()) > 0);
+        }
+        // An operation in 64 bits that cannot overflow them has its left operand converted
+        std::string left = generateCode(node->children[0]);
+        if (arithmetic.wideOperations.count(node.get())) {
+            left = target == CodeTarget::C ? "(int64_t)" + left : "static_cast<int64_t>(" + left + ")";
+        }
+        code << "(" << left;
         
         switch (node->token.type) {
             case TokenType::PLUS: code << " + "; break;
@@ -193,58 +1341,650 @@ std::string CodeGenerator::generateBinaryOpCode(const std::shared_ptr<ASTNode>&
     return code.str();
 }
 
+// Type of a variable or temporary, which is 64 bits when range analysis found it may not fit in 32
+std::string CodeGenerator::integerType(bool wide) const {
+    return wide ? "int64_t" : "int";
+}
+
+// An operator whose result may overflow or whose divisor may be zero, computed by the runtime in 64 or
+// 32 bits, which stops the program with the line of the statement
+std::string CodeGenerator::generateCheckedOperationCode(const std::shared_ptr<ASTNode>& node, bool wide) {
+    const char* name;
+    switch (node->token.type) {
+        case TokenType::PLUS: name = "PL_ADD("; break;
+        case TokenType::MINUS: name = "PL_SUBTRACT("; break;
+        case TokenType::STAR: name = "PL_MULTIPLY("; break;
+        default: name = "PL_DIVIDE("; break;
+    }
+    return name + integerType(wide) + ", " + generateCode(node->children[0]) + ", " + generateCode(node->children[1]) +
+           ", " + std::to_string(statementLine) + ")";
+}
+
+// A value passed, returned or stored where 32 bits are kept, checked to fit when range analysis
+// found it may not: an operator on 32-bit operands by computing it in 32 bits, anything else after it
+// is computed. site is the node the analysis noted, when it is not the value itself.
+std::string CodeGenerator::generateKeptCode(const std::shared_ptr<ASTNode>& value, const ASTNode* site) {
+    if (!checked || !arithmetic.wideValues.count(site ? site : value.get())) return generateCode(value);
+    if (arithmetic.narrowedOperations.count(value.get()) && !commonTemporaries.count(value.get())) {
+        return generateCheckedOperationCode(value, false);
+    }
+    return "PL_NARROW(" + generateCode(value) + ", " + std::to_string(statementLine) + ")";
+}
+
 // Helper methods for specific node types in procedures
 std::string CodeGenerator::generateProcedureCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
+    if (node->children.size() >= 2 && containsType(node->children.back(), ASTNodeType::YIELD_STATEMENT)) {
+        return generateGeneratorCode(node);
+    }
     if (node->children.size() >= 2) {
         std::string procName = node->children[0]->token.lexeme;
-        code << "int " << procName << "(";
+        TraceScope trace("codegen", "procedure ", procName);
         
         // Parameters
+        std::stringstream signature;
+        std::vector<std::string> parameters;
+        signature << "(";
         for (size_t i = 1; i < node->children.size() - 1; i++) {
             if (node->children[i]->type == ASTNodeType::PARAMETER) {
-                if (i > 1) code << ", ";
-                code << "int " << node->children[i]->token.lexeme;
+                if (i > 1) signature << ", ";
+                signature << "int " << node->children[i]->token.lexeme;
+                parameters.push_back(node->children[i]->token.lexeme);
             }
         }
+        signature << ")";
         
-        code << ") {\n";
+        // Tail calls to itself assign the parameters and go round a loop around the body
+        tailCalls.calls = std::move(findSelfCalls(node).tail);
+        tailCalls.parameters = parameters;
+
+        std::stringstream body;
         indentLevel++;
-        code << getIndent() << generateCode(node->children.back());
+        if (instrumented) {
+            tailCalls.site = addProfileSite(ProfileSiteKind::PROCEDURE, node->token);
+            body << getIndent() << "pl_profile::Timer pl_timer(" << profileSiteCode(tailCalls.site) << ");\n";
+        }
+        if (containsType(node->children.back(), ASTNodeType::SPAWN_STATEMENT) ||
+            containsType(node->children.back(), ASTNodeType::SYNC_STATEMENT)) {
+            body << getIndent() << "pl::TaskGroup pl_tasks;\n";
+        }
+        if (tailCalls.calls.empty()) {
+            body << getIndent() << generateCode(node->children.back());
+        } else {
+            body << getIndent() << "for (;;) {\n";
+            indentLevel++;
+            body << getIndent() << generateCode(node->children.back());
+            const auto& statements = node->children.back()->children;
+            if (statements.empty() || statements.back()->type != ASTNodeType::RETURN_STATEMENT) {
+                body << getIndent() << "break;\n";
+            }
+            indentLevel--;
+            body << getIndent() << "}\n";
+            tailCalls.calls.clear();
+        }
         indentLevel--;
-        code << "}\n\n";
+
+        // Procedures the profiled run never called are kept out of the way of the hot code
+        const ProfileSite* site = profile ? profile->find(ProfileSiteKind::PROCEDURE, node->token.line,
+                                                          node->token.column) : nullptr;
+        // The body of a memoized procedure is a function of its own, which the one with the procedure's
+        // name calls when it has no cached result. Calls in the body go through the cache too.
+        bool memoized = memoizedProcedures.count(procName) > 0;
+        if (memoized) code << "int " << procName << signature.str() << ";\n\n";
+        code << generateLineMarker(node->token);
+        if (site && site->entries == 0) code << "__attribute__((cold)) ";
+        code << "int " << procName << (memoized ? "_pl_body" : "") << signature.str() << " {\n" << body.str()
+             << "}\n\n";
+        if (memoized) code << "int " << procName << signature.str() << " {\n" << generateMemoCode(procName, parameters)
+                           << "}\n\n";
+
+        // Copy for hot call sites, inlined even without optimization. In C an inline function needs
+        // to be static, or a call it is not inlined into would need an external definition.
+        if (inlinedProcedures.count(procName)) {
+            code << (target == CodeTarget::C ? "static inline" : "inline") << " __attribute__((always_inline)) int "
+                 << procName << "_pl_inline" << signature.str() << " {\n" << body.str() << "}\n\n";
+        }
     }
     return code.str();
 }
 
+// Body of the function that returns a memoized procedure's cached result for its arguments, or
+// calls the procedure's body and caches what it returns. Each thread has its own cache; in C,
+// where parallel loops run sequentially and there are no tasks, it is a static array.
+std::string CodeGenerator::generateMemoCode(const std::string& name, const std::vector<std::string>& parameters) {
+    std::string arguments;
+    for (size_t i = 0; i < parameters.size(); i++) arguments += (i > 0 ? ", " : "") + parameters[i];
+    std::string arity = std::to_string(std::max<size_t>(parameters.size(), 1));
+    std::string key = parameters.empty() ? "0" : arguments;
+
+    std::string code;
+    if (target == CodeTarget::C) {
+        code += "    static int pl_memo[PL_MEMO_SLOTS * (" + arity + " + 2)];\n";
+    } else {
+        code += "    thread_local pl::Memo<" + arity + "> pl_memo;\n";
+    }
+    code += "    const int pl_key[" + arity + "] = {" + key + "};\n";
+    code += "    int pl_value;\n";
+    if (target == CodeTarget::C) {
+        code += "    if (!pl_memo_find(pl_memo, " + arity + ", pl_key, &pl_value)) {\n";
+    } else {
+        code += "    if (!pl_memo.find(pl_key, pl_value)) {\n";
+    }
+    code += "        pl_value = " + name + "_pl_body(" + arguments + ");\n";
+    if (target == CodeTarget::C) {
+        code += "        pl_memo_store(pl_memo, " + arity + ", pl_key, pl_value);\n";
+    } else {
+        code += "        pl_memo.store(pl_key, pl_value);\n";
+    }
+    code += "    }\n";
+    code += "    return pl_value;\n";
+    return code;
+}
+
+// A generator becomes a structure with its state and a function that runs it on to its next
+// value, which it stores before returning true; it returns false once the body has ended. The
+// state holds where the body goes on from, the parameters, and the locals in scope at a yield. The
+// body is a switch on where it goes on from, with a case after every yield that loads the locals
+// again; no thread or heap frame is needed, and a loop over the values allocates nothing. An
+// instrumented generator is counted and timed as a procedure called for each value.
+std::string CodeGenerator::generateGeneratorCode(const std::shared_ptr<ASTNode>& node) {
+    std::string name = node->children[0]->token.lexeme;
+    TraceScope trace("codegen", "generator ", name);
+    const char* boolean = target == CodeTarget::C ? "int" : "bool";
+    generator = Generator();
+    generator.active = true;
+
+    // Parameters are the first members, so the loop's arguments initialize them in order
+    std::stringstream body;
+    indentLevel++;
+    std::vector<std::string> parameters;
+    for (size_t i = 1; i + 1 < node->children.size(); i++) {
+        if (node->children[i]->type != ASTNodeType::PARAMETER) continue;
+        const std::string& parameter = node->children[i]->token.lexeme;
+        body << getIndent() << "int " << parameter << ";\n";
+        generator.members.push_back("int " + parameter);
+        generator.locals.push_back({parameter, "int", parameter});
+        parameters.push_back(parameter);
+    }
+    if (instrumented) {
+        body << getIndent() << "pl_profile::Timer pl_timer("
+             << profileSiteCode(addProfileSite(ProfileSiteKind::PROCEDURE, node->token)) << ");\n";
+    }
+    body << getIndent() << "switch (pl_self->pl_resume) {\n";
+    body << getIndent() << "case 0:\n";
+    indentLevel++;
+    for (const auto& parameter : parameters) body << getIndent() << parameter << " = pl_self->" << parameter << ";\n";
+    body << getIndent() << generateYieldingBlockCode(node->children.back());
+    indentLevel--;
+    body << getIndent() << "}\n";
+    body << getIndent() << "pl_self->pl_resume = -1;\n";
+    body << getIndent() << "return " << (target == CodeTarget::C ? "0" : "false") << ";\n";
+    indentLevel--;
+
+    std::stringstream code;
+    code << (target == CodeTarget::C ? "typedef struct " : "struct ") << name << "_pl_state {\n";
+    code << "    int pl_resume;\n";
+    for (const auto& member : generator.members) code << "    " << member << ";\n";
+    code << "}" << (target == CodeTarget::C ? " " + name + "_pl_state" : "") << ";\n\n";
+    code << generateLineMarker(node->token);
+    code << boolean << " " << name << "_pl_next(" << name << "_pl_state* pl_self, int* pl_value) {\n" << body.str()
+         << "}\n\n";
+    generator = Generator();
+    return code.str();
+}
+
+// Bring a local of the generator being generated into scope
+void CodeGenerator::declareGeneratorLocal(const std::string& name, const std::string& type) {
+    generator.locals.push_back({name, type, ""});
+}
+
+// A block of a generator with a yield in it. Its declarations are split into a declaration
+// without a value and an assignment, as the switch may jump past them to a case after a yield,
+// and it has no temporaries, which would have to be kept too. Statements without a yield are
+// generated as anywhere else.
+std::string CodeGenerator::generateYieldingBlockCode(const std::shared_ptr<ASTNode>& node) {
+    if (!containsType(node, ASTNodeType::YIELD_STATEMENT)) return generateCode(node);
+    std::stringstream code;
+    ConstantStore store;
+    auto enclosingTemporaries = std::move(commonTemporaries);
+    commonTemporaries.clear();
+    int enclosingLine = statementLine;
+    size_t scope = generator.locals.size();
+    for (const auto& child : node->children) {
+        precedingStore = store;
+        statementLine = child->token.line;
+        code << generateLineMarker(child->token);
+        code << getIndent();
+        if (child->type == ASTNodeType::DECLARATION) {
+            const std::string& name = child->children[0]->token.lexeme;
+            std::string type = integerType(arithmetic.wideVariables.count(child.get()) > 0);
+            code << type << " " << name << ";\n";
+            code << getIndent() << name << " = "
+                 << (child->children.size() >= 2 ? generateCode(child->children[1]) : "0") << ";\n";
+            declareGeneratorLocal(name, type);
+        } else if (!containsType(child, ASTNodeType::YIELD_STATEMENT)) {
+            code << generateCode(child);
+            if (child->type == ASTNodeType::PROCEDURE_CALL) code << ";\n";
+        } else if (child->type == ASTNodeType::IF_STATEMENT) {
+            code << generateYieldingIfCode(child);
+        } else if (child->type == ASTNodeType::WHILE_STATEMENT) {
+            code << generateYieldingWhileCode(child);
+        } else if (child->type == ASTNodeType::FOR_STATEMENT) {
+            code << generateYieldingForCode(child);
+        } else {
+            code << generateCode(child);
+        }
+        store = ConstantStore();
+        storesConstant(*child, store.variable, store.value);
+    }
+    generator.locals.resize(scope);
+    commonTemporaries = std::move(enclosingTemporaries);
+    statementLine = enclosingLine;
+    return code.str();
+}
+
+// An if statement of a generator with a yield in an arm, which stays a chain of ifs, as the
+// cases after its yields would belong to the switch of a lowered chain. Instrumented arms are
+// counted as in other chains.
+std::string CodeGenerator::generateYieldingIfCode(const std::shared_ptr<ASTNode>& node) {
+    std::stringstream code;
+    for (size_t i = 0; i < node->children.size(); i++) {
+        const ASTNode* arm = i == 0 ? node.get() : node->children[i].get();
+        if (i == 1) continue;
+        ProfileSiteKind kind = i == 0 ? ProfileSiteKind::BRANCH
+                               : arm->type == ASTNodeType::ELSEIF_STATEMENT ? ProfileSiteKind::ELSEIF
+                                                                            : ProfileSiteKind::ELSE;
+        std::string site = instrumented ? profileSiteCode(addProfileSite(kind, arm->token)) : "";
+        statementLine = arm->token.line;
+        if (i > 0) code << getIndent() << "} else";
+        if (kind != ProfileSiteKind::ELSE) {
+            code << (i > 0 ? " if (" : "if (") << (instrumented ? site + ".entries++, " : "")
+                 << generateCode(arm->children[0]) << ")";
+        }
+        code << " {\n";
+        indentLevel++;
+        if (instrumented && kind == ProfileSiteKind::ELSE) code << getIndent() << site << ".entries++;\n";
+        if (instrumented) code << getIndent() << site << ".events++;\n";
+        code << getIndent() << generateYieldingBlockCode(i == 0 ? node->children[1] : arm->children.back());
+        indentLevel--;
+    }
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
+// A while loop of a generator with a yield in its body. Instrumented loops count their trips but
+// are not timed, as a timer would stop at every yield.
+std::string CodeGenerator::generateYieldingWhileCode(const std::shared_ptr<ASTNode>& node) {
+    std::stringstream code;
+    std::string site = instrumented ? profileSiteCode(addProfileSite(ProfileSiteKind::LOOP, node->token)) : "";
+    if (instrumented) code << site << ".entries++;\n" << getIndent();
+    code << "while (" << generateCode(node->children[0]) << ") {\n";
+    indentLevel++;
+    if (instrumented) code << getIndent() << site << ".events++;\n";
+    code << getIndent() << generateYieldingBlockCode(node->children[1]);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
+// A for loop of a generator with a yield in it. Its variable and the locals with its bound and
+// step are declared before it, in a scope of their own, and kept across yields like other locals.
+// Instrumented loops count their trips as yielding while loops do.
+std::string CodeGenerator::generateYieldingForCode(const std::shared_ptr<ASTNode>& node) {
+    std::string site = instrumented ? profileSiteCode(addProfileSite(ProfileSiteKind::LOOP, node->token)) : "";
+    CountedLoop loop = makeCountedFor(node);
+    std::vector<std::pair<std::string, std::string>> locals;
+    std::string setVariable;
+    std::string header = generateCountedLoopHeader(loop, generateCode(loop.start), generateCode(loop.bound),
+                                                   setVariable, &locals);
+    std::stringstream code;
+    code << "{\n";
+    indentLevel++;
+    size_t scope = generator.locals.size();
+    for (const auto& local : locals) {
+        code << getIndent() << local.second << " " << local.first << ";\n";
+        declareGeneratorLocal(local.first, local.second);
+    }
+    if (instrumented) code << getIndent() << site << ".entries++;\n";
+    code << getIndent() << header << " {\n";
+    indentLevel++;
+    code << getIndent() << setVariable;
+    if (instrumented) code << getIndent() << site << ".events++;\n";
+    code << getIndent() << generateYieldingBlockCode(loop.body);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    generator.locals.resize(scope);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
+// A yield stores the value, keeps the locals in scope in the state, and returns. The next call
+// goes on at the case after it, which loads them again.
+std::string CodeGenerator::generateYieldCode(const std::shared_ptr<ASTNode>& node) {
+    std::string point = std::to_string(++generator.resumePoints);
+    std::stringstream code;
+    code << "*pl_value = " << generateKeptCode(node->children[0]) << ";\n";
+    std::stringstream load;
+    for (auto& local : generator.locals) {
+        if (local.member.empty()) {
+            // A name declared again in another scope, possibly with another width, gets a member of its own
+            local.member = local.name;
+            for (int copy = 2;; copy++) {
+                bool taken = std::any_of(generator.members.begin(), generator.members.end(),
+                                         [&](const std::string& member) {
+                                             return member.compare(member.rfind(' ') + 1, std::string::npos,
+                                                                   local.member) == 0;
+                                         });
+                if (!taken) break;
+                local.member = local.name + "_" + std::to_string(copy);
+            }
+            generator.members.push_back(local.type + " " + local.member);
+        }
+        code << getIndent() << "pl_self->" << local.member << " = " << local.name << ";\n";
+        load << getIndent() << local.name << " = pl_self->" << local.member << ";\n";
+    }
+    code << getIndent() << "pl_self->pl_resume = " << point << ";\n";
+    code << getIndent() << "return " << (target == CodeTarget::C ? "1" : "true") << ";\n";
+    code << getIndent() << "case " << point << ":" << (generator.locals.empty() ? ";" : "") << "\n";
+    code << load.str();
+    return code.str();
+}
+
+// A for each loop holds the state of its generator in a local and calls the generator's function
+// for each value, until it returns false. In a generator, with a yield in its body, the state and
+// the variable are locals of the generator, set after they are declared. Instrumented loops are
+// timed and count their trips, except those with a yield, which only count them.
+std::string CodeGenerator::generateForEachCode(const std::shared_ptr<ASTNode>& node) {
+    const auto& call = node->children[1];
+    const std::string& variable = node->children[0]->token.lexeme;
+    std::string state = call->token.lexeme + "_pl_state";
+    std::string number = std::to_string(++temporaries);
+    std::string local = "pl_each" + number;
+    bool yielding = generator.active && containsType(node->children.back(), ASTNodeType::YIELD_STATEMENT);
+    std::string arguments = "0";
+    for (const auto& argument : call->children) arguments += ", " + generateKeptCode(argument);
+
+    std::stringstream code;
+    code << "{\n";
+    indentLevel++;
+    std::string site;
+    if (instrumented) {
+        size_t index = addProfileSite(ProfileSiteKind::LOOP, node->token);
+        site = profileSiteCode(index);
+        if (yielding) {
+            code << getIndent() << site << ".entries++;\n";
+        } else {
+            code << getIndent() << "pl_profile::Timer pl_timer" << number << "(" << site << ");\n";
+        }
+    }
+    size_t scope = generator.locals.size();
+    if (yielding) {
+        code << getIndent() << state << " " << local << ";\n";
+        code << getIndent() << local << " = " << (target == CodeTarget::C ? "(" + state + ")" : state) << "{"
+             << arguments << "};\n";
+        declareGeneratorLocal(local, state);
+        declareGeneratorLocal(variable, "int");
+    } else {
+        code << getIndent() << state << " " << local << " = {" << arguments << "};\n";
+    }
+    code << getIndent() << "int " << variable << ";\n";
+    code << getIndent() << "while (" << call->token.lexeme << "_pl_next(&" << local << ", &" << variable << ")) {\n";
+    indentLevel++;
+    if (instrumented) code << getIndent() << site << ".events++;\n";
+    code << getIndent() << (yielding ? generateYieldingBlockCode(node->children.back())
+                                     : generateCode(node->children.back()));
+    indentLevel--;
+    code << getIndent() << "}\n";
+    if (yielding) generator.locals.resize(scope);
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
 // Helper methods for specific node types in procedure calls
 std::string CodeGenerator::generateProcedureCallCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
-    if (!node->children.empty()) {
-        code << node->token.lexeme << "(";
-        for (size_t i = 0; i < node->children.size(); i++) {
-            if (i > 0) code << ", ";
-            code << generateCode(node->children[i]);
-        }
-        code << ")";
+    if (instrumented) {
+        code << "(" << profileSiteCode(addProfileSite(ProfileSiteKind::CALL, node->token)) << ".entries++, ";
     }
+    code << node->token.lexeme << (hotCalls.count(node.get()) ? "_pl_inline(" : "(");
+    for (size_t i = 0; i < node->children.size(); i++) {
+        if (i > 0) code << ", ";
+        code << generateKeptCode(node->children[i]);
+    }
+    code << ")";
+    if (instrumented) code << ")";
     return code.str();
 }
 
 // Helper methods for specific node types in blocks
 std::string CodeGenerator::generateBlockCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
-    for (const auto& child : node->children) {
+    ConstantStore store;
+    // The block may run after what the temporaries around it read has changed, so it has its own
+    auto enclosingTemporaries = std::move(commonTemporaries);
+    commonTemporaries.clear();
+    CommonSubexpressions plan = findCommonSubexpressions(node->children);
+    int enclosingLine = statementLine;
+    for (size_t i = 0; i < node->children.size(); i++) {
+        const auto& child = node->children[i];
+        precedingStore = store;
+        statementLine = child->token.line;
+        code << generateLineMarker(child->token);
+        code << generateTemporariesCode(plan, i);
         code << getIndent() << generateCode(child);
+        if (child->type == ASTNodeType::PROCEDURE_CALL) code << ";\n";
+        store = ConstantStore();
+        storesConstant(*child, store.variable, store.value);
     }
+    commonTemporaries = std::move(enclosingTemporaries);
+    statementLine = enclosingLine;
     return code.str();
 }
 
+// Locals holding the repeated expressions first computed by a statement of a block or of main,
+// after forgetting those it must not use
+std::string CodeGenerator::generateTemporariesCode(const CommonSubexpressions& plan, size_t statement) {
+    if (plan.expressions.empty()) return "";
+    for (size_t expression : plan.dropped[statement]) {
+        commonTemporaries.erase(plan.expressions[expression].get());
+    }
+    std::string code;
+    for (size_t expression : plan.computed[statement]) {
+        const auto& node = plan.expressions[expression];
+        std::string name = "pl_common" + std::to_string(++temporaries);
+        code += getIndent() + integerType(arithmetic.wideOperations.count(node.get()) > 0) + " " + name + " = " +
+                generateCode(node) + ";\n";
+        commonTemporaries[node.get()] = name;
+    }
+    return code;
+}
+
 // Helper methods for specific node types in return statements
 std::string CodeGenerator::generateReturnStatementCode(const std::shared_ptr<ASTNode>& node) {
     std::stringstream code;
+    if (!node->children.empty() && tailCalls.calls.count(node->children[0].get())) {
+        return generateTailCallCode(node->children[0]);
+    }
     if (!node->children.empty()) {
-        code << "return " << generateCode(node->children[0]) << ";\n";
+        code << "return " << generateKeptCode(node->children[0]) << ";\n";
+    }
+    return code.str();
+}
+
+// A tail call of the procedure being generated to itself. The arguments are all evaluated with the
+// old parameters before any is assigned, and the loop around the body starts it again.
+std::string CodeGenerator::generateTailCallCode(const std::shared_ptr<ASTNode>& call) {
+    std::vector<size_t> changed;   // Parameters given a value computed from the old ones
+    std::vector<size_t> constants; // Parameters given a number
+    for (size_t i = 0; i < call->children.size(); i++) {
+        const auto& argument = call->children[i];
+        if (argument->type == ASTNodeType::NUMBER) {
+            constants.push_back(i);
+        } else if (argument->type != ASTNodeType::IDENTIFIER || argument->token.lexeme != tailCalls.parameters[i]) {
+            changed.push_back(i);
+        }
+    }
+
+    std::stringstream code;
+    code << "{\n";
+    indentLevel++;
+    if (instrumented) {
+        code << getIndent() << profileSiteCode(addProfileSite(ProfileSiteKind::CALL, call->token)) << ".entries++;\n";
+        code << getIndent() << profileSiteCode(tailCalls.site) << ".entries++;\n";
+    }
+    if (changed.size() == 1) {
+        code << getIndent() << tailCalls.parameters[changed[0]] << " = " << generateKeptCode(call->children[changed[0]])
+             << ";\n";
+    } else if (changed.size() > 1) {
+        std::vector<std::string> values;
+        for (size_t i : changed) {
+            values.push_back("pl_argument" + std::to_string(++temporaries));
+            code << getIndent() << "int " << values.back() << " = " << generateKeptCode(call->children[i]) << ";\n";
+        }
+        for (size_t j = 0; j < changed.size(); j++) {
+            code << getIndent() << tailCalls.parameters[changed[j]] << " = " << values[j] << ";\n";
+        }
+    }
+    for (size_t i : constants) {
+        code << getIndent() << tailCalls.parameters[i] << " = " << generateKeptCode(call->children[i]) << ";\n";
+    }
+    code << getIndent() << "continue;\n";
+    indentLevel--;
+    code << getIndent() << "}\n";
+    return code.str();
+}
+
+// Helper methods for specific node types in array declarations
+std::string CodeGenerator::generateArrayDeclarationCode(const std::shared_ptr<ASTNode>& node) {
+    std::stringstream code;
+    const std::string& name = node->children[0]->token.lexeme;
+    code << "pl::Array " << name << "(\"" << name << "\", " << generateCode(node->children[1]) << ", "
+         << node->token.line << ");\n";
+    if (node->children.size() >= 3) {
+        code << getIndent() << generateArrayAssignmentCode(name, node->children[2], node->token.line);
+    }
+    return code.str();
+}
+
+// Channel declared inside a block, which the parser reports; top-level channels are globals
+std::string CodeGenerator::generateChannelDeclarationCode(const std::shared_ptr<ASTNode>& node) {
+    const std::string& name = node->children[0]->token.lexeme;
+    return "pl::Channel " + name + "(\"" + name + "\");\n" + getIndent() + name + ".allocate(" +
+           generateCode(node->children[1]) + ", " + std::to_string(node->token.line) + ");\n";
+}
+
+// A spawned call. Its arguments are evaluated now and captured by value, so the task does not
+// see the caller's variables change.
+std::string CodeGenerator::generateSpawnStatementCode(const std::shared_ptr<ASTNode>& node) {
+    const auto& call = node->children[0];
+    std::stringstream captures;
+    std::stringstream arguments;
+    for (size_t i = 0; i < call->children.size(); i++) {
+        std::string argument = "pl_argument" + std::to_string(++temporaries);
+        captures << (i > 0 ? ", " : "") << argument << " = " << generateKeptCode(call->children[i]);
+        arguments << (i > 0 ? ", " : "") << argument;
+    }
+    return "pl_tasks.spawn([" + captures.str() + "] { " + call->token.lexeme + "(" + arguments.str() + "); });\n";
+}
+
+// Array element, checked unless a loop proved the index is in bounds
+std::string CodeGenerator::generateIndexCode(const std::shared_ptr<ASTNode>& node) {
+    const auto& index = node->children[0];
+    if (index->type == ASTNodeType::IDENTIFIER && uncheckedIndexes.count({node->token.lexeme, index->token.lexeme})) {
+        return node->token.lexeme + "[" + index->token.lexeme + "]";
+    }
+    return node->token.lexeme + ".at(" + generateCode(index) + ", " + std::to_string(node->token.line) + ")";
+}
+
+// length, sum, min or max of an array expression
+std::string CodeGenerator::generateArrayFunctionCode(const std::shared_ptr<ASTNode>& node) {
+    std::string array = generateArrayValueCode(node->children[0], node->token.line);
+    const std::string& name = node->token.lexeme;
+    if (name == "length") return array + ".length()";
+    if (name == "sum") return "pl::sum(" + array + ")";
+    return "pl::" + name + "(" + array + ", " + std::to_string(node->token.line) + ")";
+}
+
+// Statements that store an array expression into target, which has the expression's length.
+// Each operation is one runtime kernel call; the innermost-left one writes target and the ones
+// around it update it in place, so only array operands on the right need a temporary.
+void CodeGenerator::generateArrayStores(const std::string& target, const std::shared_ptr<ASTNode>& value, int line,
+                                        std::vector<std::string>& statements) {
+    if (!findArrayOperand(value)) {
+        statements.push_back("pl::fill(" + target + ", " + generateKeptCode(value) + ");");
+        return;
+    }
+    if (value->type == ASTNodeType::ARRAY_REFERENCE) {
+        if (value->token.lexeme != target) {
+            statements.push_back("pl::copy(" + target + ", " + value->token.lexeme + ", " + std::to_string(line) + ");");
+        }
+        return;
     }
+
+    const auto& left = value->children[0];
+    std::string leftCode;
+    if (left->type == ASTNodeType::BINARY_OP && findArrayOperand(left)) {
+        generateArrayStores(target, left, line, statements);
+        leftCode = target;
+    } else {
+        leftCode = generateArrayOperandCode(left, line, statements);
+    }
+    std::string rightCode = generateArrayOperandCode(value->children[1], line, statements);
+    statements.push_back(std::string("pl::apply(") + arrayOperation(value->token.type) + ", " + target + ", " +
+                         leftCode + ", " + rightCode + ", " + std::to_string(line) + ");");
+}
+
+// An operand of an array operation: a number, an array, or a temporary holding an array expression
+std::string CodeGenerator::generateArrayOperandCode(const std::shared_ptr<ASTNode>& operand, int line,
+                                                    std::vector<std::string>& statements) {
+    const ASTNode* array = findArrayOperand(operand);
+    if (!array) return generateKeptCode(operand);
+    if (operand->type == ASTNodeType::ARRAY_REFERENCE) return operand->token.lexeme;
+
+    // The temporary is named after an array of the expression for length errors
+    std::string temporary = "pl_t" + std::to_string(++temporaries);
+    const std::string& name = array->token.lexeme;
+    statements.push_back("pl::Array " + temporary + "(\"" + name + "\", " + name + ".length(), " +
+                         std::to_string(line) + ");");
+    generateArrayStores(temporary, operand, line, statements);
+    return temporary;
+}
+
+// Whole-array assignment; goes through a temporary when target is read after it is first written
+std::string CodeGenerator::generateArrayAssignmentCode(const std::string& target, const std::shared_ptr<ASTNode>& value,
+                                                       int line) {
+    std::vector<std::string> statements;
+    if (overwritesOperand(*value, target)) {
+        std::string temporary = "pl_t" + std::to_string(++temporaries);
+        statements.push_back("pl::Array " + temporary + "(\"" + target + "\", " + target + ".length(), " +
+                             std::to_string(line) + ");");
+        generateArrayStores(temporary, value, line, statements);
+        statements.push_back(target + ".swap(" + temporary + ");");
+    } else {
+        generateArrayStores(target, value, line, statements);
+    }
+    if (statements.empty()) return ";\n"; // a <- a
+    if (statements.size() == 1) return statements[0] + "\n";
+
+    // Temporaries live in a block of their own
+    std::stringstream code;
+    code << "{\n";
+    indentLevel++;
+    for (const auto& statement : statements) code << getIndent() << statement << "\n";
+    indentLevel--;
+    code << getIndent() << "}\n";
     return code.str();
+}
+
+// An array expression used as a value, e.g. by put or sum; one that is not just an array is
+// computed by a lambda that returns its temporary
+std::string CodeGenerator::generateArrayValueCode(const std::shared_ptr<ASTNode>& value, int line) {
+    if (value->type == ASTNodeType::ARRAY_REFERENCE) return value->token.lexeme;
+    std::vector<std::string> statements;
+    std::string temporary = generateArrayOperandCode(value, line, statements);
+    std::string code = "[&] {";
+    for (const auto& statement : statements) code += " " + statement;
+    return code + " return " + temporary + "; }()";
 }
\ No newline at end of file
@@ -1,33 +1,231 @@
 #pragma once
 #include <string>
+#include <map>
 #include <memory>
+#include <set>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "parser.h"
 #include "expression_parser.h"
 #include "statement_parser.h"
 #include "symbol_table.h"
+#include "perf_counters.h"
+#include "memory_stats.h"
+#include "profile.h"
+#include "common_subexpressions.h"
+#include "race_analysis.h"
+#include "range_analysis.h"
+
+// Language of the generated program. C programs use a small runtime of their own
+// instead of the C++ one, so arrays, channels and tasks are C++ only, and their
+// parallel loops run sequentially.
+enum class CodeTarget {
+    CPP,
+    C
+};
 
 class CodeGenerator {
 private:
     int indentLevel = 0;
     std::string getIndent() const;
     std::unordered_map<std::string, bool> declaredVariables;
+    PerfBreakdown* perfBreakdown = nullptr;
+    AllocationBreakdown* allocationBreakdown = nullptr;
+    bool instrumented = false;
+    bool checked = false;
+    bool partialEvaluation = true;
+    CheckedArithmetic arithmetic;                        // Widths and checks of the program, when checked
+    int statementLine = 0;                               // Line of the statement being generated, for checks
+    CodeTarget target = CodeTarget::CPP;
+    std::vector<ProfileSite> profileSites;
+    const Profile* profile = nullptr;
+    std::unordered_set<const ASTNode*> hotCalls;         // Calls that go to an inlined copy
+    std::unordered_set<std::string> inlinedProcedures;   // Procedures with an inlined copy
+    ProcedureEffectsMap procedureEffects;                // Procedures planned so far, for finding pure ones
+    const ProcedureEffectsMap* sharedEffects = nullptr;  // The parser's, used instead when set
+    std::unordered_set<std::string> memoizedProcedures;  // Procedures whose results are cached
+    bool coreRuntimeEmitted = false;
+    bool arrayRuntimeEmitted = false;
+    bool parallelRuntimeEmitted = false;
+    bool taskRuntimeEmitted = false;
+    bool memoRuntimeEmitted = false;
+    bool checkedRuntimeEmitted = false;
+    std::string runtimeHeader;                           // Path of a header with the whole runtime, if set
+    std::string markedSource;                            // Source name in #line markers, escaped; empty for none
+    std::map<int, int> lineColumns;                      // Marked line -> column of its first statement
+    bool recordingLineColumns = true;                    // Off when lineColumns would grow with the input
+    int temporaries = 0;                                 // Numbers the pl_ names of generated locals
+    std::unordered_map<const ASTNode*, std::string> commonTemporaries; // Repeated expressions -> local with their value
+    std::set<std::pair<std::string, std::string>> uncheckedIndexes; // (array, index variable) proven in bounds
+
+    // Tail calls of the procedure being generated to itself, which jump back to the start of its body
+    struct TailCalls {
+        std::unordered_set<const ASTNode*> calls;
+        std::vector<std::string> parameters;
+        size_t site = 0; // Profile site of the procedure, when instrumented
+    };
+    TailCalls tailCalls;
+
+    // A local of the generator being generated, in scope where a yield may be. It is kept in a
+    // member of the generator's state while the generator waits for its next call.
+    struct GeneratorLocal {
+        std::string name;
+        std::string type;
+        std::string member; // Empty until a yield needs it
+    };
+    // The generator being generated
+    struct Generator {
+        bool active = false;
+        std::vector<std::string> members;      // "type name" of each member after pl_resume
+        std::vector<GeneratorLocal> locals;    // In scope, innermost last
+        int resumePoints = 0;
+    };
+    Generator generator;
+
+    // A constant a statement stored in a variable, so a loop right after it knows where its variable starts
+    struct ConstantStore {
+        std::string variable; // Empty when the statement stored no constant
+        long long value = 0;
+    };
+    ConstantStore precedingStore;     // Store made by the statement before the one being generated
+    ConstantStore previousMainStore;  // Store made by the last top-level statement of main
+
+    // A loop that steps one variable: every for loop, and while loops of the form
+    // "while i < bound loop ... i <- i + c; end loop;" with no other assignment to i
+    struct CountedLoop {
+        const ASTNode* node;
+        std::string variable;
+        std::shared_ptr<ASTNode> start;      // for loops only; a while loop goes on from the variable's value
+        std::shared_ptr<ASTNode> bound;
+        std::shared_ptr<ASTNode> step;       // for loops with a step that is not constant
+        long long stepValue = 1;             // The step when it is constant
+        bool inclusive = true;               // Runs while variable <= bound (>= for a negative step)
+        std::shared_ptr<ASTNode> body;       // For while loops, without the final increment
+    };
+
+    // One arm of an if statement; the else arm has no condition
+    struct IfArm {
+        std::shared_ptr<ASTNode> condition;
+        std::shared_ptr<ASTNode> block;
+        const Token* token;
+        ProfileSiteKind kind;
+        uint64_t taken = 0;
+        int expected = -1;                   // 1 when the profile has it almost always taken, 0 almost never
+    };
+
+    std::string generateNodeCode(const std::shared_ptr<ASTNode>& node);
+    size_t addProfileSite(ProfileSiteKind kind, const Token& token);
+    std::string profileSiteCode(size_t site) const;
+    void planInlining(const std::shared_ptr<ASTNode>& program);
+    void applyBranchProfile(std::vector<IfArm>& arms) const;
+    std::string generateSwitchCode(const std::vector<IfArm>& arms);
+    std::string generateArmSearchCode(const std::string& variable,
+                                      const std::vector<std::pair<long long, size_t>>& cases, size_t begin, size_t end);
+    void generateArrayStores(const std::string& target, const std::shared_ptr<ASTNode>& value, int line,
+                             std::vector<std::string>& statements);
+    std::string generateArrayOperandCode(const std::shared_ptr<ASTNode>& operand, int line,
+                                         std::vector<std::string>& statements);
+    std::string generateArrayAssignmentCode(const std::string& target, const std::shared_ptr<ASTNode>& value, int line);
+    std::string generateArrayValueCode(const std::shared_ptr<ASTNode>& value, int line);
+    bool matchCountedWhile(const std::shared_ptr<ASTNode>& node, CountedLoop& loop) const;
+    CountedLoop makeCountedFor(const std::shared_ptr<ASTNode>& node) const;
+    bool countTrips(const CountedLoop& loop, long long& trips, long long& start) const;
+    std::vector<std::string> findUncheckedArrays(const CountedLoop& loop) const;
+    std::string generateCountedLoopCode(const CountedLoop& loop);
+    std::string generateCountedLoopHeader(const CountedLoop& loop, const std::string& start, const std::string& bound,
+                                          std::string& setVariable,
+                                          std::vector<std::pair<std::string, std::string>>* locals = nullptr);
+    std::string generateUnrolledLoopCode(const CountedLoop& loop, long long trips, long long start);
+    std::string generateTemporariesCode(const CommonSubexpressions& plan, size_t statement);
+    std::string integerType(bool wide) const;
+    std::string generateCheckedOperationCode(const std::shared_ptr<ASTNode>& node, bool wide);
+    std::string generateKeptCode(const std::shared_ptr<ASTNode>& value, const ASTNode* site = nullptr);
+    void declareGeneratorLocal(const std::string& name, const std::string& type);
+    std::string generateYieldingBlockCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateYieldingWhileCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateYieldingIfCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateYieldingForCode(const std::shared_ptr<ASTNode>& node);
 public:
     CodeGenerator() = default;
+
+    // Charge hardware counters to the node type being generated (keyed by ASTNodeType)
+    void setPerfBreakdown(PerfBreakdown* breakdown) { perfBreakdown = breakdown; }
+
+    // Charge heap allocations to the node type being generated (keyed by ASTNodeType)
+    void setAllocationBreakdown(AllocationBreakdown* breakdown) { allocationBreakdown = breakdown; }
+
+    // Count procedure calls, loop trips and branches, and time procedures and loops, in the generated program
+    void setInstrumented(bool enabled) { instrumented = enabled; }
+
+    // Stop the generated program on integer overflow and division by zero, computing in 64 bits
+    // what may not fit in 32; see analyzeRanges for which operations are checked
+    void setChecked(bool enabled) { checked = enabled; }
+
+    // Run what the main program computes without input at compile time; see evaluatePartially
+    void setPartialEvaluation(bool enabled) { partialEvaluation = enabled; }
+
+    // Find pure procedures in the effects the parser recorded, which must hold every procedure
+    // before it is planned, instead of analyzing them again into a map of the generator's own
+    void shareProcedureEffects(const ProcedureEffectsMap* effects) { sharedEffects = effects; }
+
+    // Generate C99 instead of C++; see reportCTargetErrors for what it cannot express
+    void setTarget(CodeTarget target) { this->target = target; }
+
+    // Use counts from an instrumented run to order branches, mark likely arms and inline hot calls
+    void setProfile(const Profile* profile) { this->profile = profile; }
+
+    // Include the whole runtime from a header, usually precompiled, instead of emitting the parts a program uses
+    void setRuntimeHeader(const std::string& path) { runtimeHeader = path; }
+
+    // Put a #line marker before every statement, so the C++ compiler reports errors at lines of sourceName.
+    // Without recordColumns, getLineColumns stays empty and errors are reported at column 1.
+    void setLineMarkers(const std::string& sourceName, bool recordColumns = true);
+
+    // Column of the first statement on each marked line
+    const std::map<int, int>& getLineColumns() const { return lineColumns; }
     
     // Main code generation method
     std::string generateCode(const std::shared_ptr<ASTNode>& node);
     
     // Helper methods for specific node types
     std::string generateProgramCode(const std::shared_ptr<ASTNode>& node);
+    std::string generatePreludeCode();
+    std::string generateLineMarker(const Token& token);
+    std::string generateRuntimeCode(const std::shared_ptr<ASTNode>& node);
+    void planMemoization(const std::shared_ptr<ASTNode>& node);
+    std::string generateGlobalDeclarationCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateMainBeginCode();
+    std::string generateMainStatementCode(const std::shared_ptr<ASTNode>& node,
+                                          const CommonSubexpressions* plan = nullptr, size_t index = 0);
+    std::string generateMainEndCode();
     std::string generateDeclarationCode(const std::shared_ptr<ASTNode>& node);
     std::string generateAssignmentCode(const std::shared_ptr<ASTNode>& node);
     std::string generateIfStatementCode(const std::shared_ptr<ASTNode>& node);
     std::string generateWhileStatementCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateForStatementCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateParallelForCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateSpawnStatementCode(const std::shared_ptr<ASTNode>& node);
     std::string generatePutStatementCode(const std::shared_ptr<ASTNode>& node);
     std::string generateBinaryOpCode(const std::shared_ptr<ASTNode>& node);
     std::string generateProcedureCode(const std::shared_ptr<ASTNode>& node);
     std::string generateProcedureCallCode(const std::shared_ptr<ASTNode>& node);
     std::string generateBlockCode(const std::shared_ptr<ASTNode>& node);
     std::string generateReturnStatementCode(const std::shared_ptr<ASTNode>& node);
-};
\ No newline at end of file
+    std::string generateTailCallCode(const std::shared_ptr<ASTNode>& call);
+    std::string generateMemoCode(const std::string& name, const std::vector<std::string>& parameters);
+    std::string generateGeneratorCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateForEachCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateYieldCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateArrayDeclarationCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateChannelDeclarationCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateIndexCode(const std::shared_ptr<ASTNode>& node);
+    std::string generateArrayFunctionCode(const std::shared_ptr<ASTNode>& node);
+};
+
+// Report the statements of a program that need the C++ runtime, which the C target does not have
+void reportCTargetErrors(const std::shared_ptr<ASTNode>& node, Diagnostics& diagnostics);
+
+// Report the recursive calls of a program's procedures that stay calls, because they are not
+// returned directly, are inside a loop or are made by a procedure that spawns tasks
+void reportRecursiveCalls(const std::shared_ptr<ASTNode>& node, Diagnostics& diagnostics);
\ No newline at end of file
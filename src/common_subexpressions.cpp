@@ -0,0 +1,244 @@
+#include "common_subexpressions.h"
+#include <memory_resource>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Check if a statement or expression can change variables it does not name: calls, channels and tasks
+bool hasEffects(const ASTNode& node) {
+    switch (node.type) {
+        case ASTNodeType::PROCEDURE_CALL:
+        case ASTNodeType::RECEIVE:
+        case ASTNodeType::SEND_STATEMENT:
+        case ASTNodeType::SPAWN_STATEMENT:
+        case ASTNodeType::SYNC_STATEMENT:
+        case ASTNodeType::PARALLEL_FOR_STATEMENT:
+            return true;
+        default:
+            break;
+    }
+    for (const auto& child : node.children) {
+        if (child && hasEffects(*child)) return true;
+    }
+    return false;
+}
+
+// Add the variables a statement and the statements in it assign or declare
+void collectAssigned(const ASTNode& node, std::pmr::unordered_set<std::string_view>& names) {
+    if ((node.type == ASTNodeType::ASSIGNMENT && node.children[0]->type == ASTNodeType::IDENTIFIER) ||
+        node.type == ASTNodeType::DECLARATION || node.type == ASTNodeType::FOR_STATEMENT) {
+        names.insert(node.children[0]->token.lexeme);
+    }
+    for (const auto& child : node.children) {
+        if (child) collectAssigned(*child, names);
+    }
+}
+
+const size_t none = static_cast<size_t>(-1);
+
+// Walks the statements in order, keeping the expressions whose value is still known
+class Planner {
+public:
+    Planner(size_t statementCount, std::pmr::memory_resource* memory)
+        : statementCount(statementCount), expressions(memory), readers(memory), known(memory), byVariable(memory),
+          computed(memory), dropped(memory) {}
+    void visit(const ASTNode& statement, size_t index);
+    CommonSubexpressions finish();
+
+private:
+    struct Expression {
+        std::shared_ptr<ASTNode> node;
+        size_t firstReader = none; // Expressions with this one as an operand
+        size_t uses = 0;           // Times it was met again while known
+    };
+    // An expression with a variable or another expression as an operand, in a list of those
+    struct Reader {
+        size_t expression;
+        size_t next;
+    };
+    // An expression to compute or drop before a statement
+    struct Step {
+        size_t statement;
+        size_t expression;
+    };
+
+    bool walk(const std::shared_ptr<ASTNode>& node, size_t statement, size_t& expression);
+    void addReader(size_t& list, size_t expression);
+    void drop(std::string_view variable, size_t statement);
+    void dropExpression(size_t expression, size_t statement);
+    void dropAll(size_t statement);
+
+    size_t statementCount;
+    std::pmr::vector<Expression> expressions;
+    std::pmr::vector<Reader> readers;
+    std::pmr::unordered_map<const ASTNode*, size_t> known;        // Node -> expression holding its value
+    std::pmr::unordered_map<std::string_view, size_t> byVariable; // Expressions with the variable as an operand
+    std::pmr::vector<Step> computed;
+    std::pmr::vector<Step> dropped;
+};
+
+// Note what a statement computes and which known values it makes stale. The condition of an if
+// is computed where the if is; loops compute theirs again after the body, so they only drop.
+void Planner::visit(const ASTNode& statement, size_t index) {
+    std::pmr::unordered_set<std::string_view> assigned(known.get_allocator().resource());
+    size_t expression;
+    switch (statement.type) {
+        case ASTNodeType::ASSIGNMENT:
+        case ASTNodeType::DECLARATION:
+        case ASTNodeType::PUT_STATEMENT:
+        case ASTNodeType::RETURN_STATEMENT:
+            if (hasEffects(statement)) {
+                dropAll(index);
+                return;
+            }
+            for (const auto& child : statement.children) {
+                if (child) walk(child, index, expression);
+            }
+            if (statement.type == ASTNodeType::DECLARATION ||
+                (statement.type == ASTNodeType::ASSIGNMENT &&
+                 statement.children[0]->type == ASTNodeType::IDENTIFIER)) {
+                drop(statement.children[0]->token.lexeme, index + 1);
+            }
+            return;
+        case ASTNodeType::IF_STATEMENT:
+            if (hasEffects(*statement.children[0])) {
+                dropAll(index);
+                return;
+            }
+            walk(statement.children[0], index, expression);
+            if (known.empty()) return;
+            if (hasEffects(statement)) {
+                dropAll(index + 1);
+                return;
+            }
+            collectAssigned(statement, assigned);
+            for (const auto& name : assigned) drop(name, index + 1);
+            return;
+        case ASTNodeType::WHILE_STATEMENT:
+        case ASTNodeType::FOR_STATEMENT:
+            if (known.empty()) return;
+            if (hasEffects(statement)) {
+                dropAll(index);
+                return;
+            }
+            collectAssigned(statement, assigned);
+            for (const auto& name : assigned) drop(name, index);
+            return;
+        default:
+            dropAll(index);
+            return;
+    }
+}
+
+// Note the operators of an expression over numbers and scalar variables. An operator already known
+// is a repeat, and what is inside it is not looked at again. expression is set to the one an
+// operator is noted as, and to none for other nodes.
+bool Planner::walk(const std::shared_ptr<ASTNode>& node, size_t statement, size_t& expression) {
+    expression = none;
+    if (node->type == ASTNodeType::NUMBER || node->type == ASTNodeType::IDENTIFIER) return true;
+    if (node->type != ASTNodeType::BINARY_OP) {
+        for (const auto& child : node->children) {
+            size_t unused;
+            if (child) walk(child, statement, unused);
+        }
+        return false;
+    }
+
+    auto found = known.find(node.get());
+    if (found != known.end()) {
+        expression = found->second;
+        expressions[expression].uses++;
+        return true;
+    }
+    size_t operands[2];
+    bool leftPure = walk(node->children[0], statement, operands[0]);
+    bool rightPure = walk(node->children[1], statement, operands[1]);
+    if (!leftPure || !rightPure) return false;
+
+    expression = expressions.size();
+    expressions.push_back({node});
+    for (size_t i = 0; i < 2; i++) {
+        if (operands[i] != none) {
+            addReader(expressions[operands[i]].firstReader, expression);
+        } else if (node->children[i]->type == ASTNodeType::IDENTIFIER) {
+            auto list = byVariable.emplace(node->children[i]->token.lexeme, none).first;
+            addReader(list->second, expression);
+        }
+    }
+    known[node.get()] = expression;
+    computed.push_back({statement, expression});
+    return true;
+}
+
+// Put an expression at the head of a list of readers
+void Planner::addReader(size_t& list, size_t expression) {
+    readers.push_back({expression, list});
+    list = readers.size() - 1;
+}
+
+// Forget the known expressions that read a variable, from a statement on
+void Planner::drop(std::string_view variable, size_t statement) {
+    auto list = byVariable.find(variable);
+    if (list == byVariable.end()) return;
+    for (size_t reader = list->second; reader != none; reader = readers[reader].next) {
+        dropExpression(readers[reader].expression, statement);
+    }
+    byVariable.erase(list);
+}
+
+// Forget a known expression and those computed from it, from a statement on
+void Planner::dropExpression(size_t expression, size_t statement) {
+    auto found = known.find(expressions[expression].node.get());
+    if (found == known.end() || found->second != expression) return;
+    known.erase(found);
+    if (statement < statementCount) dropped.push_back({statement, expression});
+    for (size_t reader = expressions[expression].firstReader; reader != none; reader = readers[reader].next) {
+        dropExpression(readers[reader].expression, statement);
+    }
+}
+
+// Forget every known expression, from a statement on
+void Planner::dropAll(size_t statement) {
+    if (statement < statementCount) {
+        for (const auto& entry : known) dropped.push_back({statement, entry.second});
+    }
+    known.clear();
+    byVariable.clear();
+}
+
+// The expressions that were met again, renumbered. Nothing is allocated when there are none.
+CommonSubexpressions Planner::finish() {
+    CommonSubexpressions plan;
+    std::pmr::vector<size_t> renumbered(expressions.size(), expressions.get_allocator());
+    for (size_t id = 0; id < expressions.size(); id++) {
+        if (expressions[id].uses == 0) continue;
+        renumbered[id] = plan.expressions.size();
+        plan.expressions.push_back(expressions[id].node);
+    }
+    if (plan.expressions.empty()) return plan;
+    plan.computed.resize(statementCount);
+    plan.dropped.resize(statementCount);
+    for (const Step& step : computed) {
+        if (expressions[step.expression].uses > 0) plan.computed[step.statement].push_back(renumbered[step.expression]);
+    }
+    for (const Step& step : dropped) {
+        if (expressions[step.expression].uses > 0) plan.dropped[step.statement].push_back(renumbered[step.expression]);
+    }
+    return plan;
+}
+
+}
+
+// Find the repeated expressions of statements that run one after the other. Most blocks are short,
+// so the tables of the search usually fit on the stack.
+CommonSubexpressions findCommonSubexpressions(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+    char buffer[4096];
+    std::pmr::monotonic_buffer_resource memory(buffer, sizeof(buffer));
+    Planner planner(statements.size(), &memory);
+    for (size_t index = 0; index < statements.size(); index++) {
+        if (statements[index]) planner.visit(*statements[index], index);
+    }
+    return planner.finish();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "parser.h"
+
+// Expressions a run of statements computes more than once, to be computed once
+// into a temporary. The parser makes a repeated expression over numbers and
+// scalar variables one shared node, so a repeat is that node met again while
+// none of its variables has been assigned since. Calls, channels and tasks may
+// assign any variable, so statements with them end every temporary. When no
+// expression repeats, computed and dropped are left empty.
+struct CommonSubexpressions {
+    std::vector<std::shared_ptr<ASTNode>> expressions; // Each computed into a temporary
+    std::vector<std::vector<size_t>> computed;         // Per statement: expressions to compute before it, operands first
+    std::vector<std::vector<size_t>> dropped;          // Per statement: expressions whose temporary is stale from it on
+};
+
+// Find the repeated expressions of statements that run one after the other, such as those of a
+// block. Statements nested in them, like the arms of an if, are left to the blocks they are in.
+CommonSubexpressions findCommonSubexpressions(const std::vector<std::shared_ptr<ASTNode>>& statements);
@@ -0,0 +1,575 @@
+#include "compile_server.h"
+#include "compiler.h"
+#include "runtime.h"
+#include "toolchain.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t maximumCachedCompiles = 256;
+
+// Name the #line markers give the source, which is all g++ sees of it
+const char* const markedSourceName = "source.pseudo";
+
+// One end of a connection. Replies are written whole under the lock, so
+// workers finishing at the same time do not interleave them.
+struct Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+    int fd;
+    std::mutex writing;
+};
+
+// A compile request
+struct Job {
+    std::shared_ptr<Connection> connection;
+    std::string id;
+    bool isPath = false;     // The input is the path of the source rather than the source
+    std::string input;
+    std::string binaryPath;  // Empty to get the C++ back instead
+    CodeTarget target = CodeTarget::CPP;
+    bool staticBinary = false;
+    bool checked = false;
+    bool partialEvaluation = true;
+};
+
+// What compiling one source produced, kept for later requests with the same source
+struct CompileResult {
+    ~CompileResult() {
+        if (!binary.empty()) std::remove(binary.c_str());
+    }
+    bool failed = false;
+    std::string cpp;
+    std::string diagnostics;
+    std::string binary;      // A built copy in the work directory, empty until one is built
+    std::map<int, int> lineColumns;
+};
+
+// Write all of data; false when the peer is gone
+bool writeAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t written = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        sent += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Reads header lines and counted bytes from a socket through a buffer
+class SocketReader {
+public:
+    explicit SocketReader(int fd) : fd(fd) {}
+
+    // Next line without its newline; false at the end of the stream
+    bool readLine(std::string& line) {
+        while (true) {
+            size_t end = buffer.find('\n', position);
+            if (end != std::string::npos) {
+                line.assign(buffer, position, end - position);
+                position = end + 1;
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    }
+
+    // Exactly count bytes
+    bool readBytes(size_t count, std::string& bytes) {
+        while (buffer.size() - position < count) {
+            if (!fill()) return false;
+        }
+        bytes.assign(buffer, position, count);
+        position += count;
+        return true;
+    }
+
+private:
+    int fd;
+    std::string buffer;
+    size_t position = 0;
+
+    // Append what the socket has, dropping what was already read
+    bool fill() {
+        char chunk[65536];
+        ssize_t received;
+        do {
+            received = recv(fd, chunk, sizeof(chunk), 0);
+        } while (received < 0 && errno == EINTR);
+        if (received <= 0) return false;
+        buffer.erase(0, position);
+        position = 0;
+        buffer.append(chunk, static_cast<size_t>(received));
+        return true;
+    }
+};
+
+// Send a reply to a compile request
+void sendReply(Connection& connection, const std::string& id, const char* outcome, const std::string& cpp,
+               const std::string& diagnostics) {
+    std::string header = "result " + id + " " + outcome + " " + std::to_string(cpp.size()) + " " +
+                         std::to_string(diagnostics.size()) + "\n";
+    std::lock_guard<std::mutex> lock(connection.writing);
+    writeAll(connection.fd, header) && writeAll(connection.fd, cpp) && writeAll(connection.fd, diagnostics);
+}
+
+// Whole contents of a file
+bool readFile(const std::string& path, std::string& contents) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Address of a Unix socket; false when the path does not fit
+bool socketAddress(const std::string& path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Socket connected to the server at path, or -1
+int connectTo(const std::string& path) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+class CompileServer {
+public:
+    explicit CompileServer(const ServerOptions& options) : options(options) {}
+
+    // Precompile the runtime header, listen on the socket and start the compile threads
+    bool start(std::string& error);
+
+    // Give each connection a thread that queues its requests, until the socket is shut down
+    void acceptConnections();
+
+    // Stop listening and remove the socket and the work directory
+    void stop();
+
+private:
+    ServerOptions options;
+    std::string workDirectory;
+    std::string runtimeHeader;
+    int listener = -1;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<Job> queue;
+
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, std::shared_ptr<CompileResult>> cache; // By output kind, options and source
+    std::deque<std::string> cacheOrder;                                   // Keys, oldest first
+    std::atomic<unsigned> builds{0};
+
+    void readRequests(std::shared_ptr<Connection> connection);
+    void runJobs();
+    void compile(CompilerContext& context, Job& job);
+    std::shared_ptr<CompileResult> translate(CompilerContext& context, const Job& job, const std::string& source,
+                                             bool building);
+    bool build(const std::shared_ptr<CompileResult>& result, const Job& job, std::string& binary,
+               std::string& compilerOutput);
+};
+
+// Precompile the runtime header, listen on the socket and start the compile threads
+bool CompileServer::start(std::string& error) {
+    char directory[] = "/tmp/pseudo-server-XXXXXX";
+    if (!mkdtemp(directory)) {
+        error = std::string("Could not create a work directory: ") + std::strerror(errno);
+        return false;
+    }
+    workDirectory = directory;
+
+    // Programs include the whole runtime, which g++ then loads from the .gch instead of parsing it
+    runtimeHeader = workDirectory + "/pl_runtime.h";
+    {
+        std::ofstream header(runtimeHeader);
+        header << generateRuntimeHeader();
+        if (!header) {
+            error = "Could not write " + runtimeHeader;
+            return false;
+        }
+    }
+    // g++ only uses the .gch for compiles with the same flags, -pthread as in compilerArguments
+    Process precompile;
+    precompile.setTimeout(options.compileTimeout);
+    if (!precompile.start({"g++", "-x", "c++-header", runtimeHeader, "-o", runtimeHeader + ".gch", "-pthread"},
+                          error)) {
+        return false;
+    }
+    ProcessResult precompiled = precompile.wait();
+    if (!precompiled.succeeded()) {
+        error = "Could not precompile the runtime header\n" + precompiled.errorOutput;
+        return false;
+    }
+
+    sockaddr_un address;
+    if (!socketAddress(options.socketPath, address)) {
+        error = "Socket path too long: " + options.socketPath;
+        return false;
+    }
+    // A socket file nobody answers on was left by a server that did not stop cleanly
+    int running = connectTo(options.socketPath);
+    if (running >= 0) {
+        close(running);
+        error = "A server is already listening on " + options.socketPath;
+        return false;
+    }
+    unlink(options.socketPath.c_str());
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        error = "Could not listen on " + options.socketPath + ": " + std::strerror(errno);
+        return false;
+    }
+
+    unsigned workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < workers; i++) {
+        std::thread(&CompileServer::runJobs, this).detach();
+    }
+    return true;
+}
+
+// Give each connection a thread that queues its requests, until the socket is shut down
+void CompileServer::acceptConnections() {
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EBADF || errno == EINVAL) return;
+            continue;
+        }
+        std::thread(&CompileServer::readRequests, this, std::make_shared<Connection>(fd)).detach();
+    }
+}
+
+// Stop listening and remove the socket and the work directory
+void CompileServer::stop() {
+    if (listener >= 0) {
+        shutdown(listener, SHUT_RDWR);
+        unlink(options.socketPath.c_str());
+    }
+    if (!workDirectory.empty()) {
+        std::error_code ignored;
+        std::filesystem::remove_all(workDirectory, ignored);
+    }
+}
+
+// Queue the requests of a connection until the client closes it. The
+// connection stays open until the replies to its queued requests are sent.
+void CompileServer::readRequests(std::shared_ptr<Connection> connection) {
+    SocketReader reader(connection->fd);
+    std::string line;
+    while (reader.readLine(line)) {
+        std::istringstream fields(line);
+        std::string command;
+        std::string kind;
+        size_t inputSize = 0;
+        size_t pathSize = 0;
+        Job job;
+        bool valid = (fields >> command >> job.id >> kind >> inputSize >> pathSize) && command == "compile" &&
+                     (kind == "path" || kind == "source");
+        std::string option;
+        while (valid && fields >> option) {
+            if (option == "target=c") {
+                job.target = CodeTarget::C;
+            } else if (option == "static") {
+                job.staticBinary = true;
+            } else if (option == "checked") {
+                job.checked = true;
+            } else if (option == "no-partial-evaluation") {
+                job.partialEvaluation = false;
+            } else {
+                valid = false;
+            }
+        }
+        valid = valid && (!job.staticBinary || job.target == CodeTarget::C);
+        if (!valid || !reader.readBytes(inputSize, job.input) || !reader.readBytes(pathSize, job.binaryPath)) {
+            std::lock_guard<std::mutex> lock(connection->writing);
+            writeAll(connection->fd, "error malformed request\n");
+            return;
+        }
+        job.isPath = kind == "path";
+        job.connection = connection;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(std::move(job));
+        }
+        queueReady.notify_one();
+    }
+}
+
+// Compile queued requests, one at a time per thread, reusing the thread's context
+void CompileServer::runJobs() {
+    CompilerContext context;
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this] { return !queue.empty(); });
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        // Whatever the compiler throws fails the request, not the server
+        try {
+            compile(context, job);
+        } catch (const std::exception& exception) {
+            sendReply(*job.connection, job.id, "error", "", std::string("Error: ") + exception.what() + "\n");
+        }
+    }
+}
+
+// Compile a request and reply with the C++ or the outcome of building it
+void CompileServer::compile(CompilerContext& context, Job& job) {
+    std::string source;
+    if (job.isPath) {
+        if (!readFile(job.input, source)) {
+            sendReply(*job.connection, job.id, "failed", "", "Error: Could not open file " + job.input + "\n");
+            return;
+        }
+    } else {
+        source = std::move(job.input);
+    }
+
+    bool building = !job.binaryPath.empty();
+    std::shared_ptr<CompileResult> result = translate(context, job, source, building);
+    if (!building || result->failed) {
+        sendReply(*job.connection, job.id, result->failed ? "failed" : "ok", building ? "" : result->cpp,
+                  result->diagnostics);
+        return;
+    }
+
+    std::string binary;
+    std::string compilerOutput;
+    if (!build(result, job, binary, compilerOutput)) {
+        sendReply(*job.connection, job.id, "failed", "",
+                  result->diagnostics + compilerOutput + "Error: Could not compile the generated " +
+                      (job.target == CodeTarget::C ? "C" : "C++") + " code\n");
+        return;
+    }
+    // Replace rather than overwrite, as the old binary may be running
+    std::error_code error;
+    std::filesystem::remove(job.binaryPath, error);
+    std::filesystem::copy_file(binary, job.binaryPath, error);
+    if (error) {
+        sendReply(*job.connection, job.id, "failed", "",
+                  result->diagnostics + "Error: Could not write " + job.binaryPath + ": " + error.message() + "\n");
+        return;
+    }
+    sendReply(*job.connection, job.id, "ok", "", result->diagnostics + compilerOutput);
+}
+
+// Diagnostics and C++ for a source, from the cache when it was compiled before with the
+// same options. C++ for building includes the precompiled runtime header instead of the runtime.
+std::shared_ptr<CompileResult> CompileServer::translate(CompilerContext& context, const Job& job,
+                                                        const std::string& source, bool building) {
+    std::string key = std::string(building ? "b" : "c") + (job.target == CodeTarget::C ? "c" : "+") +
+                      (job.staticBinary ? "s" : "-") + (job.checked ? "k" : "-") + (job.partialEvaluation ? "e" : "-") + source;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto found = cache.find(key);
+        if (found != cache.end()) return found->second;
+    }
+
+    auto result = std::make_shared<CompileResult>();
+    CompileOptions compileOptions;
+    compileOptions.target = job.target;
+    compileOptions.checked = job.checked;
+    compileOptions.partialEvaluation = job.partialEvaluation;
+    if (building) {
+        compileOptions.runtimeHeader = runtimeHeader;
+        compileOptions.sourceName = markedSourceName;
+    }
+    context.setOptions(compileOptions);
+    result->failed = !context.compile(source);
+    std::ostringstream rendered;
+    context.getDiagnostics().render(rendered, DiagnosticFormat::TEXT);
+    result->diagnostics = rendered.str();
+    result->cpp = context.getCpp();
+    result->lineColumns = context.getLineColumns();
+
+    // Keep the newest results; an evicted one's binary goes when its last request is done with it
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cache.emplace(key, result).second) {
+        cacheOrder.push_back(key);
+        if (cacheOrder.size() > maximumCachedCompiles) {
+            cache.erase(cacheOrder.front());
+            cacheOrder.pop_front();
+        }
+    }
+    return result;
+}
+
+// Path of the program built from a result, building it with g++ (or gcc for C) the first time
+bool CompileServer::build(const std::shared_ptr<CompileResult>& result, const Job& job, std::string& binary,
+                          std::string& compilerOutput) {
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (!result->binary.empty()) {
+            binary = result->binary;
+            return true;
+        }
+    }
+
+    // g++ reads the C++ from a pipe; its messages about PseudoLang lines are rendered like the parser's
+    std::string base = workDirectory + "/job" + std::to_string(++builds);
+    ProgramBuild build("-", base, job.staticBinary ? staticFlags() : std::vector<std::string>(),
+                       options.compileTimeout, job.target == CodeTarget::C ? "c" : "c++");
+    std::string error;
+    if (!build.start(error)) {
+        compilerOutput = "Error: " + error + "\n";
+        return false;
+    }
+    build.input() << result->cpp;
+    Diagnostics mapped;
+    std::string unmapped;
+    bool built = build.finish(markedSourceName, result->lineColumns, mapped, unmapped);
+    std::ostringstream rendered;
+    mapped.render(rendered, DiagnosticFormat::TEXT);
+    compilerOutput = rendered.str() + unmapped;
+    if (!built) return false;
+
+    // Two requests for the same source may both have built it; keep the first
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (result->binary.empty()) {
+        result->binary = base;
+    } else {
+        std::remove(base.c_str());
+    }
+    binary = result->binary;
+    return true;
+}
+
+}
+
+// Serve until SIGINT, SIGTERM or SIGHUP
+int runServer(const ServerOptions& options) {
+    // Block the signals in every thread, so they reach sigwait below
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    // Never destroyed, as its threads run until the process exits
+    CompileServer* server = new CompileServer(options);
+    std::string error;
+    if (!server->start(error)) {
+        server->stop();
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+    std::cout << "Serving compiles on " << options.socketPath << std::endl;
+    std::thread(&CompileServer::acceptConnections, server).detach();
+
+    int signal = 0;
+    sigwait(&stopSignals, &signal);
+    server->stop();
+    return 0;
+}
+
+// Compile files through a server, all in flight at once
+int runClient(const std::string& socketPath, const std::vector<std::string>& files, const ClientOptions& options) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        std::cerr << "Error: Could not connect to a compile server on " << socketPath << "\n";
+        return 1;
+    }
+    Connection connection(fd);
+
+    std::string requestOptions;
+    if (options.target == CodeTarget::C) requestOptions += " target=c";
+    if (options.staticBinary) requestOptions += " static";
+    if (options.checked) requestOptions += " checked";
+    if (!options.partialEvaluation) requestOptions += " no-partial-evaluation";
+
+    // Send every request before reading a reply, so the server's threads compile them together
+    std::vector<std::string> binaries;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string kind = "path";
+        std::string input;
+        std::string binary = files.size() == 1 || files[i] == "-" ? options.outputBinary
+                                                                   : std::filesystem::path(files[i]).stem().string();
+        if (files[i] == "-") {
+            kind = "source";
+            input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        } else {
+            input = std::filesystem::absolute(files[i]).string();
+        }
+        std::string binaryPath = std::filesystem::absolute(binary).string();
+        std::string request = "compile " + std::to_string(i) + " " + kind + " " + std::to_string(input.size()) + " " +
+                              std::to_string(binaryPath.size()) + requestOptions + "\n" + input + binaryPath;
+        if (!writeAll(fd, request)) {
+            std::cerr << "Error: The compile server closed the connection\n";
+            return 1;
+        }
+        binaries.push_back(binary);
+    }
+
+    SocketReader reader(fd);
+    int status = 0;
+    for (size_t replies = 0; replies < files.size(); replies++) {
+        std::string line;
+        std::string word;
+        std::string outcome;
+        size_t index = 0;
+        size_t cppSize = 0;
+        size_t diagnosticsSize = 0;
+        std::string cpp;
+        std::string diagnostics;
+        if (!reader.readLine(line)) {
+            std::cerr << "Error: The compile server closed the connection\n";
+            return 1;
+        }
+        std::istringstream fields(line);
+        if (!(fields >> word >> index >> outcome >> cppSize >> diagnosticsSize) || word != "result" ||
+            index >= files.size() || !reader.readBytes(cppSize, cpp) || !reader.readBytes(diagnosticsSize, diagnostics)) {
+            std::cerr << "Error: Unexpected reply from the compile server: " << line << "\n";
+            return 1;
+        }
+
+        if (files.size() > 1 && !diagnostics.empty()) std::cerr << files[index] << ":\n";
+        std::cerr << diagnostics;
+        if (outcome == "ok") {
+            const std::string& binary = binaries[index];
+            std::string command = std::filesystem::path(binary).has_parent_path() ? binary : "./" + binary;
+            std::cout << "Compilation successful! Run the program with '" << command << "'\n";
+        } else {
+            std::cerr << "Error: Could not compile " << files[index] << "\n";
+            status = 1;
+        }
+    }
+    return status;
+}
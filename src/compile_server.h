@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "codegen.h"
+
+// A compile server keeps what every compile needs warm between compiles: the
+// keyword tables, a pool of compile threads with a CompilerContext each, the
+// runtime as a precompiled header and the results of recent compiles. It
+// listens on a Unix socket.
+//
+// A request and its reply are a header line followed by raw bytes, so one
+// connection can have many requests in flight. Replies come back in the order
+// the compiles finish and carry the id of their request:
+//
+//   compile <id> <path|source> <input bytes> <binary path bytes> [options]\n<input><binary path>
+//   result <id> <ok|failed|error> <C++ bytes> <diagnostics bytes>\n<C++><diagnostics>
+//
+// The input is the path of a source file or the source itself. With a binary
+// path the server builds the program there with g++ and the reply has no C++;
+// without one the reply has the C++ a direct compile would write to output.cpp.
+// The diagnostics are the parser's, as text, followed by any g++ output. A
+// request the compiler itself failed on is an error, with the message as its
+// diagnostics; the server goes on with the other requests. The
+// options are any of the words target=c, static, checked and
+// no-partial-evaluation, which compile and build as the flags of the same
+// names do.
+
+// Options of a server started with --server
+struct ServerOptions {
+    std::string socketPath;
+    unsigned workers = 0;        // Compile threads; 0 for one per hardware thread
+    double compileTimeout = 300; // Seconds a g++ run may take
+};
+
+// Serve until SIGINT, SIGTERM or SIGHUP, then remove the socket and the
+// server's files. Returns the exit status.
+int runServer(const ServerOptions& options);
+
+// How a client asks for its files to be built, as the flags of a direct compile
+struct ClientOptions {
+    std::string outputBinary = "output"; // --output, for a single file or standard input
+    CodeTarget target = CodeTarget::CPP; // --target=c
+    bool staticBinary = false;           // --static
+    bool checked = false;                // --checked
+    bool partialEvaluation = true;       // Off with --no-partial-evaluation
+};
+
+// Compile files through the server at socketPath, all requests in flight at
+// once. One file is built as ./output (or --output) like a direct compile,
+// several as their names without the extension; "-" reads a program from
+// standard input and sends its source. Returns the exit status.
+int runClient(const std::string& socketPath, const std::vector<std::string>& files, const ClientOptions& options);
@@ -0,0 +1,106 @@
+#include "compiler.h"
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "trace.h"
+#include <algorithm>
+#include <new>
+
+namespace {
+
+const size_t firstBlockSize = 64 * 1024;
+const std::align_val_t blockAlignment{64};
+
+}
+
+// Give the blocks back
+Arena::~Arena() {
+    for (const Block& block : blocks) {
+        ::operator delete(block.data, blockAlignment);
+    }
+}
+
+// Make every block available again
+void Arena::reset() {
+    current = 0;
+    used = 0;
+}
+
+// Bytes in the blocks
+size_t Arena::getCapacity() const {
+    size_t capacity = 0;
+    for (const Block& block : blocks) capacity += block.size;
+    return capacity;
+}
+
+// Carve bytes from the current block, moving on to the next, or a new one twice the size of the last
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+    while (true) {
+        for (; current < blocks.size(); current++, used = 0) {
+            size_t start = (used + alignment - 1) & ~(alignment - 1);
+            if (start + bytes <= blocks[current].size) {
+                used = start + bytes;
+                return blocks[current].data + start;
+            }
+        }
+        size_t size = std::max(blocks.empty() ? firstBlockSize : blocks.back().size * 2, bytes + alignment);
+        blocks.push_back({static_cast<char*>(::operator new(size, blockAlignment)), size});
+    }
+}
+
+// Lex, parse and generate code, reusing the memory of the last compile
+bool CompilerContext::compile(const std::string& source) {
+    reset();
+    NodeArenaScope scope(arena);
+
+    {
+        TraceScope phase("phase", "lex");
+        try {
+            Lexer(source).tokenize(tokens);
+        } catch (const LexError& error) {
+            // Nothing after an unterminated string or comment is lexed, so there is nothing to parse
+            diagnostics.report(error.code, error.token);
+            return false;
+        }
+        phase.addCount("tokens", tokens.size());
+    }
+
+    {
+        TraceScope phase("phase", "parse");
+        Parser parser(std::move(tokens), diagnostics);
+        program = parser.parse();
+        tokens = std::move(parser.tokens); // Keep the buffer for the next compile
+        if (Tracer::current()) phase.addCount("AST nodes", countNodes(program));
+    }
+    if (!program) return false;
+    // What needs the C++ runtime is not generated at all, rather than left to fail in gcc
+    if (options.target == CodeTarget::C) reportCTargetErrors(program, diagnostics);
+    if (options.reportRecursion) reportRecursiveCalls(program, diagnostics);
+    if (diagnostics.hasErrors()) return false;
+
+    TraceScope phase("phase", "codegen");
+    CodeGenerator generator;
+    generator.setPerfBreakdown(options.perfBreakdown);
+    generator.setAllocationBreakdown(options.allocationBreakdown);
+    generator.setInstrumented(options.instrumented);
+    generator.setProfile(options.profile);
+    generator.setTarget(options.target);
+    generator.setChecked(options.checked);
+    generator.setPartialEvaluation(options.partialEvaluation);
+    if (!options.runtimeHeader.empty()) generator.setRuntimeHeader(options.runtimeHeader);
+    if (!options.sourceName.empty()) generator.setLineMarkers(options.sourceName);
+    cpp = generator.generateCode(program);
+    lineColumns = generator.getLineColumns();
+    phase.addCount("bytes emitted", cpp.size());
+    return true;
+}
+
+// Drop what the last compile produced
+void CompilerContext::reset() {
+    tokens.clear();
+    diagnostics.clear();
+    program.reset();
+    cpp.clear();
+    lineColumns.clear();
+    arena.reset();
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include "codegen.h"
+#include "diagnostics.h"
+#include "token.h"
+
+class Profile;
+
+// Memory handed out by bumping a pointer through large blocks. Freeing does
+// nothing; reset makes all of it available again but keeps the blocks, so
+// compiling programs of similar size stops allocating after the first.
+class Arena : public std::pmr::memory_resource {
+public:
+    Arena() = default;
+    ~Arena() override;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void reset();
+    size_t getCapacity() const;
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0; // Block being handed out
+    size_t used = 0;    // Bytes of it handed out
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+// How a context compiles
+struct CompileOptions {
+    bool instrumented = false;           // Count calls, loop trips and branches, as --instrument
+    const Profile* profile = nullptr;    // Optimize with counts from an instrumented run, as --profile-use
+    std::string runtimeHeader;           // Include the runtime from this header instead of emitting it
+    std::string sourceName;              // Mark statements with #line for this name, so g++ reports their lines
+    CodeTarget target = CodeTarget::CPP; // Generate C, as --target=c; what needs the C++ runtime is an error
+    bool checked = false;                // Stop on integer overflow and division by zero, as --checked
+    bool partialEvaluation = true;       // Run the input-independent main program now; off with --no-partial-evaluation
+    bool reportRecursion = false;        // Report recursive calls, as --report-recursion
+    PerfBreakdown* perfBreakdown = nullptr;             // Hardware counters of codegen per node type, as --perf-counters
+    AllocationBreakdown* allocationBreakdown = nullptr; // Heap use of codegen per node type, as --mem-report
+};
+
+// Compiles PseudoLang source to C++ in memory, for programs that embed the
+// compiler. The memory one compile used (the AST node arena, the token buffer
+// and the diagnostics) is kept for the next, so a context that compiles many
+// programs allocates little. A context is used by one thread at a time; give
+// each thread its own. All contexts share the keyword tables.
+class CompilerContext {
+public:
+    CompilerContext() = default;
+    CompilerContext(const CompilerContext&) = delete;
+    CompilerContext& operator=(const CompilerContext&) = delete;
+
+    void setOptions(const CompileOptions& options) { this->options = options; }
+
+    // Limits and warning settings apply to every later compile
+    Diagnostics& getDiagnostics() { return diagnostics; }
+    const Diagnostics& getDiagnostics() const { return diagnostics; }
+
+    // Compile source to C++. False when it has errors, which the diagnostics
+    // list; an unterminated string or comment is one, and nothing after it is
+    // compiled. The C++ and diagnostics stay valid until the next compile or reset.
+    bool compile(const std::string& source);
+    const std::string& getCpp() const { return cpp; }
+
+    // AST of the last compile, also when it had errors; null when it stopped before parsing
+    const std::shared_ptr<ASTNode>& getProgram() const { return program; }
+
+    // Column of the first statement on each line marked with #line, for mapCompilerMessages
+    const std::map<int, int>& getLineColumns() const { return lineColumns; }
+
+    // Drop what the last compile produced, keeping its memory
+    void reset();
+
+private:
+    CompileOptions options;
+    Arena arena;
+    std::vector<Token> tokens;
+    Diagnostics diagnostics;
+    std::shared_ptr<ASTNode> program; // In the arena, so declared after it to go first
+    std::string cpp;
+    std::map<int, int> lineColumns;
+};
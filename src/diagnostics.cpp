@@ -0,0 +1,258 @@
+#include "diagnostics.h"
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+struct DiagnosticInfo {
+    const char* name;
+    Severity severity;
+    const char* message;
+    bool mentionsToken; // Message is followed by the token's text
+};
+
+// Indexed by DiagnosticCode
+const DiagnosticInfo diagnosticTable[] = {
+    {"extra-semicolon", Severity::WARNING, "Extra semicolon", false},
+    {"expected-assign-or-call", Severity::ERROR, "Expected '<-' or '(' after identifier", false},
+    {"unexpected-token", Severity::ERROR, "Unexpected token: ", true},
+    {"unexpected-token-in-block", Severity::ERROR, "Unexpected token in block: ", true},
+    {"unexpected-token-in-expression", Severity::ERROR, "Unexpected token in expression: ", true},
+    {"undeclared-variable", Severity::ERROR, "Undeclared variable: ", true},
+    {"expected-assign", Severity::ERROR, "Expected '<-' after identifier", false},
+    {"expected-close-paren", Severity::ERROR, "Expected ')'", false},
+    {"expected-right-operand", Severity::ERROR, "Expected right operand after operator", false},
+    {"expected-semicolon-after-declaration", Severity::ERROR, "Expected ';' after declaration", false},
+    {"expected-semicolon-after-assignment", Severity::ERROR, "Expected ';' after assignment", false},
+    {"expected-then-after-if", Severity::ERROR, "Expected 'then' after if condition", false},
+    {"expected-then-after-elseif", Severity::ERROR, "Expected 'then' after elseif condition", false},
+    {"expected-end-if", Severity::ERROR, "Expected 'end if'", false},
+    {"expected-semicolon-after-end-if", Severity::ERROR, "Expected ';' after 'end if'", false},
+    {"expected-loop-after-while", Severity::ERROR, "Expected 'loop' after while condition", false},
+    {"expected-end-loop", Severity::ERROR, "Expected 'end loop'", false},
+    {"expected-semicolon-after-end-loop", Severity::ERROR, "Expected ';' after 'end loop'", false},
+    {"expected-open-paren-after-put", Severity::ERROR, "Expected '(' after put", false},
+    {"expected-close-paren-after-put", Severity::ERROR, "Expected ')' after put expression", false},
+    {"expected-semicolon-after-put", Severity::ERROR, "Expected ';' after put statement", false},
+    {"expected-procedure-after-memo", Severity::ERROR, "Expected 'procedure' after 'memo'", false},
+    {"expected-procedure-name", Severity::ERROR, "Expected procedure name", false},
+    {"expected-open-paren-after-procedure-name", Severity::ERROR, "Expected '(' after procedure name", false},
+    {"expected-parameter-name", Severity::ERROR, "Expected parameter name", false},
+    {"expected-comma-between-parameters", Severity::ERROR, "Expected ',' between parameters", false},
+    {"expected-close-paren-after-parameters", Severity::ERROR, "Expected ')' after parameters", false},
+    {"expected-begin", Severity::ERROR, "Expected 'begin' after procedure header", false},
+    {"expected-end-procedure", Severity::ERROR, "Expected 'end procedure'", false},
+    {"expected-semicolon-after-end-procedure", Severity::ERROR, "Expected ';' after 'end procedure'", false},
+    {"expected-comma-between-arguments", Severity::ERROR, "Expected ',' between arguments", false},
+    {"expected-close-paren-after-arguments", Severity::ERROR, "Expected ')' after arguments", false},
+    {"expected-semicolon-after-call", Severity::ERROR, "Expected ';' after procedure call", false},
+    {"expected-semicolon-after-return", Severity::ERROR, "Expected ';' after return statement", false},
+    {"expected-close-bracket", Severity::ERROR, "Expected ']'", false},
+    {"index-of-non-array", Severity::ERROR, "Only arrays can be indexed: ", true},
+    {"array-in-scalar-context", Severity::ERROR, "Array used where a number is expected: ", true},
+    {"array-comparison", Severity::ERROR, "Arrays cannot be compared with ", true},
+    {"expected-loop-variable", Severity::ERROR, "Expected loop variable after 'for'", false},
+    {"expected-from", Severity::ERROR, "Expected 'from' after loop variable", false},
+    {"expected-to", Severity::ERROR, "Expected 'to' after start value", false},
+    {"expected-loop-after-for", Severity::ERROR, "Expected 'loop' after for range", false},
+    {"zero-step", Severity::ERROR, "Step of a for loop cannot be 0", false},
+    {"assignment-to-loop-variable", Severity::ERROR, "Loop variable cannot be assigned: ", true},
+    {"expected-for-after-parallel", Severity::ERROR, "Expected 'for' after 'parallel'", false},
+    {"expected-reduction-operator", Severity::ERROR, "Expected '+' or '*' before reduction variable", false},
+    {"invalid-reduction-variable", Severity::ERROR, "Reduction variable must be a number declared outside the loop: ",
+     true},
+    {"parallel-shared-assignment", Severity::ERROR,
+     "Iterations of a parallel loop race assigning a variable declared outside it: ", true},
+    {"parallel-reduction-use", Severity::ERROR,
+     "Reduction variable can only be updated as x <- x op expression, with its operator: ", true},
+    {"parallel-array-conflict", Severity::ERROR,
+     "Parallel loop writes an array it accesses at an index other than the loop variable: ", true},
+    {"parallel-output", Severity::ERROR, "A parallel loop cannot print, its output order would vary", false},
+    {"parallel-return", Severity::ERROR, "Cannot return from inside a parallel loop", false},
+    {"parallel-call", Severity::ERROR, "Parallel loop calls a procedure that shares state with its iterations: ",
+     true},
+    {"expected-call-after-spawn", Severity::ERROR, "Expected a procedure call after 'spawn'", false},
+    {"expected-semicolon-after-spawn", Severity::ERROR, "Expected ';' after spawned call", false},
+    {"expected-semicolon-after-sync", Severity::ERROR, "Expected ';' after sync", false},
+    {"expected-channel-capacity", Severity::ERROR, "Expected '[capacity]' after channel", false},
+    {"expected-open-paren-after-send", Severity::ERROR, "Expected '(' after send", false},
+    {"expected-comma-after-channel", Severity::ERROR, "Expected ',' after the channel", false},
+    {"expected-semicolon-after-send", Severity::ERROR, "Expected ';' after send", false},
+    {"expected-open-paren-after-receive", Severity::ERROR, "Expected '(' after receive", false},
+    {"expected-channel", Severity::ERROR, "Expected a channel: ", true},
+    {"channel-as-number", Severity::ERROR, "Channels can only be used with send and receive: ", true},
+    {"local-channel", Severity::ERROR, "Channels can only be declared at the top level: ", true},
+    {"spawn-shared-write", Severity::ERROR, "Spawned procedure writes shared state or prints: ", true},
+    {"task-shared-write", Severity::ERROR, "Written while a spawned call that reads it may still be running: ", true},
+    {"compiler-error", Severity::ERROR, "Compiler: ", true},
+    {"compiler-warning", Severity::WARNING, "Compiler: ", true},
+    {"c-target-array", Severity::ERROR, "Arrays need the C++ target: ", true},
+    {"c-target-channel", Severity::ERROR, "Channels need the C++ target: ", true},
+    {"c-target-task", Severity::ERROR, "spawn and sync need the C++ target", false},
+    {"recursive-call-not-tail", Severity::WARNING, "Recursive call is not returned directly and stays a call: ", true},
+    {"recursive-call-in-loop", Severity::WARNING, "Recursive tail call inside a loop stays a call: ", true},
+    {"recursive-call-with-tasks", Severity::WARNING, "Recursive tail call in a procedure with spawn or sync stays a call: ", true},
+    {"memo-impure", Severity::ERROR, "A memo procedure cannot assign globals, write arrays, print or read globals: ", true},
+    {"expected-in", Severity::ERROR, "Expected 'in' after the variable of for each", false},
+    {"expected-generator-call", Severity::ERROR, "Expected a call to a generator after 'in'", false},
+    {"not-a-generator", Severity::ERROR, "for each needs a procedure that yields, defined before the loop: ", true},
+    {"generator-call", Severity::ERROR, "A procedure that yields can only be called by for each: ", true},
+    {"expected-semicolon-after-yield", Severity::ERROR, "Expected ';' after yield", false},
+    {"yield-outside-procedure", Severity::ERROR, "yield can only be used in a procedure", false},
+    {"generator-return", Severity::ERROR, "A procedure that yields cannot return a value", false},
+    {"generator-task", Severity::ERROR, "A procedure that yields cannot spawn or sync", false},
+    {"generator-array", Severity::ERROR, "A procedure that yields cannot keep an array across a yield: ", true},
+    {"generator-shadowing", Severity::ERROR, "A procedure that yields cannot declare a name again around a yield: ",
+     true},
+    {"memo-generator", Severity::ERROR, "A memo procedure cannot yield: ", true},
+    {"parallel-yield", Severity::ERROR, "Cannot yield from inside a parallel loop", false},
+    {"unterminated-string", Severity::ERROR, "Unterminated string literal", false},
+    {"unterminated-comment", Severity::ERROR, "Unterminated multi-line comment", false},
+};
+
+static_assert(sizeof(diagnosticTable) / sizeof(diagnosticTable[0]) == static_cast<size_t>(DiagnosticCode::COUNT),
+              "diagnosticTable must have an entry for every DiagnosticCode");
+
+const DiagnosticInfo& infoOf(DiagnosticCode code) {
+    return diagnosticTable[static_cast<size_t>(code)];
+}
+
+// Escape a string for a JSON string literal
+std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    escaped += buffer;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+}
+
+// Severity of a diagnostic code
+Severity Diagnostics::severityOf(DiagnosticCode code) {
+    return infoOf(code).severity;
+}
+
+// Stable name of a diagnostic code, used in JSON output
+const char* Diagnostics::nameOf(DiagnosticCode code) {
+    return infoOf(code).name;
+}
+
+// Message of a diagnostic code, without the token text some messages end with
+const char* Diagnostics::messageOf(DiagnosticCode code) {
+    return infoOf(code).message;
+}
+
+// Store a diagnostic unless it repeats one already recorded at the same place
+void Diagnostics::record(DiagnosticCode code, Severity severity, const Token& token) {
+    Diagnostic diagnostic{code, severity, token.offset, token.line, token.column, 0, 0};
+    store(diagnostic, infoOf(code).mentionsToken ? std::string_view(token.lexeme) : std::string_view());
+}
+
+// Keep a diagnostic with the token text its message mentions, unless one with the same code and
+// position was already kept. Past the limit it is only counted.
+void Diagnostics::store(Diagnostic diagnostic, std::string_view argument) {
+    uint64_t key = (static_cast<uint64_t>(diagnostic.line) << 32) |
+                   (static_cast<uint64_t>(diagnostic.column & 0xFFFFFF) << 8) |
+                   static_cast<uint64_t>(diagnostic.code);
+    // Past the limit only the kept entries are remembered, so dropping leaves nothing behind
+    bool full = limit != 0 && entries.size() >= limit;
+    if (full ? seen.count(key) != 0 : !seen.insert(key).second) return;
+
+    if (diagnostic.severity == Severity::ERROR) {
+        errorCount++;
+    } else {
+        warningCount++;
+    }
+    if (full) {
+        droppedCount++;
+        return;
+    }
+
+    diagnostic.argumentStart = static_cast<uint32_t>(textArena.size());
+    diagnostic.argumentLength = static_cast<uint32_t>(argument.size());
+    textArena += argument;
+    entries.push_back(diagnostic);
+}
+
+// Add the entries of another set of diagnostics after this one's, as if they were reported here
+void Diagnostics::append(const Diagnostics& other) {
+    std::string_view arena(other.textArena);
+    size_t keptErrors = 0;
+    for (const Diagnostic& diagnostic : other.entries) {
+        if (diagnostic.severity == Severity::ERROR) keptErrors++;
+        store(diagnostic, arena.substr(diagnostic.argumentStart, diagnostic.argumentLength));
+    }
+    // What the other set was over its limit with is only counted there, so it is only counted here
+    errorCount += other.errorCount - keptErrors;
+    warningCount += other.warningCount - (other.entries.size() - keptErrors);
+    droppedCount += other.droppedCount;
+}
+
+// Forget all recorded diagnostics, keeping the settings
+void Diagnostics::clear() {
+    entries.clear();
+    textArena.clear();
+    seen.clear();
+    errorCount = 0;
+    warningCount = 0;
+    droppedCount = 0;
+}
+
+// Format the message of a diagnostic, without its position
+std::string Diagnostics::getMessage(const Diagnostic& diagnostic) const {
+    const DiagnosticInfo& info = infoOf(diagnostic.code);
+    std::string message = info.message;
+    if (info.mentionsToken) {
+        message.append(textArena, diagnostic.argumentStart, diagnostic.argumentLength);
+    }
+    return message;
+}
+
+// Write all diagnostics in one go
+void Diagnostics::render(std::ostream& out, DiagnosticFormat format) const {
+    std::ostringstream text;
+
+    if (format == DiagnosticFormat::JSON) {
+        text << "{\"diagnostics\": [";
+        for (size_t i = 0; i < entries.size(); i++) {
+            const Diagnostic& diagnostic = entries[i];
+            text << (i > 0 ? ",\n  " : "\n  ")
+                 << "{\"code\": \"" << nameOf(diagnostic.code) << "\", "
+                 << "\"severity\": \"" << (diagnostic.severity == Severity::ERROR ? "error" : "warning") << "\", "
+                 << "\"message\": \"" << escapeJson(getMessage(diagnostic)) << "\", "
+                 << "\"line\": " << diagnostic.line << ", "
+                 << "\"column\": " << diagnostic.column << ", "
+                 << "\"offset\": " << diagnostic.offset << "}";
+        }
+        text << (entries.empty() ? "" : "\n") << "], "
+             << "\"errors\": " << errorCount << ", "
+             << "\"warnings\": " << warningCount << ", "
+             << "\"omitted\": " << droppedCount << "}\n";
+    } else {
+        for (const Diagnostic& diagnostic : entries) {
+            if (diagnostic.severity == Severity::WARNING) text << "Warning: ";
+            text << getMessage(diagnostic) << " at line " << diagnostic.line
+                 << ", column " << diagnostic.column << "\n";
+        }
+        if (droppedCount > 0) {
+            text << "Too many diagnostics, " << droppedCount << " more not shown\n";
+        }
+    }
+
+    out << text.str();
+    out.flush();
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "token.h"
+
+enum class Severity {
+    WARNING,
+    ERROR
+};
+
+enum class DiagnosticCode {
+    EXTRA_SEMICOLON,
+    EXPECTED_ASSIGN_OR_CALL,
+    UNEXPECTED_TOKEN,
+    UNEXPECTED_TOKEN_IN_BLOCK,
+    UNEXPECTED_TOKEN_IN_EXPRESSION,
+    UNDECLARED_VARIABLE,
+    EXPECTED_ASSIGN,
+    EXPECTED_CLOSE_PAREN,
+    EXPECTED_RIGHT_OPERAND,
+    EXPECTED_SEMICOLON_AFTER_DECLARATION,
+    EXPECTED_SEMICOLON_AFTER_ASSIGNMENT,
+    EXPECTED_THEN_AFTER_IF,
+    EXPECTED_THEN_AFTER_ELSEIF,
+    EXPECTED_END_IF,
+    EXPECTED_SEMICOLON_AFTER_END_IF,
+    EXPECTED_LOOP_AFTER_WHILE,
+    EXPECTED_END_LOOP,
+    EXPECTED_SEMICOLON_AFTER_END_LOOP,
+    EXPECTED_OPEN_PAREN_AFTER_PUT,
+    EXPECTED_CLOSE_PAREN_AFTER_PUT,
+    EXPECTED_SEMICOLON_AFTER_PUT,
+    EXPECTED_PROCEDURE_AFTER_MEMO,
+    EXPECTED_PROCEDURE_NAME,
+    EXPECTED_OPEN_PAREN_AFTER_PROCEDURE_NAME,
+    EXPECTED_PARAMETER_NAME,
+    EXPECTED_COMMA_BETWEEN_PARAMETERS,
+    EXPECTED_CLOSE_PAREN_AFTER_PARAMETERS,
+    EXPECTED_BEGIN,
+    EXPECTED_END_PROCEDURE,
+    EXPECTED_SEMICOLON_AFTER_END_PROCEDURE,
+    EXPECTED_COMMA_BETWEEN_ARGUMENTS,
+    EXPECTED_CLOSE_PAREN_AFTER_ARGUMENTS,
+    EXPECTED_SEMICOLON_AFTER_CALL,
+    EXPECTED_SEMICOLON_AFTER_RETURN,
+    EXPECTED_CLOSE_BRACKET,
+    INDEX_OF_NON_ARRAY,
+    ARRAY_IN_SCALAR_CONTEXT,
+    ARRAY_COMPARISON,
+    EXPECTED_LOOP_VARIABLE,
+    EXPECTED_FROM,
+    EXPECTED_TO,
+    EXPECTED_LOOP_AFTER_FOR,
+    ZERO_STEP,
+    ASSIGNMENT_TO_LOOP_VARIABLE,
+    EXPECTED_FOR_AFTER_PARALLEL,
+    EXPECTED_REDUCTION_OPERATOR,
+    INVALID_REDUCTION_VARIABLE,
+    PARALLEL_SHARED_ASSIGNMENT,
+    PARALLEL_REDUCTION_USE,
+    PARALLEL_ARRAY_CONFLICT,
+    PARALLEL_OUTPUT,
+    PARALLEL_RETURN,
+    PARALLEL_CALL,
+    EXPECTED_CALL_AFTER_SPAWN,
+    EXPECTED_SEMICOLON_AFTER_SPAWN,
+    EXPECTED_SEMICOLON_AFTER_SYNC,
+    EXPECTED_CHANNEL_CAPACITY,
+    EXPECTED_OPEN_PAREN_AFTER_SEND,
+    EXPECTED_COMMA_AFTER_CHANNEL,
+    EXPECTED_SEMICOLON_AFTER_SEND,
+    EXPECTED_OPEN_PAREN_AFTER_RECEIVE,
+    EXPECTED_CHANNEL,
+    CHANNEL_AS_NUMBER,
+    LOCAL_CHANNEL,
+    SPAWN_SHARED_WRITE,
+    TASK_SHARED_WRITE,
+    COMPILER_ERROR,
+    COMPILER_WARNING,
+    C_TARGET_ARRAY,
+    C_TARGET_CHANNEL,
+    C_TARGET_TASK,
+    RECURSIVE_CALL_NOT_TAIL,
+    RECURSIVE_CALL_IN_LOOP,
+    RECURSIVE_CALL_WITH_TASKS,
+    MEMO_IMPURE,
+    EXPECTED_IN,
+    EXPECTED_GENERATOR_CALL,
+    NOT_A_GENERATOR,
+    GENERATOR_CALL,
+    EXPECTED_SEMICOLON_AFTER_YIELD,
+    YIELD_OUTSIDE_PROCEDURE,
+    GENERATOR_RETURN,
+    GENERATOR_TASK,
+    GENERATOR_ARRAY,
+    GENERATOR_SHADOWING,
+    MEMO_GENERATOR,
+    PARALLEL_YIELD,
+    UNTERMINATED_STRING,
+    UNTERMINATED_COMMENT,
+    COUNT
+};
+
+// A recorded diagnostic. The message is not formatted until rendering; the
+// token text it mentions (if any) lives in the owning Diagnostics' text arena.
+struct Diagnostic {
+    DiagnosticCode code;
+    Severity severity;
+    size_t offset;
+    int line;
+    int column;
+    uint32_t argumentStart;
+    uint32_t argumentLength;
+};
+
+enum class DiagnosticFormat {
+    TEXT,
+    JSON
+};
+
+// Collects diagnostics while compiling and renders them once at the end.
+// Reporting never formats or flushes, and is a single branch when the
+// diagnostic's severity is suppressed.
+class Diagnostics {
+public:
+    Diagnostics() = default;
+
+    void report(DiagnosticCode code, const Token& token) {
+        Severity severity = severityOf(code);
+        if (severity == Severity::WARNING && !warningsEnabled) return;
+        record(code, severity, token);
+    }
+
+    void setWarningsEnabled(bool enabled) { warningsEnabled = enabled; }
+    void setLimit(size_t limit) { this->limit = limit; }
+    bool hasErrors() const { return errorCount > 0; }
+    size_t getErrorCount() const { return errorCount; }
+    size_t getWarningCount() const { return warningCount; }
+    std::vector<Diagnostic>& getEntries() { return entries; }
+    const std::vector<Diagnostic>& getEntries() const { return entries; }
+
+    void append(const Diagnostics& other);
+    void clear();
+    std::string getMessage(const Diagnostic& diagnostic) const;
+    void render(std::ostream& out, DiagnosticFormat format) const;
+
+    static Severity severityOf(DiagnosticCode code);
+    static const char* nameOf(DiagnosticCode code);
+    static const char* messageOf(DiagnosticCode code);
+
+private:
+    std::vector<Diagnostic> entries;
+    std::string textArena;
+    std::unordered_set<uint64_t> seen; // Code and position of recorded entries, for dedup
+    bool warningsEnabled = true;
+    size_t limit = 1000;               // Entries kept before the rest are only counted (0 = no limit)
+    size_t errorCount = 0;
+    size_t warningCount = 0;
+    size_t droppedCount = 0;
+
+    void record(DiagnosticCode code, Severity severity, const Token& token);
+    void store(Diagnostic diagnostic, std::string_view argument);
+};
@@ -0,0 +1,582 @@
+#include "document.h"
+#include "lexer.h"
+#include "statement_parser.h"
+#include "expression_parser.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+// Move a token or diagnostic that follows an edit into the coordinates of the edited text
+template <typename Positioned>
+void shiftToken(Positioned& token, long offsetDelta, int lineDelta, size_t columnLimit, int columnDelta) {
+    if (token.offset < columnLimit) {
+        token.column += columnDelta; // Token is on the line the edit ended on
+    }
+    token.offset += offsetDelta;
+    token.line += lineDelta;
+}
+
+// Shift every token in an AST subtree once, skipping synthetic tokens that have no position.
+// Repeated expressions are one node reached from several parents.
+void shiftNode(ASTNode& node, long offsetDelta, int lineDelta, size_t columnLimit, int columnDelta,
+               std::unordered_set<const ASTNode*>& shifted) {
+    if (!shifted.insert(&node).second) return;
+    if (node.token.line > 0) {
+        shiftToken(node.token, offsetDelta, lineDelta, columnLimit, columnDelta);
+    }
+    for (auto& child : node.children) {
+        if (child) shiftNode(*child, offsetDelta, lineDelta, columnLimit, columnDelta, shifted);
+    }
+}
+
+// Shift every token of a statement's AST
+void shiftNode(ASTNode& node, long offsetDelta, int lineDelta, size_t columnLimit, int columnDelta) {
+    std::unordered_set<const ASTNode*> shifted;
+    shiftNode(node, offsetDelta, lineDelta, columnLimit, columnDelta, shifted);
+}
+
+// Count newlines in part of a string
+int countLines(const std::string& text, size_t start, size_t end) {
+    return static_cast<int>(std::count(text.begin() + start, text.begin() + end, '\n'));
+}
+
+// Check if two procedures look the same to the checks of their callers
+bool sameEffects(const ProcedureEffects& a, const ProcedureEffects& b) {
+    return a.writes == b.writes && a.reads == b.reads && a.assigned == b.assigned && a.yields == b.yields;
+}
+
+// Column (1-based) of a byte offset
+int columnAt(const std::string& text, size_t offset) {
+    size_t lineStart = offset == 0 ? std::string::npos : text.rfind('\n', offset - 1);
+    lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+    return static_cast<int>(offset - lineStart) + 1;
+}
+
+}
+
+// Constructor for Document, lexes and parses the whole text once
+Document::Document(const std::string& text)
+    : text(text), endOfFile(TokenType::END_OF_FILE, "", 1, 1) {
+    size_t resyncIndex = 0;
+    Diagnostics lexErrors;
+    auto tokens = lexFrom(0, 1, 1, 0, 0, resyncIndex, lexErrors);
+
+    bool incomplete = false;
+    statements = parseRegion(tokens, 0, endOfFile, incomplete);
+    attachLexErrors(statements, lexErrors, nullptr);
+    for (auto& statement : statements) {
+        registerStatement(statement.get());
+    }
+    relexedTokens = tokens.size();
+    reparsedStatements = statements.size();
+}
+
+// Replace the bytes in [start, end) and bring tokens and AST up to date
+void Document::applyEdit(size_t start, size_t end, const std::string& replacement) {
+    if (start > end || end > text.size()) {
+        throw std::out_of_range("Edit range is outside the document");
+    }
+
+    long delta = static_cast<long>(replacement.size()) - static_cast<long>(end - start);
+    int lineDelta = countLines(replacement, 0, replacement.size()) - countLines(text, start, end);
+
+    // Tokens on the rest of the line the edit ends on also change column
+    size_t lineEnd = text.find('\n', end);
+    if (lineEnd == std::string::npos) lineEnd = std::numeric_limits<size_t>::max();
+    size_t lastNewline = replacement.rfind('\n');
+    int newEndColumn = lastNewline == std::string::npos
+        ? columnAt(text, start) + static_cast<int>(replacement.size())
+        : static_cast<int>(replacement.size() - lastNewline);
+    int columnDelta = newEndColumn - columnAt(text, end);
+
+    // Restart at the statement in front of the edit. Statements that failed to parse
+    // looked at the token after them, so step back over those as well.
+    size_t first = 0;
+    if (!statements.empty()) {
+        first = findStatement(start);
+        while (first > 0 && (!statements[first - 1]->node ||
+                             statements[first - 1]->tokens.back().type != TokenType::SEMICOLON)) {
+            first--;
+        }
+    }
+    size_t restart = 0;
+    int line = 1;
+    int column = 1;
+    if (first < statements.size()) {
+        flush(*statements[first]);
+        const Token& restartToken = statements[first]->tokens.front();
+        if (restartToken.offset <= start) {
+            restart = restartToken.offset;
+            line = restartToken.line;
+            column = restartToken.column;
+        }
+    }
+
+    // Re-lex until a token lands on the start of an untouched statement
+    text.replace(start, end - start, replacement);
+    size_t resyncIndex = first;
+    Diagnostics lexErrors;
+    std::vector<Token> region = lexFrom(restart, line, column, start + replacement.size(), delta, resyncIndex,
+                                        lexErrors);
+    relexedTokens = region.size();
+
+    // Everything after the resync point only moves
+    if (resyncIndex < statements.size()) {
+        shiftToken(endOfFile, delta, lineDelta, lineEnd, columnDelta);
+    }
+    for (size_t i = resyncIndex; i < statements.size(); i++) {
+        Statement& statement = *statements[i];
+        if (startOf(statement) < lineEnd) {
+            flush(statement);
+            for (auto& token : statement.tokens) {
+                shiftToken(token, delta, lineDelta, lineEnd, columnDelta);
+            }
+            if (statement.node) shiftNode(*statement.node, delta, lineDelta, lineEnd, columnDelta);
+            for (auto& diagnostic : statement.diagnostics.getEntries()) {
+                shiftToken(diagnostic, delta, lineDelta, lineEnd, columnDelta);
+            }
+            for (auto& diagnostic : statement.lexErrors.getEntries()) {
+                shiftToken(diagnostic, delta, lineDelta, lineEnd, columnDelta);
+            }
+        } else {
+            statement.pendingOffset += delta;
+            statement.pendingLine += lineDelta;
+        }
+    }
+
+    // Re-parse the region, pulling in following statements while the last one is cut short
+    size_t absorbed = resyncIndex;
+    size_t extra = 1;
+    bool incomplete = false;
+    auto parsed = parseRegion(region, restart, tokenAfter(absorbed), incomplete);
+    while (incomplete && absorbed < statements.size()) {
+        size_t until = std::min(statements.size(), absorbed + extra);
+        for (; absorbed < until; absorbed++) {
+            flush(*statements[absorbed]);
+            region.insert(region.end(), statements[absorbed]->tokens.begin(), statements[absorbed]->tokens.end());
+            lexErrors.append(statements[absorbed]->lexErrors); // Absorbed statements are not lexed again
+        }
+        extra *= 2;
+        parsed = parseRegion(region, restart, tokenAfter(absorbed), incomplete);
+    }
+    reparsedStatements = parsed.size();
+    if (restart == 0) leadingLexErrors.clear();
+    attachLexErrors(parsed, lexErrors, first > 0 ? statements[first - 1].get() : nullptr);
+
+    // Swap the statements in and note which names gained or lost a declaration, or changed type,
+    // and which procedures were added, removed or changed what they do
+    std::unordered_map<std::string, VariableType> oldNames;
+    std::unordered_map<std::string, VariableType> newNames;
+    std::unordered_map<std::string, ProcedureEffects> oldProcedures;
+    std::unordered_map<std::string, ProcedureEffects> newProcedures;
+    RunningTasks oldRunning = absorbed > 0 ? statements[absorbed - 1]->runningAfter : RunningTasks();
+    for (size_t i = first; i < absorbed; i++) {
+        if (!statements[i]->declaredName.empty()) oldNames[statements[i]->declaredName] = statements[i]->declaredType;
+        if (!statements[i]->procedureName.empty()) oldProcedures[statements[i]->procedureName] = statements[i]->effects;
+        unregisterStatement(statements[i].get());
+    }
+    for (auto& statement : parsed) {
+        if (!statement->declaredName.empty()) newNames[statement->declaredName] = statement->declaredType;
+        if (!statement->procedureName.empty()) newProcedures[statement->procedureName] = statement->effects;
+        registerStatement(statement.get());
+    }
+    size_t parsedCount = parsed.size();
+    statements.erase(statements.begin() + first, statements.begin() + absorbed);
+    statements.insert(statements.begin() + first,
+                      std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+
+    size_t regionEnd = first + parsedCount < statements.size()
+        ? startOf(*statements[first + parsedCount])
+        : std::numeric_limits<size_t>::max();
+    // Statements after the region are checked against the calls spawned before them that still run
+    ProcedureChanges changes;
+    RunningTasks newRunning = first + parsedCount > 0 ? statements[first + parsedCount - 1]->runningAfter
+                                                      : RunningTasks();
+    if (newRunning != oldRunning) recheckTasks(first + parsedCount, changes);
+    for (const auto& name : oldNames) {
+        auto found = newNames.find(name.first);
+        if (found == newNames.end() || found->second != name.second) {
+            recheckUses(name.first, restart, regionEnd, changes);
+        }
+    }
+    for (const auto& name : newNames) {
+        if (!oldNames.count(name.first)) recheckUses(name.first, restart, regionEnd, changes);
+    }
+    for (const auto& procedure : oldProcedures) {
+        auto found = newProcedures.find(procedure.first);
+        if (found == newProcedures.end() || !sameEffects(found->second, procedure.second)) {
+            changes.push_back({procedure.first, regionEnd});
+        }
+    }
+    for (const auto& procedure : newProcedures) {
+        if (!oldProcedures.count(procedure.first)) changes.push_back({procedure.first, regionEnd});
+    }
+    recheckCallers(changes);
+}
+
+// Return all tokens, including the END_OF_FILE token
+std::vector<Token> Document::getTokens() {
+    std::vector<Token> tokens;
+    for (auto& statement : statements) {
+        flush(*statement);
+        tokens.insert(tokens.end(), statement->tokens.begin(), statement->tokens.end());
+    }
+    tokens.push_back(endOfFile);
+    return tokens;
+}
+
+// Return a program node over the current statements, sharing their AST nodes
+std::shared_ptr<ASTNode> Document::getProgram() {
+    auto programNode = makeNode(ASTNodeType::PROGRAM, Token(TokenType::UNKNOWN, "", 0, 0));
+    for (auto& statement : statements) {
+        flush(*statement);
+        if (statement->node) programNode->children.push_back(statement->node);
+    }
+    return programNode;
+}
+
+// Return the diagnostics of all statements in document order
+Diagnostics Document::getDiagnostics() {
+    Diagnostics diagnostics;
+    diagnostics.append(leadingLexErrors);
+    for (auto& statement : statements) {
+        flush(*statement);
+        diagnostics.append(statement->diagnostics);
+        diagnostics.append(statement->lexErrors);
+    }
+    return diagnostics;
+}
+
+// Message of the first text no token could be made of, or empty when the whole text lexed
+std::string Document::getLexError() const {
+    const Diagnostics* first = &leadingLexErrors;
+    for (size_t i = 0; i < statements.size() && first->getEntries().empty(); i++) {
+        first = &statements[i]->lexErrors;
+    }
+    return first->getEntries().empty() ? "" : Diagnostics::messageOf(first->getEntries()[0].code);
+}
+
+// Byte offset where a statement starts in the current text
+size_t Document::startOf(const Statement& statement) const {
+    return statement.tokens.front().offset + statement.pendingOffset;
+}
+
+// Index of the last statement starting at or before an offset (0 if there is none)
+size_t Document::findStatement(size_t offset) const {
+    auto it = std::upper_bound(statements.begin(), statements.end(), offset,
+        [this](size_t value, const std::unique_ptr<Statement>& statement) {
+            return value < startOf(*statement);
+        });
+    return it == statements.begin() ? 0 : static_cast<size_t>(it - statements.begin()) - 1;
+}
+
+// First token of statement index (brought up to date), or the END_OF_FILE token
+const Token& Document::tokenAfter(size_t index) {
+    if (index >= statements.size()) return endOfFile;
+    flush(*statements[index]);
+    return statements[index]->tokens.front();
+}
+
+// Check if a top-level declaration of name starts before an offset
+bool Document::isDeclaredBefore(const std::string& name, size_t offset) const {
+    auto it = declarations.find(name);
+    if (it == declarations.end()) return false;
+    for (const Statement* statement : it->second) {
+        if (startOf(*statement) < offset) return true;
+    }
+    return false;
+}
+
+// Type given by the last top-level declaration of name before an offset, UNKNOWN if there is none
+VariableType Document::typeDeclaredBefore(const std::string& name, size_t offset) const {
+    auto it = declarations.find(name);
+    if (it == declarations.end()) return VariableType::UNKNOWN;
+    VariableType type = VariableType::UNKNOWN;
+    size_t latest = 0;
+    for (const Statement* statement : it->second) {
+        size_t start = startOf(*statement);
+        if (start < offset && (type == VariableType::UNKNOWN || start >= latest)) {
+            type = statement->declaredType;
+            latest = start;
+        }
+    }
+    return type;
+}
+
+// What calls spawned by main program statements before an offset, and not synced, read
+RunningTasks Document::runningBefore(size_t offset) const {
+    auto it = std::lower_bound(statements.begin(), statements.end(), offset,
+        [this](const std::unique_ptr<Statement>& statement, size_t value) {
+            return startOf(*statement) < value;
+        });
+    return it == statements.begin() ? RunningTasks() : (*(it - 1))->runningAfter;
+}
+
+// Lex from a position until the end of the text or until a token at or after
+// resyncStart lines up with the (pre-edit) start of statement resyncIndex or later
+std::vector<Token> Document::lexFrom(size_t position, int line, int column, size_t resyncStart,
+                                     long delta, size_t& resyncIndex, Diagnostics& lexErrors) {
+    std::vector<Token> tokens;
+    Lexer lexer(text, position, line, column);
+
+    while (true) {
+        Token token(TokenType::UNKNOWN, "", 0, 0);
+        try {
+            token = lexer.nextToken();
+        } catch (const LexError& error) {
+            // Carry on from the next line so later statements can still line up
+            lexErrors.report(error.code, error.token);
+            lexer.skipToNextLine();
+            continue;
+        }
+
+        if (token.type == TokenType::END_OF_FILE) {
+            endOfFile = token;
+            resyncIndex = statements.size();
+            return tokens;
+        }
+
+        if (token.offset >= resyncStart) {
+            size_t oldOffset = static_cast<size_t>(static_cast<long>(token.offset) - delta);
+            while (resyncIndex < statements.size() && startOf(*statements[resyncIndex]) < oldOffset) {
+                resyncIndex++;
+            }
+            if (resyncIndex < statements.size() && startOf(*statements[resyncIndex]) == oldOffset) {
+                return tokens;
+            }
+        }
+        tokens.push_back(token);
+    }
+}
+
+// Parse tokens into top-level statements; next is the token that follows them
+// in the text. incomplete is set when the last statement failed at the end of
+// the tokens and might parse with more input.
+std::vector<std::unique_ptr<Document::Statement>> Document::parseRegion(const std::vector<Token>& tokens,
+                                                                        size_t restartOffset, const Token& next,
+                                                                        bool& incomplete) {
+    std::vector<std::unique_ptr<Statement>> result;
+    incomplete = false;
+    if (tokens.empty()) return result;
+
+    std::vector<Token> input(tokens);
+    input.push_back(next);
+    input.back().type = TokenType::END_OF_FILE; // Keeps the text so diagnostics at the sentinel read the same
+
+    Diagnostics unused;
+    Parser parser(input, unused);
+    parser.procedureEffects.globals = globals; // So the effects of procedures carry over between regions
+    parser.getSymbolTable().setFallbackLookup([this, restartOffset](const std::string& name) {
+        return typeDeclaredBefore(name, restartOffset);
+    });
+
+    // What the last definition before the region does of each procedure the region calls, for
+    // checking those calls. Names not before '(' are never looked up, so the rest are left out.
+    for (size_t i = 0; i + 1 < tokens.size(); i++) {
+        if (tokens[i].type != TokenType::IDENTIFIER || tokens[i + 1].type != TokenType::OPEN_PAREN) continue;
+        auto procedure = procedures.find(tokens[i].lexeme);
+        if (procedure == procedures.end() || parser.procedureEffects.procedures.count(procedure->first)) continue;
+        const Statement* last = nullptr;
+        for (const Statement* statement : procedure->second) {
+            size_t start = startOf(*statement);
+            if (start < restartOffset && (!last || start > startOf(*last))) last = statement;
+        }
+        if (last) parser.procedureEffects.procedures[procedure->first] = last->effects;
+    }
+    parser.mainTasks = runningBefore(restartOffset);
+
+    while (!parser.isAtEnd()) {
+        size_t begin = parser.currentPosition;
+        auto statement = std::make_unique<Statement>();
+        parser.setDiagnostics(statement->diagnostics);
+        parser.expressionParser->clearSharedExpressions(); // Statements are shifted one at a time
+        auto node = parser.parseStatement();
+
+        statement->tokens.assign(input.begin() + begin, input.begin() + parser.currentPosition);
+        statement->node = node;
+        statement->runningAfter = parser.mainTasks;
+        if (node && (node->type == ASTNodeType::DECLARATION || node->type == ASTNodeType::ARRAY_DECLARATION ||
+                     node->type == ASTNodeType::CHANNEL_DECLARATION)) {
+            statement->declaredName = node->children[0]->token.lexeme;
+            statement->declaredType = node->type == ASTNodeType::ARRAY_DECLARATION     ? VariableType::ARRAY
+                                      : node->type == ASTNodeType::CHANNEL_DECLARATION ? VariableType::CHANNEL
+                                                                                         : VariableType::INTEGER;
+        }
+        if (node && node->type == ASTNodeType::PROCEDURE) {
+            statement->procedureName = node->children[0]->token.lexeme;
+            statement->effects = parser.procedureEffects.procedures[statement->procedureName];
+        }
+        for (size_t i = 0; i < statement->tokens.size(); i++) {
+            const auto& token = statement->tokens[i];
+            if (token.type != TokenType::IDENTIFIER) continue;
+            if ((i == 0 || statement->tokens[i - 1].type != TokenType::DECLARE) &&
+                std::find(statement->usedNames.begin(), statement->usedNames.end(), token.lexeme) ==
+                    statement->usedNames.end()) {
+                statement->usedNames.push_back(token.lexeme);
+            }
+            // A name before '(' may be a call, whose checks read what the procedure does
+            if (i + 1 < statement->tokens.size() && statement->tokens[i + 1].type == TokenType::OPEN_PAREN &&
+                std::find(statement->calledNames.begin(), statement->calledNames.end(), token.lexeme) ==
+                    statement->calledNames.end()) {
+                statement->calledNames.push_back(token.lexeme);
+            }
+        }
+
+        // A statement that failed or reported a problem at the sentinel might parse with more input
+        const auto& entries = statement->diagnostics.getEntries();
+        bool reportedAtEnd = !entries.empty() && entries.back().offset == input.back().offset;
+        incomplete = (!node || reportedAtEnd) && parser.isAtEnd();
+        result.push_back(std::move(statement));
+    }
+    return result;
+}
+
+// Give each lex error of a re-lexed region to the last statement in front of it, which keeps it
+// until the text after it is lexed again. Errors in front of every parsed statement go to the
+// statement before the region, or in front of the first statement.
+void Document::attachLexErrors(std::vector<std::unique_ptr<Statement>>& parsed, const Diagnostics& lexErrors,
+                               Statement* before) {
+    if (before) flush(*before);
+    size_t next = 0;
+    for (const auto& error : lexErrors.getEntries()) {
+        while (next < parsed.size() && startOf(*parsed[next]) <= error.offset) next++;
+        Diagnostics& owner = next > 0 ? parsed[next - 1]->lexErrors
+                             : before ? before->lexErrors
+                                      : leadingLexErrors;
+        owner.report(error.code, Token(TokenType::UNKNOWN, "", error.line, error.column, error.offset, 0));
+    }
+}
+
+// Apply a statement's pending position shift to its tokens and AST
+void Document::flush(Statement& statement) {
+    if (statement.pendingOffset == 0 && statement.pendingLine == 0) return;
+    for (auto& token : statement.tokens) {
+        shiftToken(token, statement.pendingOffset, statement.pendingLine, 0, 0);
+    }
+    if (statement.node) shiftNode(*statement.node, statement.pendingOffset, statement.pendingLine, 0, 0);
+    for (auto& diagnostic : statement.diagnostics.getEntries()) {
+        shiftToken(diagnostic, statement.pendingOffset, statement.pendingLine, 0, 0);
+    }
+    for (auto& diagnostic : statement.lexErrors.getEntries()) {
+        shiftToken(diagnostic, statement.pendingOffset, statement.pendingLine, 0, 0);
+    }
+    statement.pendingOffset = 0;
+    statement.pendingLine = 0;
+}
+
+// Add a statement to the declaration, use, procedure and caller indexes
+void Document::registerStatement(Statement* statement) {
+    if (!statement->declaredName.empty()) {
+        declarations[statement->declaredName].push_back(statement);
+    }
+    for (const auto& name : statement->usedNames) {
+        uses[name].push_back(statement);
+    }
+    if (!statement->procedureName.empty()) {
+        procedures[statement->procedureName].push_back(statement);
+    }
+    for (const auto& name : statement->calledNames) {
+        callers[name].push_back(statement);
+    }
+}
+
+// Remove a statement from the declaration, use, procedure and caller indexes
+void Document::unregisterStatement(Statement* statement) {
+    auto remove = [statement](std::vector<Statement*>& list) {
+        list.erase(std::remove(list.begin(), list.end(), statement), list.end());
+    };
+    if (!statement->declaredName.empty()) {
+        remove(declarations[statement->declaredName]);
+    }
+    for (const auto& name : statement->usedNames) {
+        remove(uses[name]);
+    }
+    if (!statement->procedureName.empty()) {
+        remove(procedures[statement->procedureName]);
+    }
+    for (const auto& name : statement->calledNames) {
+        remove(callers[name]);
+    }
+}
+
+// Re-parse statements after an edited region whose uses of name changed between
+// declared and undeclared because the region gained or lost a declaration
+void Document::recheckUses(const std::string& name, size_t regionStart, size_t regionEnd, ProcedureChanges& changes) {
+    if (isDeclaredBefore(name, regionStart)) return;
+
+    // Statements after the next declaration of name are unaffected (its own initializer is not)
+    size_t limit = std::numeric_limits<size_t>::max();
+    for (const Statement* statement : declarations[name]) {
+        size_t position = startOf(*statement);
+        if (position >= regionEnd) limit = std::min(limit, position);
+    }
+
+    std::vector<Statement*> users = uses[name];
+    for (Statement* statement : users) {
+        size_t position = startOf(*statement);
+        if (position < regionEnd || position > limit) continue;
+        if (reparse(*statement, changes)) recheckTasks(findStatement(position) + 1, changes);
+    }
+}
+
+// Re-parse the statements that call a procedure whose effects changed, from the offset noted with
+// it on. Callers that are procedures and change what they do in turn have their callers re-parsed
+// too, which ends as callers only see procedures defined before them.
+void Document::recheckCallers(ProcedureChanges& changes) {
+    while (!changes.empty()) {
+        auto change = changes.back();
+        changes.pop_back();
+        auto found = callers.find(change.first);
+        if (found == callers.end()) continue;
+        std::vector<Statement*> dependents = found->second;
+        for (Statement* statement : dependents) {
+            size_t position = startOf(*statement);
+            if (position >= change.second && reparse(*statement, changes)) {
+                recheckTasks(findStatement(position) + 1, changes);
+            }
+        }
+    }
+}
+
+// Re-parse the statements from index on while what the calls spawned before them and still running
+// read changed, as writes to it are reported
+void Document::recheckTasks(size_t index, ProcedureChanges& changes) {
+    while (index < statements.size() && reparse(*statements[index], changes)) index++;
+}
+
+// Re-parse a statement whose tokens did not change against what is declared and defined before it
+// now, noting the procedure it defines when that changed what it does. Returns true when what the
+// calls still running after it read changed.
+bool Document::reparse(Statement& statement, ProcedureChanges& changes) {
+    flush(statement);
+    size_t position = startOf(statement);
+    bool incomplete = false;
+    auto parsed = parseRegion(statement.tokens, position, tokenAfter(findStatement(position) + 1), incomplete);
+    if (parsed.size() != 1) return false;
+    reparsedStatements++;
+    Statement& next = *parsed[0];
+    if (statement.procedureName != next.procedureName) {
+        if (!statement.procedureName.empty()) changes.push_back({statement.procedureName, position + 1});
+        if (!next.procedureName.empty()) changes.push_back({next.procedureName, position + 1});
+    } else if (!next.procedureName.empty() && !sameEffects(statement.effects, next.effects)) {
+        changes.push_back({next.procedureName, position + 1});
+    }
+    // The tokens, and so the names used and called, are the same; only the procedure index may change
+    if (statement.procedureName != next.procedureName) {
+        if (!statement.procedureName.empty()) {
+            auto& list = procedures[statement.procedureName];
+            list.erase(std::remove(list.begin(), list.end(), &statement), list.end());
+        }
+        if (!next.procedureName.empty()) procedures[next.procedureName].push_back(&statement);
+    }
+    statement.node = next.node;
+    statement.diagnostics = std::move(next.diagnostics);
+    statement.procedureName = next.procedureName;
+    statement.effects = next.effects;
+    bool runningChanged = statement.runningAfter != next.runningAfter;
+    statement.runningAfter = std::move(next.runningAfter);
+    return runningChanged;
+}
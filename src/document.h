@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "token.h"
+#include "parser.h"
+
+// Source text that is kept lexed and parsed while it is being edited.
+// Each edit re-lexes from the start of the top-level statement in front of it
+// until the token stream lines up with an old statement boundary again, and
+// only the statements in between are re-parsed. Untouched statements keep
+// their tokens and AST nodes; their positions are shifted lazily. Statements
+// after the edit whose checks depend on what it changed, a declaration or
+// what a procedure does, are re-parsed as well.
+class Document {
+public:
+    Document(const std::string& text);
+
+    void applyEdit(size_t start, size_t end, const std::string& replacement);
+
+    const std::string& getText() const { return text; }
+    std::vector<Token> getTokens();
+    std::shared_ptr<ASTNode> getProgram();
+    Diagnostics getDiagnostics();
+
+    size_t getStatementCount() const { return statements.size(); }
+    size_t getRelexedTokenCount() const { return relexedTokens; }
+    size_t getReparsedStatementCount() const { return reparsedStatements; }
+    std::string getLexError() const;
+
+private:
+    // A top-level statement together with every token it consumed
+    struct Statement {
+        std::vector<Token> tokens;
+        std::shared_ptr<ASTNode> node; // nullptr for skipped or malformed input
+        Diagnostics diagnostics;
+        Diagnostics lexErrors;         // Of the text after its tokens, up to the next statement
+        std::string declaredName;      // Set for top-level declarations
+        VariableType declaredType = VariableType::UNKNOWN;
+        std::vector<std::string> usedNames; // Identifiers whose declaration affects the parse
+        std::string procedureName;     // Set for procedures
+        ProcedureEffects effects;      // Of the procedure, as the checks of its callers see them
+        std::vector<std::string> calledNames; // Procedures whose effects the checks of the statement read
+        RunningTasks runningAfter;     // What calls spawned by the main program and not synced read after it
+        long pendingOffset = 0;        // Position shift not yet applied to tokens and AST
+        int pendingLine = 0;
+    };
+
+    std::string text;
+    std::vector<std::unique_ptr<Statement>> statements;
+    Token endOfFile;
+    Diagnostics leadingLexErrors;      // Of the text in front of the first statement
+    size_t relexedTokens = 0;
+    size_t reparsedStatements = 0;
+
+    // Statements declaring or using each name, used to re-check statements
+    // whose identifiers became declared or undeclared after an edit
+    std::unordered_map<std::string, std::vector<Statement*>> declarations;
+    std::unordered_map<std::string, std::vector<Statement*>> uses;
+
+    // Statements defining or calling each procedure, used to re-check calls, spawns, parallel
+    // loops and for each loops after an edit changes what the procedure does or whether it yields
+    std::unordered_map<std::string, std::vector<Statement*>> procedures;
+    std::unordered_map<std::string, std::vector<Statement*>> callers;
+
+    // Numbers of the globals in the effects of every statement, shared by the parsers of each region
+    std::shared_ptr<GlobalNames> globals = std::make_shared<GlobalNames>();
+
+    // Procedures whose effects changed, with the offset their callers are re-checked from
+    using ProcedureChanges = std::vector<std::pair<std::string, size_t>>;
+
+    size_t startOf(const Statement& statement) const;
+    size_t findStatement(size_t offset) const;
+    const Token& tokenAfter(size_t index);
+    bool isDeclaredBefore(const std::string& name, size_t offset) const;
+    VariableType typeDeclaredBefore(const std::string& name, size_t offset) const;
+    std::vector<Token> lexFrom(size_t position, int line, int column, size_t resyncStart,
+                               long delta, size_t& resyncIndex, Diagnostics& lexErrors);
+    std::vector<std::unique_ptr<Statement>> parseRegion(const std::vector<Token>& tokens,
+                                                        size_t restartOffset, const Token& next, bool& incomplete);
+    void attachLexErrors(std::vector<std::unique_ptr<Statement>>& parsed, const Diagnostics& lexErrors,
+                         Statement* before);
+    void flush(Statement& statement);
+    void registerStatement(Statement* statement);
+    void unregisterStatement(Statement* statement);
+    void recheckUses(const std::string& name, size_t regionStart, size_t regionEnd, ProcedureChanges& changes);
+    void recheckCallers(ProcedureChanges& changes);
+    void recheckTasks(size_t index, ProcedureChanges& changes);
+    bool reparse(Statement& statement, ProcedureChanges& changes);
+    RunningTasks runningBefore(size_t offset) const;
+};
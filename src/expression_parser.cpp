@@ -1,27 +1,26 @@
 #include "expression_parser.h"
-#include <iostream>
 #include "statement_parser.h"
 
+namespace {
+
+// Builtins that take a whole array; a procedure of the same name is still called with numbers
+bool isArrayFunction(const std::string& name) {
+    return name == "length" || name == "sum" || name == "min" || name == "max";
+}
+
+bool isComparison(TokenType type) {
+    return type == TokenType::EQUAL || type == TokenType::NOT_EQUAL || type == TokenType::LESS ||
+           type == TokenType::GREATER || type == TokenType::LESS_EQUAL || type == TokenType::GREATER_EQUAL;
+}
+
+}
+
 // Parse an expression
 std::shared_ptr<ASTNode> ExpressionParser::parseExpression() {
-    if (parser.match(TokenType::OPEN_PAREN)) {
-        auto expr = parseExpression();
-        if (!parser.match(TokenType::CLOSE_PAREN)) {
-            std::cerr << "Expected ')' at line " << parser.peek().line 
-                      << ", column " << parser.peek().column << std::endl;
-            return nullptr;
-        }
-        return expr;
-    }
-    
-    // Check for procedure call first
-    if (parser.check(TokenType::IDENTIFIER) && 
-        parser.tokens[parser.currentPosition + 1].type == TokenType::OPEN_PAREN) {
-        return parser.statementParser->parseProcedureCall();
-    }
-    
-    // Check for assignment
     auto left = parsePrimary();
+    if (!left) {
+        return nullptr;
+    }
     while (parser.match(TokenType::PLUS) || parser.match(TokenType::MINUS) || 
            parser.match(TokenType::STAR) || parser.match(TokenType::SLASH) || 
            parser.match(TokenType::EQUAL) || parser.match(TokenType::NOT_EQUAL) || 
@@ -30,11 +29,13 @@ std::shared_ptr<ASTNode> ExpressionParser::parseExpression() {
         auto operatorToken = parser.previous();
         auto right = parsePrimary();
         if (!right) {
-            std::cerr << "Expected right operand after operator at line " 
-                      << operatorToken.line << ", column " << operatorToken.column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::EXPECTED_RIGHT_OPERAND, operatorToken);
             return nullptr;
         }
-        auto binaryOpNode = std::make_shared<ASTNode>(ASTNodeType::BINARY_OP, operatorToken);
+        if (isComparison(operatorToken.type) && (findArrayOperand(left) || findArrayOperand(right))) {
+            parser.getDiagnostics().report(DiagnosticCode::ARRAY_COMPARISON, operatorToken);
+        }
+        auto binaryOpNode = makeNode(ASTNodeType::BINARY_OP, operatorToken);
         binaryOpNode->children.push_back(left);
         binaryOpNode->children.push_back(right);
         left = binaryOpNode;
@@ -42,31 +43,187 @@ std::shared_ptr<ASTNode> ExpressionParser::parseExpression() {
     return left;
 }
 
+// Parse an expression that must be a number, such as a condition or an index
+std::shared_ptr<ASTNode> ExpressionParser::parseScalarExpression() {
+    auto expr = parseExpression();
+    if (const ASTNode* array = findArrayOperand(expr)) {
+        parser.getDiagnostics().report(DiagnosticCode::ARRAY_IN_SCALAR_CONTEXT, array->token);
+    }
+    return expr;
+}
+
+// Report arrays passed to a procedure, whose parameters are numbers
+void ExpressionParser::checkScalarArguments(const ASTNode& call) {
+    for (const auto& argument : call.children) {
+        if (const ASTNode* array = findArrayOperand(argument)) {
+            parser.getDiagnostics().report(DiagnosticCode::ARRAY_IN_SCALAR_CONTEXT, array->token);
+        }
+    }
+}
+
+// Report a name used as a channel that is not one
+void ExpressionParser::checkChannel(const Token& name) {
+    if (!parser.getSymbolTable().isVariableDeclared(name.lexeme)) {
+        parser.getDiagnostics().report(DiagnosticCode::UNDECLARED_VARIABLE, name);
+    } else if (parser.getSymbolTable().getVariableType(name.lexeme) != VariableType::CHANNEL) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CHANNEL, name);
+    }
+}
+
+// Parse the "(channel)" after receive, which waits for the next number sent on the channel
+std::shared_ptr<ASTNode> ExpressionParser::parseReceive() {
+    if (!parser.match(TokenType::OPEN_PAREN)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_OPEN_PAREN_AFTER_RECEIVE, parser.peek());
+        return nullptr;
+    }
+    if (!parser.match(TokenType::IDENTIFIER)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CHANNEL, parser.peek());
+        return nullptr;
+    }
+    auto channelToken = parser.previous();
+    checkChannel(channelToken);
+    if (!parser.match(TokenType::CLOSE_PAREN)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN, parser.peek());
+        return nullptr;
+    }
+    return makeNode(ASTNodeType::RECEIVE, channelToken);
+}
+
+// Parse the "[index]" after an array name
+std::shared_ptr<ASTNode> ExpressionParser::parseIndex(const Token& arrayToken) {
+    if (parser.getSymbolTable().getVariableType(arrayToken.lexeme) != VariableType::ARRAY) {
+        parser.getDiagnostics().report(parser.getSymbolTable().isVariableDeclared(arrayToken.lexeme)
+                                           ? DiagnosticCode::INDEX_OF_NON_ARRAY
+                                           : DiagnosticCode::UNDECLARED_VARIABLE,
+                                       arrayToken);
+    }
+    parser.advance(); // Consume '['
+    auto index = parseScalarExpression();
+    if (!index) {
+        return nullptr;
+    }
+    if (!parser.match(TokenType::CLOSE_BRACKET)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_BRACKET, parser.peek());
+        return nullptr;
+    }
+    auto indexNode = makeNode(ASTNodeType::INDEX, arrayToken);
+    indexNode->children.push_back(index);
+    return indexNode;
+}
+
 // Parse a primary expression
 std::shared_ptr<ASTNode> ExpressionParser::parsePrimary() {
+    // Procedure calls can be used as operands
+    if (parser.check(TokenType::IDENTIFIER) &&
+        parser.tokens[parser.currentPosition + 1].type == TokenType::OPEN_PAREN) {
+        auto call = parser.statementParser->parseProcedureCall();
+        if (call && isArrayFunction(call->token.lexeme) && call->children.size() == 1 &&
+            findArrayOperand(call->children[0])) {
+            call->type = ASTNodeType::ARRAY_FUNCTION;
+            return call;
+        }
+        if (call) checkScalarArguments(*call);
+        return call;
+    }
+
+    if (parser.check(TokenType::IDENTIFIER) &&
+        parser.tokens[parser.currentPosition + 1].type == TokenType::OPEN_BRACKET) {
+        return parseIndex(parser.advance());
+    }
+
     if (parser.match(TokenType::NUMBER)) {
-        return std::make_shared<ASTNode>(ASTNodeType::NUMBER, parser.previous());
+        return makeNode(ASTNodeType::NUMBER, parser.previous());
+    } else if (parser.match(TokenType::RECEIVE)) {
+        return parseReceive();
     } else if (parser.match(TokenType::IDENTIFIER)) {
         if (!parser.getSymbolTable().isVariableDeclared(parser.previous().lexeme)) {
-            std::cerr << "Undeclared variable: " << parser.previous().lexeme 
-                      << " at line " << parser.previous().line 
-                      << ", column " << parser.previous().column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::UNDECLARED_VARIABLE, parser.previous());
+        }
+        if (parser.getSymbolTable().getVariableType(parser.previous().lexeme) == VariableType::ARRAY) {
+            return makeNode(ASTNodeType::ARRAY_REFERENCE, parser.previous());
         }
-        return std::make_shared<ASTNode>(ASTNodeType::IDENTIFIER, parser.previous());
+        if (parser.getSymbolTable().getVariableType(parser.previous().lexeme) == VariableType::CHANNEL) {
+            parser.getDiagnostics().report(DiagnosticCode::CHANNEL_AS_NUMBER, parser.previous());
+        }
+        return makeNode(ASTNodeType::IDENTIFIER, parser.previous());
     } else if (parser.match(TokenType::STRING)) {
-        return std::make_shared<ASTNode>(ASTNodeType::STRING, parser.previous());
+        return makeNode(ASTNodeType::STRING, parser.previous());
     } else if (parser.match(TokenType::OPEN_PAREN)) {
         auto expr = parseExpression();
         if (!parser.match(TokenType::CLOSE_PAREN)) {
-            std::cerr << "Expected ')' at line " << parser.peek().line 
-                      << ", column " << parser.peek().column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN, parser.peek());
+            return nullptr;
         }
         return expr;
     }
 
     // Warn about unexpected token
-    std::cerr << "Unexpected token in expression: " << parser.peek().lexeme 
-              << " at line " << parser.peek().line 
-              << ", column " << parser.peek().column << std::endl;
-    return std::make_shared<ASTNode>(ASTNodeType::UNKNOWN, Token(TokenType::UNKNOWN, "", 0, 0));
-}
\ No newline at end of file
+    parser.getDiagnostics().report(DiagnosticCode::UNEXPECTED_TOKEN_IN_EXPRESSION, parser.peek());
+    return makeNode(ASTNodeType::UNKNOWN, Token(TokenType::UNKNOWN, "", 0, 0));
+}
+
+// Make every repeated operator expression of a statement, and of the statements parsed before it,
+// one node. Numbers and variables outside operators keep their own nodes. Runs once the analyses
+// of the statement have reported at the positions of its own nodes.
+void ExpressionParser::shareExpressions(ASTNode& statement) {
+    for (auto& child : statement.children) {
+        if (!child) continue;
+        if (child->type == ASTNodeType::BINARY_OP) {
+            const ASTNode* value;
+            child = shareOperator(child, value);
+        } else {
+            shareExpressions(*child);
+        }
+    }
+}
+
+// The node of an operator expression: one made earlier for the same operator and operand values,
+// or this one with its operands shared. value is set to the shared node, or null when the
+// expression has operands that are not shared, such as calls and array elements.
+std::shared_ptr<ASTNode> ExpressionParser::shareOperator(const std::shared_ptr<ASTNode>& node,
+                                                         const ASTNode*& value) {
+    const ASTNode* operands[2] = {nullptr, nullptr};
+    for (size_t i = 0; i < 2; i++) {
+        auto& operand = node->children[i];
+        if (operand->type == ASTNodeType::BINARY_OP) {
+            operand = shareOperator(operand, operands[i]);
+        } else {
+            shareExpressions(*operand);
+            operands[i] = sharedLeaf(operand);
+        }
+    }
+    value = nullptr;
+    if (!operands[0] || !operands[1]) return node;
+    auto shared = sharedExpressions.emplace(
+        ExpressionKey{ASTNodeType::BINARY_OP, node->token.type, operands[0], operands[1], {}}, node);
+    value = shared.first->second.get();
+    return shared.first->second;
+}
+
+// The first number or variable with the text of an operand, or null for other operands
+const ASTNode* ExpressionParser::sharedLeaf(const std::shared_ptr<ASTNode>& operand) {
+    if (operand->type != ASTNodeType::NUMBER && operand->type != ASTNodeType::IDENTIFIER) return nullptr;
+    ExpressionKey key{operand->type, TokenType::UNKNOWN, nullptr, nullptr, operand->token.lexeme};
+    return sharedExpressions.emplace(key, operand).first->second.get();
+}
+
+// Forget the shared expressions, so statements parsed next share none with those before
+void ExpressionParser::clearSharedExpressions() {
+    sharedExpressions.clear();
+}
+
+// Compare every field
+bool ExpressionParser::ExpressionKey::operator==(const ExpressionKey& other) const {
+    return type == other.type && operation == other.operation && left == other.left && right == other.right &&
+           text == other.text;
+}
+
+// Mix the fields
+size_t ExpressionParser::ExpressionKeyHash::operator()(const ExpressionKey& key) const {
+    size_t hash = std::hash<std::string_view>()(key.text);
+    for (size_t part : {static_cast<size_t>(key.type), static_cast<size_t>(key.operation),
+                        reinterpret_cast<size_t>(key.left), reinterpret_cast<size_t>(key.right)}) {
+        hash ^= part + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
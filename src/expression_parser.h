@@ -1,13 +1,42 @@
 #pragma once
 #include "parser.h"
+#include <string_view>
+#include <unordered_map>
 
 class ExpressionParser {
 public:
     ExpressionParser(Parser& parser) : parser(parser) {}
     
     std::shared_ptr<ASTNode> parseExpression();
+    std::shared_ptr<ASTNode> parseScalarExpression();
     std::shared_ptr<ASTNode> parsePrimary();
+    std::shared_ptr<ASTNode> parseIndex(const Token& arrayToken);
+    void checkScalarArguments(const ASTNode& call);
+    void checkChannel(const Token& name);
+    std::shared_ptr<ASTNode> parseReceive();
+    void shareExpressions(ASTNode& statement);
+    void clearSharedExpressions();
 
 private:
+    // What makes two expressions the same: a number or variable by its text, an
+    // operator by the values of its operands
+    struct ExpressionKey {
+        ASTNodeType type;
+        TokenType operation;
+        const ASTNode* left;
+        const ASTNode* right;
+        std::string_view text; // Lexeme of the node stored under the key
+        bool operator==(const ExpressionKey& other) const;
+    };
+    struct ExpressionKeyHash {
+        size_t operator()(const ExpressionKey& key) const;
+    };
+
+    std::shared_ptr<ASTNode> shareOperator(const std::shared_ptr<ASTNode>& node, const ASTNode*& value);
+    const ASTNode* sharedLeaf(const std::shared_ptr<ASTNode>& operand);
+
     Parser& parser;
+    // Operators over numbers and scalar variables, one node for each expression,
+    // and the first number or variable of each text
+    std::unordered_map<ExpressionKey, std::shared_ptr<ASTNode>, ExpressionKeyHash> sharedExpressions;
 };
\ No newline at end of file
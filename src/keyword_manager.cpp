@@ -5,6 +5,12 @@ KeywordManager::KeywordManager() {
     initializeKeywordMaps();
 }
 
+// The tables every lexer uses
+const KeywordManager& KeywordManager::shared() {
+    static const KeywordManager keywords;
+    return keywords;
+}
+
 // Initialize keyword maps
 void KeywordManager::initializeKeywordMaps() {
     keywordMap = {
@@ -12,17 +18,32 @@ void KeywordManager::initializeKeywordMaps() {
         {"else", TokenType::ELSE},
         {"elseif", TokenType::ELSEIF},
         {"while", TokenType::WHILE},
+        {"for", TokenType::FOR},
+        {"in", TokenType::IN},
+        {"from", TokenType::FROM},
+        {"to", TokenType::TO},
+        {"step", TokenType::STEP},
+        {"parallel", TokenType::PARALLEL},
+        {"reduce", TokenType::REDUCE},
+        {"spawn", TokenType::SPAWN},
+        {"sync", TokenType::SYNC},
+        {"channel", TokenType::CHANNEL},
+        {"send", TokenType::SEND},
+        {"receive", TokenType::RECEIVE},
         {"declare", TokenType::DECLARE},
         {"put", TokenType::PUT},
         {"then", TokenType::THEN},
         {"loop", TokenType::LOOP},
+        {"memo", TokenType::MEMO},
         {"procedure", TokenType::PROCEDURE},
         {"begin", TokenType::BEGIN},
         {"end", TokenType::END},
-        {"return", TokenType::RETURN}
+        {"return", TokenType::RETURN},
+        {"yield", TokenType::YIELD}
     };
 
     multiWordKeywordMap = {
+        {"for each", TokenType::FOR_EACH},
         {"end if", TokenType::END_IF},
         {"end loop", TokenType::END_LOOP},
         {"end procedure", TokenType::END_PROCEDURE}
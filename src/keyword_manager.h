@@ -6,6 +6,8 @@
 class KeywordManager {
 public:
     KeywordManager();
+    // Tables built on first use and only read afterwards, shared by every lexer on every thread
+    static const KeywordManager& shared();
     TokenType getKeywordType(const std::string& word) const;
     bool isMultiWordKeyword(const std::string& firstWord) const;
     TokenType getMultiWordKeywordType(const std::string& fullKeyword) const;
@@ -6,19 +6,40 @@
 
 // Constructor for Lexer class
 Lexer::Lexer(const std::string& sourceCode) 
-    : sourceCode(sourceCode), currentPosition(0), line(1), column(1) {
+    : Lexer(sourceCode, 0, 1, 1) {}
+
+// Constructor for a lexer that starts part way through the source code
+Lexer::Lexer(const std::string& sourceCode, size_t startPosition, int startLine, int startColumn)
+    : line(startLine), column(startColumn), currentPosition(startPosition), sourceCode(sourceCode) {
     scanner = std::make_unique<TokenScanner>(sourceCode, currentPosition, line, column);
-    keywordManager = std::make_unique<KeywordManager>();
+    keywordManager = &KeywordManager::shared();
 }
 
 // Tokenize the source code
 std::vector<Token> Lexer::tokenize() {
     std::vector<Token> tokens;
-    
-    while (!isAtEnd()) {
+    tokenize(tokens);
+    return tokens;
+}
+
+// Tokenize the source code into tokens, replacing what they held
+void Lexer::tokenize(std::vector<Token>& tokens) {
+    tokens.clear();
+    while (true) {
+        Token token = nextToken();
+        tokens.push_back(token);
+        if (token.type == TokenType::END_OF_FILE) break;
+    }
+}
+
+// Scan the next token, returning END_OF_FILE once the source is exhausted
+Token Lexer::nextToken() {
+    while (true) {
         skipWhitespace();
         
-        if (isAtEnd()) break;
+        if (isAtEnd()) {
+            return Token(TokenType::END_OF_FILE, "", line, column, currentPosition, 0);
+        }
         
         // Handle comments
         if (peek() == '/') {
@@ -30,53 +51,61 @@ std::vector<Token> Lexer::tokenize() {
                 continue;
             }
         }
+        break;
+    }
 
-        // Save position before scanning token
-        size_t startPos = currentPosition;
-        int startLine = line;
-        int startCol = column;
-        
-        Token token = scanner->scanToken();
+    // Save position before scanning token
+    size_t tokenStart = currentPosition;
+    size_t startPos = currentPosition;
+    int startLine = line;
+    int startCol = column;
+    
+    Token token = scanner->scanToken();
+
+    // Handle potential multi-word keywords
+    if (token.type == TokenType::IDENTIFIER) {
+        if (keywordManager->isMultiWordKeyword(token.lexeme)) {
+            savePosition(startPos, startLine, startCol);
+            
+            skipWhitespace();
+            if (!isAtEnd() && isalpha(peek())) {
+                std::string secondWord;
+                while (!isAtEnd() && (isalnum(peek()) || peek() == '_')) {
+                    secondWord += advance();
+                }
 
-        // Handle potential multi-word keywords
-        if (token.type == TokenType::IDENTIFIER) {
-            if (keywordManager->isMultiWordKeyword(token.lexeme)) {
-                savePosition(startPos, startLine, startCol);
-                
-                skipWhitespace();
-                if (!isAtEnd() && isalpha(peek())) {
-                    std::string secondWord;
-                    while (!isAtEnd() && (isalnum(peek()) || peek() == '_')) {
-                        secondWord += advance();
-                    }
-
-                    std::string combined = token.lexeme + " " + secondWord;
-                    TokenType multiWordType = keywordManager->getMultiWordKeywordType(combined);
-
-                    if (multiWordType != TokenType::UNKNOWN) {
-                        token = Token(multiWordType, combined, token.line, token.column);
-                    } else {
-                        restorePosition(startPos, startLine, startCol);
-                    }
+                std::string combined = token.lexeme + " " + secondWord;
+                TokenType multiWordType = keywordManager->getMultiWordKeywordType(combined);
+
+                if (multiWordType != TokenType::UNKNOWN) {
+                    token = Token(multiWordType, combined, token.line, token.column);
                 } else {
                     restorePosition(startPos, startLine, startCol);
                 }
+            } else {
+                restorePosition(startPos, startLine, startCol);
             }
+        }
 
-            // Check for single-word keywords
-            if (token.type == TokenType::IDENTIFIER) {
-                TokenType keywordType = keywordManager->getKeywordType(token.lexeme);
-                if (keywordType != TokenType::UNKNOWN) {
-                    token = Token(keywordType, token.lexeme, token.line, token.column);
-                }
+        // Check for single-word keywords
+        if (token.type == TokenType::IDENTIFIER) {
+            TokenType keywordType = keywordManager->getKeywordType(token.lexeme);
+            if (keywordType != TokenType::UNKNOWN) {
+                token = Token(keywordType, token.lexeme, token.line, token.column);
             }
         }
-
-        tokens.push_back(token);
     }
 
-    tokens.push_back(Token(TokenType::END_OF_FILE, "", line, column));
-    return tokens;
+    token.offset = tokenStart;
+    token.length = currentPosition - tokenStart;
+    return token;
+}
+
+// Skip the rest of the current line, used to recover after a lexical error
+void Lexer::skipToNextLine() {
+    while (!isAtEnd() && peek() != '\n') {
+        advance();
+    }
 }
 
 // Skip whitespace characters
@@ -98,6 +127,7 @@ void Lexer::skipComment() {
 
 // Skip multi-line comments
 void Lexer::skipMultilineComment() {
+    Token start(TokenType::UNKNOWN, "/*", line, column, currentPosition, 2);
     advance(); // Skip '/'
     advance(); // Skip '*'
     
@@ -110,7 +140,7 @@ void Lexer::skipMultilineComment() {
         advance();
     }
     
-    throw std::runtime_error("Unterminated multi-line comment");
+    throw LexError(DiagnosticCode::UNTERMINATED_COMMENT, start);
 }
 
 // Return the current character
@@ -1,24 +1,42 @@
 #pragma once
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <memory>
+#include "diagnostics.h"
 #include "token.h"
 #include "token_scanner.h"
 #include "keyword_manager.h"
 
+// Thrown for text no token can be made of: a string that reaches the end of its
+// line, or a comment that is never closed. The token is where it starts.
+class LexError : public std::runtime_error {
+public:
+    LexError(DiagnosticCode code, const Token& token)
+        : std::runtime_error(Diagnostics::messageOf(code)), code(code), token(token) {}
+
+    DiagnosticCode code;
+    Token token;
+};
+
 class Lexer {
 public:
     Lexer(const std::string& sourceCode);
+    Lexer(const std::string& sourceCode, size_t startPosition, int startLine, int startColumn);
     std::vector<Token> tokenize();
+    // Tokenize into tokens, reusing their storage
+    void tokenize(std::vector<Token>& tokens);
+    Token nextToken();
+    void skipToNextLine();
 
 private:
     int line;
     int column;
 
     size_t currentPosition;
-    std::string sourceCode;
+    const std::string& sourceCode;
     std::unique_ptr<TokenScanner> scanner;
-    std::unique_ptr<KeywordManager> keywordManager;
+    const KeywordManager* keywordManager;
 
     void skipWhitespace();
     void skipComment();
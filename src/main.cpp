@@ -1,17 +1,250 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <string>
-#include "lexer.h"
+#include "compiler.h"
 #include "parser.h"
 #include "codegen.h"
+#include "diagnostics.h"
+#include "stream_compiler.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "memory_stats.h"
+#include "profile.h"
+#include "compile_server.h"
+#include "toolchain.h"
+#include <map>
+#include <memory>
+
+namespace {
+
+// Build code with g++ into binary, reading it through a pipe. The messages of
+// a failed build are added to output. finalBinary names the files g++ writes
+// besides the binary, such as profiles, when binary is a temporary path.
+bool buildProgram(const std::string& code, const std::string& binary, const std::vector<std::string>& flags,
+                  double timeout, std::string& output, const std::string& finalBinary = "") {
+    Process process;
+    process.setPipedInput(true);
+    process.setTimeout(timeout);
+    std::string error;
+    if (!process.start(compilerArguments("-", binary, finalBinary.empty() ? binary : finalBinary, flags), error)) {
+        output += "Error: " + error + "\n";
+        return false;
+    }
+    process.input() << code;
+    ProcessResult result = process.wait();
+    if (!result.succeeded()) output += result.errorOutput;
+    return result.succeeded();
+}
+
+// Run a program built for profiling with its output discarded, killing it after
+// timeout seconds. profilePath, if not empty, is where an instrumented program
+// writes its profile. Why a run failed to start or finish is added to output.
+bool runProgram(const std::string& binary, const std::string& profilePath, double timeout, std::string& output) {
+    Process process;
+    process.setDiscardOutput(true);
+    process.setTimeout(timeout);
+    if (!profilePath.empty()) process.setEnvironment("PSEUDO_PROFILE", profilePath);
+    std::string error;
+    std::string path = std::filesystem::path(binary).has_parent_path() ? binary : "./" + binary;
+    if (!process.start({path}, error)) {
+        output += "Error: " + error + "\n";
+        return false;
+    }
+    ProcessResult result = process.wait();
+    if (result.timedOut) {
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%g", timeout);
+        output += std::string("Error: The training run did not finish within ") + seconds + " seconds\n";
+    }
+    return result.succeeded();
+}
+
+// Whole number after the '=' of an option. A value that is not one is reported.
+bool parseCount(const std::string& arg, size_t& count) {
+    std::string value = arg.substr(arg.find('=') + 1);
+    errno = 0;
+    unsigned long long parsed = std::strtoull(value.c_str(), nullptr, 10);
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || errno == ERANGE) {
+        std::cerr << "Error: " << arg.substr(0, arg.find('=')) << " needs a whole number, not '" << value << "'\n";
+        return false;
+    }
+    count = static_cast<size_t>(parsed);
+    return true;
+}
+
+// Seconds after the '=' of an option, 0 for no limit. A value that is not a number of seconds is reported.
+bool parseSeconds(const std::string& arg, double& seconds) {
+    std::string value = arg.substr(arg.find('=') + 1);
+    char* end = nullptr;
+    double parsed = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || !std::isfinite(parsed) || parsed < 0) {
+        std::cerr << "Error: " << arg.substr(0, arg.find('=')) << " needs a number of seconds, not '" << value
+                  << "'\n";
+        return false;
+    }
+    seconds = parsed;
+    return true;
+}
+
+}
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+    std::string filename;
+    std::vector<std::string> filenames;
+    bool streaming = false;
+    bool reportRecursion = false;
+    CompilerContext context; // A direct compile; what --stream and g++ report goes to its diagnostics too
+    Diagnostics& diagnostics = context.getDiagnostics();
+    DiagnosticFormat diagnosticFormat = DiagnosticFormat::TEXT;
+    bool timeReport = false;
+    bool perfReport = false;
+    bool memoryReport = false;
+    bool instrument = false;
+    std::string annotateProfile;
+    std::string profileUse;
+    bool pgo = false;
+    std::string traceFile;
+    ServerOptions server;
+    std::string clientSocket;
+    std::string outputBinary = "output";
+    std::string emitCpp;
+    double compileTimeout = 300;
+    double runTimeout = 300;
+    CodeTarget target = CodeTarget::CPP;
+    bool staticBinary = false;
+    bool checked = false;
+    bool partialEvaluation = true;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stream") {
+            streaming = true;
+        } else if (arg == "--diagnostics=json") {
+            diagnosticFormat = DiagnosticFormat::JSON;
+        } else if (arg == "--diagnostics=text") {
+            diagnosticFormat = DiagnosticFormat::TEXT;
+        } else if (arg.rfind("--error-limit=", 0) == 0) {
+            size_t limit = 0;
+            if (!parseCount(arg, limit)) return 1;
+            diagnostics.setLimit(limit);
+        } else if (arg == "--no-warnings") {
+            diagnostics.setWarningsEnabled(false);
+        } else if (arg == "--time-report") {
+            timeReport = true;
+        } else if (arg == "--perf-counters") {
+            perfReport = true;
+        } else if (arg == "--mem-report") {
+            memoryReport = true;
+        } else if (arg == "--instrument") {
+            instrument = true;
+        } else if (arg.rfind("--annotate=", 0) == 0) {
+            annotateProfile = arg.substr(11);
+        } else if (arg.rfind("--profile-use=", 0) == 0) {
+            profileUse = arg.substr(14);
+        } else if (arg == "--pgo") {
+            pgo = true;
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            traceFile = arg.substr(8);
+        } else if (arg.rfind("--server=", 0) == 0) {
+            server.socketPath = arg.substr(9);
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            size_t workers = 0;
+            if (!parseCount(arg, workers)) return 1;
+            server.workers = static_cast<unsigned>(workers);
+        } else if (arg.rfind("--output=", 0) == 0) {
+            outputBinary = arg.substr(9);
+        } else if (arg.rfind("--emit-cpp=", 0) == 0) {
+            emitCpp = arg.substr(11);
+        } else if (arg.rfind("--compile-timeout=", 0) == 0) {
+            if (!parseSeconds(arg, compileTimeout)) return 1;
+        } else if (arg.rfind("--run-timeout=", 0) == 0) {
+            if (!parseSeconds(arg, runTimeout)) return 1;
+        } else if (arg == "--target=c") {
+            target = CodeTarget::C;
+        } else if (arg == "--target=c++") {
+            target = CodeTarget::CPP;
+        } else if (arg == "--static") {
+            staticBinary = true;
+        } else if (arg == "--checked") {
+            checked = true;
+        } else if (arg == "--no-partial-evaluation") {
+            partialEvaluation = false;
+        } else if (arg == "--report-recursion") {
+            reportRecursion = true;
+        } else if (arg.rfind("--client=", 0) == 0) {
+            clientSocket = arg.substr(9);
+        } else {
+            filename = arg;
+            filenames.push_back(arg);
+        }
+    }
+
+    // Serve compiles to clients, or be one
+    if (!server.socketPath.empty()) {
+        server.compileTimeout = compileTimeout;
+        return runServer(server);
+    }
+    // Count from the start so that frees in the report match allocations in it
+    if (memoryReport) {
+        MemoryStats::enable();
+    }
+
+    if (filename.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--stream] [--diagnostics=text|json] [--error-limit=N] [--no-warnings]"
+                  << " [--time-report] [--trace=<file>] [--perf-counters] [--mem-report]"
+                  << " [--instrument] [--annotate=<profile>] [--profile-use=<profile>] [--pgo]"
+                  << " [--output=<binary>] [--emit-cpp=<file>] [--compile-timeout=<seconds>] [--run-timeout=<seconds>]"
+                  << " [--target=c++|c] [--static] [--checked] [--no-partial-evaluation] [--report-recursion] <filename>\n"
+                  << "       " << argv[0] << " --server=<socket> [--workers=N]\n"
+                  << "       " << argv[0] << " --client=<socket> <filename|->..." << std::endl;
+        return 1;
+    }
+    bool usingProfile = pgo || !profileUse.empty();
+    if ((instrument || usingProfile) && streaming) {
+        std::cerr << "Error: --instrument, --profile-use and --pgo cannot be combined with --stream\n";
+        return 1;
+    }
+    if (instrument && usingProfile) {
+        std::cerr << "Error: --instrument cannot be combined with --profile-use or --pgo\n";
+        return 1;
+    }
+    if (target == CodeTarget::C && (streaming || instrument || pgo)) {
+        std::cerr << "Error: --target=c cannot be combined with --stream, --instrument or --pgo\n";
+        return 1;
+    }
+    if ((reportRecursion || checked) && streaming) {
+        std::cerr << "Error: --report-recursion and --checked cannot be combined with --stream\n";
+        return 1;
+    }
+    if (staticBinary && target != CodeTarget::C) {
+        std::cerr << "Error: --static needs --target=c\n";
         return 1;
     }
 
-    std::string filename = argv[1];
+    // The server builds with --output, --target=c, --static, --checked and --no-partial-evaluation; the other
+    // flags only work directly
+    if (!clientSocket.empty()) {
+        if (streaming || instrument || usingProfile || !annotateProfile.empty() || !emitCpp.empty() ||
+            reportRecursion || diagnosticFormat != DiagnosticFormat::TEXT) {
+            std::cerr << "Error: --client cannot be combined with --stream, --instrument, --annotate, --profile-use,"
+                      << " --pgo, --emit-cpp, --report-recursion or --diagnostics=json\n";
+            return 1;
+        }
+        if (filenames.size() > 1 && outputBinary != "output") {
+            std::cerr << "Error: --output needs a single file with --client\n";
+            return 1;
+        }
+        ClientOptions clientOptions;
+        clientOptions.outputBinary = outputBinary;
+        clientOptions.target = target;
+        clientOptions.staticBinary = staticBinary;
+        clientOptions.checked = checked;
+        clientOptions.partialEvaluation = partialEvaluation;
+        return runClient(clientSocket, filenames, clientOptions);
+    }
 
     // Open PseudoLang source file
     std::ifstream sourceFile(filename);
@@ -20,44 +253,271 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Read the file into a string
-    std::string sourceCode((std::istreambuf_iterator<char>(sourceFile)), 
-                            std::istreambuf_iterator<char>());
+    // Print the source annotated with a profile from an instrumented run instead of compiling
+    if (!annotateProfile.empty()) {
+        std::ifstream profileFile(annotateProfile);
+        if (!profileFile) {
+            std::cerr << "Error: Could not open file " << annotateProfile << "\n";
+            return 1;
+        }
+        Profile profile;
+        std::string error;
+        if (!profile.load(profileFile, error)) {
+            std::cerr << "Error: " << annotateProfile << ": " << error << "\n";
+            return 1;
+        }
+        std::string source((std::istreambuf_iterator<char>(sourceFile)), std::istreambuf_iterator<char>());
+        profile.renderListing(std::cout, source);
+        return 0;
+    }
 
-    // Create lexer and tokenize input
-    Lexer lexer(sourceCode);
-    auto tokens = lexer.tokenize();
+    // Profile from an earlier instrumented run
+    Profile profile;
+    if (!profileUse.empty()) {
+        std::ifstream profileFile(profileUse);
+        std::string error;
+        if (!profileFile) {
+            std::cerr << "Error: Could not open file " << profileUse << "\n";
+            return 1;
+        }
+        if (!profile.load(profileFile, error)) {
+            std::cerr << "Error: " << profileUse << ": " << error << "\n";
+            return 1;
+        }
+    }
 
-    // Create parser and parse tokens into AST
-    Parser parser(tokens);
-    auto ast = parser.parse();
+    // --pgo keeps both profiles in a directory of its own next to the binary, removed on exit
+    std::unique_ptr<TemporaryDirectory> pgoDirectory;
+    if (pgo) {
+        pgoDirectory = std::make_unique<TemporaryDirectory>(outputBinary + "-pgo");
+        if (pgoDirectory->getPath().empty()) {
+            std::cerr << "Error: Could not create a directory for the profiles next to " << outputBinary << "\n";
+            return 1;
+        }
+    }
 
-    if (!ast) {
-        std::cerr << "Parsing failed!" << std::endl;
-        return 1;
+    // g++ reads the C++ through a pipe; --emit-cpp also writes it to a file
+    std::ofstream cppFile;
+    if (!emitCpp.empty()) {
+        cppFile.open(emitCpp);
+        if (!cppFile) {
+            std::cerr << "Error: Could not open file " << emitCpp << "\n";
+            return 1;
+        }
     }
 
-    // Generate code from AST
-    CodeGenerator generator;
-    std::string cppCode = generator.generateCode(ast);
+    // Time the pipeline phases when asked to report them
+    Tracer tracer;
+    if (timeReport || perfReport || memoryReport || !traceFile.empty()) {
+        Tracer::setCurrent(&tracer);
+    }
 
-    // Write the C++ code to a file
-    std::string outputCppFile = "output.cpp";
-    std::ofstream cppFile(outputCppFile);
-    if(!cppFile) {
-        std::cerr << "Error: Could not open file " << outputCppFile << "\n";
-        return 1;
+    // Heap allocations per phase and per AST node type in codegen
+    std::unique_ptr<AllocationBreakdown> codegenAllocations;
+    std::vector<NodeMemory> astMemory;
+    if (memoryReport) {
+        tracer.setMemoryAccounting(true);
+        codegenAllocations = std::make_unique<AllocationBreakdown>(static_cast<size_t>(ASTNodeType::UNKNOWN) + 1);
+    }
+
+    // Hardware counters per phase and per AST node type in codegen, when the kernel allows it
+    std::unique_ptr<PerfCounters> counters;
+    std::unique_ptr<PerfBreakdown> codegenCounters;
+    if (perfReport) {
+        counters = std::make_unique<PerfCounters>();
+        if (counters->isAvailable()) {
+            tracer.setCounters(counters.get());
+            codegenCounters = std::make_unique<PerfBreakdown>(*counters, static_cast<size_t>(ASTNodeType::UNKNOWN) + 1);
+        } else {
+            std::cerr << "Warning: hardware counters unavailable, " << counters->getError() << "\n";
+        }
+    }
+
+    // g++ messages about PseudoLang lines become diagnostics, through the #line markers of the C++
+    const std::map<int, int>& lineColumns = context.getLineColumns();
+    std::string compilerOutput;
+    const std::string& cppCode = context.getCpp();
+    std::unique_ptr<ProgramBuild> streamBuild;
+    if (streaming) {
+        // Compile statement by statement without holding the whole program in memory. g++ reads
+        // the statements as they are generated, unless they go to a file first.
+        TraceScope phase("phase", "stream");
+        streamBuild = std::make_unique<ProgramBuild>(emitCpp.empty() ? "-" : emitCpp, outputBinary,
+                                                     std::vector<std::string>(), compileTimeout);
+        std::string error;
+        if (emitCpp.empty() && !streamBuild->start(error)) {
+            std::cerr << "Error: " << error << "\n";
+            return 1;
+        }
+        StreamCompiler compiler(sourceFile, emitCpp.empty() ? streamBuild->input() : cppFile, diagnostics, filename);
+        if (!compiler.compile()) {
+            std::cerr << "Error: Could not write " << (emitCpp.empty() ? "to g++" : emitCpp) << "\n";
+            return 1;
+        }
+
+        // A program with errors is not built; destroying the build stops g++
+        if (diagnostics.hasErrors()) {
+            diagnostics.render(std::cerr, diagnosticFormat);
+            return 1;
+        }
+        if (!emitCpp.empty()) {
+            phase.addCount("bytes emitted", static_cast<uint64_t>(cppFile.tellp()));
+            cppFile.close();
+            if (!streamBuild->start(error)) {
+                std::cerr << "Error: " << error << "\n";
+                return 1;
+            }
+        }
+    } else {
+        // Read the file into a string
+        std::string sourceCode;
+        {
+            TraceScope phase("phase", "read");
+            sourceCode.assign(std::istreambuf_iterator<char>(sourceFile), std::istreambuf_iterator<char>());
+            phase.addCount("bytes", sourceCode.size());
+        }
+
+        CompileOptions options;
+        options.instrumented = instrument;
+        options.profile = usingProfile ? &profile : nullptr;
+        options.sourceName = filename;
+        options.target = target;
+        options.checked = checked;
+        options.partialEvaluation = partialEvaluation;
+        options.reportRecursion = reportRecursion;
+        options.perfBreakdown = codegenCounters.get();
+        options.allocationBreakdown = codegenAllocations.get();
+
+        // --pgo: compile the program instrumented, build it and run it once for the profile used below
+        if (pgo) {
+            TraceScope phase("phase", "training run");
+            CompileOptions training;
+            training.instrumented = true;
+            training.reportRecursion = reportRecursion;
+            context.setOptions(training);
+            if (!context.compile(sourceCode)) {
+                diagnostics.render(std::cerr, diagnosticFormat);
+                return 1;
+            }
+            std::string trainingBinary = uniqueOutputPath(outputBinary + "-training");
+            std::string profilePath = pgoDirectory->getPath() + "/training.profile";
+            bool trained = buildProgram(cppCode, trainingBinary, {}, compileTimeout, compilerOutput) &&
+                           runProgram(trainingBinary, profilePath, runTimeout, compilerOutput);
+            std::remove(trainingBinary.c_str());
+            if (!trained) {
+                std::cerr << compilerOutput << "Error: The instrumented training run failed\n";
+                return 1;
+            }
+            std::ifstream profileFile(profilePath);
+            std::string error;
+            if (!profile.load(profileFile, error)) {
+                std::cerr << "Error: " << profilePath << ": " << error << "\n";
+                return 1;
+            }
+        }
+
+        // Lex, parse and generate code. A program with errors is not generated or built, so
+        // neither g++ nor a binary with them follows.
+        context.setOptions(options);
+        bool generated = context.compile(sourceCode);
+        if (memoryReport) astMemory = measureAstMemory(context.getProgram());
+        if (!generated) {
+            diagnostics.render(std::cerr, diagnosticFormat);
+            return 1;
+        }
+
+        // Keep a copy of the C++ when asked to
+        if (!emitCpp.empty()) {
+            TraceScope phase("phase", "write");
+            cppFile << cppCode;
+            cppFile.close();
+            phase.addCount("bytes", cppCode.size());
+        }
     }
-    cppFile << cppCode;
-    cppFile.close();
 
     // Compile the generated C++ code
-    std::string compileCommand = "g++ " + outputCppFile + " -o output";
-    if (system(compileCommand.c_str()) != 0) {
-        std::cerr << "Error: Could not compile the generated C++ code\n";
+    std::vector<std::string> compileFlags;
+    bool compiled = true;
+    if (pgo) {
+        // Record g++'s own profile of exactly this code, for -fprofile-use below
+        TraceScope phase("phase", "training run (g++)");
+        std::string generatingBinary = uniqueOutputPath(outputBinary);
+        compiled = buildProgram(cppCode, generatingBinary,
+                                {"-O2", "-fprofile-generate", "-fprofile-dir=" + pgoDirectory->getPath()},
+                                compileTimeout, compilerOutput, outputBinary) &&
+                   runProgram(generatingBinary, "", runTimeout, compilerOutput);
+        std::remove(generatingBinary.c_str());
+    }
+    if (usingProfile) {
+        // Without data from --pgo, g++ finds no profile for the code and just optimizes
+        compileFlags = {"-O2", "-fprofile-use", "-fprofile-correction", "-Wno-missing-profile",
+                        "-Wno-coverage-mismatch"};
+        if (pgo) compileFlags.push_back("-fprofile-dir=" + pgoDirectory->getPath());
+    }
+    if (staticBinary) {
+        std::vector<std::string> flags = staticFlags();
+        compileFlags.insert(compileFlags.end(), flags.begin(), flags.end());
+    }
+    if (compiled) {
+        TraceScope phase("phase", "compile (g++)");
+        if (streamBuild) {
+            compiled = streamBuild->finish(filename, lineColumns, diagnostics, compilerOutput);
+        } else {
+            ProgramBuild build("-", outputBinary, compileFlags, compileTimeout,
+                               target == CodeTarget::C ? "c" : "c++");
+            std::string error;
+            if (build.start(error)) {
+                build.input() << cppCode;
+                compiled = build.finish(filename, lineColumns, diagnostics, compilerOutput);
+            } else {
+                compilerOutput += "Error: " + error + "\n";
+                compiled = false;
+            }
+        }
+    }
+
+    // Report everything the parser and g++ found in one write
+    diagnostics.render(std::cerr, diagnosticFormat);
+    std::cerr << compilerOutput;
+
+    Tracer::setCurrent(nullptr);
+    if (timeReport) {
+        tracer.renderReport(std::cerr);
+    }
+    if (perfReport && counters->isAvailable()) {
+        tracer.renderCounterReport(std::cerr);
+        std::vector<std::pair<std::string, PerfSample>> rows;
+        for (size_t i = 0; i <= static_cast<size_t>(ASTNodeType::UNKNOWN); i++) {
+            if (codegenCounters->getEntries(i) == 0) continue;
+            rows.emplace_back(nodeTypeName(static_cast<ASTNodeType>(i)), codegenCounters->getTotal(i));
+        }
+        counters->renderTable(std::cerr, "Codegen node", rows);
+    }
+    if (memoryReport) {
+        tracer.renderMemoryReport(std::cerr);
+        if (!astMemory.empty()) renderAstMemoryTable(std::cerr, astMemory);
+        std::vector<std::pair<std::string, AllocationSample>> rows;
+        for (size_t i = 0; i <= static_cast<size_t>(ASTNodeType::UNKNOWN); i++) {
+            if (codegenAllocations->getEntries(i) == 0) continue;
+            rows.emplace_back(nodeTypeName(static_cast<ASTNodeType>(i)), codegenAllocations->getTotal(i));
+        }
+        if (!rows.empty()) renderAllocationTable(std::cerr, "Codegen node", rows);
+    }
+    if (!traceFile.empty()) {
+        std::ofstream traceOut(traceFile);
+        if (!traceOut) {
+            std::cerr << "Error: Could not open file " << traceFile << "\n";
+            return 1;
+        }
+        tracer.writeChromeTrace(traceOut);
+    }
+
+    if (!compiled) {
+        std::cerr << "Error: Could not compile the generated code\n";
         return 1;
     }
 
-    std::cout << "Compilation successful! Run the program with './output'\n";
+    std::string command = std::filesystem::path(outputBinary).has_parent_path() ? outputBinary : "./" + outputBinary;
+    std::cout << "Compilation successful! Run the program with '" << command << "'\n";
     return 0;
-}
\ No newline at end of file
+}
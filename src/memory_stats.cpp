@@ -0,0 +1,235 @@
+#include "memory_stats.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_set>
+#include <unistd.h>
+#include "parser.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+std::atomic<bool> countingEnabled{false};
+thread_local AllocationSample counts;
+thread_local int64_t peakLive = 0;
+
+// Bytes actually reserved for a block returned by malloc
+size_t blockSize(void* pointer) {
+#ifdef __GLIBC__
+    return malloc_usable_size(pointer);
+#else
+    (void)pointer;
+    return 0;
+#endif
+}
+
+// Allocator that remembers the size of the block it hands out
+template <typename T>
+struct MeasuringAllocator {
+    using value_type = T;
+    size_t* bytes;
+
+    explicit MeasuringAllocator(size_t* bytes) : bytes(bytes) {}
+    template <typename U>
+    MeasuringAllocator(const MeasuringAllocator<U>& other) : bytes(other.bytes) {}
+
+    T* allocate(size_t count) {
+        void* pointer = ::operator new(count * sizeof(T));
+        *bytes = blockSize(pointer);
+        return static_cast<T*>(pointer);
+    }
+    void deallocate(T* pointer, size_t) { ::operator delete(pointer); }
+};
+
+template <typename T, typename U>
+bool operator==(const MeasuringAllocator<T>&, const MeasuringAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const MeasuringAllocator<T>&, const MeasuringAllocator<U>&) { return false; }
+
+// Heap bytes of a string's buffer, 0 when it fits in the small-string buffer
+uint64_t stringBytes(const std::string& text) {
+    const char* data = text.data();
+    const char* object = reinterpret_cast<const char*>(&text);
+    if (data >= object && data < object + sizeof(text)) return 0;
+    return blockSize(const_cast<char*>(data));
+}
+
+}
+
+// Difference between two samples
+AllocationSample AllocationSample::operator-(const AllocationSample& other) const {
+    AllocationSample difference;
+    difference.allocations = allocations - other.allocations;
+    difference.frees = frees - other.frees;
+    difference.allocatedBytes = allocatedBytes - other.allocatedBytes;
+    difference.freedBytes = freedBytes - other.freedBytes;
+    return difference;
+}
+
+// Add another sample to this one
+AllocationSample& AllocationSample::operator+=(const AllocationSample& other) {
+    allocations += other.allocations;
+    frees += other.frees;
+    allocatedBytes += other.allocatedBytes;
+    freedBytes += other.freedBytes;
+    return *this;
+}
+
+// Start counting allocations on all threads
+void MemoryStats::enable() {
+    countingEnabled.store(true, std::memory_order_relaxed);
+}
+
+// Check if allocations are being counted
+bool MemoryStats::isEnabled() {
+    return countingEnabled.load(std::memory_order_relaxed);
+}
+
+// Count a block just allocated, when counting is on
+void MemoryStats::countAllocation(void* pointer) {
+    if (!countingEnabled.load(std::memory_order_relaxed)) return;
+    counts.allocations++;
+    counts.allocatedBytes += blockSize(pointer);
+    int64_t live = counts.liveBytes();
+    if (live > peakLive) peakLive = live;
+}
+
+// Count a block about to be freed, when counting is on
+void MemoryStats::countFree(void* pointer) {
+    if (!countingEnabled.load(std::memory_order_relaxed)) return;
+    counts.frees++;
+    counts.freedBytes += blockSize(pointer);
+}
+
+// Allocation totals of the current thread
+AllocationSample MemoryStats::read() {
+    return counts;
+}
+
+// Highest live byte count of the current thread
+int64_t MemoryStats::peakLiveBytes() {
+    return peakLive;
+}
+
+// Restart the peak from the current live count, returning the old peak
+int64_t MemoryStats::swapPeak() {
+    int64_t old = peakLive;
+    peakLive = counts.liveBytes();
+    return old;
+}
+
+// Make the peak at least bytes
+void MemoryStats::raisePeak(int64_t bytes) {
+    if (bytes > peakLive) peakLive = bytes;
+}
+
+// Resident set size from /proc/self/statm
+uint64_t MemoryStats::residentBytes() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    int fields = fscanf(file, "%llu %llu", &size, &resident);
+    fclose(file);
+    return fields == 2 ? resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// Size of the block make_shared uses for a node and its control block
+uint64_t MemoryStats::nodeBlockBytes() {
+    static const uint64_t bytes = [] {
+        size_t size = 0;
+        std::allocate_shared<ASTNode>(MeasuringAllocator<ASTNode>(&size), ASTNodeType::UNKNOWN,
+                                      Token(TokenType::UNKNOWN, "", 0, 0));
+        return static_cast<uint64_t>(size);
+    }();
+    return bytes;
+}
+
+// Memory held by a tree, indexed by ASTNodeType; shared subtrees are counted once
+std::vector<NodeMemory> measureAstMemory(const std::shared_ptr<ASTNode>& root) {
+    std::vector<NodeMemory> memory(static_cast<size_t>(ASTNodeType::UNKNOWN) + 1);
+    std::unordered_set<const ASTNode*> visited;
+    std::vector<const ASTNode*> pending;
+    if (root) pending.push_back(root.get());
+    while (!pending.empty()) {
+        const ASTNode* node = pending.back();
+        pending.pop_back();
+        if (!visited.insert(node).second) continue;
+
+        NodeMemory& entry = memory[static_cast<size_t>(node->type)];
+        entry.nodes++;
+        entry.bytes += MemoryStats::nodeBlockBytes() + stringBytes(node->token.lexeme);
+        if (node->children.capacity() > 0) {
+            entry.bytes += blockSize(const_cast<std::shared_ptr<ASTNode>*>(node->children.data()));
+        }
+        for (const auto& child : node->children) {
+            if (child) pending.push_back(child.get());
+        }
+    }
+    return memory;
+}
+
+// Print the node count and bytes of every node type present in a tree
+void renderAstMemoryTable(std::ostream& out, const std::vector<NodeMemory>& memory) {
+    std::string report;
+    char line[160];
+    snprintf(line, sizeof(line), "%-18s %12s %12s %12s\n", "AST node", "Nodes", "KB", "Bytes/node");
+    report += line;
+    NodeMemory total;
+    for (size_t i = 0; i < memory.size(); i++) {
+        if (memory[i].nodes == 0) continue;
+        snprintf(line, sizeof(line), "%-18s %12llu %12.1f %12.1f\n", nodeTypeName(static_cast<ASTNodeType>(i)),
+                 static_cast<unsigned long long>(memory[i].nodes), memory[i].bytes / 1024.0,
+                 static_cast<double>(memory[i].bytes) / memory[i].nodes);
+        report += line;
+        total.nodes += memory[i].nodes;
+        total.bytes += memory[i].bytes;
+    }
+    snprintf(line, sizeof(line), "%-18s %12llu %12.1f\n", "total", static_cast<unsigned long long>(total.nodes),
+             total.bytes / 1024.0);
+    report += line;
+    out << report;
+}
+
+// Constructor for the AllocationBreakdown class
+AllocationBreakdown::AllocationBreakdown(size_t keyCount) : totals(keyCount), entries(keyCount) {}
+
+// Charge the allocations since the last enter or leave to the innermost region
+void AllocationBreakdown::charge() {
+    AllocationSample now = MemoryStats::read();
+    if (!stack.empty()) totals[stack.back()] += now - last;
+    last = now;
+}
+
+// Start a region nested in the current one
+void AllocationBreakdown::enter(size_t key) {
+    charge();
+    stack.push_back(key);
+    entries[key]++;
+}
+
+// End the innermost region
+void AllocationBreakdown::leave() {
+    charge();
+    stack.pop_back();
+}
+
+// Print one row per (name, sample) with counts and sizes
+void renderAllocationTable(std::ostream& out, const char* title,
+                           const std::vector<std::pair<std::string, AllocationSample>>& rows) {
+    std::string report;
+    char line[160];
+    snprintf(line, sizeof(line), "%-18s %12s %12s %14s %12s\n", title, "Allocs", "Frees", "Allocated KB", "Net KB");
+    report += line;
+    for (const auto& row : rows) {
+        const AllocationSample& sample = row.second;
+        snprintf(line, sizeof(line), "%-18s %12llu %12llu %14.1f %12.1f\n", row.first.c_str(),
+                 static_cast<unsigned long long>(sample.allocations), static_cast<unsigned long long>(sample.frees),
+                 sample.allocatedBytes / 1024.0, sample.liveBytes() / 1024.0);
+        report += line;
+    }
+    out << report;
+}
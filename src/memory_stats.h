@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ASTNode;
+
+// Heap activity of one thread, or the difference between two points
+struct AllocationSample {
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    uint64_t allocatedBytes = 0;
+    uint64_t freedBytes = 0;
+
+    int64_t liveBytes() const { return static_cast<int64_t>(allocatedBytes - freedBytes); }
+    AllocationSample operator-(const AllocationSample& other) const;
+    AllocationSample& operator+=(const AllocationSample& other);
+};
+
+// Counts made by the replacement global operator new and delete in
+// allocation_hooks.cpp. Counting is off until enable() is called and then costs
+// a few thread-local increments per allocation; the counters belong to the
+// allocating thread. Sizes are the usable size of each block, so freeing a
+// block counts the same bytes as allocating it. The compiler library leaves
+// allocation_hooks.cpp out, so programs embedding it keep their own operator
+// new; everything here still works there, but counts nothing.
+class MemoryStats {
+public:
+    static void enable();
+    static bool isEnabled();
+
+    // Called by the replacement operator new and delete
+    static void countAllocation(void* pointer);
+    static void countFree(void* pointer);
+
+    // Totals for the current thread since counting was enabled
+    static AllocationSample read();
+
+    // Highest live byte count on this thread; swapPeak() restarts it from the
+    // current live count and returns the old value, so nested regions can
+    // measure their own peak and then fold it back into the enclosing one
+    static int64_t peakLiveBytes();
+    static int64_t swapPeak();
+    static void raisePeak(int64_t bytes);
+
+    // Resident set size of the process, 0 when it cannot be read
+    static uint64_t residentBytes();
+
+    // Heap bytes of one make_shared<ASTNode>, measured once
+    static uint64_t nodeBlockBytes();
+};
+
+// Heap memory held by the nodes of one type in an AST
+struct NodeMemory {
+    uint64_t nodes = 0;
+    uint64_t bytes = 0; // Node blocks, children arrays and long lexemes
+};
+
+// Memory held by a tree, indexed by ASTNodeType
+std::vector<NodeMemory> measureAstMemory(const std::shared_ptr<ASTNode>& root);
+void renderAstMemoryTable(std::ostream& out, const std::vector<NodeMemory>& memory);
+
+// Splits allocations between nested regions by key (e.g. AST node type),
+// charging each region only while it is innermost, like PerfBreakdown.
+class AllocationBreakdown {
+public:
+    explicit AllocationBreakdown(size_t keyCount);
+
+    void enter(size_t key);
+    void leave();
+
+    const AllocationSample& getTotal(size_t key) const { return totals[key]; }
+    uint64_t getEntries(size_t key) const { return entries[key]; }
+
+private:
+    std::vector<AllocationSample> totals;
+    std::vector<uint64_t> entries;
+    std::vector<size_t> stack;
+    AllocationSample last;
+
+    void charge();
+};
+
+// Print one row per (name, sample) with counts and sizes
+void renderAllocationTable(std::ostream& out, const char* title,
+                           const std::vector<std::pair<std::string, AllocationSample>>& rows);
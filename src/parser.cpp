@@ -1,12 +1,11 @@
 #include "parser.h"
 #include "statement_parser.h"
 #include "expression_parser.h"
-#include <iostream>
 #include <algorithm>
 
 // Constructor for the Parser class
-Parser::Parser(const std::vector<Token>& tokens) 
-    : tokens(tokens), currentPosition(0) {
+Parser::Parser(std::vector<Token> tokens, Diagnostics& diagnostics) 
+    : tokens(std::move(tokens)), currentPosition(0), diagnostics(&diagnostics) {
     symbolTable.enterScope(); // Enter global scope
     statementParser = std::make_unique<StatementParser>(*this); // Initialize statement parser
     expressionParser = std::make_unique<ExpressionParser>(*this); // Initialize expression parser
@@ -17,70 +16,164 @@ std::shared_ptr<ASTNode> Parser::parse() {
     return parseProgram();
 }
 
+// Replace the tokens being parsed, keeping the symbol table for the next statements. They share
+// no expressions with the statements before, so the table of those does not grow without end.
+void Parser::setTokens(std::vector<Token> newTokens) {
+    tokens = std::move(newTokens);
+    currentPosition = 0;
+    expressionParser->clearSharedExpressions();
+}
+
 // Parse the entire program
 std::shared_ptr<ASTNode> Parser::parseProgram() {
-    auto programNode = std::make_shared<ASTNode>(ASTNodeType::PROGRAM, Token(TokenType::UNKNOWN, "", 0, 0));
+    auto programNode = makeNode(ASTNodeType::PROGRAM, Token(TokenType::UNKNOWN, "", 0, 0));
     
     while (!isAtEnd()) {
-        // Skip whitespaces and extra semicolons
-        while (!isAtEnd() && (isWhitespace(peek()) || peek().type == TokenType::SEMICOLON)) {
-            if (peek().type == TokenType::SEMICOLON) {
-                // Warn about extra semicolons
-                std::cerr << "Warning: Extra semicolon at line " << peek().line 
-                          << ", column " << peek().column << std::endl;
-            }
-            advance();
-        }
-        
-        if (isAtEnd()) break; // Check for end of file
-        
-        // Parse statements based on current token type
-        if (match(TokenType::DECLARE)) {
-            auto node = statementParser->parseDeclaration();
-            if (node) programNode->children.push_back(node);
-        } else if (match(TokenType::PROCEDURE)) {
-            auto node = statementParser->parseProcedure();
-            if (node) programNode->children.push_back(node);
-        } else if (match(TokenType::IDENTIFIER)) { // Can be procedure calls or assignments
-            Token identToken = previous();
-            if (peek().type == TokenType::OPEN_PAREN) {
-                currentPosition--; // Back up so parseProcedureCall sees the identifier
-                auto node = statementParser->parseProcedureCall();
-                if (node) programNode->children.push_back(node);
-            } else if (peek().type == TokenType::ASSIGN) {
-                currentPosition--; // Back up so parseAssignment sees the identifier
-                auto node = statementParser->parseAssignment();
-                if (node) programNode->children.push_back(node);
-            } else {
-                // Report unexpected token
-                std::cerr << "Expected '<-' or '(' after identifier at line " 
-                        << identToken.line << ", column " << identToken.column << std::endl;
-            }
-        } else if (match(TokenType::IF)) {
-            auto node = statementParser->parseIfStatement();
-            if (node) programNode->children.push_back(node);
-        } else if (match(TokenType::WHILE)) {
-            auto node = statementParser->parseWhileStatement();
-            if (node) programNode->children.push_back(node);
-        } else if (match(TokenType::PUT)) {
-            auto node = statementParser->parsePutStatement();
-            if (node) programNode->children.push_back(node);
-        } else if (!isWhitespace(peek())) {
-            std::cerr << "Unexpected token: " << peek().lexeme 
-                      << " at line " << peek().line 
-                      << ", column " << peek().column << std::endl;
-            advance(); // Skip the unexpected token
-        } else {
-            advance();
-        }
+        auto node = parseStatement();
+        if (node) programNode->children.push_back(node);
     }
     
     return programNode; // Return the root node of the AST
 }
 
+// Parse a single top-level statement, returning nullptr for skipped or malformed input. Those
+// outside procedures also run while the calls spawned by the ones before them do. Once checked,
+// its repeated expressions become nodes shared with each other and with earlier statements.
+std::shared_ptr<ASTNode> Parser::parseStatement() {
+    auto node = parseTopLevelStatement();
+    if (node && node->type != ASTNodeType::PROCEDURE) {
+        checkTasks(*node, mainTasks, procedureEffects, getDiagnostics());
+    }
+    if (node) expressionParser->shareExpressions(*node);
+    return node;
+}
+
+// Parse a top-level statement by its first token
+std::shared_ptr<ASTNode> Parser::parseTopLevelStatement() {
+    // Skip whitespaces and warn about extra semicolons
+    if (isWhitespace(peek())) {
+        advance();
+        return nullptr;
+    }
+    if (peek().type == TokenType::SEMICOLON) {
+        getDiagnostics().report(DiagnosticCode::EXTRA_SEMICOLON, peek());
+        advance();
+        return nullptr;
+    }
+    
+    // Parse statements based on current token type
+    if (match(TokenType::DECLARE)) {
+        return statementParser->parseDeclaration(true);
+    } else if (match(TokenType::PROCEDURE)) {
+        return statementParser->parseProcedure();
+    } else if (match(TokenType::MEMO)) {
+        if (!match(TokenType::PROCEDURE)) {
+            getDiagnostics().report(DiagnosticCode::EXPECTED_PROCEDURE_AFTER_MEMO, peek());
+            return nullptr;
+        }
+        return statementParser->parseProcedure(true);
+    } else if (match(TokenType::IDENTIFIER)) { // Can be procedure calls or assignments
+        Token identToken = previous();
+        if (peek().type == TokenType::OPEN_PAREN) {
+            currentPosition--; // Back up so parseProcedureCall sees the identifier
+            return statementParser->parseProcedureCallStatement();
+        } else if (peek().type == TokenType::ASSIGN || peek().type == TokenType::OPEN_BRACKET) {
+            currentPosition--; // Back up so parseAssignment sees the identifier
+            return statementParser->parseAssignment();
+        }
+        // Report unexpected token
+        getDiagnostics().report(DiagnosticCode::EXPECTED_ASSIGN_OR_CALL, identToken);
+        return nullptr;
+    } else if (match(TokenType::IF)) {
+        return statementParser->parseIfStatement();
+    } else if (match(TokenType::WHILE)) {
+        return statementParser->parseWhileStatement();
+    } else if (match(TokenType::FOR)) {
+        return statementParser->parseForStatement();
+    } else if (match(TokenType::FOR_EACH)) {
+        return statementParser->parseForEachStatement();
+    } else if (match(TokenType::YIELD)) {
+        return statementParser->parseYieldStatement();
+    } else if (match(TokenType::PARALLEL)) {
+        return statementParser->parseParallelForStatement();
+    } else if (match(TokenType::PUT)) {
+        return statementParser->parsePutStatement();
+    } else if (match(TokenType::SPAWN)) {
+        return statementParser->parseSpawnStatement();
+    } else if (match(TokenType::SYNC)) {
+        return statementParser->parseSyncStatement();
+    } else if (match(TokenType::SEND)) {
+        return statementParser->parseSendStatement();
+    }
+
+    getDiagnostics().report(DiagnosticCode::UNEXPECTED_TOKEN, peek());
+    advance(); // Skip the unexpected token
+    return nullptr;
+}
+
+namespace {
+
+// Where makeNode allocates on this thread; the heap when null
+thread_local std::pmr::memory_resource* nodeArena = nullptr;
+
+}
+
+// A new AST node, from the thread's node arena if it has one
+std::shared_ptr<ASTNode> makeNode(ASTNodeType type, const Token& token) {
+    if (!nodeArena) return std::make_shared<ASTNode>(type, token);
+    return std::allocate_shared<ASTNode>(std::pmr::polymorphic_allocator<ASTNode>(nodeArena), type, token);
+}
+
+// Allocate nodes from arena until the scope ends
+NodeArenaScope::NodeArenaScope(std::pmr::memory_resource& arena) : previous(nodeArena) {
+    nodeArena = &arena;
+}
+
+// Go back to the arena, or the heap, used before
+NodeArenaScope::~NodeArenaScope() {
+    nodeArena = previous;
+}
+
+// Count the nodes of a tree
+size_t countNodes(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return 0;
+    size_t count = 1;
+    for (const auto& child : node->children) {
+        count += countNodes(child);
+    }
+    return count;
+}
+
+// Whole array operand of an expression, so nullptr when the expression is a number.
+// Indexing, length, sum, min and max turn arrays into numbers.
+const ASTNode* findArrayOperand(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return nullptr;
+    if (node->type == ASTNodeType::ARRAY_REFERENCE) return node.get();
+    if (node->type != ASTNodeType::BINARY_OP) return nullptr;
+    for (const auto& child : node->children) {
+        if (const ASTNode* operand = findArrayOperand(child)) return operand;
+    }
+    return nullptr;
+}
+
+// Name of a node type for reports
+const char* nodeTypeName(ASTNodeType type) {
+    static const char* const names[] = {
+        "PROGRAM", "DECLARATION", "ASSIGNMENT", "IF_STATEMENT", "ELSEIF_STATEMENT", "ELSE_STATEMENT",
+        "WHILE_STATEMENT", "PUT_STATEMENT", "BLOCK", "BINARY_OP", "NUMBER", "STRING", "IDENTIFIER",
+        "PARAMETER", "PROCEDURE", "PROCEDURE_CALL", "RETURN_STATEMENT", "ARRAY_DECLARATION", "ARRAY_REFERENCE",
+        "INDEX", "ARRAY_FUNCTION", "FOR_STATEMENT", "PARALLEL_FOR_STATEMENT",
+        "REDUCTION", "SPAWN_STATEMENT", "SYNC_STATEMENT", "CHANNEL_DECLARATION", "SEND_STATEMENT", "RECEIVE",
+        "FOR_EACH_STATEMENT", "YIELD_STATEMENT", "UNKNOWN"
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(ASTNodeType::UNKNOWN) + 1,
+                  "names must have an entry for every ASTNodeType");
+    return names[static_cast<size_t>(type)];
+}
+
 // Utility method
 bool Parser::isAtEnd() const {
-    return currentPosition >= tokens.size();
+    return currentPosition >= tokens.size() || tokens[currentPosition].type == TokenType::END_OF_FILE;
 }
 
 // Advances the current position and returns previous token
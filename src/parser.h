@@ -1,8 +1,11 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <memory_resource>
 #include "lexer.h"
 #include "symbol_table.h"
+#include "diagnostics.h"
+#include "race_analysis.h"
 
 enum class ASTNodeType {
     PROGRAM,
@@ -22,6 +25,20 @@ enum class ASTNodeType {
     PROCEDURE,
     PROCEDURE_CALL,
     RETURN_STATEMENT,
+    ARRAY_DECLARATION,
+    ARRAY_REFERENCE,
+    INDEX,
+    ARRAY_FUNCTION,
+    FOR_STATEMENT,
+    PARALLEL_FOR_STATEMENT,
+    REDUCTION,
+    SPAWN_STATEMENT,
+    SYNC_STATEMENT,
+    CHANNEL_DECLARATION,
+    SEND_STATEMENT,
+    RECEIVE,
+    FOR_EACH_STATEMENT,
+    YIELD_STATEMENT,
     UNKNOWN
 };
 
@@ -33,13 +50,34 @@ public:
     std::vector<std::shared_ptr<ASTNode>> children;
 };
 
+// A new AST node, from the calling thread's node arena if it has one
+std::shared_ptr<ASTNode> makeNode(ASTNodeType type, const Token& token);
+
+// Gives the calling thread a node arena until the scope ends. Nodes made in
+// the scope must be destroyed before the arena's memory is released.
+class NodeArenaScope {
+public:
+    explicit NodeArenaScope(std::pmr::memory_resource& arena);
+    ~NodeArenaScope();
+    NodeArenaScope(const NodeArenaScope&) = delete;
+    NodeArenaScope& operator=(const NodeArenaScope&) = delete;
+
+private:
+    std::pmr::memory_resource* previous;
+};
+
+size_t countNodes(const std::shared_ptr<ASTNode>& node);
+const ASTNode* findArrayOperand(const std::shared_ptr<ASTNode>& node);
+const char* nodeTypeName(ASTNodeType type);
+
 class StatementParser;
 class ExpressionParser;
 
 class Parser {
 public:
-    Parser(const std::vector<Token>& tokens);
+    Parser(std::vector<Token> tokens, Diagnostics& diagnostics);
     std::shared_ptr<ASTNode> parse();
+    void setTokens(std::vector<Token> newTokens);
 
     bool isAtEnd() const;
     const Token& advance();
@@ -49,12 +87,21 @@ public:
     bool check(TokenType type) const;
     bool isWhitespace(const Token& token) const;
     SymbolTable& getSymbolTable() { return symbolTable; }
+    Diagnostics& getDiagnostics() { return *diagnostics; }
+    void setDiagnostics(Diagnostics& newDiagnostics) { diagnostics = &newDiagnostics; }
 
     std::vector<Token> tokens;
     size_t currentPosition;
     SymbolTable symbolTable;
+    Diagnostics* diagnostics;
     std::unique_ptr<StatementParser> statementParser;
     std::unique_ptr<ExpressionParser> expressionParser;
+    ProcedureEffectsMap procedureEffects; // Procedures parsed so far, for checking calls in parallel loops
+    RunningTasks mainTasks;               // What calls spawned by top-level statements and not synced read
     
     std::shared_ptr<ASTNode> parseProgram();
+    std::shared_ptr<ASTNode> parseStatement();
+
+private:
+    std::shared_ptr<ASTNode> parseTopLevelStatement();
 };
\ No newline at end of file
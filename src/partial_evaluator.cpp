@@ -0,0 +1,477 @@
+#include "partial_evaluator.h"
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Statements, operations and calls run at compile time: fuelPerNode for each node of the program,
+// within these bounds, so that a loop the program runs for long costs a compile in proportion to
+// the program rather than a fixed million steps
+const size_t fuelPerNode = 16;
+const size_t minimumFuel = 20000;
+const size_t maximumFuel = 1000000;
+const size_t maximumOutput = 1 << 20; // Bytes of output put into the program as text
+const size_t maximumDepth = 10000;    // Calls nested in each other
+
+// How a statement run at compile time ended
+enum class Flow {
+    NEXT,   // Went on to the statement after it
+    RETURN, // Returned from the procedure it is in
+    STUCK   // Needs what is only known at run time, or ran out of fuel
+};
+
+// Check if a value fits the int the generated program computes it in
+bool fitsInt(long long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+// Runs top-level statements one at a time on the globals known so far
+class Evaluator {
+public:
+    Evaluator(const std::vector<std::shared_ptr<ASTNode>>& procedures, const ProcedureEffectsMap& effects,
+              size_t fuel);
+    bool run(const ASTNode& statement);
+    void forget(const ASTNode& statement);
+    void flush(std::vector<std::shared_ptr<ASTNode>>& statements, const Token& token,
+               const std::unordered_set<std::string_view>& used);
+    bool hasFuel() const { return remaining > 0; }
+
+private:
+    // A variable declared in a block or a parameter, innermost last
+    struct Local {
+        std::string_view name;
+        long long value;
+    };
+    // A global as it was before the statement being run first assigned it
+    struct Change {
+        std::string_view name;
+        bool known;
+        long long value;
+        bool changed;
+    };
+
+    Flow execute(const ASTNode& node);
+    bool evaluate(const ASTNode& node, long long& value);
+    bool call(const ASTNode& node, long long& value);
+    bool generate(const ASTNode& node, std::vector<long long>& values);
+    Flow enter(const ASTNode& node);
+    bool put(const ASTNode& node);
+    bool lookup(std::string_view name, long long& value) const;
+    bool assign(std::string_view name, long long value);
+    void setGlobal(std::string_view name, long long value);
+
+    const ProcedureEffectsMap& effects;
+    std::unordered_map<std::string_view, const ASTNode*> pure; // Procedures that can run now, by name
+    std::unordered_map<std::string_view, long long> globals;  // Globals whose value is known
+    std::vector<std::string_view> changed;                    // Known globals the program has another value in
+    std::unordered_set<std::string_view> changedNames;
+    std::vector<Local> locals;
+    size_t frame = 0; // First local of the procedure being run
+    size_t depth = 0; // Calls being run; globals are out of reach of procedures
+    long long returned = 0;
+    std::vector<long long>* yielded = nullptr; // Values of the generator being run
+    std::vector<Change> journal; // Undoes the statement being run
+    std::unordered_set<std::string_view> journaled;
+    std::string output;          // Printed by the statements run since the last flush
+    size_t statementOutput = 0;  // Where the statement being run started printing
+    size_t remaining;
+};
+
+// Note which procedures are pure, so that calls to them can run
+Evaluator::Evaluator(const std::vector<std::shared_ptr<ASTNode>>& procedures, const ProcedureEffectsMap& effects,
+                     size_t fuel)
+    : effects(effects), remaining(fuel) {
+    for (const auto& procedure : procedures) {
+        if (procedure->children.size() < 2) continue;
+        auto found = effects.procedures.find(procedure->children[0]->token.lexeme);
+        if (found != effects.procedures.end() && !found->second.writes && found->second.reads.empty()) {
+            pure[procedure->children[0]->token.lexeme] = procedure.get();
+        }
+    }
+}
+
+// Run a top-level statement. When it gets stuck, what it did is undone and false returned.
+bool Evaluator::run(const ASTNode& statement) {
+    journal.clear();
+    journaled.clear();
+    statementOutput = output.size();
+    Flow flow = Flow::STUCK;
+    if (statement.type == ASTNodeType::DECLARATION) {
+        // Globals start at 0
+        long long value = 0;
+        if (statement.children.size() < 2 || evaluate(*statement.children[1], value)) {
+            setGlobal(statement.children[0]->token.lexeme, value);
+            flow = Flow::NEXT;
+        }
+    } else {
+        flow = execute(statement);
+    }
+    if (flow == Flow::NEXT) return true;
+
+    for (auto change = journal.rbegin(); change != journal.rend(); ++change) {
+        if (change->known) {
+            globals[change->name] = change->value;
+        } else {
+            globals.erase(change->name);
+        }
+        if (!change->changed && changedNames.erase(change->name)) changed.pop_back();
+    }
+    output.resize(statementOutput);
+    locals.clear();
+    frame = 0;
+    depth = 0;
+    return false;
+}
+
+// Make unknown the globals a statement left to the program may assign, directly or through calls
+void Evaluator::forget(const ASTNode& node) {
+    switch (node.type) {
+        case ASTNodeType::ASSIGNMENT:
+        case ASTNodeType::DECLARATION:
+        case ASTNodeType::REDUCTION:
+            globals.erase(node.children[0]->token.lexeme);
+            break;
+        case ASTNodeType::PROCEDURE_CALL: {
+            auto found = effects.procedures.find(node.token.lexeme);
+            if (found == effects.procedures.end()) {
+                globals.clear();
+                break;
+            }
+            found->second.assigned.forEach([&](size_t index) { globals.erase(effects.globals->name(index)); });
+            break;
+        }
+        default:
+            break;
+    }
+    for (const auto& child : node.children) {
+        if (child) forget(*child);
+    }
+}
+
+// Add what the statements run since the last flush leave behind: a put of what they printed and
+// assignments of the globals they changed that the rest of the program uses
+void Evaluator::flush(std::vector<std::shared_ptr<ASTNode>>& statements, const Token& token,
+                      const std::unordered_set<std::string_view>& used) {
+    if (!output.empty()) {
+        // Every put ends its line, and a put of the text without the last line break adds it back
+        std::string text;
+        for (size_t i = 0; i + 1 < output.size(); i++) {
+            if (output[i] == '\n') {
+                text += "\\n";
+            } else {
+                text += output[i];
+            }
+        }
+        auto put = makeNode(ASTNodeType::PUT_STATEMENT, token);
+        put->children.push_back(makeNode(ASTNodeType::STRING, Token(TokenType::STRING, text, token.line,
+                                                                      token.column)));
+        statements.push_back(put);
+        output.clear();
+    }
+    for (std::string_view name : changed) {
+        if (!used.count(name)) continue;
+        auto assignment = makeNode(ASTNodeType::ASSIGNMENT, token);
+        assignment->children.push_back(makeNode(ASTNodeType::IDENTIFIER, Token(TokenType::IDENTIFIER,
+                                                                                std::string(name), token.line,
+                                                                                token.column)));
+        assignment->children.push_back(makeNode(ASTNodeType::NUMBER, Token(TokenType::NUMBER,
+                                                                            std::to_string(globals[name]),
+                                                                            token.line, token.column)));
+        statements.push_back(assignment);
+    }
+    changed.clear();
+    changedNames.clear();
+}
+
+// Run a statement inside a top-level one
+Flow Evaluator::execute(const ASTNode& node) {
+    if (remaining == 0) return Flow::STUCK;
+    remaining--;
+    long long value;
+    switch (node.type) {
+        case ASTNodeType::BLOCK: {
+            size_t scope = locals.size();
+            for (const auto& child : node.children) {
+                Flow flow = execute(*child);
+                if (flow != Flow::NEXT) return flow;
+            }
+            locals.resize(scope);
+            return Flow::NEXT;
+        }
+        case ASTNodeType::DECLARATION:
+            value = 0;
+            if (node.children.size() >= 2 && !evaluate(*node.children[1], value)) return Flow::STUCK;
+            locals.push_back({node.children[0]->token.lexeme, value});
+            return Flow::NEXT;
+        case ASTNodeType::ASSIGNMENT:
+            if (node.children[0]->type != ASTNodeType::IDENTIFIER || !evaluate(*node.children[1], value) ||
+                !assign(node.children[0]->token.lexeme, value)) {
+                return Flow::STUCK;
+            }
+            return Flow::NEXT;
+        case ASTNodeType::PUT_STATEMENT:
+            return put(node) ? Flow::NEXT : Flow::STUCK;
+        case ASTNodeType::PROCEDURE_CALL:
+            return call(node, value) ? Flow::NEXT : Flow::STUCK;
+        case ASTNodeType::RETURN_STATEMENT:
+            if (depth == 0 || node.children.empty() || !evaluate(*node.children[0], returned)) return Flow::STUCK;
+            return Flow::RETURN;
+        case ASTNodeType::IF_STATEMENT: {
+            if (!evaluate(*node.children[0], value)) return Flow::STUCK;
+            if (value) return execute(*node.children[1]);
+            for (size_t i = 2; i < node.children.size(); i++) {
+                const ASTNode& arm = *node.children[i];
+                if (arm.type == ASTNodeType::ELSE_STATEMENT) return execute(*arm.children[0]);
+                if (!evaluate(*arm.children[0], value)) return Flow::STUCK;
+                if (value) return execute(*arm.children[1]);
+            }
+            return Flow::NEXT;
+        }
+        case ASTNodeType::WHILE_STATEMENT:
+            while (true) {
+                if (!evaluate(*node.children[0], value)) return Flow::STUCK;
+                if (!value) return Flow::NEXT;
+                Flow flow = execute(*node.children[1]);
+                if (flow != Flow::NEXT) return flow;
+            }
+        case ASTNodeType::FOR_STATEMENT: {
+            // The range is evaluated once, and the loop variable only exists inside the loop
+            long long last;
+            long long step = 1;
+            if (!evaluate(*node.children[1], value) || !evaluate(*node.children[2], last)) return Flow::STUCK;
+            if (node.children.size() >= 5 && !evaluate(*node.children[3], step)) return Flow::STUCK;
+            if (step == 0) return Flow::STUCK;
+
+            // A loop that would run out of fuel is not started; each trip takes at least two steps
+            unsigned long long distance = step > 0 ? last - value : value - last;
+            unsigned long long trips = (step > 0 ? value <= last : value >= last)
+                                           ? distance / (step > 0 ? step : -step) + 1 : 0;
+            if (trips > remaining / 2) return Flow::STUCK;
+            for (; step > 0 ? value <= last : value >= last; value += step) {
+                locals.push_back({node.children[0]->token.lexeme, value});
+                Flow flow = execute(*node.children.back());
+                if (flow != Flow::NEXT) return flow;
+                locals.pop_back();
+                if (!fitsInt(value + step)) return Flow::STUCK;
+            }
+            return Flow::NEXT;
+        }
+        case ASTNodeType::FOR_EACH_STATEMENT: {
+            // The generator is pure, so running it to its end before the body changes nothing the body sees
+            std::vector<long long> values;
+            if (!generate(*node.children[1], values)) return Flow::STUCK;
+            for (long long each : values) {
+                locals.push_back({node.children[0]->token.lexeme, each});
+                Flow flow = execute(*node.children.back());
+                if (flow != Flow::NEXT) return flow;
+                locals.pop_back();
+            }
+            return Flow::NEXT;
+        }
+        case ASTNodeType::YIELD_STATEMENT:
+            if (!yielded || !evaluate(*node.children[0], value)) return Flow::STUCK;
+            yielded->push_back(value);
+            return Flow::NEXT;
+        default:
+            return Flow::STUCK;
+    }
+}
+
+// The value of an expression over numbers, known variables and calls to pure procedures
+bool Evaluator::evaluate(const ASTNode& node, long long& value) {
+    if (remaining == 0) return false;
+    remaining--;
+    long long left;
+    long long right;
+    switch (node.type) {
+        case ASTNodeType::NUMBER:
+            try {
+                value = std::stoll(node.token.lexeme);
+            } catch (const std::out_of_range&) {
+                return false;
+            }
+            return fitsInt(value);
+        case ASTNodeType::IDENTIFIER:
+            return lookup(node.token.lexeme, value);
+        case ASTNodeType::PROCEDURE_CALL:
+            return call(node, value);
+        case ASTNodeType::BINARY_OP:
+            if (!evaluate(*node.children[0], left) || !evaluate(*node.children[1], right)) return false;
+            switch (node.token.type) {
+                case TokenType::PLUS: value = left + right; break;
+                case TokenType::MINUS: value = left - right; break;
+                case TokenType::STAR: value = left * right; break;
+                case TokenType::SLASH:
+                    if (right == 0) return false;
+                    value = left / right;
+                    break;
+                case TokenType::EQUAL: value = left == right; break;
+                case TokenType::NOT_EQUAL: value = left != right; break;
+                case TokenType::LESS: value = left < right; break;
+                case TokenType::GREATER: value = left > right; break;
+                case TokenType::LESS_EQUAL: value = left <= right; break;
+                case TokenType::GREATER_EQUAL: value = left >= right; break;
+                default: return false;
+            }
+            return fitsInt(value);
+        default:
+            return false;
+    }
+}
+
+// Run a call to a pure procedure, which has to return a value
+bool Evaluator::call(const ASTNode& node, long long& value) {
+    Flow flow = enter(node);
+    value = returned;
+    return flow == Flow::RETURN;
+}
+
+// Run a pure generator to its end, collecting the values it yields
+bool Evaluator::generate(const ASTNode& node, std::vector<long long>& values) {
+    std::vector<long long>* enclosing = yielded;
+    yielded = &values;
+    Flow flow = enter(node);
+    yielded = enclosing;
+    return flow == Flow::NEXT;
+}
+
+// Run the body of the pure procedure a call names, on the call's arguments
+Flow Evaluator::enter(const ASTNode& node) {
+    auto found = pure.find(node.token.lexeme);
+    if (found == pure.end() || depth == maximumDepth) return Flow::STUCK;
+    const ASTNode& procedure = *found->second;
+    if (node.children.size() + 2 != procedure.children.size()) return Flow::STUCK;
+
+    // Every argument is evaluated before the parameters are in reach
+    std::vector<long long> arguments(node.children.size());
+    for (size_t i = 0; i < node.children.size(); i++) {
+        if (!evaluate(*node.children[i], arguments[i])) return Flow::STUCK;
+    }
+    size_t scope = locals.size();
+    for (size_t i = 0; i < arguments.size(); i++) {
+        locals.push_back({procedure.children[i + 1]->token.lexeme, arguments[i]});
+    }
+    size_t callerFrame = frame;
+    frame = scope;
+    depth++;
+    Flow flow = execute(*procedure.children.back());
+    depth--;
+    frame = callerFrame;
+    locals.resize(scope);
+    return flow;
+}
+
+// Print a number or a string. Strings with escape sequences are left to the compiler of the
+// generated code, as one written next to other text could read on into it.
+bool Evaluator::put(const ASTNode& node) {
+    if (node.children.empty()) return false;
+    const ASTNode& printed = *node.children[0];
+    if (printed.type == ASTNodeType::STRING) {
+        if (printed.token.lexeme.find('\\') != std::string::npos) return false;
+        output += printed.token.lexeme;
+    } else {
+        long long value;
+        if (!evaluate(printed, value)) return false;
+        output += std::to_string(value);
+    }
+    output += '\n';
+    return output.size() <= maximumOutput;
+}
+
+// The value of a variable in reach, if it is known
+bool Evaluator::lookup(std::string_view name, long long& value) const {
+    for (size_t i = locals.size(); i > frame; i--) {
+        if (locals[i - 1].name == name) {
+            value = locals[i - 1].value;
+            return true;
+        }
+    }
+    if (depth > 0) return false;
+    auto found = globals.find(name);
+    if (found == globals.end()) return false;
+    value = found->second;
+    return true;
+}
+
+// Assign a variable in reach
+bool Evaluator::assign(std::string_view name, long long value) {
+    for (size_t i = locals.size(); i > frame; i--) {
+        if (locals[i - 1].name == name) {
+            locals[i - 1].value = value;
+            return true;
+        }
+    }
+    if (depth > 0) return false;
+    setGlobal(name, value);
+    return true;
+}
+
+// Give a global a value, noting how to undo it
+void Evaluator::setGlobal(std::string_view name, long long value) {
+    auto found = globals.find(name);
+    if (journaled.insert(name).second) {
+        bool known = found != globals.end();
+        journal.push_back({name, known, known ? found->second : 0, changedNames.count(name) > 0});
+    }
+    if (found != globals.end()) {
+        found->second = value;
+    } else {
+        globals.emplace(name, value);
+    }
+    if (changedNames.insert(name).second) changed.push_back(name);
+}
+
+// Add the names a statement mentions, with the index of the statement, over those of earlier ones
+void noteUses(const ASTNode& node, size_t statement, std::unordered_map<std::string_view, size_t>& lastUses) {
+    if (node.type == ASTNodeType::IDENTIFIER) lastUses[node.token.lexeme] = statement;
+    for (const auto& child : node.children) {
+        if (child) noteUses(*child, statement, lastUses);
+    }
+}
+
+}
+
+// Run what can run at compile time, and put what it leaves behind in its place
+std::vector<std::shared_ptr<ASTNode>> evaluatePartially(const std::vector<std::shared_ptr<ASTNode>>& statements,
+                                                        const std::vector<std::shared_ptr<ASTNode>>& procedures,
+                                                        const ProcedureEffectsMap& effects) {
+    // A global that is changed now has to be assigned in the program if procedures read it, or if a
+    // statement after the ones that changed it mentions it
+    std::unordered_map<std::string_view, size_t> lastUses;
+    for (size_t i = 0; i < statements.size(); i++) noteUses(*statements[i], i, lastUses);
+    std::unordered_set<std::string_view> read;
+    for (const auto& procedure : effects.procedures) {
+        procedure.second.reads.forEach([&](size_t index) { read.insert(effects.globals->name(index)); });
+    }
+
+    size_t nodes = 0;
+    for (const auto& statement : statements) nodes += countNodes(statement);
+    for (const auto& procedure : procedures) nodes += countNodes(procedure);
+    Evaluator evaluator(procedures, effects, std::min(std::max(nodes * fuelPerNode, minimumFuel), maximumFuel));
+    std::vector<std::shared_ptr<ASTNode>> residual;
+    const Token* firstRun = nullptr;
+    for (size_t i = 0; i < statements.size(); i++) {
+        const auto& statement = statements[i];
+        if (evaluator.hasFuel() && evaluator.run(*statement)) {
+            if (!firstRun) firstRun = &statement->token;
+            continue;
+        }
+        if (firstRun) {
+            std::unordered_set<std::string_view> used(read);
+            for (const auto& use : lastUses) {
+                if (use.second >= i) used.insert(use.first);
+            }
+            evaluator.flush(residual, *firstRun, used);
+        }
+        firstRun = nullptr;
+        residual.push_back(statement);
+        evaluator.forget(*statement);
+    }
+    if (firstRun) evaluator.flush(residual, *firstRun, {});
+    return residual;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "parser.h"
+#include "race_analysis.h"
+
+// Run the statements of the main program at compile time, as far as they only
+// depend on numbers, variables they gave a value and calls to pure procedures.
+// Programs read no input, so that is often most of a program. Each top-level
+// statement either runs completely, within a budget of steps (fuel) shared by
+// the whole program and in proportion to its size, or is left to run when the
+// program does. A for loop with more trips than the fuel left is not started.
+// What runs now is replaced by what it leaves behind: one put of the text it
+// printed, and assignments of the globals it set to their values, before the
+// next statement left in the program. Statements with arrays, channels, tasks,
+// procedures that are not pure, or arithmetic that overflows or divides by zero
+// are left as they are, and the globals they may assign are unknown from then on.
+std::vector<std::shared_ptr<ASTNode>> evaluatePartially(const std::vector<std::shared_ptr<ASTNode>>& statements,
+                                                        const std::vector<std::shared_ptr<ASTNode>>& procedures,
+                                                        const ProcedureEffectsMap& effects);
@@ -0,0 +1,217 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char* const eventNames[] = {"cycles", "instructions", "branches", "branch-misses", "L1D-misses", "LLC-misses"};
+
+static_assert(sizeof(eventNames) / sizeof(eventNames[0]) == static_cast<size_t>(PerfEvent::COUNT),
+              "eventNames must have an entry for every PerfEvent");
+
+#ifdef __linux__
+// perf_event_attr type and config for an event
+std::pair<uint32_t, uint64_t> configOf(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::CYCLES:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+        case PerfEvent::INSTRUCTIONS:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+        case PerfEvent::BRANCHES:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS};
+        case PerfEvent::BRANCH_MISSES:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES};
+        case PerfEvent::L1D_MISSES:
+            return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+        default:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+    }
+}
+
+int openEvent(PerfEvent event, int groupFd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    auto config = configOf(event);
+    attr.type = config.first;
+    attr.config = config.second;
+    attr.disabled = groupFd == -1 ? 1 : 0;
+    attr.exclude_kernel = 1; // Allowed at perf_event_paranoid 2, and the compiler is user code anyway
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+
+// a / b, or -1 when b is zero
+double ratio(uint64_t a, uint64_t b) {
+    return b == 0 ? -1.0 : static_cast<double>(a) / static_cast<double>(b);
+}
+
+}
+
+// Difference between two samples
+PerfSample PerfSample::operator-(const PerfSample& other) const {
+    PerfSample result;
+    for (size_t i = 0; i < static_cast<size_t>(PerfEvent::COUNT); i++) {
+        result.values[i] = values[i] - other.values[i];
+    }
+    return result;
+}
+
+// Add another sample's values to this one
+PerfSample& PerfSample::operator+=(const PerfSample& other) {
+    for (size_t i = 0; i < static_cast<size_t>(PerfEvent::COUNT); i++) {
+        values[i] += other.values[i];
+    }
+    return *this;
+}
+
+// Constructor for the PerfCounters class, opens and starts the counter group
+PerfCounters::PerfCounters() {
+#ifdef __linux__
+    for (size_t i = 0; i < static_cast<size_t>(PerfEvent::COUNT); i++) {
+        PerfEvent event = static_cast<PerfEvent>(i);
+        int fd = openEvent(event, fds.empty() ? -1 : fds[0]);
+        if (fd < 0) {
+            if (fds.empty()) {
+                error = std::string("perf_event_open failed: ") + strerror(errno);
+                if (errno == EACCES || errno == EPERM) {
+                    error += " (check /proc/sys/kernel/perf_event_paranoid)";
+                }
+                return;
+            }
+            continue; // Leave out events this CPU does not have
+        }
+        eventIndex.emplace_back(event, fds.size());
+        fds.push_back(fd);
+    }
+
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    // A group that is never scheduled (too few counters in a VM) reads as zero forever
+    PerfSample probe = read();
+    for (volatile int i = 0; i < 100000; i = i + 1) {}
+    if (read().get(PerfEvent::CYCLES) == probe.get(PerfEvent::CYCLES)) {
+        error = "hardware counters could not be scheduled";
+        close();
+    }
+#else
+    error = "hardware counters are only supported on Linux";
+#endif
+}
+
+// Destructor for the PerfCounters class
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+// Close the counters, leaving them unavailable
+void PerfCounters::close() {
+#ifdef __linux__
+    for (int fd : fds) {
+        ::close(fd);
+    }
+#endif
+    fds.clear();
+    eventIndex.clear();
+}
+
+// Check if an event was opened
+bool PerfCounters::hasEvent(PerfEvent event) const {
+    for (const auto& entry : eventIndex) {
+        if (entry.first == event) return true;
+    }
+    return false;
+}
+
+// Read all counters with one system call, scaled up if the kernel multiplexed them
+PerfSample PerfCounters::read() const {
+    PerfSample sample;
+#ifdef __linux__
+    if (fds.empty()) return sample;
+    uint64_t buffer[3 + static_cast<size_t>(PerfEvent::COUNT)];
+    if (::read(fds[0], buffer, sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t))) return sample;
+
+    uint64_t enabled = buffer[1];
+    uint64_t running = buffer[2];
+    for (const auto& entry : eventIndex) {
+        uint64_t value = buffer[3 + entry.second];
+        if (running != 0 && running < enabled) {
+            value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+        }
+        sample.values[static_cast<size_t>(entry.first)] = value;
+    }
+#endif
+    return sample;
+}
+
+// Print one row per (name, sample) with IPC and miss rates
+void PerfCounters::renderTable(std::ostream& out, const char* title,
+                               const std::vector<std::pair<std::string, PerfSample>>& rows) const {
+    std::string table;
+    char line[200];
+    snprintf(line, sizeof(line), "%-16s %14s %14s %6s %10s %12s %12s\n", title, eventNames[0], eventNames[1],
+             "IPC", "br-miss %", "L1D-mis/ki", "LLC-mis/ki");
+    table += line;
+
+    auto cell = [](char* buffer, size_t size, double value, const char* format) {
+        if (value < 0) {
+            snprintf(buffer, size, "n/a");
+        } else {
+            snprintf(buffer, size, format, value);
+        }
+    };
+    for (const auto& row : rows) {
+        const PerfSample& sample = row.second;
+        uint64_t instructions = sample.get(PerfEvent::INSTRUCTIONS);
+        char ipc[16], branch[16], l1d[16], llc[16];
+        cell(ipc, sizeof(ipc), ratio(instructions, sample.get(PerfEvent::CYCLES)), "%.2f");
+        cell(branch, sizeof(branch), hasEvent(PerfEvent::BRANCH_MISSES) && hasEvent(PerfEvent::BRANCHES)
+                 ? 100.0 * ratio(sample.get(PerfEvent::BRANCH_MISSES), sample.get(PerfEvent::BRANCHES)) : -1.0,
+             "%.2f");
+        cell(l1d, sizeof(l1d), hasEvent(PerfEvent::L1D_MISSES)
+                 ? 1000.0 * ratio(sample.get(PerfEvent::L1D_MISSES), instructions) : -1.0, "%.2f");
+        cell(llc, sizeof(llc), hasEvent(PerfEvent::LLC_MISSES)
+                 ? 1000.0 * ratio(sample.get(PerfEvent::LLC_MISSES), instructions) : -1.0, "%.3f");
+        snprintf(line, sizeof(line), "%-16s %14llu %14llu %6s %10s %12s %12s\n", row.first.c_str(),
+                 static_cast<unsigned long long>(sample.get(PerfEvent::CYCLES)),
+                 static_cast<unsigned long long>(instructions), ipc, branch, l1d, llc);
+        table += line;
+    }
+    out << table;
+}
+
+// Constructor for the PerfBreakdown class
+PerfBreakdown::PerfBreakdown(const PerfCounters& counters, size_t keyCount)
+    : counters(counters), totals(keyCount), entries(keyCount) {}
+
+// Charge the counts since the last enter or leave to the innermost region
+void PerfBreakdown::charge() {
+    PerfSample now = counters.read();
+    if (!stack.empty()) totals[stack.back()] += now - last;
+    last = now;
+}
+
+// Start a region nested in the current one
+void PerfBreakdown::enter(size_t key) {
+    charge();
+    stack.push_back(key);
+    entries[key]++;
+}
+
+// End the innermost region
+void PerfBreakdown::leave() {
+    charge();
+    stack.pop_back();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class PerfEvent {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCHES,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    COUNT
+};
+
+// Counter values at one point in time, or the difference between two points
+struct PerfSample {
+    uint64_t values[static_cast<size_t>(PerfEvent::COUNT)] = {};
+
+    uint64_t get(PerfEvent event) const { return values[static_cast<size_t>(event)]; }
+    PerfSample operator-(const PerfSample& other) const;
+    PerfSample& operator+=(const PerfSample& other);
+};
+
+// Linux hardware performance counters for this thread, read as one group.
+// When the kernel refuses them (no PMU in a VM, perf_event_paranoid, not
+// Linux) isAvailable() is false, getError() says why and read() returns zeros.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isAvailable() const { return !eventIndex.empty(); }
+    bool hasEvent(PerfEvent event) const;
+    const std::string& getError() const { return error; }
+    PerfSample read() const;
+
+    // Print one row per (name, sample) with IPC and miss rates
+    void renderTable(std::ostream& out, const char* title,
+                     const std::vector<std::pair<std::string, PerfSample>>& rows) const;
+
+private:
+    std::vector<int> fds;                          // fds[0] is the group leader
+    std::vector<std::pair<PerfEvent, size_t>> eventIndex; // Event and its slot in a group read
+    std::string error;
+
+    void close();
+};
+
+// Splits counter deltas between nested regions by key (e.g. AST node type).
+// Each region is charged only for the time it is innermost, so the totals
+// add up to the whole without double counting.
+class PerfBreakdown {
+public:
+    PerfBreakdown(const PerfCounters& counters, size_t keyCount);
+
+    void enter(size_t key);
+    void leave();
+
+    const PerfSample& getTotal(size_t key) const { return totals[key]; }
+    uint64_t getEntries(size_t key) const { return entries[key]; }
+
+private:
+    const PerfCounters& counters;
+    std::vector<PerfSample> totals;
+    std::vector<uint64_t> entries;
+    std::vector<size_t> stack;
+    PerfSample last;
+
+    void charge();
+};
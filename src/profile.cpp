@@ -0,0 +1,226 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <sstream>
+
+namespace {
+
+const char* const kindNames[] = {"program", "procedure", "loop", "branch", "elseif", "else", "call"};
+
+static_assert(sizeof(kindNames) / sizeof(kindNames[0]) == static_cast<size_t>(ProfileSiteKind::COUNT),
+              "kindNames must have an entry for every ProfileSiteKind");
+
+const char* const profileHeader = "# pseudo-profile 1";
+
+// Cycle counts like 1.2M for the listing
+std::string formatCycles(uint64_t cycles) {
+    char buffer[32];
+    if (cycles >= 1000000000ULL) {
+        snprintf(buffer, sizeof(buffer), "%.2fG", cycles / 1e9);
+    } else if (cycles >= 1000000ULL) {
+        snprintf(buffer, sizeof(buffer), "%.2fM", cycles / 1e6);
+    } else if (cycles >= 1000ULL) {
+        snprintf(buffer, sizeof(buffer), "%.2fK", cycles / 1e3);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(cycles));
+    }
+    return buffer;
+}
+
+// Number shown in the count column: calls, iterations or evaluations
+uint64_t displayedCount(const ProfileSite& site) {
+    return site.kind == ProfileSiteKind::LOOP ? site.events : site.entries;
+}
+
+// Explanation printed after the source line
+std::string describe(const ProfileSite& site) {
+    char buffer[160];
+    switch (site.kind) {
+        case ProfileSiteKind::PROCEDURE:
+            snprintf(buffer, sizeof(buffer), "%llu calls, %s cycles/call",
+                     static_cast<unsigned long long>(site.entries),
+                     formatCycles(site.entries ? site.cycles / site.entries : 0).c_str());
+            break;
+        case ProfileSiteKind::LOOP:
+            snprintf(buffer, sizeof(buffer), "reached %llu times, %.1f trips each, %s cycles/trip",
+                     static_cast<unsigned long long>(site.entries),
+                     site.entries ? static_cast<double>(site.events) / site.entries : 0.0,
+                     formatCycles(site.events ? site.cycles / site.events : 0).c_str());
+            break;
+        case ProfileSiteKind::BRANCH:
+        case ProfileSiteKind::ELSEIF:
+            snprintf(buffer, sizeof(buffer), "taken %llu of %llu (%.1f%%)",
+                     static_cast<unsigned long long>(site.events), static_cast<unsigned long long>(site.entries),
+                     site.entries ? 100.0 * site.events / site.entries : 0.0);
+            break;
+        case ProfileSiteKind::ELSE:
+            snprintf(buffer, sizeof(buffer), "taken %llu", static_cast<unsigned long long>(site.events));
+            break;
+        case ProfileSiteKind::CALL:
+            snprintf(buffer, sizeof(buffer), "%llu calls", static_cast<unsigned long long>(site.entries));
+            break;
+        default:
+            return "";
+    }
+    return buffer;
+}
+
+}
+
+// Name of a site kind in profile files
+const char* Profile::kindName(ProfileSiteKind kind) {
+    return kindNames[static_cast<size_t>(kind)];
+}
+
+// Site kind from its name in a profile file
+bool Profile::parseKind(const std::string& name, ProfileSiteKind& kind) {
+    for (size_t i = 0; i < static_cast<size_t>(ProfileSiteKind::COUNT); i++) {
+        if (name == kindNames[i]) {
+            kind = static_cast<ProfileSiteKind>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read a profile file
+bool Profile::load(std::istream& in, std::string& error) {
+    sites.clear();
+    index.clear();
+    std::string line;
+    if (!std::getline(in, line) || line != profileHeader) {
+        error = "not a PseudoLang profile";
+        return false;
+    }
+    int lineNumber = 1;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.empty()) continue;
+        std::istringstream fields(line);
+        std::string kind;
+        ProfileSite site{ProfileSiteKind::PROGRAM, 0, 0};
+        if (!(fields >> kind >> site.line >> site.column >> site.entries >> site.events >> site.cycles) ||
+            !parseKind(kind, site.kind)) {
+            error = "malformed site on line " + std::to_string(lineNumber);
+            return false;
+        }
+        index[std::make_tuple(static_cast<int>(site.kind), site.line, site.column)] = sites.size();
+        sites.push_back(site);
+    }
+    return true;
+}
+
+// Site of the given kind at a source position
+const ProfileSite* Profile::find(ProfileSiteKind kind, int line, int column) const {
+    auto found = index.find(std::make_tuple(static_cast<int>(kind), line, column));
+    return found == index.end() ? nullptr : &sites[found->second];
+}
+
+// Print the source with per-line counts, cycle shares and branch rates
+void Profile::renderListing(std::ostream& out, const std::string& source) const {
+    uint64_t programCycles = 0;
+    std::map<int, std::vector<const ProfileSite*>> byLine;
+    for (const auto& site : sites) {
+        if (site.kind == ProfileSiteKind::PROGRAM) {
+            programCycles += site.cycles;
+        } else {
+            byLine[site.line].push_back(&site);
+        }
+    }
+    for (auto& entry : byLine) {
+        std::sort(entry.second.begin(), entry.second.end(),
+                  [](const ProfileSite* a, const ProfileSite* b) { return a->column < b->column; });
+    }
+
+    std::string listing;
+    char buffer[64];
+    listing += "Program: " + formatCycles(programCycles) + " cycles\n";
+    snprintf(buffer, sizeof(buffer), "%12s %8s %6s  %s\n", "count", "cycles", "line", "source");
+    listing += buffer;
+
+    std::istringstream lines(source);
+    std::string text;
+    int lineNumber = 0;
+    while (std::getline(lines, text)) {
+        lineNumber++;
+        if (!text.empty() && text.back() == '\r') text.pop_back();
+        auto found = byLine.find(lineNumber);
+        if (found == byLine.end()) {
+            snprintf(buffer, sizeof(buffer), "%12s %8s %6d  ", "", "", lineNumber);
+            listing += buffer + text + "\n";
+            continue;
+        }
+
+        // The first site on the line fills the columns, every site adds a note
+        const ProfileSite& first = *found->second.front();
+        char share[16] = "";
+        if (programCycles > 0 && first.cycles > 0) {
+            snprintf(share, sizeof(share), "%.1f%%", 100.0 * first.cycles / programCycles);
+        }
+        snprintf(buffer, sizeof(buffer), "%12llu %8s %6d  ", static_cast<unsigned long long>(displayedCount(first)),
+                 share, lineNumber);
+        listing += buffer + text;
+        std::string notes;
+        for (const ProfileSite* site : found->second) {
+            notes += notes.empty() ? "" : "; ";
+            notes += std::string(kindName(site->kind)) + " " + std::to_string(site->column) + ": " + describe(*site);
+        }
+        listing += "    [" + notes + "]\n";
+    }
+    out << listing;
+}
+
+// C++ support code for instrumented programs
+std::string generateProfileRuntime(const std::vector<ProfileSite>& sites) {
+    std::stringstream code;
+    code << "#include <chrono>\n"
+            "#include <cstdio>\n"
+            "#include <cstdlib>\n\n"
+            "namespace pl_profile {\n"
+            "struct Site {\n"
+            "    const char* kind;\n"
+            "    int line;\n"
+            "    int column;\n"
+            "    unsigned long long entries;\n"
+            "    unsigned long long events;\n"
+            "    unsigned long long cycles;\n"
+            "    int active;\n"
+            "};\n\n"
+            "Site sites[] = {\n";
+    for (const auto& site : sites) {
+        code << "    {\"" << Profile::kindName(site.kind) << "\", " << site.line << ", " << site.column
+             << ", 0, 0, 0, 0},\n";
+    }
+    code << "};\n\n"
+            "inline unsigned long long now() {\n"
+            "#if defined(__x86_64__) || defined(__i386__)\n"
+            "    return __builtin_ia32_rdtsc();\n"
+            "#else\n"
+            "    return std::chrono::steady_clock::now().time_since_epoch().count();\n"
+            "#endif\n"
+            "}\n\n"
+            "// Counts an entry and adds the cycles of the outermost activation, so recursion is not counted twice\n"
+            "struct Timer {\n"
+            "    Site& site;\n"
+            "    unsigned long long start;\n"
+            "    explicit Timer(Site& site) : site(site), start(site.active++ ? 0 : now()) { site.entries++; }\n"
+            "    ~Timer() { if (--site.active == 0) site.cycles += now() - start; }\n"
+            "};\n\n"
+            "// Saves the counters when the program exits, to $PSEUDO_PROFILE or output.profile\n"
+            "struct Writer {\n"
+            "    ~Writer() {\n"
+            "        const char* path = std::getenv(\"PSEUDO_PROFILE\");\n"
+            "        std::FILE* file = std::fopen(path ? path : \"output.profile\", \"w\");\n"
+            "        if (!file) return;\n"
+            "        std::fprintf(file, \"" << profileHeader << "\\n\");\n"
+            "        for (const Site& site : sites) {\n"
+            "            std::fprintf(file, \"%s %d %d %llu %llu %llu\\n\", site.kind, site.line, site.column,\n"
+            "                         site.entries, site.events, site.cycles);\n"
+            "        }\n"
+            "        std::fclose(file);\n"
+            "    }\n"
+            "} writer;\n"
+            "}\n\n";
+    return code.str();
+}
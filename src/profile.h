@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <tuple>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class ProfileSiteKind {
+    PROGRAM,    // main: cycles of the whole run
+    PROCEDURE,  // entries = calls, cycles of the outermost activations
+    LOOP,       // entries = times reached, events = iterations, cycles
+    BRANCH,     // if: entries = conditions evaluated, events = taken
+    ELSEIF,     // elseif: entries = conditions evaluated, events = taken
+    ELSE,       // else: entries = events = taken
+    CALL,       // procedure call: entries = calls made here
+    COUNT
+};
+
+// One instrumented place in the PseudoLang source and what it measured
+struct ProfileSite {
+    ProfileSiteKind kind;
+    int line;
+    int column;
+    uint64_t entries = 0;
+    uint64_t events = 0;
+    uint64_t cycles = 0;
+};
+
+// Profile written by a program compiled with --instrument: a header line and
+// one "kind line column entries events cycles" line per site
+class Profile {
+public:
+    bool load(std::istream& in, std::string& error);
+
+    const std::vector<ProfileSite>& getSites() const { return sites; }
+
+    // Site of the given kind at a source position, nullptr when the profile has none
+    const ProfileSite* find(ProfileSiteKind kind, int line, int column) const;
+
+    // Print the source with per-line counts, cycle shares and branch rates
+    void renderListing(std::ostream& out, const std::string& source) const;
+
+    static const char* kindName(ProfileSiteKind kind);
+    static bool parseKind(const std::string& name, ProfileSiteKind& kind);
+
+private:
+    std::vector<ProfileSite> sites;
+    std::map<std::tuple<int, int, int>, size_t> index; // (kind, line, column) to slot in sites
+};
+
+// C++ support code for instrumented programs: the site table, the cycle
+// timer and the writer that saves the profile when the program exits
+std::string generateProfileRuntime(const std::vector<ProfileSite>& sites);
@@ -0,0 +1,445 @@
+#include "race_analysis.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include <map>
+#include <set>
+#include <tuple>
+
+// Number a name the first time it is met
+size_t GlobalNames::number(const std::string& name) {
+    auto inserted = indices.emplace(name, names.size());
+    if (inserted.second) names.push_back(&inserted.first->first);
+    return inserted.first->second;
+}
+
+bool GlobalNames::find(const std::string& name, size_t& index) const {
+    auto found = indices.find(name);
+    if (found == indices.end()) return false;
+    index = found->second;
+    return true;
+}
+
+void GlobalSet::insert(size_t index) {
+    if (words.size() <= index / 64) words.resize(index / 64 + 1);
+    words[index / 64] |= uint64_t(1) << (index % 64);
+}
+
+void GlobalSet::insert(const GlobalSet& other) {
+    if (words.size() < other.words.size()) words.resize(other.words.size());
+    for (size_t i = 0; i < other.words.size(); i++) words[i] |= other.words[i];
+}
+
+bool GlobalSet::contains(size_t index) const {
+    return index / 64 < words.size() && (words[index / 64] >> (index % 64) & 1);
+}
+
+bool GlobalSet::intersects(const GlobalSet& other) const {
+    for (size_t i = 0; i < words.size() && i < other.words.size(); i++) {
+        if (words[i] & other.words[i]) return true;
+    }
+    return false;
+}
+
+namespace {
+
+// Walks statements resolving names through a SymbolTable of the declarations
+// met along the way. Names it cannot resolve are shared with the enclosing
+// code, and accesses to them go to the hooks.
+class ScopedWalk {
+public:
+    virtual ~ScopedWalk() = default;
+
+    virtual void visit(const ASTNode& node) {
+        switch (node.type) {
+            case ASTNodeType::BLOCK:
+                locals.enterScope();
+                visitChildren(node, 0);
+                locals.exitScope();
+                break;
+            case ASTNodeType::DECLARATION:
+            case ASTNodeType::ARRAY_DECLARATION:
+            case ASTNodeType::CHANNEL_DECLARATION:
+                visitChildren(node, 1);
+                locals.declareVariable(node.children[0]->token.lexeme, declaredType(node.type));
+                break;
+            case ASTNodeType::FOR_STATEMENT:
+            case ASTNodeType::PARALLEL_FOR_STATEMENT:
+            case ASTNodeType::FOR_EACH_STATEMENT:
+                // The range, or the generator's call, is evaluated outside the loop variable's scope
+                for (size_t i = 1; i + 1 < node.children.size(); i++) visit(*node.children[i]);
+                locals.enterScope();
+                locals.declareVariable(node.children[0]->token.lexeme, VariableType::LOOP_COUNTER);
+                visit(*node.children.back());
+                locals.exitScope();
+                break;
+            case ASTNodeType::REDUCTION:
+                if (isShared(node.children[0]->token.lexeme)) reduceShared(node);
+                break;
+            case ASTNodeType::ASSIGNMENT: {
+                const ASTNode& target = *node.children[0];
+                if (isShared(target.token.lexeme)) {
+                    assignShared(node);
+                } else {
+                    visitChildren(target, 0);
+                    visit(*node.children[1]);
+                }
+                break;
+            }
+            case ASTNodeType::IDENTIFIER:
+            case ASTNodeType::ARRAY_REFERENCE:
+            case ASTNodeType::INDEX:
+                if (isShared(node.token.lexeme)) readShared(node);
+                visitChildren(node, 0);
+                break;
+            case ASTNodeType::PUT_STATEMENT:
+                output(node);
+                visitChildren(node, 0);
+                break;
+            case ASTNodeType::RETURN_STATEMENT:
+                returns(node);
+                visitChildren(node, 0);
+                break;
+            case ASTNodeType::YIELD_STATEMENT:
+                yields(node);
+                visitChildren(node, 0);
+                break;
+            case ASTNodeType::PROCEDURE_CALL:
+                call(node);
+                visitChildren(node, 0);
+                break;
+            default:
+                visitChildren(node, 0);
+                break;
+        }
+    }
+
+protected:
+    SymbolTable locals;
+
+    ScopedWalk() { locals.enterScope(); }
+
+    bool isShared(const std::string& name) const { return !locals.isVariableDeclared(name); }
+
+    static VariableType declaredType(ASTNodeType declaration) {
+        if (declaration == ASTNodeType::ARRAY_DECLARATION) return VariableType::ARRAY;
+        if (declaration == ASTNodeType::CHANNEL_DECLARATION) return VariableType::CHANNEL;
+        return VariableType::INTEGER;
+    }
+
+    void visitChildren(const ASTNode& node, size_t first) {
+        for (size_t i = first; i < node.children.size(); i++) visit(*node.children[i]);
+    }
+
+    // Hooks for an assignment to a shared name (the hook visits its operands), a reduction into a
+    // shared variable by a nested parallel loop, and reads of shared names
+    virtual void assignShared(const ASTNode& assignment) = 0;
+    virtual void reduceShared(const ASTNode& reduction) = 0;
+    virtual void readShared(const ASTNode& node) = 0;
+    virtual void output(const ASTNode& put) = 0;
+    virtual void returns(const ASTNode&) {}
+    virtual void yields(const ASTNode&) {}
+    virtual void call(const ASTNode& call) = 0;
+};
+
+// Collects the effects of a procedure body
+class ProcedureWalk : public ScopedWalk {
+public:
+    ProcedureWalk(const std::string& name, ProcedureEffectsMap& procedures)
+        : name(name), procedures(procedures.procedures), globals(*procedures.globals) {}
+
+    void declareParameter(const std::string& parameter) { locals.declareVariable(parameter, VariableType::INTEGER); }
+
+    ProcedureEffects effects;
+
+private:
+    const std::string& name;
+    const std::unordered_map<std::string, ProcedureEffects>& procedures;
+    GlobalNames& globals;
+
+    void assignShared(const ASTNode& assignment) override {
+        effects.writes = true;
+        effects.assigned.insert(globals.number(assignment.children[0]->token.lexeme));
+        visitChildren(*assignment.children[0], 0);
+        visit(*assignment.children[1]);
+    }
+
+    void reduceShared(const ASTNode& reduction) override {
+        effects.writes = true;
+        effects.assigned.insert(globals.number(reduction.children[0]->token.lexeme));
+    }
+
+    void readShared(const ASTNode& node) override { effects.reads.insert(globals.number(node.token.lexeme)); }
+
+    void output(const ASTNode&) override { effects.writes = true; }
+
+    void yields(const ASTNode&) override { effects.yields = true; }
+
+    // Recursive calls add nothing; procedures not seen yet could do anything
+    void call(const ASTNode& node) override {
+        if (node.token.lexeme == name) return;
+        auto found = procedures.find(node.token.lexeme);
+        if (found == procedures.end()) {
+            effects.writes = true;
+            return;
+        }
+        effects.writes = effects.writes || found->second.writes;
+        effects.reads.insert(found->second.reads);
+        effects.assigned.insert(found->second.assigned);
+    }
+};
+
+// Checks the body of a parallel loop. The first pass only collects the shared
+// arrays the body writes, the second reports.
+class ParallelLoopWalk : public ScopedWalk {
+public:
+    ParallelLoopWalk(const ASTNode& loop, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics)
+        : variable(loop.children[0]->token.lexeme), procedures(procedures), diagnostics(diagnostics) {
+        for (const auto& child : loop.children) {
+            if (child->type == ASTNodeType::REDUCTION) reductions[child->children[0]->token.lexeme] = child->token.type;
+        }
+    }
+
+    void run(const ASTNode& body) {
+        visit(body);
+        reporting = true;
+        visit(body);
+    }
+
+private:
+    const std::string& variable;
+    const ProcedureEffectsMap& procedures;
+    Diagnostics& diagnostics;
+    std::map<std::string, TokenType> reductions; // Reduction variable and its operator
+    std::set<std::string> writtenArrays;
+    bool reporting = false;
+
+    void report(DiagnosticCode code, const Token& token) {
+        if (reporting) diagnostics.report(code, token);
+    }
+
+    // Each iteration has its own value of the loop variable, so a[i] is an element no other iteration touches
+    bool isLoopIndex(const ASTNode& index) const {
+        return index.type == ASTNodeType::IDENTIFIER && index.token.lexeme == variable && isShared(variable);
+    }
+
+    void assignShared(const ASTNode& assignment) override {
+        const ASTNode& target = *assignment.children[0];
+        const ASTNode& value = *assignment.children[1];
+        const std::string& name = target.token.lexeme;
+        if (target.type == ASTNodeType::IDENTIFIER) {
+            auto reduction = reductions.find(name);
+            if (reduction == reductions.end()) {
+                report(DiagnosticCode::PARALLEL_SHARED_ASSIGNMENT, target.token);
+                visit(value);
+                return;
+            }
+
+            // x <- x op e or x <- e op x, where e does not read x
+            if (value.type == ASTNodeType::BINARY_OP && value.token.type == reduction->second) {
+                for (int side = 0; side < 2; side++) {
+                    const ASTNode& operand = *value.children[side];
+                    if (operand.type == ASTNodeType::IDENTIFIER && operand.token.lexeme == name) {
+                        visit(*value.children[1 - side]);
+                        return;
+                    }
+                }
+            }
+            report(DiagnosticCode::PARALLEL_REDUCTION_USE, target.token);
+            visit(value);
+            return;
+        }
+
+        writtenArrays.insert(name);
+        if (target.type != ASTNodeType::INDEX || !isLoopIndex(*target.children[0])) {
+            report(DiagnosticCode::PARALLEL_ARRAY_CONFLICT, target.token);
+        }
+        visitChildren(target, 0);
+        visit(value);
+    }
+
+    void reduceShared(const ASTNode& reduction) override {
+        const Token& token = reduction.children[0]->token;
+        auto found = reductions.find(token.lexeme);
+        if (found == reductions.end()) {
+            report(DiagnosticCode::PARALLEL_SHARED_ASSIGNMENT, token);
+        } else if (found->second != reduction.token.type) {
+            report(DiagnosticCode::PARALLEL_REDUCTION_USE, token);
+        }
+    }
+
+    void readShared(const ASTNode& node) override {
+        const std::string& name = node.token.lexeme;
+        if (node.type == ASTNodeType::IDENTIFIER) {
+            if (reductions.count(name)) report(DiagnosticCode::PARALLEL_REDUCTION_USE, node.token);
+        } else if (writtenArrays.count(name) &&
+                   (node.type == ASTNodeType::ARRAY_REFERENCE || !isLoopIndex(*node.children[0]))) {
+            report(DiagnosticCode::PARALLEL_ARRAY_CONFLICT, node.token);
+        }
+    }
+
+    void output(const ASTNode& put) override { report(DiagnosticCode::PARALLEL_OUTPUT, put.token); }
+
+    void returns(const ASTNode& node) override { report(DiagnosticCode::PARALLEL_RETURN, node.token); }
+
+    void yields(const ASTNode& node) override { report(DiagnosticCode::PARALLEL_YIELD, node.token); }
+
+    void call(const ASTNode& node) override {
+        auto found = procedures.procedures.find(node.token.lexeme);
+        bool shares = found == procedures.procedures.end() || found->second.writes;
+        if (!shares) {
+            found->second.reads.forEach([&](size_t index) {
+                const std::string& name = procedures.globals->name(index);
+                if (reductions.count(name) || writtenArrays.count(name)) shares = true;
+            });
+        }
+        if (shares) report(DiagnosticCode::PARALLEL_CALL, node.token);
+    }
+};
+
+// Check if a tree spawns a call
+bool containsSpawn(const ASTNode& node) {
+    if (node.type == ASTNodeType::SPAWN_STATEMENT) return true;
+    for (const auto& child : node.children) {
+        if (containsSpawn(*child)) return true;
+    }
+    return false;
+}
+
+// Follows spawns and syncs through the control flow. Spawned procedures only
+// read shared state, so what a running call could see change is what it reads;
+// a branch leaves running what either arm does, and a loop what a second trip
+// would start with.
+class TaskWalk : public ScopedWalk {
+public:
+    TaskWalk(RunningTasks& running, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics)
+        : running(running), procedures(procedures), diagnostics(diagnostics) {}
+
+    void declareParameter(const std::string& parameter) { locals.declareVariable(parameter, VariableType::INTEGER); }
+
+    void visit(const ASTNode& node) override {
+        switch (node.type) {
+            case ASTNodeType::SPAWN_STATEMENT: {
+                const ASTNode& call = *node.children[0];
+                visitChildren(call, 0); // The arguments are evaluated before the call is spawned
+                auto found = procedures.procedures.find(call.token.lexeme);
+                if (found == procedures.procedures.end() || found->second.writes) {
+                    report(DiagnosticCode::SPAWN_SHARED_WRITE, call.token);
+                } else {
+                    running.insert(found->second.reads);
+                }
+                break;
+            }
+            case ASTNodeType::SYNC_STATEMENT:
+                running.clear();
+                break;
+            case ASTNodeType::IF_STATEMENT: {
+                visit(*node.children[0]);
+                RunningTasks before = running;
+                RunningTasks after;
+                bool exhaustive = false;
+                for (size_t i = 1; i < node.children.size(); i++) {
+                    running = before;
+                    visit(*node.children[i]);
+                    after.insert(running);
+                    exhaustive = exhaustive || node.children[i]->type == ASTNodeType::ELSE_STATEMENT;
+                }
+                if (!exhaustive) after.insert(before);
+                running = after;
+                break;
+            }
+            case ASTNodeType::WHILE_STATEMENT:
+            case ASTNodeType::FOR_STATEMENT:
+            case ASTNodeType::PARALLEL_FOR_STATEMENT:
+            case ASTNodeType::FOR_EACH_STATEMENT: {
+                if (running.empty() && !containsSpawn(node)) break;
+                RunningTasks before = running;
+                ScopedWalk::visit(node);
+                if (running != before) ScopedWalk::visit(node);
+                running.insert(before); // The loop may not run at all
+                break;
+            }
+            default:
+                ScopedWalk::visit(node);
+                break;
+        }
+    }
+
+private:
+    RunningTasks& running;
+    const ProcedureEffectsMap& procedures;
+    Diagnostics& diagnostics;
+    std::set<std::tuple<int, int, DiagnosticCode>> reported; // Loops are walked twice
+
+    void report(DiagnosticCode code, const Token& token) {
+        if (reported.insert(std::make_tuple(token.line, token.column, code)).second) diagnostics.report(code, token);
+    }
+
+    // Names no procedure reads have no number, and no running call reads them
+    bool isRunning(const std::string& name) const {
+        size_t index;
+        return procedures.globals->find(name, index) && running.contains(index);
+    }
+
+    void assignShared(const ASTNode& assignment) override {
+        const ASTNode& target = *assignment.children[0];
+        if (isRunning(target.token.lexeme)) report(DiagnosticCode::TASK_SHARED_WRITE, target.token);
+        visitChildren(target, 0);
+        visit(*assignment.children[1]);
+    }
+
+    void reduceShared(const ASTNode& reduction) override {
+        const Token& token = reduction.children[0]->token;
+        if (isRunning(token.lexeme)) report(DiagnosticCode::TASK_SHARED_WRITE, token);
+    }
+
+    void readShared(const ASTNode&) override {}
+
+    void output(const ASTNode&) override {}
+
+    void call(const ASTNode& node) override {
+        if (running.empty()) return;
+        auto found = procedures.procedures.find(node.token.lexeme);
+        if (found == procedures.procedures.end()) {
+            report(DiagnosticCode::TASK_SHARED_WRITE, node.token);
+            return;
+        }
+        if (found->second.assigned.intersects(running)) report(DiagnosticCode::TASK_SHARED_WRITE, node.token);
+    }
+};
+
+}
+
+// Effects of a procedure, given those of the procedures before it
+ProcedureEffects analyzeProcedure(const ASTNode& procedure, ProcedureEffectsMap& procedures) {
+    ProcedureWalk walk(procedure.children[0]->token.lexeme, procedures);
+    for (size_t i = 1; i + 1 < procedure.children.size(); i++) {
+        walk.declareParameter(procedure.children[i]->token.lexeme);
+    }
+    walk.visit(*procedure.children.back());
+    return walk.effects;
+}
+
+// Report what in the body of a parallel for could make its iterations race
+void checkParallelLoop(const ASTNode& loop, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics) {
+    ParallelLoopWalk walk(loop, procedures, diagnostics);
+    walk.run(*loop.children.back());
+}
+
+// Report spawns of procedures that share state, and writes to what running spawned calls read
+void checkTasks(const ASTNode& statement, RunningTasks& running, const ProcedureEffectsMap& procedures,
+                Diagnostics& diagnostics) {
+    if (running.empty() && !containsSpawn(statement)) return;
+    TaskWalk walk(running, procedures, diagnostics);
+    walk.visit(statement);
+}
+
+// The same for the body of a procedure
+void checkProcedureTasks(const ASTNode& procedure, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics) {
+    if (!containsSpawn(procedure)) return;
+    RunningTasks running;
+    TaskWalk walk(running, procedures, diagnostics);
+    for (size_t i = 1; i + 1 < procedure.children.size(); i++) {
+        walk.declareParameter(procedure.children[i]->token.lexeme);
+    }
+    walk.visit(*procedure.children.back());
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ASTNode;
+class Diagnostics;
+
+// Numbers the globals and global arrays procedures read or assign, in the
+// order they are first met, so the sets of them below take a bit each
+class GlobalNames {
+public:
+    size_t number(const std::string& name);
+    bool find(const std::string& name, size_t& index) const;
+    const std::string& name(size_t index) const { return *names[index]; }
+
+private:
+    std::unordered_map<std::string, size_t> indices;
+    std::vector<const std::string*> names; // Keys of indices, by number
+};
+
+// Set of globals numbered by a GlobalNames
+class GlobalSet {
+public:
+    void insert(size_t index);
+    void insert(const GlobalSet& other);
+    bool contains(size_t index) const;
+    bool intersects(const GlobalSet& other) const;
+    bool empty() const { return words.empty(); }
+    void clear() { words.clear(); }
+    bool operator==(const GlobalSet& other) const { return words == other.words; }
+    bool operator!=(const GlobalSet& other) const { return words != other.words; }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (size_t word = 0; word < words.size(); word++) {
+            for (uint64_t bits = words[word]; bits; bits &= bits - 1) visit(word * 64 + __builtin_ctzll(bits));
+        }
+    }
+
+private:
+    std::vector<uint64_t> words; // No trailing zero words, so equal sets compare equal
+};
+
+// What a procedure does to state outside it, directly or through the procedures it calls
+struct ProcedureEffects {
+    bool writes = false;  // Assigns globals or global array elements, or prints
+    GlobalSet reads;      // Globals and global arrays it reads
+    GlobalSet assigned;   // Globals and global arrays it assigns
+    bool yields = false;  // Is a generator, which for each loops run instead of calls
+};
+
+// Effects of the procedures defined so far. Maps that share their global
+// numbers can exchange effects, as the parsers of one Document do.
+struct ProcedureEffectsMap {
+    std::unordered_map<std::string, ProcedureEffects> procedures;
+    std::shared_ptr<GlobalNames> globals = std::make_shared<GlobalNames>();
+};
+
+// Globals and global arrays read by spawned calls that may still be running,
+// numbered by the globals of the effects map the task checks are given
+using RunningTasks = GlobalSet;
+
+// Effects of a procedure, given those of the procedures before it. Calls to
+// procedures that are not known yet count as writing. The globals it uses are
+// numbered in procedures.globals.
+ProcedureEffects analyzeProcedure(const ASTNode& procedure, ProcedureEffectsMap& procedures);
+
+// Report what in the body of a parallel for could make its iterations race:
+// assignments to variables declared outside the loop other than reduction
+// updates, reads of reduction variables, array elements other than a[i] of
+// arrays the loop writes, output, return, yield, and calls to procedures that write
+// shared state or read what the loop writes. Names are resolved through a
+// SymbolTable of the declarations inside the loop.
+void checkParallelLoop(const ASTNode& loop, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics);
+
+// Report spawns of procedures that write shared state or print, and writes to
+// what a spawned call that may still be running reads. Follows the control
+// flow of a top-level statement: running holds what the calls spawned before
+// it read, and gets what is still running after it. sync empties it.
+void checkTasks(const ASTNode& statement, RunningTasks& running, const ProcedureEffectsMap& procedures,
+                Diagnostics& diagnostics);
+
+// The same for the body of a procedure, which syncs before returning
+void checkProcedureTasks(const ASTNode& procedure, const ProcedureEffectsMap& procedures, Diagnostics& diagnostics);
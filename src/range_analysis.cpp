@@ -0,0 +1,859 @@
+#include "range_analysis.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+const int delayedWidening = 2; // Trips of a loop run before ranges that keep growing are widened
+
+// The values something can have, from low to high; none when low is above high
+struct Range {
+    long long low = 1;
+    long long high = 0;
+
+    bool empty() const { return low > high; }
+};
+
+const Range none;
+const Range int32Range = {INT32_MIN, INT32_MAX};
+const Range int64Range = {INT64_MIN, INT64_MAX};
+
+// Bounds of a result before it is known to fit in 64 bits
+struct Exact {
+    __int128 low;
+    __int128 high;
+};
+
+// The values either range can have
+Range join(const Range& a, const Range& b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    return {std::min(a.low, b.low), std::max(a.high, b.high)};
+}
+
+// Check if every value of inner is one of outer
+bool includes(const Range& outer, const Range& inner) {
+    return inner.empty() || (!outer.empty() && outer.low <= inner.low && inner.high <= outer.high);
+}
+
+// The range a loop goes on with when next has values old does not: bounds that grew move to
+// the end of the 32-bit range, or of the 64-bit range when they are past that already
+Range widen(const Range& old, const Range& next) {
+    if (old.empty() || next.empty()) return join(old, next);
+    Range widened = old;
+    if (next.low < old.low) widened.low = next.low >= INT32_MIN ? INT32_MIN : INT64_MIN;
+    if (next.high > old.high) widened.high = next.high <= INT32_MAX ? INT32_MAX : INT64_MAX;
+    return widened;
+}
+
+// Check if an exact result always fits in limits
+bool fits(const Exact& exact, const Range& limits) {
+    return exact.low >= limits.low && exact.high <= limits.high;
+}
+
+// The values of an exact result that fit in limits; the others stop the program
+Range clamp(const Exact& exact, const Range& limits) {
+    return {static_cast<long long>(std::max<__int128>(exact.low, limits.low)),
+            static_cast<long long>(std::min<__int128>(exact.high, limits.high))};
+}
+
+// The smallest and largest of the four results of an operator on the bounds of its operands
+Exact corners(TokenType op, const Range& left, const Range& right) {
+    __int128 values[4];
+    long long lefts[2] = {left.low, left.high};
+    long long rights[2] = {right.low, right.high};
+    for (int i = 0; i < 4; i++) {
+        __int128 a = lefts[i / 2];
+        __int128 b = rights[i % 2];
+        values[i] = op == TokenType::STAR ? a * b : a / b;
+    }
+    return {*std::min_element(values, values + 4), *std::max_element(values, values + 4)};
+}
+
+// The exact range of an arithmetic operator's result, and whether its divisor can be zero.
+// Returns false when it has no result, as every divisor is zero.
+bool exactResult(TokenType op, const Range& left, const Range& right, Exact& result, bool& divisionByZero) {
+    divisionByZero = false;
+    switch (op) {
+        case TokenType::PLUS:
+            result = {static_cast<__int128>(left.low) + right.low, static_cast<__int128>(left.high) + right.high};
+            return true;
+        case TokenType::MINUS:
+            result = {static_cast<__int128>(left.low) - right.high, static_cast<__int128>(left.high) - right.low};
+            return true;
+        case TokenType::STAR:
+            result = corners(op, left, right);
+            return true;
+        default:
+            break;
+    }
+
+    // Truncating division is monotonic in each operand while the divisor keeps its sign,
+    // so the results are at the corners of the negative and of the positive divisors
+    divisionByZero = right.low <= 0 && right.high >= 0;
+    bool any = false;
+    const Range parts[2] = {{right.low, std::min(right.high, -1LL)}, {std::max(right.low, 1LL), right.high}};
+    for (const Range& part : parts) {
+        if (part.empty()) continue;
+        Exact quotient = corners(op, left, part);
+        result = any ? Exact{std::min(result.low, quotient.low), std::max(result.high, quotient.high)} : quotient;
+        any = true;
+    }
+    return any;
+}
+
+bool isComparison(TokenType type) {
+    switch (type) {
+        case TokenType::EQUAL:
+        case TokenType::NOT_EQUAL:
+        case TokenType::LESS:
+        case TokenType::GREATER:
+        case TokenType::LESS_EQUAL:
+        case TokenType::GREATER_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The comparison that holds when this one does not
+TokenType negated(TokenType type) {
+    switch (type) {
+        case TokenType::EQUAL: return TokenType::NOT_EQUAL;
+        case TokenType::NOT_EQUAL: return TokenType::EQUAL;
+        case TokenType::LESS: return TokenType::GREATER_EQUAL;
+        case TokenType::GREATER: return TokenType::LESS_EQUAL;
+        case TokenType::LESS_EQUAL: return TokenType::GREATER;
+        default: return TokenType::LESS;
+    }
+}
+
+// The comparison with its operands swapped
+TokenType mirrored(TokenType type) {
+    switch (type) {
+        case TokenType::LESS: return TokenType::GREATER;
+        case TokenType::GREATER: return TokenType::LESS;
+        case TokenType::LESS_EQUAL: return TokenType::GREATER_EQUAL;
+        case TokenType::GREATER_EQUAL: return TokenType::LESS_EQUAL;
+        default: return type;
+    }
+}
+
+// Check if an expression is a whole array, which array kernels compute
+bool arrayValued(const ASTNode& node) {
+    if (node.type == ASTNodeType::ARRAY_REFERENCE) return true;
+    if (node.type != ASTNodeType::BINARY_OP) return false;
+    return std::any_of(node.children.begin(), node.children.end(),
+                       [](const std::shared_ptr<ASTNode>& child) { return child && arrayValued(*child); });
+}
+
+// Check if an expression calls a procedure, which may assign globals
+bool hasCalls(const ASTNode& node) {
+    if (node.type == ASTNodeType::PROCEDURE_CALL) return true;
+    return std::any_of(node.children.begin(), node.children.end(),
+                       [](const std::shared_ptr<ASTNode>& child) { return child && hasCalls(*child); });
+}
+
+// Check if a program spawns tasks, which may assign globals while main runs
+bool spawnsTasks(const ASTNode& node) {
+    if (node.type == ASTNodeType::SPAWN_STATEMENT) return true;
+    return std::any_of(node.children.begin(), node.children.end(),
+                       [](const std::shared_ptr<ASTNode>& child) { return child && spawnsTasks(*child); });
+}
+
+// Runs a program on ranges, round after round, until what it found stops changing
+class Analyzer {
+public:
+    Analyzer(const std::shared_ptr<ASTNode>& program, const std::vector<std::shared_ptr<ASTNode>>& mainStatements);
+    CheckedArithmetic run();
+
+private:
+    // How an operator is computed wherever the program reaches it
+    struct Operation {
+        bool wide = false;
+        bool checked = false;
+        bool wideOperands = false;
+    };
+    // A variable in scope; globals of the main program have no declaration
+    struct Variable {
+        std::string_view name;
+        const ASTNode* declaration;
+    };
+    // The ranges of the variables in scope at a point of the program, which may not be reachable
+    struct State {
+        std::vector<Range> values;
+        bool reachable = true;
+    };
+
+    void analyzeProcedure(const ASTNode& procedure);
+    void analyzeMain();
+    void execute(const ASTNode& node, State& state);
+    void executeIf(const ASTNode& node, State& state);
+    void executeWhile(const ASTNode& node, State& state);
+    void executeFor(const ASTNode& node, State& state);
+    void executeForEach(const ASTNode& node, State& state);
+    Range evaluateStatement(const ASTNode& node, State& state);
+    Range evaluate(const ASTNode& node, State& state);
+    Range evaluateOperation(const ASTNode& node, State& state);
+    void evaluateArray(const ASTNode& node, State& state);
+    void refine(const ASTNode& condition, bool outcome, State& state);
+    void bound(const ASTNode& operand, TokenType comparison, const Range& other, State& state);
+    void boundSum(const ASTNode& sum, TokenType comparison, const Range& other, State& state);
+    void boundSquare(const ASTNode& square, TokenType comparison, const Range& other, State& state);
+    void assign(const ASTNode& assignment, std::string_view name, Range value, State& state);
+    void declare(const ASTNode& declaration, Range value, State& state);
+    void keep(const ASTNode& site, const ASTNode& value, const Range& range);
+    bool recording() const { return exploring == 0; }
+    void forgetGlobals(State& state);
+    int find(std::string_view name) const;
+    void merge(State& into, const State& from) const;
+    bool includesState(const State& outer, const State& inner) const;
+    void widenState(State& head, const State& next, bool delayed) const;
+
+    std::vector<const ASTNode*> procedures;
+    const std::vector<std::shared_ptr<ASTNode>>& mainStatements;
+    std::vector<std::string_view> globalNames;
+    bool tasks;                                                    // Main sees its globals like procedures do
+    bool inMain = false;
+    std::vector<Variable> scope;                                   // Innermost last
+    std::unordered_map<std::string_view, Range> globals;           // Values given to each global, as of the last round
+    std::unordered_map<std::string_view, Range> stored;            // Values given to each global in this round
+    std::unordered_set<std::string_view> assignedByProcedures;     // Globals some procedure assigns
+    std::unordered_map<const ASTNode*, Operation> operations;
+    std::unordered_map<const ASTNode*, Range> locals;              // Values given to each local, by declaration
+    std::unordered_set<const ASTNode*> wideValues;
+    std::unordered_set<const ASTNode*> keptOperations;            // Operators whose kept result may not fit
+    int exploring = 0;                                             // Loops finding their ranges, which record nothing
+    bool changed = false;
+};
+
+Analyzer::Analyzer(const std::shared_ptr<ASTNode>& program, const std::vector<std::shared_ptr<ASTNode>>& mainStatements)
+    : mainStatements(mainStatements), tasks(spawnsTasks(*program)) {
+    for (const auto& child : program->children) {
+        if (child->type == ASTNodeType::PROCEDURE && child->children.size() >= 2) procedures.push_back(child.get());
+        if (child->type == ASTNodeType::DECLARATION) {
+            globalNames.push_back(child->children[0]->token.lexeme);
+            globals[globalNames.back()] = {0, 0};
+        }
+    }
+}
+
+// Run the program until another round finds nothing new. Globals start at 0 and every value
+// given to them widens what procedures see; an operator that needs 64 bits or a check keeps them,
+// so the last round, which sees every value, decides.
+CheckedArithmetic Analyzer::run() {
+    do {
+        changed = false;
+        stored.clear();
+        for (std::string_view name : globalNames) stored[name] = {0, 0};
+        for (const ASTNode* procedure : procedures) analyzeProcedure(*procedure);
+        analyzeMain();
+        for (std::string_view name : globalNames) {
+            Range& known = globals[name];
+            if (includes(known, stored[name])) continue;
+            known = widen(known, join(known, stored[name]));
+            changed = true;
+        }
+    } while (changed);
+
+    CheckedArithmetic arithmetic;
+    for (const auto& entry : operations) {
+        if (entry.second.wide) arithmetic.wideOperations.insert(entry.first);
+        if (entry.second.checked) arithmetic.checkedOperations.insert(entry.first);
+    }
+    for (const ASTNode* operation : keptOperations) {
+        if (!operations[operation].wideOperands) arithmetic.narrowedOperations.insert(operation);
+    }
+    arithmetic.wideValues = std::move(wideValues);
+    for (const auto& entry : locals) {
+        if (!includes(int32Range, entry.second)) arithmetic.wideVariables.insert(entry.first);
+    }
+    for (const auto& entry : globals) {
+        if (!includes(int32Range, entry.second)) arithmetic.wideGlobals.emplace(entry.first);
+    }
+    return arithmetic;
+}
+
+// Run a procedure body for any arguments
+void Analyzer::analyzeProcedure(const ASTNode& procedure) {
+    inMain = false;
+    scope.clear();
+    State state;
+    for (size_t i = 1; i + 1 < procedure.children.size(); i++) {
+        const ASTNode& parameter = *procedure.children[i];
+        if (parameter.type != ASTNodeType::PARAMETER) continue;
+        scope.push_back({parameter.token.lexeme, &parameter});
+        state.values.push_back(int32Range);
+    }
+    execute(*procedure.children.back(), state);
+}
+
+// Run the main program from globals that are all 0. A global's declaration assigns it. When tasks
+// may assign globals at any time, main only knows every value they are given, as procedures do.
+void Analyzer::analyzeMain() {
+    inMain = true;
+    scope.clear();
+    State state;
+    for (std::string_view name : tasks ? std::vector<std::string_view>() : globalNames) {
+        scope.push_back({name, nullptr});
+        state.values.push_back({0, 0});
+    }
+    for (const auto& statement : mainStatements) {
+        if (statement->type != ASTNodeType::DECLARATION) {
+            execute(*statement, state);
+        } else if (statement->children.size() >= 2) {
+            Range value = evaluateStatement(*statement->children[1], state);
+            assign(*statement, statement->children[0]->token.lexeme, value, state);
+        }
+    }
+}
+
+// Run a statement on the ranges of state
+void Analyzer::execute(const ASTNode& node, State& state) {
+    if (!state.reachable) return;
+    switch (node.type) {
+        case ASTNodeType::BLOCK: {
+            size_t depth = scope.size();
+            for (const auto& child : node.children) {
+                if (child) execute(*child, state);
+            }
+            scope.resize(depth);
+            state.values.resize(depth);
+            return;
+        }
+        case ASTNodeType::DECLARATION:
+            declare(node, node.children.size() >= 2 ? evaluateStatement(*node.children[1], state) : Range{0, 0}, state);
+            return;
+        case ASTNodeType::ASSIGNMENT: {
+            const ASTNode& target = *node.children[0];
+            const ASTNode& value = *node.children[1];
+            if (target.type == ASTNodeType::IDENTIFIER) {
+                assign(node, target.token.lexeme, evaluateStatement(value, state), state);
+            } else if (target.type == ASTNodeType::INDEX) {
+                if (hasCalls(node)) forgetGlobals(state);
+                evaluate(*target.children[0], state);
+                keep(node, value, evaluate(value, state));
+            } else {
+                if (hasCalls(node)) forgetGlobals(state);
+                evaluateArray(value, state);
+            }
+            return;
+        }
+        case ASTNodeType::ARRAY_DECLARATION:
+            if (hasCalls(node)) forgetGlobals(state);
+            evaluate(*node.children[1], state);
+            if (node.children.size() >= 3) evaluateArray(*node.children[2], state);
+            return;
+        case ASTNodeType::CHANNEL_DECLARATION:
+            evaluateStatement(*node.children[1], state);
+            return;
+        case ASTNodeType::PUT_STATEMENT:
+            if (node.children.empty() || node.children[0]->type == ASTNodeType::STRING) return;
+            if (arrayValued(*node.children[0])) {
+                if (hasCalls(node)) forgetGlobals(state);
+                evaluateArray(*node.children[0], state);
+            } else {
+                evaluateStatement(*node.children[0], state);
+            }
+            return;
+        case ASTNodeType::PROCEDURE_CALL:
+            evaluateStatement(node, state);
+            return;
+        case ASTNodeType::RETURN_STATEMENT:
+            if (!node.children.empty()) {
+                keep(*node.children[0], *node.children[0], evaluateStatement(*node.children[0], state));
+            }
+            state.reachable = false;
+            return;
+        case ASTNodeType::SEND_STATEMENT:
+        case ASTNodeType::YIELD_STATEMENT:
+            keep(*node.children[0], *node.children[0], evaluateStatement(*node.children[0], state));
+            return;
+        case ASTNodeType::SPAWN_STATEMENT:
+            evaluateStatement(*node.children[0], state);
+            return;
+        case ASTNodeType::SYNC_STATEMENT:
+            forgetGlobals(state);
+            return;
+        case ASTNodeType::IF_STATEMENT:
+            executeIf(node, state);
+            return;
+        case ASTNodeType::WHILE_STATEMENT:
+            executeWhile(node, state);
+            return;
+        case ASTNodeType::FOR_STATEMENT:
+        case ASTNodeType::PARALLEL_FOR_STATEMENT:
+            executeFor(node, state);
+            return;
+        case ASTNodeType::FOR_EACH_STATEMENT:
+            executeForEach(node, state);
+            return;
+        default:
+            return;
+    }
+}
+
+// Run each arm on the ranges for which its condition holds and the ones before it did not
+void Analyzer::executeIf(const ASTNode& node, State& state) {
+    State rest = state;
+    State out{state.values, false};
+    auto arm = [&](const ASTNode& condition, const ASTNode& block) {
+        evaluateStatement(condition, rest);
+        State taken = rest;
+        refine(condition, true, taken);
+        execute(block, taken);
+        merge(out, taken);
+        refine(condition, false, rest);
+    };
+    arm(*node.children[0], *node.children[1]);
+    for (size_t i = 2; i < node.children.size(); i++) {
+        const ASTNode& child = *node.children[i];
+        if (child.type == ASTNodeType::ELSEIF_STATEMENT) {
+            arm(*child.children[0], *child.children[1]);
+        } else if (child.type == ASTNodeType::ELSE_STATEMENT) {
+            execute(*child.children[0], rest);
+        }
+    }
+    merge(out, rest);
+    state = std::move(out);
+}
+
+// Run the body until the ranges at the condition include what the body leaves, then leave with the
+// ranges for which the condition does not hold. The last ranges are the ones the body left, which
+// the condition bounds again after widening; they hold on every trip, so the body is run once more
+// from them to record what it computes.
+void Analyzer::executeWhile(const ASTNode& node, State& state) {
+    const ASTNode& condition = *node.children[0];
+    auto trip = [&](State next) {
+        evaluateStatement(condition, next);
+        refine(condition, true, next);
+        execute(*node.children[1], next);
+        State joined = state;
+        merge(joined, next);
+        return joined;
+    };
+    State head = state;
+    State joined;
+    exploring++;
+    for (int count = 0;; count++) {
+        joined = trip(head);
+        if (includesState(head, joined)) break;
+        widenState(head, joined, count < delayedWidening);
+    }
+    exploring--;
+    trip(joined);
+    state = std::move(joined);
+    evaluateStatement(condition, state);
+    refine(condition, false, state);
+}
+
+// Run a for loop like a while loop on its variable, which is between the start and the bound while
+// the body runs and is stepped after it. Its declaration is given the start and the bound: the
+// generated loop counts its trips in 64 bits, so the variable never holds a value past the bound.
+void Analyzer::executeFor(const ASTNode& node, State& state) {
+    if (hasCalls(node)) forgetGlobals(state);
+    Range start = evaluate(*node.children[1], state);
+    Range limit = evaluate(*node.children[2], state);
+    Range step = {1, 1};
+    for (size_t i = 3; i + 1 < node.children.size(); i++) {
+        if (node.children[i]->type != ASTNodeType::REDUCTION) step = evaluate(*node.children[i], state);
+    }
+    if (start.empty() || limit.empty() || step.empty()) {
+        state.reachable = false;
+        return;
+    }
+    if (recording()) locals[&node] = join(locals[&node], join(start, limit));
+
+    // Each chunk of a parallel loop adds to a sum of its own, which starts at 0
+    if (node.type == ASTNodeType::PARALLEL_FOR_STATEMENT) {
+        for (size_t i = 3; i + 1 < node.children.size(); i++) {
+            const ASTNode& reduction = *node.children[i];
+            if (reduction.type != ASTNodeType::REDUCTION || reduction.token.type != TokenType::PLUS) continue;
+            int index = find(reduction.children[0]->token.lexeme);
+            if (index >= 0) state.values[index] = join(state.values[index], {0, 0});
+        }
+    }
+
+    size_t variable = scope.size();
+    scope.push_back({node.children[0]->token.lexeme, &node});
+    state.values.push_back(start);
+    auto trip = [&](State next) {
+        Range& value = next.values[variable];
+        if (step.low > 0) value.high = std::min(value.high, limit.high);
+        if (step.high < 0) value.low = std::max(value.low, limit.low);
+        if (value.empty()) next.reachable = false;
+        execute(*node.children.back(), next);
+        if (next.reachable) {
+            Exact stepped = {static_cast<__int128>(next.values[variable].low) + step.low,
+                             static_cast<__int128>(next.values[variable].high) + step.high};
+            next.values[variable] = clamp(stepped, int64Range);
+        }
+        State joined = state;
+        merge(joined, next);
+        return joined;
+    };
+    State head = state;
+    State joined;
+    exploring++;
+    for (int count = 0;; count++) {
+        joined = trip(head);
+        if (includesState(head, joined)) break;
+        widenState(head, joined, count < delayedWidening);
+    }
+    exploring--;
+    trip(joined);
+    state = std::move(joined);
+    scope.pop_back();
+    state.values.pop_back();
+}
+
+// Run a for each loop like a while loop whose condition is a call, to the generator, which may
+// assign globals. Its variable holds any value the generator yields, which fits in 32 bits.
+void Analyzer::executeForEach(const ASTNode& node, State& state) {
+    evaluateStatement(*node.children[1], state);
+    if (!state.reachable) return;
+    size_t variable = scope.size();
+    scope.push_back({node.children[0]->token.lexeme, &node});
+    state.values.push_back(int32Range);
+    auto trip = [&](State next) {
+        forgetGlobals(next);
+        next.values[variable] = int32Range;
+        execute(*node.children.back(), next);
+        State joined = state;
+        merge(joined, next);
+        return joined;
+    };
+    State head = state;
+    State joined;
+    exploring++;
+    for (int count = 0;; count++) {
+        joined = trip(head);
+        if (includesState(head, joined)) break;
+        widenState(head, joined, count < delayedWidening);
+    }
+    exploring--;
+    trip(joined);
+    state = std::move(joined);
+    forgetGlobals(state);
+    scope.pop_back();
+    state.values.pop_back();
+}
+
+// The range of an expression a statement evaluates. Calls in it may assign globals before any of
+// its operands is read, as C++ evaluates operands in any order.
+Range Analyzer::evaluateStatement(const ASTNode& node, State& state) {
+    if (hasCalls(node)) forgetGlobals(state);
+    return evaluate(node, state);
+}
+
+// The range of a scalar expression; none when it cannot be reached or always stops the program
+Range Analyzer::evaluate(const ASTNode& node, State& state) {
+    if (!state.reachable) return none;
+    switch (node.type) {
+        case ASTNodeType::NUMBER:
+            try {
+                long long value = std::stoll(node.token.lexeme);
+                return {value, value};
+            } catch (const std::out_of_range&) {
+                return int64Range;
+            }
+        case ASTNodeType::IDENTIFIER: {
+            int index = find(node.token.lexeme);
+            if (index >= 0) return state.values[index];
+            auto global = globals.find(node.token.lexeme);
+            return global != globals.end() ? global->second : int32Range;
+        }
+        case ASTNodeType::BINARY_OP:
+            return evaluateOperation(node, state);
+        case ASTNodeType::PROCEDURE_CALL:
+            for (const auto& argument : node.children) {
+                Range value = evaluate(*argument, state);
+                if (value.empty()) return none;
+                keep(*argument, *argument, value);
+            }
+            forgetGlobals(state);
+            return int32Range;
+        case ASTNodeType::INDEX:
+            evaluate(*node.children[0], state);
+            return int32Range;
+        case ASTNodeType::ARRAY_FUNCTION:
+            evaluateArray(*node.children[0], state);
+            return node.token.lexeme == "length" ? Range{0, INT32_MAX} : int32Range;
+        default:
+            return int32Range;
+    }
+}
+
+// The range of an operator's result. Its operation is made 64 bits when an operand or the result
+// may not fit in 32, and checked when the result may not fit in 64 or the divisor may be zero; a
+// checked result is what fits, as the program stops on the rest.
+Range Analyzer::evaluateOperation(const ASTNode& node, State& state) {
+    if (arrayValued(node)) {
+        evaluateArray(node, state);
+        return int32Range;
+    }
+    Range left = evaluate(*node.children[0], state);
+    Range right = evaluate(*node.children[1], state);
+    if (left.empty() || right.empty()) return none;
+    if (isComparison(node.token.type)) return {0, 1};
+
+    Exact exact{0, 0};
+    bool divisionByZero = false;
+    bool any = exactResult(node.token.type, left, right, exact, divisionByZero);
+    Operation& operation = operations[&node];
+    bool wideOperands = !includes(int32Range, left) || !includes(int32Range, right);
+    bool wide = wideOperands || (any && !fits(exact, int32Range));
+    bool checked = divisionByZero || (any && !fits(exact, int64Range));
+    if (recording()) {
+        if ((wide && !operation.wide) || (checked && !operation.checked)) changed = true;
+        operation.wide = operation.wide || wide;
+        operation.checked = operation.checked || checked;
+        operation.wideOperands = operation.wideOperands || wideOperands;
+    }
+    if (!any) return none;
+    return clamp(exact, operation.wide || wide ? int64Range : int32Range);
+}
+
+// Evaluate the numbers an array expression combines with arrays, which array kernels take as 32 bits
+void Analyzer::evaluateArray(const ASTNode& node, State& state) {
+    if (node.type == ASTNodeType::ARRAY_REFERENCE) return;
+    if (!arrayValued(node)) {
+        keep(node, node, evaluate(node, state));
+        return;
+    }
+    for (const auto& child : node.children) evaluateArray(*child, state);
+}
+
+// Bound the variables a condition tests by what it says when it comes out as outcome: a comparison
+// bounds its operands, a product of conditions is true when each of them is, and a sum of conditions
+// is false when each of them is. Any other condition is compared with 0. Conditions with calls are
+// not used, as evaluating them again could see other globals.
+void Analyzer::refine(const ASTNode& condition, bool outcome, State& state) {
+    if (!state.reachable || arrayValued(condition) || hasCalls(condition)) return;
+    if (condition.type != ASTNodeType::BINARY_OP) {
+        bound(condition, outcome ? TokenType::NOT_EQUAL : TokenType::EQUAL, {0, 0}, state);
+        return;
+    }
+    const ASTNode& left = *condition.children[0];
+    const ASTNode& right = *condition.children[1];
+    Range leftRange = evaluate(left, state);
+    Range rightRange = evaluate(right, state);
+    if (leftRange.empty() || rightRange.empty()) return;
+    if (isComparison(condition.token.type)) {
+        TokenType comparison = outcome ? condition.token.type : negated(condition.token.type);
+        bound(left, comparison, rightRange, state);
+        bound(right, mirrored(comparison), leftRange, state);
+    } else if (condition.token.type == TokenType::STAR && outcome) {
+        refine(left, true, state);
+        refine(right, true, state);
+    } else if (condition.token.type == TokenType::PLUS && !outcome && leftRange.low >= 0 && rightRange.low >= 0) {
+        refine(left, false, state);
+        refine(right, false, state);
+    } else {
+        bound(condition, outcome ? TokenType::NOT_EQUAL : TokenType::EQUAL, {0, 0}, state);
+    }
+}
+
+// Bound a variable by "variable comparison other", when the state follows it, or the variable of a
+// sum with a number or of a square
+void Analyzer::bound(const ASTNode& operand, TokenType comparison, const Range& other, State& state) {
+    if (!state.reachable) return;
+    if (operand.type == ASTNodeType::BINARY_OP) {
+        if (operand.token.type == TokenType::PLUS || operand.token.type == TokenType::MINUS) {
+            boundSum(operand, comparison, other, state);
+        } else if (operand.token.type == TokenType::STAR) {
+            boundSquare(operand, comparison, other, state);
+        }
+        return;
+    }
+    if (operand.type != ASTNodeType::IDENTIFIER) return;
+    int index = find(operand.token.lexeme);
+    if (index < 0) return;
+    Range& value = state.values[index];
+    switch (comparison) {
+        case TokenType::LESS:
+            if (other.high == INT64_MIN) value = none;
+            else value.high = std::min(value.high, other.high - 1);
+            break;
+        case TokenType::LESS_EQUAL:
+            value.high = std::min(value.high, other.high);
+            break;
+        case TokenType::GREATER:
+            if (other.low == INT64_MAX) value = none;
+            else value.low = std::max(value.low, other.low + 1);
+            break;
+        case TokenType::GREATER_EQUAL:
+            value.low = std::max(value.low, other.low);
+            break;
+        case TokenType::EQUAL:
+            value = {std::max(value.low, other.low), std::min(value.high, other.high)};
+            break;
+        default:
+            if (other.low != other.high) break;
+            if (value.low == other.low && value.high == other.low) value = none;
+            else if (value.low == other.low) value.low++;
+            else if (value.high == other.low) value.high--;
+            break;
+    }
+    if (value.empty()) state.reachable = false;
+}
+
+// Bound the other operand of "x + c", "c + x", "x - c" or "c - x" by what a comparison of the sum says
+void Analyzer::boundSum(const ASTNode& sum, TokenType comparison, const Range& other, State& state) {
+    const ASTNode& left = *sum.children[0];
+    const ASTNode& right = *sum.children[1];
+    Range leftRange = evaluate(left, state);
+    Range rightRange = evaluate(right, state);
+    if (leftRange.empty() || rightRange.empty()) return;
+    bool minus = sum.token.type == TokenType::MINUS;
+    Exact moved;
+    if (rightRange.low == rightRange.high) {
+        // x + c compares with other as x does with other - c
+        __int128 c = minus ? -static_cast<__int128>(rightRange.low) : rightRange.low;
+        moved = {other.low - c, other.high - c};
+        if (fits(moved, int64Range)) bound(left, comparison, clamp(moved, int64Range), state);
+    } else if (leftRange.low == leftRange.high) {
+        // c - x compares with other as x does the other way round with c - other
+        __int128 c = leftRange.low;
+        moved = minus ? Exact{c - other.high, c - other.low} : Exact{other.low - c, other.high - c};
+        if (fits(moved, int64Range)) {
+            bound(right, minus ? mirrored(comparison) : comparison, clamp(moved, int64Range), state);
+        }
+    }
+}
+
+// Bound x by "x * x < other" or "x * x <= other", as its magnitude is at most the square root
+void Analyzer::boundSquare(const ASTNode& square, TokenType comparison, const Range& other, State& state) {
+    const ASTNode& left = *square.children[0];
+    const ASTNode& right = *square.children[1];
+    if ((comparison != TokenType::LESS && comparison != TokenType::LESS_EQUAL) ||
+        left.type != ASTNodeType::IDENTIFIER || right.type != ASTNodeType::IDENTIFIER ||
+        left.token.lexeme != right.token.lexeme) {
+        return;
+    }
+    __int128 limit = comparison == TokenType::LESS ? static_cast<__int128>(other.high) - 1 : other.high;
+    if (limit < 0) {
+        state.reachable = false;
+        return;
+    }
+    long long root = static_cast<long long>(std::sqrt(static_cast<double>(limit)));
+    while (static_cast<__int128>(root) * root > limit) root--;
+    while (static_cast<__int128>(root + 1) * (root + 1) <= limit) root++;
+    bound(left, TokenType::GREATER_EQUAL, {-root, -root}, state);
+    bound(left, TokenType::LESS_EQUAL, {root, root}, state);
+}
+
+// Give a variable the values of an assignment or a global's declaration. A parameter holds 32 bits,
+// so the assignment is checked when the value may not fit, and it holds what fits.
+void Analyzer::assign(const ASTNode& assignment, std::string_view name, Range value, State& state) {
+    if (!state.reachable) return;
+    if (value.empty()) {
+        state.reachable = false;
+        return;
+    }
+    int index = find(name);
+    if (index < 0) {
+        auto global = stored.find(name);
+        if (global == stored.end()) return;
+        if (recording()) global->second = join(global->second, value);
+        assignedByProcedures.insert(name);
+        return;
+    }
+    const ASTNode* declaration = scope[index].declaration;
+    if (!declaration) {
+        if (recording()) stored[name] = join(stored[name], value);
+    } else if (declaration->type == ASTNodeType::PARAMETER) {
+        keep(assignment, *assignment.children.back(), value);
+        value = {std::max<long long>(value.low, INT32_MIN), std::min<long long>(value.high, INT32_MAX)};
+        if (value.empty()) {
+            state.reachable = false;
+            return;
+        }
+    } else if (recording()) {
+        locals[declaration] = join(locals[declaration], value);
+    }
+    state.values[index] = value;
+}
+
+// Bring a local into scope with the values of its initializer
+void Analyzer::declare(const ASTNode& declaration, Range value, State& state) {
+    if (!state.reachable) return;
+    if (value.empty()) {
+        state.reachable = false;
+        return;
+    }
+    scope.push_back({declaration.children[0]->token.lexeme, &declaration});
+    state.values.push_back(value);
+    if (recording()) locals[&declaration] = join(locals[&declaration], value);
+}
+
+// Note a value passed, returned or stored in 32 bits that may not fit in them, at the node that
+// passes, returns or stores it. An operator with operands in 32 bits can be computed in 32 bits
+// there, with a check of its own.
+void Analyzer::keep(const ASTNode& site, const ASTNode& value, const Range& range) {
+    if (!recording() || includes(int32Range, range)) return;
+    if (wideValues.insert(&site).second) changed = true;
+    if (value.type == ASTNodeType::BINARY_OP && !isComparison(value.token.type)) keptOperations.insert(&value);
+}
+
+// Give the globals procedures assign every value they are given anywhere, after a call in main
+void Analyzer::forgetGlobals(State& state) {
+    if (!inMain || !state.reachable) return;
+    for (size_t i = 0; i < scope.size(); i++) {
+        if (!scope[i].declaration && assignedByProcedures.count(scope[i].name)) {
+            state.values[i] = join(state.values[i], globals[scope[i].name]);
+        }
+    }
+}
+
+// Index in scope of the innermost variable with a name, or -1
+int Analyzer::find(std::string_view name) const {
+    for (size_t i = scope.size(); i > 0; i--) {
+        if (scope[i - 1].name == name) return static_cast<int>(i - 1);
+    }
+    return -1;
+}
+
+// Add the ranges of another way to reach a point
+void Analyzer::merge(State& into, const State& from) const {
+    if (!from.reachable) return;
+    if (!into.reachable) {
+        into = from;
+        return;
+    }
+    for (size_t i = 0; i < into.values.size(); i++) into.values[i] = join(into.values[i], from.values[i]);
+}
+
+// Check if outer has every value inner has
+bool Analyzer::includesState(const State& outer, const State& inner) const {
+    if (!inner.reachable) return true;
+    if (!outer.reachable) return false;
+    for (size_t i = 0; i < outer.values.size(); i++) {
+        if (!includes(outer.values[i], inner.values[i])) return false;
+    }
+    return true;
+}
+
+// Grow the ranges at a loop's condition by what its body left: by joining them for the first trips,
+// then by widening
+void Analyzer::widenState(State& head, const State& next, bool delayed) const {
+    if (!head.reachable) {
+        head = next;
+        return;
+    }
+    for (size_t i = 0; i < head.values.size(); i++) {
+        head.values[i] = delayed ? join(head.values[i], next.values[i]) : widen(head.values[i], next.values[i]);
+    }
+}
+
+}
+
+// Find the ranges of a program's values, and what they mean for checking its arithmetic
+CheckedArithmetic analyzeRanges(const std::shared_ptr<ASTNode>& program,
+                                const std::vector<std::shared_ptr<ASTNode>>& mainStatements) {
+    return Analyzer(program, mainStatements).run();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "parser.h"
+
+// How a program built with --checked computes. Its values are exact integers: an
+// operator whose result may not fit in 32 bits is computed in 64, and a variable
+// that may hold such a result is 64 bits. The program stops with a runtime error
+// where a result may not fit in 64 bits, a divisor may be zero, or a value that
+// may not fit in 32 bits is passed, returned or stored in an array or channel,
+// which hold 32 bits. What the ranges of the values rule out is not checked.
+struct CheckedArithmetic {
+    std::unordered_set<const ASTNode*> wideOperations;    // Operators computed in 64 bits
+    std::unordered_set<const ASTNode*> checkedOperations; // Operators that may overflow or divide by zero
+    std::unordered_set<const ASTNode*> wideValues;        // Values passed, returned or stored in 32 bits that may not fit
+                                                          // (assignments to parameters and array elements by the assignment)
+    std::unordered_set<const ASTNode*> narrowedOperations; // Operators of those values computed in 32 bits, checked
+    std::unordered_set<const ASTNode*> wideVariables;     // Declarations and for loops of 64-bit locals
+    std::unordered_set<std::string> wideGlobals;          // 64-bit globals
+};
+
+// Find the ranges of the values of a program's variables and operators, by running its procedures
+// and the statements of its main program on ranges instead of numbers. Loops run until the ranges
+// stop growing; a range that keeps growing is widened to the 32-bit and then the 64-bit range, and
+// the loop's condition bounds it again. What a loop computes is recorded by one more run of its body
+// from the ranges found. Procedures are run once each, for any arguments. The main
+// program follows its globals from statement to statement, while procedures only know every value
+// a global is given anywhere, and so does main after a call to a procedure that assigns it.
+// mainStatements are those of program that are generated, after what ran at compile time.
+CheckedArithmetic analyzeRanges(const std::shared_ptr<ASTNode>& program,
+                                const std::vector<std::shared_ptr<ASTNode>>& mainStatements);
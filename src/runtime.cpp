@@ -0,0 +1,1170 @@
+#include "runtime.h"
+
+namespace {
+
+// What every part of the runtime uses
+const char* const coreRuntime = R"PL(#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace pl {
+
+// Stop with a runtime error on a PseudoLang line
+[[noreturn]] inline void fail(int line, const char* message) {
+    std::cout.flush();
+    std::fprintf(stderr, "Runtime error on line %d: %s\n", line, message);
+    std::exit(1);
+}
+
+// Trips of "for i from first to last step step", counted in unsigned arithmetic
+// so that no value past last is ever computed
+inline long long tripCount(long long first, long long last, long long step, int line) {
+    if (step == 0) fail(line, "step of a for loop is 0");
+    if (step > 0 ? first > last : first < last) return 0;
+    unsigned long long distance = step > 0 ? static_cast<unsigned long long>(last) - first
+                                           : static_cast<unsigned long long>(first) - last;
+    unsigned long long stride = step > 0 ? step : 0ull - static_cast<unsigned long long>(step);
+    return static_cast<long long>(distance / stride + 1);
+}
+
+// Set on threads where parallel loops run sequentially: those running chunks of
+// one, as the pool runs one loop at a time, and those running spawned calls
+inline thread_local bool sequentialLoops = false;
+
+}
+
+)PL";
+
+// The array runtime as it appears in generated programs. Kernels take an
+// operand pointer and a step per input: step 1 walks an array, step 0 repeats
+// the first element, which is how a number is combined with an array.
+const char* const arrayRuntime = R"PL(#include <climits>
+#include <cstring>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PL_X86 1
+#endif
+
+namespace pl {
+
+class Array {
+public:
+    explicit Array(const char* name) : name(name) {}
+    Array(const char* name, long long length, int line) : name(name) { allocate(length, line); }
+    Array(Array&& other) noexcept : name(other.name), elements(other.elements), count(other.count) {
+        other.elements = nullptr;
+        other.count = 0;
+    }
+    Array(const Array&) = delete;
+    Array& operator=(const Array&) = delete;
+    ~Array() { std::free(elements); }
+
+    // Zeroed storage, 64-byte aligned and padded to whole cache lines so kernels can use aligned loads
+    void allocate(long long length, int line) {
+        if (length < 0 || length > INT_MAX / 4) {
+            char message[160];
+            std::snprintf(message, sizeof(message), "array %s cannot have length %lld", name, length);
+            fail(line, message);
+        }
+        size_t bytes = (static_cast<size_t>(length) * sizeof(int) + 63) / 64 * 64 + 64;
+        std::free(elements);
+        elements = static_cast<int*>(std::aligned_alloc(64, bytes));
+        if (!elements) fail(line, "out of memory");
+        std::memset(elements, 0, bytes);
+        count = static_cast<int>(length);
+    }
+
+    const char* getName() const { return name; }
+    int length() const { return count; }
+    int* data() { return elements; }
+    const int* data() const { return elements; }
+
+    // Unchecked access, used where the compiler proved the index is in bounds
+    int& operator[](long long index) { return elements[index]; }
+
+    int& at(long long index, int line) {
+        if (index < 0 || index >= count) {
+            char message[160];
+            std::snprintf(message, sizeof(message), "index %lld is out of bounds for array %s of length %d",
+                          index, name, count);
+            fail(line, message);
+        }
+        return elements[index];
+    }
+
+    void swap(Array& other) {
+        std::swap(elements, other.elements);
+        std::swap(count, other.count);
+    }
+
+private:
+    const char* name;
+    int* elements = nullptr;
+    int count = 0;
+};
+
+enum class Op { ADD, SUB, MUL, DIV };
+
+enum Level { SCALAR, SSE41, AVX2 };
+
+// Widest kernels the CPU supports, capped by $PSEUDO_SIMD
+inline int simdLevel() {
+    static const int level = [] {
+        int supported = SCALAR;
+#ifdef PL_X86
+        if (__builtin_cpu_supports("sse4.1")) supported = SSE41;
+        if (__builtin_cpu_supports("avx2")) supported = AVX2;
+#endif
+        const char* cap = std::getenv("PSEUDO_SIMD");
+        if (cap && std::strcmp(cap, "scalar") == 0) return static_cast<int>(SCALAR);
+        if (cap && std::strcmp(cap, "sse4.1") == 0 && supported > SSE41) return static_cast<int>(SSE41);
+        return supported;
+    }();
+    return level;
+}
+
+// Arithmetic wraps around like the vector instructions do
+inline int combine(Op op, int x, int y) {
+    switch (op) {
+        case Op::ADD: return static_cast<int>(static_cast<unsigned>(x) + static_cast<unsigned>(y));
+        case Op::SUB: return static_cast<int>(static_cast<unsigned>(x) - static_cast<unsigned>(y));
+        case Op::MUL: return static_cast<int>(static_cast<unsigned>(x) * static_cast<unsigned>(y));
+        default: return x / y;
+    }
+}
+
+inline void binaryScalar(Op op, int* out, const int* x, int xStep, const int* y, int yStep, int begin, int end) {
+    for (int i = begin; i < end; i++) out[i] = combine(op, x[i * xStep], y[i * yStep]);
+}
+
+#ifdef PL_X86
+template <Op op>
+__attribute__((target("avx2"))) void binaryAvx2(int* out, const int* x, int xStep, const int* y, int yStep, int n) {
+    const __m256i xSplat = _mm256_set1_epi32(x[0]);
+    const __m256i ySplat = _mm256_set1_epi32(y[0]);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = xStep ? _mm256_load_si256(reinterpret_cast<const __m256i*>(x + i)) : xSplat;
+        __m256i b = yStep ? _mm256_load_si256(reinterpret_cast<const __m256i*>(y + i)) : ySplat;
+        __m256i r = op == Op::ADD ? _mm256_add_epi32(a, b)
+                  : op == Op::SUB ? _mm256_sub_epi32(a, b)
+                  : _mm256_mullo_epi32(a, b);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), r);
+    }
+    binaryScalar(op, out, x, xStep, y, yStep, i, n);
+}
+
+template <Op op>
+__attribute__((target("sse4.1"))) void binarySse41(int* out, const int* x, int xStep, const int* y, int yStep, int n) {
+    const __m128i xSplat = _mm_set1_epi32(x[0]);
+    const __m128i ySplat = _mm_set1_epi32(y[0]);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = xStep ? _mm_load_si128(reinterpret_cast<const __m128i*>(x + i)) : xSplat;
+        __m128i b = yStep ? _mm_load_si128(reinterpret_cast<const __m128i*>(y + i)) : ySplat;
+        __m128i r = op == Op::ADD ? _mm_add_epi32(a, b)
+                  : op == Op::SUB ? _mm_sub_epi32(a, b)
+                  : _mm_mullo_epi32(a, b);
+        _mm_store_si128(reinterpret_cast<__m128i*>(out + i), r);
+    }
+    binaryScalar(op, out, x, xStep, y, yStep, i, n);
+}
+
+template <Op op>
+void binaryVector(int level, int* out, const int* x, int xStep, const int* y, int yStep, int n) {
+    if (level == AVX2) binaryAvx2<op>(out, x, xStep, y, yStep, n);
+    else binarySse41<op>(out, x, xStep, y, yStep, n);
+}
+#endif
+
+// out = x op y elementwise; there is no vector integer division, so DIV is always scalar
+inline void binary(Op op, int* out, const int* x, int xStep, const int* y, int yStep, int n) {
+    if (n == 0) return;
+#ifdef PL_X86
+    int level = simdLevel();
+    if (level != SCALAR && op != Op::DIV) {
+        switch (op) {
+            case Op::ADD: binaryVector<Op::ADD>(level, out, x, xStep, y, yStep, n); return;
+            case Op::SUB: binaryVector<Op::SUB>(level, out, x, xStep, y, yStep, n); return;
+            default: binaryVector<Op::MUL>(level, out, x, xStep, y, yStep, n); return;
+        }
+    }
+#endif
+    binaryScalar(op, out, x, xStep, y, yStep, 0, n);
+}
+
+enum class Reduce { SUM, MIN, MAX };
+
+inline int reduceScalar(Reduce kind, const int* x, int begin, int end, int result) {
+    for (int i = begin; i < end; i++) {
+        if (kind == Reduce::SUM) result = static_cast<int>(static_cast<unsigned>(result) + static_cast<unsigned>(x[i]));
+        else if (kind == Reduce::MIN) result = x[i] < result ? x[i] : result;
+        else result = x[i] > result ? x[i] : result;
+    }
+    return result;
+}
+
+#ifdef PL_X86
+template <Reduce kind>
+__attribute__((target("avx2"))) int reduceAvx2(const int* x, int n) {
+    __m256i accumulator = kind == Reduce::SUM ? _mm256_setzero_si256() : _mm256_set1_epi32(x[0]);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(x + i));
+        accumulator = kind == Reduce::SUM ? _mm256_add_epi32(accumulator, a)
+                    : kind == Reduce::MIN ? _mm256_min_epi32(accumulator, a)
+                    : _mm256_max_epi32(accumulator, a);
+    }
+    alignas(32) int lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), accumulator);
+    int result = reduceScalar(kind, lanes, 1, 8, lanes[0]);
+    return reduceScalar(kind, x, i, n, result);
+}
+
+template <Reduce kind>
+__attribute__((target("sse4.1"))) int reduceSse41(const int* x, int n) {
+    __m128i accumulator = kind == Reduce::SUM ? _mm_setzero_si128() : _mm_set1_epi32(x[0]);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(x + i));
+        accumulator = kind == Reduce::SUM ? _mm_add_epi32(accumulator, a)
+                    : kind == Reduce::MIN ? _mm_min_epi32(accumulator, a)
+                    : _mm_max_epi32(accumulator, a);
+    }
+    alignas(16) int lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), accumulator);
+    int result = reduceScalar(kind, lanes, 1, 4, lanes[0]);
+    return reduceScalar(kind, x, i, n, result);
+}
+#endif
+
+template <Reduce kind>
+int reduce(const int* x, int n) {
+#ifdef PL_X86
+    int level = simdLevel();
+    if (level == AVX2) return reduceAvx2<kind>(x, n);
+    if (level == SSE41) return reduceSse41<kind>(x, n);
+#endif
+    return reduceScalar(kind, x, 1, n, x[0]);
+}
+
+inline void checkLengths(const Array& out, const Array& x, int line) {
+    if (out.length() != x.length()) {
+        char message[160];
+        std::snprintf(message, sizeof(message), "arrays %s and %s have different lengths (%d and %d)",
+                      out.getName(), x.getName(), out.length(), x.length());
+        fail(line, message);
+    }
+}
+
+inline void fill(Array& out, int value) {
+    int zero = 0;
+    binary(Op::ADD, out.data(), &value, 0, &zero, 0, out.length());
+}
+
+inline void copy(Array& out, const Array& x, int line) {
+    checkLengths(out, x, line);
+    if (out.length() > 0 && out.data() != x.data()) std::memcpy(out.data(), x.data(), out.length() * sizeof(int));
+}
+
+inline void apply(Op op, Array& out, const Array& x, const Array& y, int line) {
+    checkLengths(out, x, line);
+    checkLengths(out, y, line);
+    binary(op, out.data(), x.data(), 1, y.data(), 1, out.length());
+}
+
+inline void apply(Op op, Array& out, const Array& x, int y, int line) {
+    checkLengths(out, x, line);
+    binary(op, out.data(), x.data(), 1, &y, 0, out.length());
+}
+
+inline void apply(Op op, Array& out, int x, const Array& y, int line) {
+    checkLengths(out, y, line);
+    binary(op, out.data(), &x, 0, y.data(), 1, out.length());
+}
+
+inline int sum(const Array& x) {
+    return x.length() == 0 ? 0 : reduce<Reduce::SUM>(x.data(), x.length());
+}
+
+inline int min(const Array& x, int line) {
+    if (x.length() == 0) fail(line, "min of an empty array");
+    return reduce<Reduce::MIN>(x.data(), x.length());
+}
+
+inline int max(const Array& x, int line) {
+    if (x.length() == 0) fail(line, "max of an empty array");
+    return reduce<Reduce::MAX>(x.data(), x.length());
+}
+
+// put(array) prints the elements in brackets: [1, 2, 3]
+inline std::ostream& operator<<(std::ostream& out, const Array& x) {
+    out << '[';
+    for (int i = 0; i < x.length(); i++) out << (i ? ", " : "") << x.data()[i];
+    return out << ']';
+}
+
+}
+
+)PL";
+
+// The parallel loop runtime. Chunk boundaries depend only on the trip count
+// and partial results are combined in chunk order, so reductions come out the
+// same whatever the number of threads and however the chunks were scheduled.
+const char* const parallelRuntime = R"PL(#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pl {
+
+enum class Combine { ADD, MUL };
+
+// Worker threads that run the chunks of one loop at a time, together with the
+// thread that started it. Each starts with an equal share of the chunks and
+// takes them from the front; one that runs out steals the back half of
+// another's share. A share is a [begin, end) pair packed into one atomic word,
+// so taking and stealing are each a single compare-and-swap.
+class Pool {
+public:
+    // Never destroyed: the workers stay parked when the program exits
+    static Pool& instance() {
+        static Pool* pool = new Pool();
+        return *pool;
+    }
+
+    int threads() const { return count; }
+
+    void run(uint32_t chunks, void (*task)(void*, uint32_t), void* context) {
+        for (int p = 0; p < count; p++) {
+            shares[p].range.store(pack(uint64_t(chunks) * p / count, uint64_t(chunks) * (p + 1) / count),
+                                  std::memory_order_relaxed);
+        }
+        remaining.store(chunks, std::memory_order_relaxed);
+        busy.store(count - 1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = task;
+            this->context = context;
+            generation++;
+        }
+        wake.notify_all();
+
+        sequentialLoops = true;
+        work(0);
+        sequentialLoops = false;
+        while (remaining.load(std::memory_order_acquire) > 0 || busy.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    struct alignas(64) Share {
+        std::atomic<uint64_t> range{0};
+    };
+
+    int count = 1;
+    std::unique_ptr<Share[]> shares;
+    std::mutex mutex;
+    std::condition_variable wake;
+    uint64_t generation = 0;
+    void (*task)(void*, uint32_t) = nullptr;
+    void* context = nullptr;
+    std::atomic<uint32_t> remaining{0}; // Chunks not finished
+    std::atomic<int> busy{0};           // Workers still in the current loop
+
+    // $PSEUDO_THREADS threads, or one per hardware thread
+    Pool() {
+        const char* requested = std::getenv("PSEUDO_THREADS");
+        count = requested ? std::atoi(requested) : static_cast<int>(std::thread::hardware_concurrency());
+        if (count < 1) count = 1;
+        shares.reset(new Share[count]);
+        for (int p = 1; p < count; p++) std::thread(&Pool::loop, this, p).detach();
+    }
+
+    static uint64_t pack(uint64_t begin, uint64_t end) { return begin << 32 | end; }
+
+    void loop(int self) {
+        sequentialLoops = true;
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return generation != seen; });
+                seen = generation;
+            }
+            work(self);
+            busy.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void work(int self) {
+        for (long long chunk; (chunk = next(self)) >= 0;) {
+            task(context, static_cast<uint32_t>(chunk));
+            remaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    // Next chunk from this thread's share, else stolen from another's; -1 once all are taken
+    long long next(int self) {
+        std::atomic<uint64_t>& own = shares[self].range;
+        uint64_t range = own.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(range >> 32) < static_cast<uint32_t>(range)) {
+            if (own.compare_exchange_weak(range, range + (uint64_t(1) << 32), std::memory_order_acq_rel)) {
+                return static_cast<long long>(range >> 32);
+            }
+        }
+        for (int offset = 1; offset < count; offset++) {
+            std::atomic<uint64_t>& victim = shares[(self + offset) % count].range;
+            uint64_t stolen = victim.load(std::memory_order_acquire);
+            while (static_cast<uint32_t>(stolen >> 32) < static_cast<uint32_t>(stolen)) {
+                uint32_t begin = static_cast<uint32_t>(stolen >> 32);
+                uint32_t end = static_cast<uint32_t>(stolen);
+                uint32_t middle = begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(stolen, pack(begin, middle), std::memory_order_acq_rel)) {
+                    own.store(pack(middle + 1, end), std::memory_order_release);
+                    return middle;
+                }
+            }
+        }
+        return -1;
+    }
+};
+
+const long long maximumChunks = 1024;
+
+// Combine two partial results of a reduction. Ints wrap around, as in a
+// sequential loop; the 64-bit ones of checked programs stop on overflow.
+inline int combinePartials(Combine combine, int x, int y, int) {
+    unsigned result = combine == Combine::ADD ? static_cast<unsigned>(x) + static_cast<unsigned>(y)
+                                              : static_cast<unsigned>(x) * static_cast<unsigned>(y);
+    return static_cast<int>(result);
+}
+
+inline int64_t combinePartials(Combine combine, int64_t x, int64_t y, int line) {
+    int64_t result;
+    bool overflow = combine == Combine::ADD ? __builtin_add_overflow(x, y, &result)
+                                            : __builtin_mul_overflow(x, y, &result);
+    if (overflow) fail(line, "integer overflow");
+    return result;
+}
+
+// Run body(first, last, partials) over chunks of [0, trips) on the pool. Each
+// chunk stores its value of every reduction in partials; results gets them
+// combined in chunk order. Checked programs have 64-bit partials, and the
+// line of the loop for reporting their overflow.
+template <class T, class Body>
+void parallelFor(long long trips, int reductions, const Combine* combines, T* results, const Body& body,
+                 int line = 0) {
+    long long size = trips > maximumChunks ? (trips + maximumChunks - 1) / maximumChunks : 1;
+    long long chunks = (trips + size - 1) / size;
+    std::vector<T> partials(static_cast<size_t>(chunks * reductions));
+
+    struct Context {
+        const Body& body;
+        long long trips;
+        long long size;
+        T* partials;
+        int reductions;
+    } context{body, trips, size, partials.data(), reductions};
+    auto task = [](void* data, uint32_t chunk) {
+        Context& context = *static_cast<Context*>(data);
+        long long first = chunk * context.size;
+        long long last = first + context.size < context.trips ? first + context.size : context.trips;
+        context.body(first, last, context.partials + chunk * context.reductions);
+    };
+
+    Pool& pool = Pool::instance();
+    if (chunks > 1 && pool.threads() > 1 && !sequentialLoops) {
+        pool.run(static_cast<uint32_t>(chunks), task, &context);
+    } else {
+        for (long long chunk = 0; chunk < chunks; chunk++) task(&context, static_cast<uint32_t>(chunk));
+    }
+
+    for (int r = 0; r < reductions; r++) {
+        T result = combines[r] == Combine::ADD ? 0 : 1;
+        for (long long chunk = 0; chunk < chunks; chunk++) {
+            result = combinePartials(combines[r], result, partials[chunk * reductions + r], line);
+        }
+        results[r] = result;
+    }
+}
+
+// A loop without reductions
+template <class Body>
+void parallelFor(long long trips, int reductions, const Combine* combines, std::nullptr_t, const Body& body) {
+    parallelFor(trips, reductions, combines, static_cast<int*>(nullptr), body);
+}
+
+}
+
+)PL";
+
+// Support for spawn, sync and channels as it appears in generated programs
+const char* const taskRuntime = R"PL(#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace pl {
+
+// Set by instrumented programs, so their counters are not shared between
+// threads: spawned calls then run as they are spawned
+inline bool serialTasks = false;
+
+struct Task {
+    std::function<void()> call;
+    std::atomic<int>* pending; // Count of the group that spawned it
+};
+
+// Worker threads running spawned calls. Each has a deque of tasks: it pushes
+// and pops at the back, so it carries on with the newest task, whose data is
+// still in its cache, while threads that run out steal the oldest from the
+// front. Threads that are not workers share deque 0.
+class Scheduler {
+public:
+    // Never destroyed: the workers stay parked when the program exits
+    static Scheduler& instance() {
+        static Scheduler* scheduler = new Scheduler();
+        return *scheduler;
+    }
+
+    void push(Task* task) {
+        Deque& deque = deques[worker];
+        {
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            deque.tasks.push_back(task);
+        }
+        // Sequentially consistent, so either the sleeper sees the task or this sees the sleeper
+        queued.fetch_add(1);
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+
+    // Run this thread's newest task, else one stolen from another thread; false if there was none
+    bool runOne() {
+        Task* task = take();
+        if (!task) return false;
+        task->call();
+        task->pending->fetch_sub(1, std::memory_order_release);
+        delete task;
+        return true;
+    }
+
+private:
+    struct alignas(64) Deque {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    static inline thread_local int worker = 0;
+    int count = 2; // Deques: the shared one and one per worker
+    std::unique_ptr<Deque[]> deques;
+    std::atomic<int> queued{0};
+    std::atomic<int> sleeping{0};
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    // Workers for $PSEUDO_THREADS threads, or one per hardware thread, counting the
+    // main thread; at least one, so a main thread waiting on a channel is never alone
+    Scheduler() {
+        const char* requested = std::getenv("PSEUDO_THREADS");
+        int threads = requested ? std::atoi(requested) : static_cast<int>(std::thread::hardware_concurrency());
+        if (threads > count) count = threads;
+        deques.reset(new Deque[count]);
+        for (int w = 1; w < count; w++) std::thread(&Scheduler::loop, this, w).detach();
+    }
+
+    void loop(int self) {
+        worker = self;
+        sequentialLoops = true;
+        while (true) {
+            if (runOne()) continue;
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.fetch_add(1);
+            wake.wait(lock, [&] { return queued.load() > 0; });
+            sleeping.fetch_sub(1);
+        }
+    }
+
+    Task* take() {
+        if (queued.load(std::memory_order_relaxed) == 0) return nullptr;
+        for (int offset = 0; offset < count; offset++) {
+            Deque& deque = deques[(worker + offset) % count];
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            if (deque.tasks.empty()) continue;
+            Task* task;
+            if (offset == 0) {
+                task = deque.tasks.back();
+                deque.tasks.pop_back();
+            } else {
+                task = deque.tasks.front();
+                deque.tasks.pop_front();
+            }
+            queued.fetch_sub(1);
+            return task;
+        }
+        return nullptr;
+    }
+};
+
+// The calls one activation of a procedure, or the main program, spawned. They
+// are waited for at sync and when it returns.
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    ~TaskGroup() { sync(); }
+
+    template <class Call>
+    void spawn(Call&& call) {
+        if (serialTasks) {
+            call();
+            return;
+        }
+        pending.fetch_add(1, std::memory_order_relaxed);
+        Scheduler::instance().push(new Task{std::forward<Call>(call), &pending});
+    }
+
+    // Wait for the calls spawned so far, running queued tasks meanwhile
+    void sync() {
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (!Scheduler::instance().runOne()) std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<int> pending{0};
+};
+
+// A bounded queue of numbers that any number of threads send to and receive
+// from without locks (Vyukov's array queue). Each cell has a sequence number
+// telling whether it waits for the sender or the receiver of a position;
+// senders and receivers claim positions with a compare-and-swap and publish
+// the cell by advancing its sequence number.
+class Channel {
+public:
+    explicit Channel(const char* name) : name(name) {}
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Room for capacity numbers, rounded up to a power of two so positions map to cells with a mask
+    void allocate(long long capacity, int line) {
+        if (capacity < 1 || capacity > (1LL << 30)) {
+            char message[160];
+            std::snprintf(message, sizeof(message), "channel %s cannot have capacity %lld", name, capacity);
+            fail(line, message);
+        }
+        size_t size = 2;
+        while (size < static_cast<size_t>(capacity)) size *= 2;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+        mask = size - 1;
+        sendPosition.store(0, std::memory_order_relaxed);
+        receivePosition.store(0, std::memory_order_relaxed);
+    }
+
+    void send(int value, int line) {
+        while (!trySend(value)) {
+            if (serialTasks) {
+                grow();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Only another thread can send to an empty channel, and with serial tasks there is none
+    int receive(int line) {
+        int value;
+        while (!tryReceive(value)) {
+            if (serialTasks) {
+                char message[160];
+                std::snprintf(message, sizeof(message), "channel %s is empty and no other task can run", name);
+                fail(line, message);
+            }
+            std::this_thread::yield();
+        }
+        return value;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        int value;
+    };
+
+    const char* name;
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> sendPosition{0};
+    alignas(64) std::atomic<size_t> receivePosition{0};
+
+    // A cell is free for the sender of position p when its sequence is p
+    bool trySend(int value) {
+        size_t position = sendPosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            intptr_t lag = static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire)) -
+                           static_cast<intptr_t>(position);
+            if (lag == 0) {
+                if (sendPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = sendPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // A cell holds the number for the receiver of position p when its sequence is p + 1
+    bool tryReceive(int& value) {
+        size_t position = receivePosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            intptr_t lag = static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire)) -
+                           static_cast<intptr_t>(position + 1);
+            if (lag == 0) {
+                if (receivePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                position = receivePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Twice the cells, with the numbers queued moved to the front in order. With serial tasks
+    // nothing could receive from a full channel, so it grows instead.
+    void grow() {
+        size_t size = (mask + 1) * 2;
+        std::unique_ptr<Cell[]> grown(new Cell[size]);
+        size_t count = 0;
+        size_t end = sendPosition.load(std::memory_order_relaxed);
+        for (size_t p = receivePosition.load(std::memory_order_relaxed); p != end; p++) {
+            grown[count++].value = cells[p & mask].value;
+        }
+        for (size_t i = 0; i < size; i++) grown[i].sequence.store(i < count ? i + 1 : i, std::memory_order_relaxed);
+        cells = std::move(grown);
+        mask = size - 1;
+        receivePosition.store(0, std::memory_order_relaxed);
+        sendPosition.store(count, std::memory_order_relaxed);
+    }
+};
+
+}
+
+)PL";
+
+// Result caches of memoized procedures as they appear in generated programs
+const char* const memoRuntime = R"PL(#include <memory>
+
+namespace pl {
+
+const unsigned memoSlots = 1 << 14; // Results a cache holds
+const unsigned memoWindow = 8;      // Slots a result can be in, from the one its arguments hash to
+
+// Results of a pure procedure by its N arguments, in an open-addressing table
+// allocated on first use. A result goes in the first free slot of its window.
+// When the window is full, it replaces the first result that was not found
+// again since it was stored or since the last eviction passed over it (second
+// chance), or the first one of the window if all were.
+template <unsigned N>
+class Memo {
+public:
+    bool find(const int* key, int& value) {
+        if (!slots) return false;
+        unsigned home = hash(key);
+        for (unsigned i = 0; i < memoWindow; i++) {
+            Slot& slot = slots[(home + i) & (memoSlots - 1)];
+            if (slot.state == EMPTY) return false;
+            if (matches(slot, key)) {
+                slot.state = FOUND;
+                value = slot.value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(const int* key, int value) {
+        if (!slots) slots.reset(new Slot[memoSlots]());
+        unsigned home = hash(key);
+        Slot* victim = nullptr;
+        for (unsigned i = 0; i < memoWindow && !victim; i++) {
+            Slot& slot = slots[(home + i) & (memoSlots - 1)];
+            if (slot.state == EMPTY || matches(slot, key)) victim = &slot;
+        }
+        for (unsigned i = 0; i < memoWindow && !victim; i++) {
+            Slot& slot = slots[(home + i) & (memoSlots - 1)];
+            if (slot.state == STORED) {
+                victim = &slot;
+            } else {
+                slot.state = STORED;
+            }
+        }
+        if (!victim) victim = &slots[home];
+        for (unsigned i = 0; i < N; i++) victim->key[i] = key[i];
+        victim->value = value;
+        victim->state = STORED;
+    }
+
+private:
+    enum State : unsigned char { EMPTY, STORED, FOUND };
+    struct Slot {
+        int key[N];
+        int value;
+        State state;
+    };
+    std::unique_ptr<Slot[]> slots;
+
+    static unsigned hash(const int* key) {
+        unsigned hash = 2166136261u;
+        for (unsigned i = 0; i < N; i++) hash = (hash ^ static_cast<unsigned>(key[i])) * 0x9e3779b1u;
+        return (hash ^ (hash >> 15)) & (memoSlots - 1);
+    }
+
+    static bool matches(const Slot& slot, const int* key) {
+        for (unsigned i = 0; i < N; i++) {
+            if (slot.key[i] != key[i]) return false;
+        }
+        return true;
+    }
+};
+
+}
+
+)PL";
+
+// Arithmetic of programs built with --checked as it appears in generated programs
+const char* const checkedRuntime = R"PL(#include <cstdint>
+
+#define PL_FAIL pl::fail
+
+)PL";
+
+// The operators of checked programs, after a definition of PL_FAIL. They are
+// statement expressions, a GNU extension of C and C++: programs are built
+// without optimization, where a call would cost more than the check.
+const char* const checkedOperators = R"PL(// Operators computed in type T, which stop the program when the result does
+// not fit in it or the divisor is zero
+#define PL_CHECKED(T, overflows, a, b, line)                                  \
+    ({                                                                        \
+        T pl_checked;                                                         \
+        if (overflows(a, b, &pl_checked)) PL_FAIL(line, "integer overflow");  \
+        pl_checked;                                                           \
+    })
+#define PL_ADD(T, a, b, line) PL_CHECKED(T, __builtin_add_overflow, a, b, line)
+#define PL_SUBTRACT(T, a, b, line) PL_CHECKED(T, __builtin_sub_overflow, a, b, line)
+#define PL_MULTIPLY(T, a, b, line) PL_CHECKED(T, __builtin_mul_overflow, a, b, line)
+#define PL_DIVIDE(T, a, b, line)                                              \
+    ({                                                                        \
+        T pl_dividend = (a), pl_divisor = (b), pl_quotient;                   \
+        if (pl_divisor == 0) PL_FAIL(line, "division by zero");               \
+        if (pl_divisor == -1 ? __builtin_sub_overflow((T)0, pl_dividend, &pl_quotient) \
+                             : (pl_quotient = pl_dividend / pl_divisor, 0)) { \
+            PL_FAIL(line, "integer overflow");                                \
+        }                                                                     \
+        pl_quotient;                                                          \
+    })
+
+// A value passed, returned or stored where 32 bits are kept
+#define PL_NARROW(value, line)                                                \
+    ({                                                                        \
+        int64_t pl_value = (value);                                           \
+        if (pl_value < INT32_MIN || pl_value > INT32_MAX) {                   \
+            PL_FAIL(line, "integer overflow");                                \
+        }                                                                     \
+        (int)pl_value;                                                        \
+    })
+
+)PL";
+
+// The runtime of programs generated as C. Output is collected in a buffer
+// that goes out through write(2) when it fills and when main returns. With
+// PL_NO_LIBC defined the program makes its system calls itself and starts at
+// its own _start, so it can be linked with -static -nostartfiles and nothing
+// of the C library runs before main.
+const char* const cRuntime = R"PL(#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef PL_NO_LIBC
+#if defined(__x86_64__)
+#define PL_SYS_WRITE 1
+#define PL_SYS_EXIT_GROUP 231
+static long pl_syscall(long number, long a, long b, long c) {
+    long result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a), "S"(b), "d"(c) : "rcx", "r11", "memory");
+    return result;
+}
+__asm__(".text\n.global _start\n_start:\n    xor %rbp, %rbp\n    and $-16, %rsp\n    call pl_start\n    hlt\n");
+#elif defined(__aarch64__)
+#define PL_SYS_WRITE 64
+#define PL_SYS_EXIT_GROUP 94
+static long pl_syscall(long number, long a, long b, long c) {
+    register long x8 __asm__("x8") = number;
+    register long x0 __asm__("x0") = a;
+    register long x1 __asm__("x1") = b;
+    register long x2 __asm__("x2") = c;
+    __asm__ volatile("svc 0" : "+r"(x0) : "r"(x8), "r"(x1), "r"(x2) : "memory");
+    return x0;
+}
+__asm__(".text\n.global _start\n_start:\n    mov x29, #0\n    mov x30, #0\n    bl pl_start\n");
+#else
+#error "PL_NO_LIBC needs x86-64 or AArch64"
+#endif
+
+// Write to a file descriptor; a negative errno on failure
+static long pl_write(int fd, const char* data, size_t size) {
+    return pl_syscall(PL_SYS_WRITE, fd, (long)data, (long)size);
+}
+
+__attribute__((noreturn)) static void pl_exit(int status) {
+    pl_syscall(PL_SYS_EXIT_GROUP, status, 0, 0);
+    for (;;) {
+    }
+}
+
+int main(void);
+
+// Entered from _start with an aligned stack; main flushes the output before it returns
+void pl_start(void) {
+    pl_syscall(PL_SYS_EXIT_GROUP, main(), 0, 0);
+    for (;;) {
+    }
+}
+#else
+#include <errno.h>
+#include <unistd.h>
+
+// Write to a file descriptor; a negative errno on failure
+static long pl_write(int fd, const char* data, size_t size) {
+    long written = (long)write(fd, data, size);
+    return written < 0 ? -errno : written;
+}
+
+__attribute__((noreturn)) static void pl_exit(int status) {
+    _exit(status);
+}
+#endif
+
+static char pl_buffer[1 << 16];
+static size_t pl_used;
+
+// Write out the buffered output. What cannot be written is dropped, as with a closed stdout.
+static void pl_flush(void) {
+    size_t done = 0;
+    while (done < pl_used) {
+        long written = pl_write(1, pl_buffer + done, pl_used - done);
+        if (written == -4) continue; // EINTR
+        if (written <= 0) break;
+        done += (size_t)written;
+    }
+    pl_used = 0;
+}
+
+// Bytes are copied one at a time, so the compiler does not turn the loops into
+// calls to memcpy or strlen, which a PL_NO_LIBC program does not have
+static void pl_put_bytes(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (pl_used == sizeof(pl_buffer)) pl_flush();
+        pl_buffer[pl_used++] = data[i];
+    }
+}
+
+// put of a string, and the line break after it
+static void pl_put_string(const char* text) {
+    for (; *text; text++) {
+        if (pl_used == sizeof(pl_buffer)) pl_flush();
+        pl_buffer[pl_used++] = *text;
+    }
+    pl_put_bytes("\n", 1);
+}
+
+// put of a number, in decimal, and the line break after it. Checked programs
+// have 64-bit values too.
+static void pl_put_int(long long value) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+    *--start = '\n';
+    do {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--start = '-';
+    pl_put_bytes(start, (size_t)(end - start));
+}
+
+// Stop with a runtime error on a PseudoLang line, after the output so far
+__attribute__((noreturn, cold)) static void pl_fail(int line, const char* message) {
+    static const char prefix[] = "Runtime error on line ";
+    char text[128];
+    size_t length = 0;
+    char digits[12];
+    int count = 0;
+    unsigned int number = line > 0 ? (unsigned int)line : 0u;
+    for (size_t i = 0; prefix[i]; i++) text[length++] = prefix[i];
+    do {
+        digits[count++] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number);
+    while (count > 0) text[length++] = digits[--count];
+    text[length++] = ':';
+    text[length++] = ' ';
+    for (; *message && length < sizeof(text) - 1; message++) text[length++] = *message;
+    text[length++] = '\n';
+    pl_flush();
+    pl_write(2, text, length);
+    pl_exit(1);
+}
+
+// Trips of "for i from first to last step step", like pl::tripCount
+static long long pl_trip_count(long long first, long long last, long long step, int line) {
+    unsigned long long distance;
+    unsigned long long stride;
+    if (step == 0) pl_fail(line, "step of a for loop is 0");
+    if (step > 0 ? first > last : first < last) return 0;
+    distance = step > 0 ? (unsigned long long)last - (unsigned long long)first
+                        : (unsigned long long)first - (unsigned long long)last;
+    stride = step > 0 ? (unsigned long long)step : 0ull - (unsigned long long)step;
+    return (long long)(distance / stride + 1);
+}
+
+// Result caches of memoized procedures, which the program declares as static
+// arrays of PL_MEMO_SLOTS slots. A slot is arity + 2 ints: the state (0 empty,
+// 1 stored, 2 found again since), the result and the arguments. Results are
+// placed and evicted like in the C++ runtime's pl::Memo.
+#define PL_MEMO_SLOTS 16384
+#define PL_MEMO_WINDOW 8
+
+static int* pl_memo_slot(int* table, int arity, unsigned int index) {
+    return table + (size_t)(index & (PL_MEMO_SLOTS - 1)) * (size_t)(arity + 2);
+}
+
+static unsigned int pl_memo_hash(int arity, const int* key) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < arity; i++) hash = (hash ^ (unsigned int)key[i]) * 0x9e3779b1u;
+    return (hash ^ (hash >> 15)) & (PL_MEMO_SLOTS - 1);
+}
+
+static int pl_memo_matches(const int* slot, int arity, const int* key) {
+    for (int i = 0; i < arity; i++) {
+        if (slot[2 + i] != key[i]) return 0;
+    }
+    return 1;
+}
+
+// The result cached for key, if there is one
+static int pl_memo_find(int* table, int arity, const int* key, int* value) {
+    unsigned int home = pl_memo_hash(arity, key);
+    for (unsigned int i = 0; i < PL_MEMO_WINDOW; i++) {
+        int* slot = pl_memo_slot(table, arity, home + i);
+        if (slot[0] == 0) return 0;
+        if (pl_memo_matches(slot, arity, key)) {
+            slot[0] = 2;
+            *value = slot[1];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Cache the result for key, evicting one of its window when that is full
+static void pl_memo_store(int* table, int arity, const int* key, int value) {
+    unsigned int home = pl_memo_hash(arity, key);
+    int* victim = NULL;
+    for (unsigned int i = 0; i < PL_MEMO_WINDOW && !victim; i++) {
+        int* slot = pl_memo_slot(table, arity, home + i);
+        if (slot[0] == 0 || pl_memo_matches(slot, arity, key)) victim = slot;
+    }
+    for (unsigned int i = 0; i < PL_MEMO_WINDOW && !victim; i++) {
+        int* slot = pl_memo_slot(table, arity, home + i);
+        if (slot[0] == 1) {
+            victim = slot;
+        } else {
+            slot[0] = 1;
+        }
+    }
+    if (!victim) victim = pl_memo_slot(table, arity, home);
+    for (int i = 0; i < arity; i++) victim[2 + i] = key[i];
+    victim[1] = value;
+    victim[0] = 1;
+}
+
+)PL";
+
+// Arithmetic of programs built with --checked and generated as C, which the
+// program has after the C runtime
+const char* const cCheckedRuntime = R"PL(#define PL_FAIL pl_fail
+
+)PL";
+
+}
+
+// C++ support code every part of the runtime needs
+std::string generateCoreRuntime() {
+    return coreRuntime;
+}
+
+// C++ support code for programs that use arrays
+std::string generateArrayRuntime() {
+    return arrayRuntime;
+}
+
+// C++ support code for programs with parallel loops
+std::string generateParallelRuntime() {
+    return parallelRuntime;
+}
+
+// C++ support code for programs that spawn calls or use channels
+std::string generateTaskRuntime() {
+    return taskRuntime;
+}
+
+// C++ support code for programs with memoized procedures
+std::string generateMemoRuntime() {
+    return memoRuntime;
+}
+
+// C++ support code for programs built with --checked
+std::string generateCheckedRuntime() {
+    return std::string(checkedRuntime) + checkedOperators;
+}
+
+// The whole runtime as a header
+std::string generateRuntimeHeader() {
+    return std::string(coreRuntime) + arrayRuntime + parallelRuntime + taskRuntime + memoRuntime +
+           generateCheckedRuntime();
+}
+
+// The runtime of programs generated as C
+std::string generateCRuntime() {
+    return cRuntime;
+}
+
+// What programs generated as C need for --checked
+std::string generateCCheckedRuntime() {
+    return std::string(cCheckedRuntime) + checkedOperators;
+}
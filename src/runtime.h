@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+
+// pl::fail, which stops the program with a runtime error on a PseudoLang
+// line; it goes before the other parts
+std::string generateCoreRuntime();
+
+// C++ support code for programs that use arrays: the pl::Array type with
+// 64-byte aligned storage, checked element access that reports the PseudoLang
+// line, and elementwise operations and reductions. Those run AVX2 or SSE4.1
+// kernels, picked when the program starts from what the CPU supports, so the
+// program itself does not need to be built with -mavx2. PSEUDO_SIMD=scalar,
+// sse4.1 or avx2 caps the kernels used, for comparing them.
+std::string generateArrayRuntime();
+
+// Support code for parallel loops: a pool of one thread per core (or
+// $PSEUDO_THREADS) that splits a loop into chunks, balanced by work stealing,
+// and pl::parallelFor, which combines reductions deterministically.
+std::string generateParallelRuntime();
+
+// Support code for spawn, sync and channels: a scheduler whose worker threads
+// run spawned calls, balanced by work stealing; pl::TaskGroup, which waits for
+// the calls a procedure spawned; and pl::Channel, a bounded lock-free queue.
+std::string generateTaskRuntime();
+
+// Support code for memoized procedures: pl::Memo, a bounded open-addressing
+// table of the results of a procedure, which evicts with a second chance. Each
+// thread that calls the procedure has one.
+std::string generateMemoRuntime();
+
+// Support code for programs built with --checked: PL_ADD, PL_SUBTRACT,
+// PL_MULTIPLY and PL_DIVIDE, which compute in the type they are given and stop
+// the program on overflow and division by zero, and PL_NARROW, which stops it
+// when a value does not fit in 32 bits.
+std::string generateCheckedRuntime();
+
+// Every part above in one header, for compilers that precompile the runtime
+// once and include it in every program they build
+std::string generateRuntimeHeader();
+
+// The runtime of programs generated as C99, which needs neither libstdc++ nor
+// stdio: put writes to a buffer that goes out with write(2). Defining
+// PL_NO_LIBC makes it use system calls directly and provide _start, for
+// binaries linked with -static -nostartfiles (x86-64 and AArch64).
+std::string generateCRuntime();
+
+// What programs generated as C need after the C runtime for --checked: the
+// operators of generateCheckedRuntime, which stop the program with pl_fail.
+std::string generateCCheckedRuntime();
@@ -1,76 +1,157 @@
 #include "statement_parser.h"
 #include "expression_parser.h"
-#include <iostream>
+#include "trace.h"
+#include <algorithm>
+
+namespace {
+
+// Check if a tree has a yield statement
+bool containsYield(const ASTNode& node) {
+    if (node.type == ASTNodeType::YIELD_STATEMENT) return true;
+    return std::any_of(node.children.begin(), node.children.end(),
+                       [](const std::shared_ptr<ASTNode>& child) { return child && containsYield(*child); });
+}
+
+}
 
 // Constructor for StatementParser
-std::shared_ptr<ASTNode> StatementParser::parseDeclaration() {
+std::shared_ptr<ASTNode> StatementParser::parseDeclaration(bool topLevel) {
     // Store declare token
     auto declareToken = parser.previous();
 
     // Assume identifier is next
     auto identifierToken = parser.advance();
+    if (parser.match(TokenType::CHANNEL)) {
+        return parseChannelDeclaration(declareToken, identifierToken, topLevel);
+    }
+
+    // Arrays have their length in brackets: declare name[length]
+    std::shared_ptr<ASTNode> lengthNode = nullptr;
+    if (parser.match(TokenType::OPEN_BRACKET)) {
+        lengthNode = parser.expressionParser->parseScalarExpression();
+        if (!lengthNode) {
+            return nullptr;
+        }
+        if (!parser.match(TokenType::CLOSE_BRACKET)) {
+            parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_BRACKET, parser.peek());
+            return nullptr;
+        }
+    }
 
     std::shared_ptr<ASTNode> valueNode = nullptr;
     if (parser.match(TokenType::ASSIGN)) {
-        valueNode = parser.expressionParser->parseExpression();
+        valueNode = lengthNode ? parser.expressionParser->parseExpression()
+                               : parser.expressionParser->parseScalarExpression();
     }
 
     // Check for semicolon
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after declaration at line " << parser.peek().line
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_DECLARATION, parser.peek());
         return nullptr;
     }
 
     // Add variable to symbol table
-    parser.getSymbolTable().declareVariable(identifierToken.lexeme, VariableType::INTEGER);
+    parser.getSymbolTable().declareVariable(identifierToken.lexeme,
+                                            lengthNode ? VariableType::ARRAY : VariableType::INTEGER);
 
-    // Create the declaration AST node
-    auto declarationNode = std::make_shared<ASTNode>(ASTNodeType::DECLARATION, declareToken);
-    declarationNode->children.push_back(std::make_shared<ASTNode>(ASTNodeType::IDENTIFIER, identifierToken));
+    // Create the declaration AST node: [name, value] or, for arrays, [name, length, value]
+    auto declarationNode = makeNode(
+        lengthNode ? ASTNodeType::ARRAY_DECLARATION : ASTNodeType::DECLARATION, declareToken);
+    declarationNode->children.push_back(makeNode(ASTNodeType::IDENTIFIER, identifierToken));
+    if (lengthNode) {
+        declarationNode->children.push_back(lengthNode);
+    }
     if (valueNode) { // Add value node if it exists
         declarationNode->children.push_back(valueNode);
     }
 
     return declarationNode;
 }
+
+// Parse the rest of "declare name channel[capacity];"
+std::shared_ptr<ASTNode> StatementParser::parseChannelDeclaration(const Token& declareToken,
+                                                                  const Token& identifierToken, bool topLevel) {
+    if (!parser.match(TokenType::OPEN_BRACKET)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CHANNEL_CAPACITY, parser.peek());
+        return nullptr;
+    }
+    auto capacityNode = parser.expressionParser->parseScalarExpression();
+    if (!capacityNode) {
+        return nullptr;
+    }
+    if (!parser.match(TokenType::CLOSE_BRACKET)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_BRACKET, parser.peek());
+        return nullptr;
+    }
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_DECLARATION, parser.peek());
+        return nullptr;
+    }
+
+    // Spawned procedures can only reach a channel as a global, since their parameters are numbers
+    if (!topLevel) {
+        parser.getDiagnostics().report(DiagnosticCode::LOCAL_CHANNEL, identifierToken);
+    }
+    parser.getSymbolTable().declareVariable(identifierToken.lexeme, VariableType::CHANNEL);
+
+    auto declarationNode = makeNode(ASTNodeType::CHANNEL_DECLARATION, declareToken);
+    declarationNode->children.push_back(makeNode(ASTNodeType::IDENTIFIER, identifierToken));
+    declarationNode->children.push_back(capacityNode);
+    return declarationNode;
+}
  // Parse an assignment statement
 std::shared_ptr<ASTNode> StatementParser::parseAssignment() {
     // Store identifier token
     auto identifierToken = parser.advance();
 
+    // The target is a variable, a whole array or an array element
+    auto targetNode = makeNode(ASTNodeType::IDENTIFIER, identifierToken);
+    if (parser.check(TokenType::OPEN_BRACKET)) {
+        targetNode = parser.expressionParser->parseIndex(identifierToken);
+        if (!targetNode) {
+            return nullptr;
+        }
+    } else if (parser.getSymbolTable().getVariableType(identifierToken.lexeme) == VariableType::ARRAY) {
+        targetNode->type = ASTNodeType::ARRAY_REFERENCE;
+    } else if (parser.getSymbolTable().getVariableType(identifierToken.lexeme) == VariableType::CHANNEL) {
+        parser.getDiagnostics().report(DiagnosticCode::CHANNEL_AS_NUMBER, identifierToken);
+    }
+
     // Check to make sure assignment operator is next
     if (!parser.match(TokenType::ASSIGN)) {
-        std::cerr << "Expected '<-' after identifier at line " 
-                  << parser.peek().line << ", column " 
-                  << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_ASSIGN, parser.peek());
         return nullptr;
     }
 
-    // Parse the variable's assigned value
-    auto valueNode = parser.expressionParser->parseExpression();
+    // Parse the variable's assigned value; a whole array takes an array or a number to fill it with
+    auto valueNode = targetNode->type == ASTNodeType::ARRAY_REFERENCE
+        ? parser.expressionParser->parseExpression()
+        : parser.expressionParser->parseScalarExpression();
     if (!valueNode) {
         return nullptr;
     }
 
     // Check for semicolon
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after assignment at line " << parser.peek().line
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_ASSIGNMENT, parser.peek());
         return nullptr;
     }
 
     // Check if variable is declared
     if (!parser.getSymbolTable().isVariableDeclared(identifierToken.lexeme)) {
-        std::cerr << "Undeclared variable: " << identifierToken.lexeme 
-                  << " at line " << identifierToken.line 
-                  << ", column " << identifierToken.column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::UNDECLARED_VARIABLE, identifierToken);
+        return nullptr;
+    }
+
+    // A for loop's variable is changed only by the loop
+    if (parser.getSymbolTable().getVariableType(identifierToken.lexeme) == VariableType::LOOP_COUNTER) {
+        parser.getDiagnostics().report(DiagnosticCode::ASSIGNMENT_TO_LOOP_VARIABLE, identifierToken);
         return nullptr;
     }
 
     // Create the assignment AST node
-    auto assignmentNode = std::make_shared<ASTNode>(ASTNodeType::ASSIGNMENT, identifierToken);
-    assignmentNode->children.push_back(std::make_shared<ASTNode>(ASTNodeType::IDENTIFIER, identifierToken));
+    auto assignmentNode = makeNode(ASTNodeType::ASSIGNMENT, identifierToken);
+    assignmentNode->children.push_back(targetNode);
     assignmentNode->children.push_back(valueNode);
 
     return assignmentNode;
@@ -81,44 +162,39 @@ std::shared_ptr<ASTNode> StatementParser::parseIfStatement() {
     auto ifToken = parser.previous();
     
     // Parse condition
-    auto conditionNode = parser.expressionParser->parseExpression();
+    auto conditionNode = parser.expressionParser->parseScalarExpression();
     if (!conditionNode) {
         return nullptr;
     }
 
     // Check for 'then' keyword
     if (!parser.match(TokenType::THEN)) {
-        std::cerr << "Expected 'then' after if condition at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_THEN_AFTER_IF, parser.peek());
         return nullptr;
     }
 
-    // Enter new scope for if block
-    parser.getSymbolTable().enterScope();
-
-    // Parse if block
+    // Parse if block (parseBlock opens its own scope)
     auto ifBlockNode = parseBlock();
     if (!ifBlockNode) {
         return nullptr;
     }
 
     // Create if node
-    auto ifNode = std::make_shared<ASTNode>(ASTNodeType::IF_STATEMENT, ifToken);
+    auto ifNode = makeNode(ASTNodeType::IF_STATEMENT, ifToken);
     ifNode->children.push_back(conditionNode);
     ifNode->children.push_back(ifBlockNode);
 
     // Parse elseif and else blocks
     while (parser.peek().type == TokenType::ELSEIF) {
-        parser.advance(); // Consume ELSEIF
-        auto elseifCondition = parser.expressionParser->parseExpression();
+        Token elseifToken = parser.advance(); // Consume ELSEIF
+        auto elseifCondition = parser.expressionParser->parseScalarExpression();
         if (!elseifCondition) {
             return nullptr;
         }
 
     // Check for 'then' keyword after elseif condition
         if (!parser.match(TokenType::THEN)) {
-            std::cerr << "Expected 'then' after elseif condition at line " 
-                      << parser.peek().line << ", column " << parser.peek().column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::EXPECTED_THEN_AFTER_ELSEIF, parser.peek());
             return nullptr;
         }
 
@@ -129,7 +205,7 @@ std::shared_ptr<ASTNode> StatementParser::parseIfStatement() {
         }
 
         // Create elseif node
-        auto elseifNode = std::make_shared<ASTNode>(ASTNodeType::ELSEIF_STATEMENT, parser.previous());
+        auto elseifNode = makeNode(ASTNodeType::ELSEIF_STATEMENT, elseifToken);
         elseifNode->children.push_back(elseifCondition);
         elseifNode->children.push_back(elseifBlock);
         ifNode->children.push_back(elseifNode);
@@ -137,30 +213,25 @@ std::shared_ptr<ASTNode> StatementParser::parseIfStatement() {
 
     // Parse else block if it exists
     if (parser.peek().type == TokenType::ELSE) {
-        parser.advance(); // Consume ELSE
+        Token elseToken = parser.advance(); // Consume ELSE
         auto elseBlock = parseBlock();
         if (!elseBlock) {
             return nullptr;
         }
-        auto elseNode = std::make_shared<ASTNode>(ASTNodeType::ELSE_STATEMENT, parser.previous());
+        auto elseNode = makeNode(ASTNodeType::ELSE_STATEMENT, elseToken);
         elseNode->children.push_back(elseBlock);
         ifNode->children.push_back(elseNode);
     }
 
     // Check for 'end if' 
     if (!parser.match(TokenType::END_IF)) {
-        std::cerr << "Expected 'end if' at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_END_IF, parser.peek());
         return nullptr;
     }
 
-    // Exit scope for if block
-    parser.getSymbolTable().exitScope();
-
     // Require semicolon after end if
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after 'end if' at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_END_IF, parser.peek());
         return nullptr;
     }
 
@@ -172,15 +243,14 @@ std::shared_ptr<ASTNode> StatementParser::parseWhileStatement() {
     auto whileToken = parser.previous();
     
     // Parse condition expression 
-    auto conditionNode = parser.expressionParser->parseExpression();
+    auto conditionNode = parser.expressionParser->parseScalarExpression();
     if (!conditionNode) {
         return nullptr;
     }
 
     // Check for loop keyword after condition
     if (!parser.match(TokenType::LOOP)) {
-        std::cerr << "Expected 'loop' after while condition at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_LOOP_AFTER_WHILE, parser.peek());
         return nullptr;
     }
 
@@ -192,33 +262,202 @@ std::shared_ptr<ASTNode> StatementParser::parseWhileStatement() {
 
     // Check for end loop keyword after block
     if (!parser.match(TokenType::END_LOOP)) {
-        std::cerr << "Expected 'end loop' at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_END_LOOP, parser.peek());
         return nullptr;
     }
 
     // Require semicolon after end loop
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after 'end loop' at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_END_LOOP, parser.peek());
         return nullptr;
     }
 
     // Exit scope for while block
-    auto whileNode = std::make_shared<ASTNode>(ASTNodeType::WHILE_STATEMENT, whileToken);
+    auto whileNode = makeNode(ASTNodeType::WHILE_STATEMENT, whileToken);
     whileNode->children.push_back(conditionNode);
     whileNode->children.push_back(blockNode);
     return whileNode;
 }
 
+// Parse a for statement: for i from A to B [step S] loop ... end loop;
+std::shared_ptr<ASTNode> StatementParser::parseForStatement(bool parallel) {
+    auto forToken = parser.previous();
+
+    // Parse loop variable
+    if (!parser.match(TokenType::IDENTIFIER)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_LOOP_VARIABLE, parser.peek());
+        return nullptr;
+    }
+    auto variableToken = parser.previous();
+
+    // Parse range; the bounds are evaluated before the variable exists
+    if (!parser.match(TokenType::FROM)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_FROM, parser.peek());
+        return nullptr;
+    }
+    auto startNode = parser.expressionParser->parseScalarExpression();
+    if (!startNode) {
+        return nullptr;
+    }
+    if (!parser.match(TokenType::TO)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_TO, parser.peek());
+        return nullptr;
+    }
+    auto boundNode = parser.expressionParser->parseScalarExpression();
+    if (!boundNode) {
+        return nullptr;
+    }
+    std::shared_ptr<ASTNode> stepNode = nullptr;
+    if (parser.match(TokenType::STEP)) {
+        Token stepToken = parser.peek();
+        stepNode = parser.expressionParser->parseScalarExpression();
+        if (!stepNode) {
+            return nullptr;
+        }
+        if (stepNode->type == ASTNodeType::NUMBER &&
+            stepNode->token.lexeme.find_first_not_of('0') == std::string::npos) {
+            parser.getDiagnostics().report(DiagnosticCode::ZERO_STEP, stepToken);
+        }
+    }
+
+    // Parse reductions of a parallel loop: "reduce + total, * product"
+    std::vector<std::shared_ptr<ASTNode>> reductions;
+    if (parallel && parser.match(TokenType::REDUCE)) {
+        do {
+            if (!parser.match(TokenType::PLUS) && !parser.match(TokenType::STAR)) {
+                parser.getDiagnostics().report(DiagnosticCode::EXPECTED_REDUCTION_OPERATOR, parser.peek());
+                return nullptr;
+            }
+            auto reduction = makeNode(ASTNodeType::REDUCTION, parser.previous());
+            if (!parser.match(TokenType::IDENTIFIER)) {
+                parser.getDiagnostics().report(DiagnosticCode::INVALID_REDUCTION_VARIABLE, parser.peek());
+                return nullptr;
+            }
+            const Token& name = parser.previous();
+            bool repeated = std::any_of(reductions.begin(), reductions.end(),
+                                        [&](const std::shared_ptr<ASTNode>& other) {
+                                            return other->children[0]->token.lexeme == name.lexeme;
+                                        });
+            if (repeated || parser.getSymbolTable().getVariableType(name.lexeme) != VariableType::INTEGER) {
+                parser.getDiagnostics().report(DiagnosticCode::INVALID_REDUCTION_VARIABLE, name);
+            }
+            reduction->children.push_back(makeNode(ASTNodeType::IDENTIFIER, name));
+            reductions.push_back(reduction);
+        } while (parser.match(TokenType::COMMA));
+    }
+
+    // Check for loop keyword after range
+    if (!parser.match(TokenType::LOOP)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_LOOP_AFTER_FOR, parser.peek());
+        return nullptr;
+    }
+
+    // The loop variable lives in a scope around the block
+    parser.getSymbolTable().enterScope();
+    parser.getSymbolTable().declareVariable(variableToken.lexeme, VariableType::LOOP_COUNTER);
+    auto blockNode = parseBlock();
+    parser.getSymbolTable().exitScope();
+
+    // Check for end loop keyword after block
+    if (!parser.match(TokenType::END_LOOP)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_END_LOOP, parser.peek());
+        return nullptr;
+    }
+
+    // Require semicolon after end loop
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_END_LOOP, parser.peek());
+        return nullptr;
+    }
+
+    // Create for node: [variable, start, bound, step (if given), reductions (if parallel), block]
+    auto forNode = makeNode(parallel ? ASTNodeType::PARALLEL_FOR_STATEMENT : ASTNodeType::FOR_STATEMENT, forToken);
+    forNode->children.push_back(makeNode(ASTNodeType::IDENTIFIER, variableToken));
+    forNode->children.push_back(startNode);
+    forNode->children.push_back(boundNode);
+    if (stepNode) {
+        forNode->children.push_back(stepNode);
+    }
+    forNode->children.insert(forNode->children.end(), reductions.begin(), reductions.end());
+    forNode->children.push_back(blockNode);
+    if (parallel) {
+        checkParallelLoop(*forNode, parser.procedureEffects, parser.getDiagnostics());
+    }
+    return forNode;
+}
+
+// Parse "parallel for ...", a for loop whose iterations may run on several threads
+std::shared_ptr<ASTNode> StatementParser::parseParallelForStatement() {
+    if (!parser.match(TokenType::FOR)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_FOR_AFTER_PARALLEL, parser.peek());
+        return nullptr;
+    }
+    return parseForStatement(true);
+}
+
+// Parse "for each x in generator(arguments) loop ... end loop;", which runs the block once for every
+// value the generator yields, in order
+std::shared_ptr<ASTNode> StatementParser::parseForEachStatement() {
+    auto forToken = parser.previous();
+
+    // Parse loop variable
+    if (!parser.match(TokenType::IDENTIFIER)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_LOOP_VARIABLE, parser.peek());
+        return nullptr;
+    }
+    auto variableToken = parser.previous();
+    if (!parser.match(TokenType::IN)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_IN, parser.peek());
+        return nullptr;
+    }
+
+    // The generator's arguments are evaluated once, before the variable exists
+    if (!parser.check(TokenType::IDENTIFIER) ||
+        parser.tokens[parser.currentPosition + 1].type != TokenType::OPEN_PAREN) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_GENERATOR_CALL, parser.peek());
+        return nullptr;
+    }
+    auto callNode = parseProcedureCall(true);
+    if (!callNode) {
+        return nullptr;
+    }
+    parser.expressionParser->checkScalarArguments(*callNode);
+
+    if (!parser.match(TokenType::LOOP)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_LOOP_AFTER_FOR, parser.peek());
+        return nullptr;
+    }
+
+    // The loop variable lives in a scope around the block
+    parser.getSymbolTable().enterScope();
+    parser.getSymbolTable().declareVariable(variableToken.lexeme, VariableType::LOOP_COUNTER);
+    auto blockNode = parseBlock();
+    parser.getSymbolTable().exitScope();
+
+    if (!parser.match(TokenType::END_LOOP)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_END_LOOP, parser.peek());
+        return nullptr;
+    }
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_END_LOOP, parser.peek());
+        return nullptr;
+    }
+
+    // Create for each node: [variable, call, block]
+    auto forEachNode = makeNode(ASTNodeType::FOR_EACH_STATEMENT, forToken);
+    forEachNode->children.push_back(makeNode(ASTNodeType::IDENTIFIER, variableToken));
+    forEachNode->children.push_back(callNode);
+    forEachNode->children.push_back(blockNode);
+    return forEachNode;
+}
+
 // Parse a put statement
 std::shared_ptr<ASTNode> StatementParser::parsePutStatement() {
     auto putToken = parser.previous();
     
     // Handle opening parenthesis
     if (!parser.match(TokenType::OPEN_PAREN)) {
-        std::cerr << "Expected '(' after put at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_OPEN_PAREN_AFTER_PUT, parser.peek());
         return nullptr;
     }
     
@@ -230,57 +469,54 @@ std::shared_ptr<ASTNode> StatementParser::parsePutStatement() {
     
     // Handle closing parenthesis
     if (!parser.match(TokenType::CLOSE_PAREN)) {
-        std::cerr << "Expected ')' after put expression at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN_AFTER_PUT, parser.peek());
         return nullptr;
     }
     
     // Handle semicolon
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after put statement at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_PUT, parser.peek());
         return nullptr;
     }
 
     // Create put node
-    auto putNode = std::make_shared<ASTNode>(ASTNodeType::PUT_STATEMENT, putToken);
+    auto putNode = makeNode(ASTNodeType::PUT_STATEMENT, putToken);
     putNode->children.push_back(expressionNode);
     return putNode;
 }
 
-// Parse a procedure definition
-std::shared_ptr<ASTNode> StatementParser::parseProcedure() {
+// Parse a procedure definition. The node of one marked memo has the procedure keyword as its token,
+// with the type MEMO. A procedure with a yield in its body is a generator.
+std::shared_ptr<ASTNode> StatementParser::parseProcedure(bool memo) {
     auto procToken = parser.previous();
+    if (memo) procToken.type = TokenType::MEMO;
     
     // Parse procedure name
     if (!parser.match(TokenType::IDENTIFIER)) {
-        std::cerr << "Expected procedure name at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_PROCEDURE_NAME, parser.peek());
         return nullptr;
     }
-    auto nameNode = std::make_shared<ASTNode>(ASTNodeType::IDENTIFIER, parser.previous());
+    auto nameNode = makeNode(ASTNodeType::IDENTIFIER, parser.previous());
+    TraceScope trace("parse", "procedure ", nameNode->token.lexeme);
     
     // Parse parameters
     std::vector<std::shared_ptr<ASTNode>> params;
     if (!parser.match(TokenType::OPEN_PAREN)) {
-        std::cerr << "Expected '(' after procedure name at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_OPEN_PAREN_AFTER_PROCEDURE_NAME, parser.peek());
         return nullptr;
     }
     
     // Parse parameter list
     while (!parser.check(TokenType::CLOSE_PAREN)) {
         if (!parser.match(TokenType::IDENTIFIER)) {
-            std::cerr << "Expected parameter name at line " << parser.peek().line 
-                      << ", column " << parser.peek().column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::EXPECTED_PARAMETER_NAME, parser.peek());
             return nullptr;
         }
-        params.push_back(std::make_shared<ASTNode>(ASTNodeType::PARAMETER, parser.previous()));
+        params.push_back(makeNode(ASTNodeType::PARAMETER, parser.previous()));
         
         if (!parser.check(TokenType::CLOSE_PAREN)) {
             if (!parser.match(TokenType::COMMA)) {
-                std::cerr << "Expected ',' between parameters at line " 
-                          << parser.peek().line << ", column " << parser.peek().column << std::endl;
+                parser.getDiagnostics().report(DiagnosticCode::EXPECTED_COMMA_BETWEEN_PARAMETERS, parser.peek());
                 return nullptr;
             }
         }
@@ -288,61 +524,86 @@ std::shared_ptr<ASTNode> StatementParser::parseProcedure() {
     
     // Handle closing parenthesis
     if (!parser.match(TokenType::CLOSE_PAREN)) {
-        std::cerr << "Expected ')' after parameters at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN_AFTER_PARAMETERS, parser.peek());
         return nullptr;
     }
     
     // Parse procedure body
     if (!parser.match(TokenType::BEGIN)) {
-        std::cerr << "Expected 'begin' after procedure header at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_BEGIN, parser.peek());
         return nullptr;
     }
     
+    // Parameters are variables of the procedure body
+    parser.getSymbolTable().enterScope();
+    for (auto& param : params) {
+        parser.getSymbolTable().declareVariable(param->token.lexeme, VariableType::INTEGER);
+    }
+    inProcedure = true;
     auto bodyNode = parseBlock();
+    inProcedure = false;
+    parser.getSymbolTable().exitScope();
     
     // Handle end procedure
     if (!parser.match(TokenType::END_PROCEDURE)) {
-        std::cerr << "Expected 'end procedure' at line " << parser.peek().line 
-                  << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_END_PROCEDURE, parser.peek());
         return nullptr;
     }
     
     // Require semicolon after end procedure
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after 'end procedure' at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_END_PROCEDURE, parser.peek());
         return nullptr;
     }
     
     // Create procedure node
-    auto procNode = std::make_shared<ASTNode>(ASTNodeType::PROCEDURE, procToken);
+    auto procNode = makeNode(ASTNodeType::PROCEDURE, procToken);
     procNode->children.push_back(nameNode);
     for (auto& param : params) {
         procNode->children.push_back(param);
     }
     procNode->children.push_back(bodyNode);
+    const ProcedureEffects& effects = parser.procedureEffects.procedures[nameNode->token.lexeme] =
+        analyzeProcedure(*procNode, parser.procedureEffects);
+    checkProcedureTasks(*procNode, parser.procedureEffects, parser.getDiagnostics());
+
+    // A cached result is only right when the procedure's result depends on nothing but its arguments
+    if (memo && effects.yields) {
+        parser.getDiagnostics().report(DiagnosticCode::MEMO_GENERATOR, nameNode->token);
+    } else if (memo && (effects.writes || !effects.reads.empty())) {
+        parser.getDiagnostics().report(DiagnosticCode::MEMO_IMPURE, nameNode->token);
+    }
+    if (effects.yields) {
+        std::vector<std::string> locals;
+        for (auto& param : params) locals.push_back(param->token.lexeme);
+        checkGenerator(*bodyNode, nameNode->token.lexeme, locals);
+    }
     
     return procNode;
 }
 
-// Parse a procedure call
-std::shared_ptr<ASTNode> StatementParser::parseProcedureCall() {
+// Parse a procedure call, or the call of a generator a for each loop runs when generator is set
+std::shared_ptr<ASTNode> StatementParser::parseProcedureCall(bool generator) {
     if (!parser.match(TokenType::IDENTIFIER)) {
-        std::cerr << "Expected procedure name at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_PROCEDURE_NAME, parser.peek());
         return nullptr;
     }
     
     // Create procedure call node
     auto procName = parser.previous();
-    auto callNode = std::make_shared<ASTNode>(ASTNodeType::PROCEDURE_CALL, procName);
+    auto callNode = makeNode(ASTNodeType::PROCEDURE_CALL, procName);
+
+    // Generators only run as for each loops, and have to be defined before them
+    auto found = parser.procedureEffects.procedures.find(procName.lexeme);
+    bool yields = found != parser.procedureEffects.procedures.end() && found->second.yields;
+    if (yields != generator) {
+        parser.getDiagnostics().report(generator ? DiagnosticCode::NOT_A_GENERATOR : DiagnosticCode::GENERATOR_CALL,
+                                       procName);
+    }
     
     // Check for opening parenthesis
     if (!parser.match(TokenType::OPEN_PAREN)) {
-        std::cerr << "Expected '(' after procedure name at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_OPEN_PAREN_AFTER_PROCEDURE_NAME, parser.peek());
         return nullptr;
     }
     
@@ -356,8 +617,7 @@ std::shared_ptr<ASTNode> StatementParser::parseProcedureCall() {
         
         if (!parser.check(TokenType::CLOSE_PAREN)) {
             if (!parser.match(TokenType::COMMA)) {
-                std::cerr << "Expected ',' between arguments at line " 
-                          << parser.peek().line << ", column " << parser.peek().column << std::endl;
+                parser.getDiagnostics().report(DiagnosticCode::EXPECTED_COMMA_BETWEEN_ARGUMENTS, parser.peek());
                 return nullptr;
             }
         }
@@ -365,8 +625,7 @@ std::shared_ptr<ASTNode> StatementParser::parseProcedureCall() {
     
     // Handle closing parenthesis
     if (!parser.match(TokenType::CLOSE_PAREN)) {
-        std::cerr << "Expected ')' after arguments at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN_AFTER_ARGUMENTS, parser.peek());
         return nullptr;
     }
     
@@ -379,11 +638,11 @@ std::shared_ptr<ASTNode> StatementParser::parseProcedureCallStatement() {
     if (!callNode) {
         return nullptr;
     }
+    parser.expressionParser->checkScalarArguments(*callNode);
     
     // Handle semicolon after procedure call
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after procedure call at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_CALL, parser.peek());
         return nullptr;
     }
     
@@ -395,34 +654,184 @@ std::shared_ptr<ASTNode> StatementParser::parseReturnStatement() {
     auto returnToken = parser.previous();
     
     // Parse expression
-    auto expressionNode = parser.expressionParser->parseExpression();
+    auto expressionNode = parser.expressionParser->parseScalarExpression();
     if (!expressionNode) {
         return nullptr;
     }
     
     // Handle semicolon after return expression
     if (!parser.match(TokenType::SEMICOLON)) {
-        std::cerr << "Expected ';' after return statement at line " 
-                  << parser.peek().line << ", column " << parser.peek().column << std::endl;
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_RETURN, parser.peek());
         return nullptr;
     }
     
     // Create return node
-    auto returnNode = std::make_shared<ASTNode>(ASTNodeType::RETURN_STATEMENT, returnToken);
+    auto returnNode = makeNode(ASTNodeType::RETURN_STATEMENT, returnToken);
     returnNode->children.push_back(expressionNode);
     return returnNode;
 }
 
+// Parse "yield value;", which hands the value to the for each loop running the procedure. The
+// procedure goes on from there when the loop asks for its next value.
+std::shared_ptr<ASTNode> StatementParser::parseYieldStatement() {
+    auto yieldToken = parser.previous();
+    if (!inProcedure) {
+        parser.getDiagnostics().report(DiagnosticCode::YIELD_OUTSIDE_PROCEDURE, yieldToken);
+    }
+
+    auto expressionNode = parser.expressionParser->parseScalarExpression();
+    if (!expressionNode) {
+        return nullptr;
+    }
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_YIELD, parser.peek());
+        return nullptr;
+    }
+
+    auto yieldNode = makeNode(ASTNodeType::YIELD_STATEMENT, yieldToken);
+    yieldNode->children.push_back(expressionNode);
+    return yieldNode;
+}
+
+// Report what a generator cannot do, as its locals are kept between values in a structure and
+// it goes on from where it yielded: return, spawn or sync, call itself, declare an array that is
+// still in scope at a later yield, or declare a name of locals, the parameters and variables declared
+// around a yield, again around a yield
+void StatementParser::checkGenerator(const ASTNode& node, const std::string& name, std::vector<std::string>& locals) {
+    size_t depth = locals.size();
+    auto declare = [&](const Token& token) {
+        if (std::find(locals.begin(), locals.end(), token.lexeme) != locals.end()) {
+            parser.getDiagnostics().report(DiagnosticCode::GENERATOR_SHADOWING, token);
+        }
+        locals.push_back(token.lexeme);
+    };
+    switch (node.type) {
+        case ASTNodeType::RETURN_STATEMENT:
+            parser.getDiagnostics().report(DiagnosticCode::GENERATOR_RETURN, node.token);
+            break;
+        case ASTNodeType::SPAWN_STATEMENT:
+        case ASTNodeType::SYNC_STATEMENT:
+            parser.getDiagnostics().report(DiagnosticCode::GENERATOR_TASK, node.token);
+            return;
+        case ASTNodeType::PROCEDURE_CALL:
+            if (node.token.lexeme == name) parser.getDiagnostics().report(DiagnosticCode::GENERATOR_CALL, node.token);
+            break;
+        case ASTNodeType::BLOCK: {
+            if (!containsYield(node)) break;
+            const ASTNode* array = nullptr;
+            for (const auto& child : node.children) {
+                if (child->type == ASTNodeType::ARRAY_DECLARATION) {
+                    if (!array) array = child.get();
+                } else if (array && containsYield(*child)) {
+                    parser.getDiagnostics().report(DiagnosticCode::GENERATOR_ARRAY, array->children[0]->token);
+                    array = nullptr;
+                }
+                if (child->type == ASTNodeType::DECLARATION) declare(child->children[0]->token);
+                checkGenerator(*child, name, locals);
+            }
+            locals.resize(depth);
+            return;
+        }
+        case ASTNodeType::FOR_STATEMENT:
+        case ASTNodeType::FOR_EACH_STATEMENT:
+            if (!containsYield(node)) break;
+            for (size_t i = 1; i + 1 < node.children.size(); i++) checkGenerator(*node.children[i], name, locals);
+            declare(node.children[0]->token);
+            checkGenerator(*node.children.back(), name, locals);
+            locals.resize(depth);
+            return;
+        default:
+            break;
+    }
+    for (const auto& child : node.children) {
+        if (child) checkGenerator(*child, name, locals);
+    }
+}
+
+// Parse "spawn name(arguments);", a call that runs while its caller goes on, until a sync or
+// the end of the caller
+std::shared_ptr<ASTNode> StatementParser::parseSpawnStatement() {
+    auto spawnToken = parser.previous();
+    if (!parser.check(TokenType::IDENTIFIER) ||
+        parser.tokens[parser.currentPosition + 1].type != TokenType::OPEN_PAREN) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CALL_AFTER_SPAWN, parser.peek());
+        return nullptr;
+    }
+    auto callNode = parseProcedureCall();
+    if (!callNode) {
+        return nullptr;
+    }
+    parser.expressionParser->checkScalarArguments(*callNode);
+
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_SPAWN, parser.peek());
+        return nullptr;
+    }
+
+    auto spawnNode = makeNode(ASTNodeType::SPAWN_STATEMENT, spawnToken);
+    spawnNode->children.push_back(callNode);
+    return spawnNode;
+}
+
+// Parse "sync;", which waits for the calls spawned so far
+std::shared_ptr<ASTNode> StatementParser::parseSyncStatement() {
+    auto syncToken = parser.previous();
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_SYNC, parser.peek());
+        return nullptr;
+    }
+    return makeNode(ASTNodeType::SYNC_STATEMENT, syncToken);
+}
+
+// Parse "send(channel, value);", which waits while the channel is full
+std::shared_ptr<ASTNode> StatementParser::parseSendStatement() {
+    if (!parser.match(TokenType::OPEN_PAREN)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_OPEN_PAREN_AFTER_SEND, parser.peek());
+        return nullptr;
+    }
+    if (!parser.match(TokenType::IDENTIFIER)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CHANNEL, parser.peek());
+        return nullptr;
+    }
+    auto channelToken = parser.previous();
+    parser.expressionParser->checkChannel(channelToken);
+    if (!parser.match(TokenType::COMMA)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_COMMA_AFTER_CHANNEL, parser.peek());
+        return nullptr;
+    }
+
+    auto valueNode = parser.expressionParser->parseScalarExpression();
+    if (!valueNode) {
+        return nullptr;
+    }
+    if (!parser.match(TokenType::CLOSE_PAREN)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_CLOSE_PAREN, parser.peek());
+        return nullptr;
+    }
+    if (!parser.match(TokenType::SEMICOLON)) {
+        parser.getDiagnostics().report(DiagnosticCode::EXPECTED_SEMICOLON_AFTER_SEND, parser.peek());
+        return nullptr;
+    }
+
+    // The node is named after the channel, and its child is the value sent
+    auto sendNode = makeNode(ASTNodeType::SEND_STATEMENT, channelToken);
+    sendNode->children.push_back(valueNode);
+    return sendNode;
+}
+
 // Parse a block of statements
 std::shared_ptr<ASTNode> StatementParser::parseBlock() {
-    auto blockNode = std::make_shared<ASTNode>(ASTNodeType::BLOCK, Token(TokenType::UNKNOWN, "", 0, 0));
+    auto blockNode = makeNode(ASTNodeType::BLOCK, Token(TokenType::UNKNOWN, "", 0, 0));
 
     // Enter new scope for block
     parser.getSymbolTable().enterScope();
 
+    // Procedures do not nest, so one starting ends the block: a block missing its 'end' is reported
+    // there and the procedure after it still parses, as does every statement after that
     while (!parser.isAtEnd() && !parser.check(TokenType::END_IF) && !parser.check(TokenType::END_LOOP) && 
            !parser.check(TokenType::ELSE) && !parser.check(TokenType::ELSEIF) && 
-           !parser.check(TokenType::END_PROCEDURE)) {  
+           !parser.check(TokenType::END_PROCEDURE) && !parser.check(TokenType::PROCEDURE) &&
+           !parser.check(TokenType::MEMO)) {  
         
         // Skip whitespace
         while (!parser.isAtEnd() && parser.isWhitespace(parser.peek())) {
@@ -432,12 +841,16 @@ std::shared_ptr<ASTNode> StatementParser::parseBlock() {
         // Break if at end of block
         if (parser.isAtEnd() || parser.check(TokenType::END_IF) || parser.check(TokenType::END_LOOP) || 
             parser.check(TokenType::ELSE) || parser.check(TokenType::ELSEIF) || 
-            parser.check(TokenType::END_PROCEDURE)) break;  
+            parser.check(TokenType::END_PROCEDURE) || parser.check(TokenType::PROCEDURE) ||
+            parser.check(TokenType::MEMO)) break;  
         
         // Parse statement based on first token in block
         if (parser.match(TokenType::RETURN)) { 
             auto returnNode = parseReturnStatement();
             if (returnNode) blockNode->children.push_back(returnNode);
+        } else if (parser.match(TokenType::YIELD)) {
+            auto yieldNode = parseYieldStatement();
+            if (yieldNode) blockNode->children.push_back(yieldNode);
         } else if (parser.match(TokenType::DECLARE)) {
             auto declNode = parseDeclaration();
             if (declNode) blockNode->children.push_back(declNode);
@@ -447,13 +860,12 @@ std::shared_ptr<ASTNode> StatementParser::parseBlock() {
                 parser.currentPosition--; // Back up so parseProcedureCall sees the identifier
                 auto node = parseProcedureCallStatement();
                 if (node) blockNode->children.push_back(node);
-            } else if (parser.peek().type == TokenType::ASSIGN) {
+            } else if (parser.peek().type == TokenType::ASSIGN || parser.peek().type == TokenType::OPEN_BRACKET) {
                 parser.currentPosition--; // Back up so parseAssignment sees the identifier
                 auto node = parseAssignment();
                 if (node) blockNode->children.push_back(node);
             } else {
-                std::cerr << "Expected '<-' or '(' after identifier at line " 
-                        << identToken.line << ", column " << identToken.column << std::endl;
+                parser.getDiagnostics().report(DiagnosticCode::EXPECTED_ASSIGN_OR_CALL, identToken);
             }
         } else if (parser.match(TokenType::IF)) {
             auto ifNode = parseIfStatement();
@@ -461,13 +873,29 @@ std::shared_ptr<ASTNode> StatementParser::parseBlock() {
         } else if (parser.match(TokenType::WHILE)) {
             auto whileNode = parseWhileStatement();
             if (whileNode) blockNode->children.push_back(whileNode);
+        } else if (parser.match(TokenType::FOR)) {
+            auto forNode = parseForStatement();
+            if (forNode) blockNode->children.push_back(forNode);
+        } else if (parser.match(TokenType::FOR_EACH)) {
+            auto forEachNode = parseForEachStatement();
+            if (forEachNode) blockNode->children.push_back(forEachNode);
+        } else if (parser.match(TokenType::PARALLEL)) {
+            auto forNode = parseParallelForStatement();
+            if (forNode) blockNode->children.push_back(forNode);
         } else if (parser.match(TokenType::PUT)) {
             auto putNode = parsePutStatement();
             if (putNode) blockNode->children.push_back(putNode);
+        } else if (parser.match(TokenType::SPAWN)) {
+            auto spawnNode = parseSpawnStatement();
+            if (spawnNode) blockNode->children.push_back(spawnNode);
+        } else if (parser.match(TokenType::SYNC)) {
+            auto syncNode = parseSyncStatement();
+            if (syncNode) blockNode->children.push_back(syncNode);
+        } else if (parser.match(TokenType::SEND)) {
+            auto sendNode = parseSendStatement();
+            if (sendNode) blockNode->children.push_back(sendNode);
         } else if (!parser.isWhitespace(parser.peek())) {
-            std::cerr << "Unexpected token in block: " << parser.peek().lexeme 
-                      << " at line " << parser.peek().line 
-                      << ", column " << parser.peek().column << std::endl;
+            parser.getDiagnostics().report(DiagnosticCode::UNEXPECTED_TOKEN_IN_BLOCK, parser.peek());
             parser.advance();
         } else {
             parser.advance();
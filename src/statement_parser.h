@@ -5,17 +5,29 @@ class StatementParser {
 public:
     StatementParser(Parser& parser) : parser(parser) {}
 
-    std::shared_ptr<ASTNode> parseDeclaration();
+    std::shared_ptr<ASTNode> parseDeclaration(bool topLevel = false);
+    std::shared_ptr<ASTNode> parseChannelDeclaration(const Token& declareToken, const Token& identifierToken,
+                                                     bool topLevel);
     std::shared_ptr<ASTNode> parseAssignment();
     std::shared_ptr<ASTNode> parseIfStatement();
     std::shared_ptr<ASTNode> parseWhileStatement();
+    std::shared_ptr<ASTNode> parseForStatement(bool parallel = false);
+    std::shared_ptr<ASTNode> parseParallelForStatement();
+    std::shared_ptr<ASTNode> parseForEachStatement();
     std::shared_ptr<ASTNode> parsePutStatement();
-    std::shared_ptr<ASTNode> parseProcedure();
-    std::shared_ptr<ASTNode> parseProcedureCall();
+    std::shared_ptr<ASTNode> parseProcedure(bool memo = false);
+    std::shared_ptr<ASTNode> parseProcedureCall(bool generator = false);
     std::shared_ptr<ASTNode> parseProcedureCallStatement();
     std::shared_ptr<ASTNode> parseReturnStatement();
+    std::shared_ptr<ASTNode> parseYieldStatement();
+    std::shared_ptr<ASTNode> parseSpawnStatement();
+    std::shared_ptr<ASTNode> parseSyncStatement();
+    std::shared_ptr<ASTNode> parseSendStatement();
     std::shared_ptr<ASTNode> parseBlock();
 
 private:
     Parser& parser;
+    bool inProcedure = false; // Parsing a procedure body, where yield makes it a generator
+
+    void checkGenerator(const ASTNode& node, const std::string& name, std::vector<std::string>& locals);
 };
\ No newline at end of file
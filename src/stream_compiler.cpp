@@ -0,0 +1,137 @@
+#include "stream_compiler.h"
+#include <iostream>
+
+// Constructor for StreamCompiler
+StreamCompiler::StreamCompiler(std::istream& input, std::ostream& output, Diagnostics& diagnostics,
+                               const std::string& sourceName, size_t chunkSize)
+    : input(input), output(output), chunkSize(chunkSize), parser(std::vector<Token>(), diagnostics) {
+    if (!sourceName.empty()) generator.setLineMarkers(sourceName, false);
+    generator.shareProcedureEffects(&parser.procedureEffects);
+}
+
+// Compile the whole input, writing C++ to the output stream
+bool StreamCompiler::compile() {
+    std::FILE* mainBody = std::tmpfile();
+    if (!mainBody) {
+        std::cerr << "Error: Could not create temporary file for streaming compile\n";
+        return false;
+    }
+
+    output << generator.generatePreludeCode();
+
+    std::vector<Token> tokens;
+    while (nextStatement(tokens)) {
+        parser.setTokens(std::move(tokens));
+        while (!parser.isAtEnd()) {
+            auto node = parser.parseStatement();
+            if (node) emitStatement(node, mainBody);
+        }
+        tokens.clear();
+    }
+
+    // Append main, copying the spooled statements back in blocks
+    output << "\n" << generator.generateMainBeginCode();
+    std::rewind(mainBody);
+    std::vector<char> block(64 * 1024);
+    size_t count;
+    while ((count = std::fread(block.data(), 1, block.size(), mainBody)) > 0) {
+        output.write(block.data(), count);
+    }
+    std::fclose(mainBody);
+    output << generator.generateMainEndCode();
+
+    return static_cast<bool>(output);
+}
+
+// Append the next chunk of input, first dropping the part of the buffer already compiled
+void StreamCompiler::readChunk() {
+    buffer.erase(0, statementStart);
+    statementStart = 0;
+
+    size_t oldSize = buffer.size();
+    buffer.resize(oldSize + chunkSize);
+    input.read(&buffer[oldSize], chunkSize);
+    buffer.resize(oldSize + input.gcount());
+    if (!input) inputDone = true;
+
+    lexer = std::make_unique<Lexer>(buffer, statementStart, line, column);
+}
+
+// Lex the tokens of the next top-level statement, ending with an END_OF_FILE token.
+// A statement ends at a ';' outside any if, while or procedure. Returns false once
+// the input is exhausted.
+bool StreamCompiler::nextStatement(std::vector<Token>& tokens) {
+    if (!lexer) readChunk();
+
+    while (true) {
+        tokens.clear();
+        int depth = 0;
+
+        while (true) {
+            Token token(TokenType::UNKNOWN, "", 0, 0);
+            try {
+                token = lexer->nextToken();
+            } catch (const LexError& error) {
+                // A comment may continue in the next chunk. Otherwise the statement goes on after the line.
+                if (error.code == DiagnosticCode::UNTERMINATED_COMMENT && !inputDone) break;
+                parser.getDiagnostics().report(error.code, error.token);
+                lexer->skipToNextLine();
+                continue;
+            }
+
+            if (token.type == TokenType::END_OF_FILE) {
+                if (!inputDone) break; // The last token may be cut off, so lex it again
+                if (tokens.empty()) return false;
+                tokens.push_back(token);
+                statementStart = buffer.size();
+                return true;
+            }
+
+            tokens.push_back(token);
+            switch (token.type) {
+                case TokenType::IF:
+                case TokenType::WHILE:
+                case TokenType::FOR:
+                case TokenType::FOR_EACH:
+                case TokenType::PROCEDURE:
+                    depth++;
+                    break;
+                case TokenType::END_IF:
+                case TokenType::END_LOOP:
+                case TokenType::END_PROCEDURE:
+                    if (depth > 0) depth--;
+                    break;
+                default:
+                    break;
+            }
+
+            if (token.type == TokenType::SEMICOLON && depth == 0) {
+                statementStart = token.offset + token.length;
+                line = token.line;
+                column = token.column + 1;
+                tokens.push_back(Token(TokenType::END_OF_FILE, "", line, column, statementStart, 0));
+                return true;
+            }
+        }
+
+        // Statement runs past the buffered input, so read more and start it over
+        readChunk();
+    }
+}
+
+// Write code for one top-level statement
+void StreamCompiler::emitStatement(const std::shared_ptr<ASTNode>& node, std::FILE* mainBody) {
+    std::string mainCode;
+    generator.planMemoization(node);
+    output << generator.generateRuntimeCode(node);
+    if (node->type == ASTNodeType::DECLARATION || node->type == ASTNodeType::ARRAY_DECLARATION ||
+        node->type == ASTNodeType::CHANNEL_DECLARATION) {
+        output << generator.generateGlobalDeclarationCode(node);
+        mainCode = generator.generateMainStatementCode(node);
+    } else if (node->type == ASTNodeType::PROCEDURE) {
+        output << generator.generateProcedureCode(node);
+    } else {
+        mainCode = generator.generateMainStatementCode(node);
+    }
+    std::fwrite(mainCode.data(), 1, mainCode.size(), mainBody);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdio>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+
+// Compiles a program one top-level statement at a time so memory use does not
+// grow with the input. Source is read in chunks, and each statement's tokens and
+// AST are freed as soon as its code is written. Between statements the compiler
+// keeps the symbol table and, for each procedure, the effects the parser found:
+// whether it writes or yields, and the globals it reads and assigns as bit sets.
+// The generator finds pure procedures in those effects rather than in a copy of
+// its own, so a procedure costs its name and a few words. Code for main is spooled to a temporary file and appended
+// at the end, so declarations must come before their first use. With a
+// sourceName, statements get #line markers for it, without the column map that
+// the whole-program compile keeps, so compiler messages map to column 1.
+class StreamCompiler {
+public:
+    StreamCompiler(std::istream& input, std::ostream& output, Diagnostics& diagnostics,
+                   const std::string& sourceName = "", size_t chunkSize = 1 << 20);
+    bool compile();
+
+private:
+    std::istream& input;
+    std::ostream& output;
+    size_t chunkSize;
+
+    std::string buffer;
+    size_t statementStart = 0; // Buffer offset of the statement being lexed
+    int line = 1;
+    int column = 1;
+    bool inputDone = false;
+    std::unique_ptr<Lexer> lexer;
+
+    Parser parser;
+    CodeGenerator generator;
+
+    void readChunk();
+    bool nextStatement(std::vector<Token>& tokens);
+    void emitStatement(const std::shared_ptr<ASTNode>& node, std::FILE* mainBody);
+};
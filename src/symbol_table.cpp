@@ -32,6 +32,9 @@ VariableType SymbolTable::getVariableType(const std::string& name) const {
             return found->second; // Return the type of the variable
         }
     }
+    if (fallbackLookup) {
+        return fallbackLookup(name);
+    }
     return VariableType::UNKNOWN; // Return UNKNOWN if variable is not found
 }
 
@@ -42,6 +45,9 @@ bool SymbolTable::isVariableDeclared(const std::string& name) const {
             return true; // Return true if variable is found
         }
     }
+    if (fallbackLookup) {
+        return fallbackLookup(name) != VariableType::UNKNOWN;
+    }
     return false; // Return false if variable is not found
 }
 
@@ -54,4 +60,9 @@ std::set<std::string> SymbolTable::getAllVariables() const {
         }
     }
     return allVariables;
+}
+
+// Set a lookup used for variables declared outside this table (e.g. by an incremental parse)
+void SymbolTable::setFallbackLookup(std::function<VariableType(const std::string&)> lookup) {
+    fallbackLookup = std::move(lookup);
 }
\ No newline at end of file
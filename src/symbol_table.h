@@ -3,11 +3,15 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <functional>
 
 enum class VariableType {
     INTEGER,
     STRING,
     BOOLEAN,
+    ARRAY,
+    LOOP_COUNTER, // Integer that only its for loop changes
+    CHANNEL,      // Queue of numbers between tasks
     UNKNOWN
 };
 
@@ -20,7 +24,9 @@ public:
     VariableType getVariableType(const std::string& name) const;
     bool isVariableDeclared(const std::string& name) const;
     std::set<std::string> getAllVariables() const;
+    void setFallbackLookup(std::function<VariableType(const std::string&)> lookup);
 
 private:
     std::vector<std::unordered_map<std::string, VariableType>> scopes;
+    std::function<VariableType(const std::string&)> fallbackLookup; // Consulted for names not in any scope, UNKNOWN if undeclared
 };
\ No newline at end of file
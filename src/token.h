@@ -6,17 +6,32 @@ enum class TokenType {
     ELSE,
     ELSEIF,
     WHILE,
+    FOR,
+    FOR_EACH,
+    IN,
+    FROM,
+    TO,
+    STEP,
+    PARALLEL,
+    REDUCE,
+    SPAWN,
+    SYNC,
+    CHANNEL,
+    SEND,
+    RECEIVE,
     DECLARE,
     PUT,
     THEN,
     END_IF,
     LOOP,
     END_LOOP,
+    MEMO,
     PROCEDURE, 
     BEGIN,
     END,
     END_PROCEDURE,
     RETURN,
+    YIELD,
     PLUS,
     MINUS,
     STAR,
@@ -32,6 +47,8 @@ enum class TokenType {
     CLOSE_PAREN,
     OPEN_BRACE,
     CLOSE_BRACE,
+    OPEN_BRACKET,
+    CLOSE_BRACKET,
     COMMA,
     SEMICOLON,
     STRING,
@@ -45,11 +62,14 @@ enum class TokenType {
 
 class Token {
 public:
-    Token(TokenType type, const std::string& lexeme, int line, int column)
-        : type(type), lexeme(lexeme), line(line), column(column) {}
+    Token(TokenType type, const std::string& lexeme, int line, int column,
+          size_t offset = 0, size_t length = 0)
+        : type(type), lexeme(lexeme), line(line), column(column), offset(offset), length(length) {}
 
     TokenType type;
     std::string lexeme;
     int line;
     int column;
+    size_t offset; // Byte offset of the first character in the source
+    size_t length; // Number of source bytes the token spans
 };
\ No newline at end of file
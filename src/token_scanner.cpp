@@ -1,6 +1,6 @@
 #include "token_scanner.h"
+#include "lexer.h"
 #include <cctype>
-#include <stdexcept>
 
 // Constructor for TokenScanner
 TokenScanner::TokenScanner(const std::string& sourceCode, size_t& pos, int& line, int& col)
@@ -70,12 +70,15 @@ Token TokenScanner::handleNumber() {
 Token TokenScanner::handleString() {
     int startCol = column;
     int startLine = line;
+    size_t startOffset = currentPosition;
     std::string str;
     
     advance();  // Consume opening quote
     while (!isAtEnd() && peek() != '"') {
         if (peek() == '\n') {
-            throw std::runtime_error("Unterminated string literal");
+            throw LexError(DiagnosticCode::UNTERMINATED_STRING,
+                           Token(TokenType::UNTERMINATED_STRING, str, startLine, startCol, startOffset,
+                                 currentPosition - startOffset));
         }
         str += advance();
     }
@@ -113,6 +116,8 @@ Token TokenScanner::handleOperator(char c) {
         case ')': return Token(TokenType::CLOSE_PAREN, ")", startLine, startCol);
         case '{': return Token(TokenType::OPEN_BRACE, "{", startLine, startCol);
         case '}': return Token(TokenType::CLOSE_BRACE, "}", startLine, startCol);
+        case '[': return Token(TokenType::OPEN_BRACKET, "[", startLine, startCol);
+        case ']': return Token(TokenType::CLOSE_BRACKET, "]", startLine, startCol);
         case ',': return Token(TokenType::COMMA, ",", startLine, startCol);
         case ';': return Token(TokenType::SEMICOLON, ";", startLine, startCol);
     }
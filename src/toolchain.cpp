@@ -0,0 +1,332 @@
+#include "toolchain.h"
+#include "diagnostics.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <pthread.h>
+#include <spawn.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// Flush what is buffered and close the pipe, so the reader sees the end of its input
+void Process::PipeBuffer::close() {
+    flush();
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+// Make room by writing the buffer out
+int Process::PipeBuffer::overflow(int c) {
+    if (!flush()) return traits_type::eof();
+    if (c != traits_type::eof()) {
+        *pptr() = static_cast<char>(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+// Write the buffer out
+int Process::PipeBuffer::sync() {
+    return flush() ? 0 : -1;
+}
+
+// Write the buffer to the pipe. SIGPIPE is blocked on this thread while
+// writing, and one raised by the reader having gone is taken off again.
+bool Process::PipeBuffer::flush() {
+    const char* data = pbase();
+    size_t size = static_cast<size_t>(pptr() - pbase());
+    setp(buffer, buffer + sizeof(buffer));
+    if (size == 0) return !failed;
+    if (fd < 0 || failed) {
+        failed = true;
+        return false;
+    }
+
+    sigset_t pipeSignal;
+    sigset_t previous;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previous);
+    int error = 0;
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            error = errno;
+            failed = true;
+            break;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    if (error == EPIPE) {
+        timespec noWait{0, 0};
+        sigtimedwait(&pipeSignal, nullptr, &noWait);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return !failed;
+}
+
+// Kill a process still running and wait for it
+Process::~Process() {
+    if (pid < 0) return;
+    kill();
+    wait();
+}
+
+// Kill the process and what it started
+void Process::kill() {
+    if (pid >= 0) ::kill(-pid, SIGKILL);
+}
+
+// Add a variable to the environment the process gets
+void Process::setEnvironment(const std::string& name, const std::string& value) {
+    environment.push_back(name + "=" + value);
+}
+
+// Start the process with its standard error, and standard input if piped, connected to pipes
+bool Process::start(const std::vector<std::string>& arguments, std::string& error) {
+    int inputPipe[2] = {-1, -1};
+    int errorPipe[2] = {-1, -1};
+    if ((pipedInput && pipe2(inputPipe, O_CLOEXEC) != 0) || pipe2(errorPipe, O_CLOEXEC) != 0) {
+        error = std::string("Could not create a pipe: ") + std::strerror(errno);
+        for (int fd : {inputPipe[0], inputPipe[1]}) {
+            if (fd >= 0) close(fd);
+        }
+        return false;
+    }
+
+    // dup2 clears close-on-exec on the copies, so the child keeps only those
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (pipedInput) posix_spawn_file_actions_adddup2(&actions, inputPipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, errorPipe[1], STDERR_FILENO);
+    if (discardOutput) posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    // A process group of its own, and no signals blocked even if they are here
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    sigset_t noSignals;
+    sigemptyset(&noSignals);
+    posix_spawnattr_setsigmask(&attributes, &noSignals);
+
+    std::vector<char*> argv;
+    for (const auto& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    // Our environment, with the added variables replacing ones of the same name
+    std::vector<char*> envp;
+    for (char** variable = environ; *variable; variable++) {
+        bool replaced = false;
+        for (const auto& added : environment) {
+            size_t nameLength = added.find('=') + 1;
+            if (std::strncmp(*variable, added.c_str(), nameLength) == 0) replaced = true;
+        }
+        if (!replaced) envp.push_back(*variable);
+    }
+    for (const auto& added : environment) envp.push_back(const_cast<char*>(added.c_str()));
+    envp.push_back(nullptr);
+
+    int status = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (pipedInput) close(inputPipe[0]);
+    close(errorPipe[1]);
+    if (status != 0) {
+        error = "Could not run " + arguments[0] + ": " + std::strerror(status);
+        pid = -1;
+        if (pipedInput) close(inputPipe[1]);
+        close(errorPipe[0]);
+        return false;
+    }
+
+    if (pipedInput) inputBuffer.open(inputPipe[1]);
+    errorFd = errorPipe[0];
+    errorReader = std::thread([this] {
+        char chunk[4096];
+        while (true) {
+            ssize_t received = read(errorFd, chunk, sizeof(chunk));
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) break;
+            errorOutput.append(chunk, static_cast<size_t>(received));
+        }
+    });
+    if (timeout > 0) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                                std::chrono::duration<double>(timeout));
+        watchdog = std::thread([this, deadline] {
+            std::unique_lock<std::mutex> lock(watchdogMutex);
+            if (!exitedChanged.wait_until(lock, deadline, [this] { return exited; })) {
+                timedOut = true;
+                ::kill(-pid, SIGKILL);
+            }
+        });
+    }
+    return true;
+}
+
+// Close the input and wait for the process to exit. It is reaped only after
+// the watchdog has stopped, so the watchdog never signals a reused pid.
+ProcessResult Process::wait() {
+    ProcessResult result;
+    if (pid < 0) return result;
+    inputBuffer.close();
+
+    siginfo_t info;
+    while (waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOWAIT) != 0 && errno == EINTR) {
+    }
+    {
+        std::lock_guard<std::mutex> lock(watchdogMutex);
+        exited = true;
+    }
+    exitedChanged.notify_all();
+    if (watchdog.joinable()) watchdog.join();
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    pid = -1;
+
+    // Children of a killed process may hold the pipe open; they were killed with it
+    errorReader.join();
+    close(errorFd);
+    errorFd = -1;
+
+    result.started = true;
+    result.timedOut = timedOut;
+    result.exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.errorOutput = std::move(errorOutput);
+    return result;
+}
+
+// A build of binary that has not started
+ProgramBuild::ProgramBuild(const std::string& source, const std::string& binary,
+                           const std::vector<std::string>& flags, double timeout, const std::string& language)
+    : source(source), binary(binary), flags(flags), timeout(timeout), language(language) {}
+
+// Stop g++ if it is still running and remove what it left
+ProgramBuild::~ProgramBuild() {
+    process.kill();
+    process.wait();
+    if (!temporary.empty()) std::remove(temporary.c_str());
+}
+
+// Start the compiler on a temporary path of its own
+bool ProgramBuild::start(std::string& error) {
+    temporary = uniqueOutputPath(binary);
+    process.setPipedInput(source == "-");
+    process.setTimeout(timeout);
+    return process.start(compilerArguments(source, temporary, binary, flags, language), error);
+}
+
+// Wait for the compiler and put the binary in place
+bool ProgramBuild::finish(const std::string& sourceName, const std::map<int, int>& lineColumns,
+                          Diagnostics& diagnostics, std::string& output) {
+    ProcessResult result = process.wait();
+    output += sourceName.empty() ? result.errorOutput
+                                 : mapCompilerMessages(result.errorOutput, sourceName, lineColumns, diagnostics);
+    if (result.timedOut) {
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%g", timeout);
+        output += std::string("Error: ") + (language == "c" ? "gcc" : "g++") + " did not finish within " + seconds +
+                  " seconds\n";
+    }
+    if (!result.succeeded()) return false;
+    if (std::rename(temporary.c_str(), binary.c_str()) != 0) {
+        output += "Error: Could not write " + binary + ": " + std::strerror(errno) + "\n";
+        return false;
+    }
+    temporary.clear();
+    return true;
+}
+
+// g++ building source into binary, or gcc building C99
+std::vector<std::string> compilerArguments(const std::string& source, const std::string& binary,
+                                           const std::string& finalBinary, const std::vector<std::string>& flags,
+                                           const std::string& language) {
+    std::vector<std::string> arguments;
+    if (language == "c") {
+        arguments = {"gcc", "-x", "c", "-std=c99", source, "-o", binary, "-dumpbase", finalBinary};
+    } else {
+        arguments = {"g++", "-x", "c++", source, "-o", binary, "-dumpbase", finalBinary, "-pthread"};
+    }
+    arguments.insert(arguments.end(), flags.begin(), flags.end());
+    return arguments;
+}
+
+// No C library start-up: the runtime's _start calls main, which makes its own system calls
+std::vector<std::string> staticFlags() {
+    return {"-static", "-nostartfiles", "-fno-stack-protector", "-DPL_NO_LIBC"};
+}
+
+// A new empty file named after path
+std::string uniqueOutputPath(const std::string& path) {
+    std::string unique = path + ".XXXXXX";
+    int fd = mkstemp(&unique[0]);
+    if (fd < 0) return path + "." + std::to_string(getpid());
+    // mkstemp makes it private; the linker keeps the mode and adds execute permission
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    close(fd);
+    return unique;
+}
+
+// Create the directory, leaving the path empty when that fails
+TemporaryDirectory::TemporaryDirectory(const std::string& path) : path(path + ".XXXXXX") {
+    if (!mkdtemp(&this->path[0])) this->path.clear();
+}
+
+// Remove the directory and what was written to it
+TemporaryDirectory::~TemporaryDirectory() {
+    std::error_code error;
+    if (!path.empty()) std::filesystem::remove_all(path, error);
+}
+
+// Report g++ errors and warnings on PseudoLang lines as diagnostics
+std::string mapCompilerMessages(const std::string& output, const std::string& sourceName,
+                                const std::map<int, int>& lineColumns, Diagnostics& diagnostics) {
+    const std::string prefix = sourceName + ":";
+    std::string rest;
+    std::istringstream lines(output);
+    std::string line;
+    bool inReported = false; // In the source excerpt and caret lines of a reported message
+    while (std::getline(lines, line)) {
+        if (line.rfind(prefix, 0) == 0) {
+            // "name:line:column: kind: message"; other lines about the file, like "In function", are context
+            inReported = true;
+            std::istringstream fields(line.substr(prefix.size()));
+            int lineNumber = 0;
+            int column = 0;
+            char separator = 0;
+            if (!(fields >> lineNumber >> separator >> column >> separator)) continue;
+            std::string message;
+            std::getline(fields, message);
+            DiagnosticCode code;
+            if (message.rfind(" error: ", 0) == 0 || message.rfind(" fatal error: ", 0) == 0) {
+                code = DiagnosticCode::COMPILER_ERROR;
+            } else if (message.rfind(" warning: ", 0) == 0) {
+                code = DiagnosticCode::COMPILER_WARNING;
+            } else {
+                continue;
+            }
+            message = message.substr(message.find(": ") + 2);
+            auto found = lineColumns.find(lineNumber);
+            diagnostics.report(code, Token(TokenType::UNKNOWN, message, lineNumber,
+                                           found == lineColumns.end() ? 1 : found->second));
+            continue;
+        }
+        if (inReported && (line.empty() || line[0] == ' ')) continue;
+        inReported = false;
+        rest += line + "\n";
+    }
+    return rest;
+}
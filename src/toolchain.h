@@ -0,0 +1,162 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+class Diagnostics;
+
+// How a process run by Process ended
+struct ProcessResult {
+    bool started = false;
+    bool timedOut = false;
+    int exitStatus = -1;     // -1 when it was killed by a signal
+    std::string errorOutput; // Everything it wrote to standard error
+
+    bool succeeded() const { return started && !timedOut && exitStatus == 0; }
+};
+
+// A child process started with posix_spawn, without a shell. Its standard
+// error is captured; its standard input can be a pipe written through
+// input(), and its standard output can be discarded. It runs in a process
+// group of its own, which is killed when the timeout passes.
+class Process {
+public:
+    Process() = default;
+    ~Process();
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+    // Seconds from the start after which the process is killed; 0 for no limit
+    void setTimeout(double seconds) { timeout = seconds; }
+    void setEnvironment(const std::string& name, const std::string& value);
+    void setPipedInput(bool piped) { pipedInput = piped; }
+    void setDiscardOutput(bool discard) { discardOutput = discard; }
+
+    // Run arguments[0], looked up on PATH. False, with the reason in error, when it could not start.
+    bool start(const std::vector<std::string>& arguments, std::string& error);
+
+    // The process's standard input, when piped. Writes fail once the process has exited.
+    std::ostream& input() { return inputStream; }
+
+    // Close the input and wait for the process to exit
+    ProcessResult wait();
+
+    // Kill the process group now; wait still has to reap it
+    void kill();
+
+private:
+    // Buffered writes to a pipe, without SIGPIPE when the reader has gone
+    class PipeBuffer : public std::streambuf {
+    public:
+        PipeBuffer() { setp(buffer, buffer + sizeof(buffer)); }
+        void open(int fd) { this->fd = fd; }
+        void close();
+
+    protected:
+        int overflow(int c) override;
+        int sync() override;
+
+    private:
+        char buffer[1 << 16];
+        int fd = -1;
+        bool failed = false;
+
+        bool flush();
+    };
+
+    double timeout = 0;
+    std::vector<std::string> environment; // NAME=value entries added to ours
+    bool pipedInput = false;
+    bool discardOutput = false;
+
+    pid_t pid = -1;
+    PipeBuffer inputBuffer;
+    std::ostream inputStream{&inputBuffer};
+    int errorFd = -1;
+    std::string errorOutput;
+    std::thread errorReader;
+
+    // Kills the process group at the deadline unless the process exits first
+    std::thread watchdog;
+    std::mutex watchdogMutex;
+    std::condition_variable exitedChanged;
+    bool exited = false;
+    bool timedOut = false;
+};
+
+// A g++ run that builds a program into a temporary path next to binary, which
+// replaces binary only when the build succeeds, so a failed build leaves the
+// old binary and concurrent builds of the same binary do not write over each
+// other. The code is written through input() when source is "-".
+class ProgramBuild {
+public:
+    ProgramBuild(const std::string& source, const std::string& binary, const std::vector<std::string>& flags,
+                 double timeout, const std::string& language = "c++");
+    ~ProgramBuild();
+    ProgramBuild(const ProgramBuild&) = delete;
+    ProgramBuild& operator=(const ProgramBuild&) = delete;
+
+    bool start(std::string& error);
+    std::ostream& input() { return process.input(); }
+
+    // Wait for g++ and move the binary into place. Messages about lines of
+    // sourceName go to diagnostics (see mapCompilerMessages), the rest to output.
+    bool finish(const std::string& sourceName, const std::map<int, int>& lineColumns, Diagnostics& diagnostics,
+                std::string& output);
+
+private:
+    std::string source;
+    std::string binary;
+    std::string temporary;
+    std::vector<std::string> flags;
+    double timeout;
+    std::string language;
+    Process process;
+};
+
+// Arguments that run g++ on source ("-" for standard input) to build binary,
+// or gcc when language is "c". The base name for files the compiler writes
+// besides it, such as profiles, is that of finalBinary, so builds into
+// different temporary paths share them.
+std::vector<std::string> compilerArguments(const std::string& source, const std::string& binary,
+                                           const std::string& finalBinary, const std::vector<std::string>& flags,
+                                           const std::string& language = "c++");
+
+// Flags that link a C program without the C library, as --static
+std::vector<std::string> staticFlags();
+
+// A new empty file next to path, for building into and then renaming into
+// place; concurrent builds of the same path each get their own
+std::string uniqueOutputPath(const std::string& path);
+
+// A new empty directory named after path, for files only this run writes, such
+// as profiles. It is removed with everything in it when the object goes out
+// of scope; concurrent runs each get their own, and no existing one is touched.
+class TemporaryDirectory {
+public:
+    explicit TemporaryDirectory(const std::string& path);
+    ~TemporaryDirectory();
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    // Empty when the directory could not be created
+    const std::string& getPath() const { return path; }
+
+private:
+    std::string path;
+};
+
+// Report compiler messages about PseudoLang lines, which the #line markers of the
+// generated code point it to, as diagnostics. g++'s columns are of the C++,
+// so each gets the column of the first statement on its line from
+// lineColumns. Returns the rest of the output, without the context lines of
+// the messages reported, for printing as it is.
+std::string mapCompilerMessages(const std::string& output, const std::string& sourceName,
+                                const std::map<int, int>& lineColumns, Diagnostics& diagnostics);
@@ -0,0 +1,199 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+
+thread_local Tracer* Tracer::currentTracer = nullptr;
+
+namespace {
+
+uint64_t toMicros(const timeval& time) {
+    return static_cast<uint64_t>(time.tv_sec) * 1000000 + static_cast<uint64_t>(time.tv_usec);
+}
+
+// Escape a string for a JSON string literal
+std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            escaped += buffer;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+}
+
+// Constructor for the Tracer class, times are measured from here
+Tracer::Tracer() : origin(0) {
+    origin = nowMicros();
+}
+
+// Wall-clock time since the tracer was created
+uint64_t Tracer::nowMicros() const {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count()) - origin;
+}
+
+// CPU time used by this process and by children it has waited for (g++)
+uint64_t Tracer::cpuMicros() {
+    rusage self;
+    rusage children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    return toMicros(self.ru_utime) + toMicros(self.ru_stime) +
+           toMicros(children.ru_utime) + toMicros(children.ru_stime);
+}
+
+// Open a span nested in the innermost open one
+void Tracer::begin(const char* category, std::string name) {
+    TraceSpan span;
+    span.name = std::move(name);
+    span.category = category;
+    span.depth = static_cast<int>(open.size());
+    span.wallMicros = 0;
+    span.cpuMicros = 0;
+    span.peakLiveBytes = 0;
+    span.residentBytes = 0;
+    open.push_back({spans.size(), cpuMicros(), PerfSample(), AllocationSample(), 0});
+    spans.push_back(std::move(span));
+    if (memoryAccounting) {
+        open.back().startMemory = MemoryStats::read();
+        open.back().enclosingPeak = MemoryStats::swapPeak();
+    }
+    spans.back().startMicros = nowMicros();
+    if (counters) open.back().startPerf = counters->read();
+}
+
+// Close the innermost open span
+void Tracer::end() {
+    if (open.empty()) return;
+    PerfSample perf = counters ? counters->read() : PerfSample();
+    uint64_t now = nowMicros();
+    TraceSpan& span = spans[open.back().index];
+    span.perf = perf - open.back().startPerf;
+    span.wallMicros = now - span.startMicros;
+    span.cpuMicros = cpuMicros() - open.back().startCpu;
+    if (memoryAccounting) {
+        span.memory = MemoryStats::read() - open.back().startMemory;
+        span.peakLiveBytes = MemoryStats::peakLiveBytes();
+        MemoryStats::raisePeak(open.back().enclosingPeak);
+        if (span.depth == 0) span.residentBytes = MemoryStats::residentBytes();
+    }
+    open.pop_back();
+}
+
+// Attach a count to the innermost open span
+void Tracer::addCount(const char* key, uint64_t value) {
+    if (open.empty()) return;
+    spans[open.back().index].counts.emplace_back(key, value);
+}
+
+// Print a table of the top-level phases with their times and counts
+void Tracer::renderReport(std::ostream& out) const {
+    std::string report;
+    char line[160];
+    snprintf(line, sizeof(line), "%-16s %12s %12s  %s\n", "Phase", "Wall (ms)", "CPU (ms)", "Counts");
+    report += line;
+
+    uint64_t totalWall = 0;
+    uint64_t totalCpu = 0;
+    for (const auto& span : spans) {
+        if (span.depth != 0) continue;
+        snprintf(line, sizeof(line), "%-16s %12.3f %12.3f  ", span.name.c_str(),
+                 span.wallMicros / 1000.0, span.cpuMicros / 1000.0);
+        report += line;
+        for (size_t i = 0; i < span.counts.size(); i++) {
+            if (i > 0) report += ", ";
+            report += std::to_string(span.counts[i].second) + " " + span.counts[i].first;
+        }
+        report += "\n";
+        totalWall += span.wallMicros;
+        totalCpu += span.cpuMicros;
+    }
+    snprintf(line, sizeof(line), "%-16s %12.3f %12.3f\n", "total", totalWall / 1000.0, totalCpu / 1000.0);
+    report += line;
+    out << report;
+}
+
+// Print the hardware counters of the top-level phases
+void Tracer::renderCounterReport(std::ostream& out) const {
+    if (!counters) return;
+    std::vector<std::pair<std::string, PerfSample>> rows;
+    PerfSample total;
+    for (const auto& span : spans) {
+        if (span.depth != 0) continue;
+        rows.emplace_back(span.name, span.perf);
+        total += span.perf;
+    }
+    rows.emplace_back("total", total);
+    counters->renderTable(out, "Phase", rows);
+}
+
+// Print the heap activity and resident memory of the top-level phases
+void Tracer::renderMemoryReport(std::ostream& out) const {
+    if (!memoryAccounting) return;
+    std::string report;
+    char line[200];
+    snprintf(line, sizeof(line), "%-16s %12s %12s %14s %12s %14s %12s\n", "Phase", "Allocs", "Frees",
+             "Allocated KB", "Net KB", "Peak live KB", "RSS KB");
+    report += line;
+
+    AllocationSample total;
+    int64_t peak = 0;
+    for (const auto& span : spans) {
+        if (span.depth != 0) continue;
+        snprintf(line, sizeof(line), "%-16s %12llu %12llu %14.1f %12.1f %14.1f %12.1f\n", span.name.c_str(),
+                 static_cast<unsigned long long>(span.memory.allocations),
+                 static_cast<unsigned long long>(span.memory.frees), span.memory.allocatedBytes / 1024.0,
+                 span.memory.liveBytes() / 1024.0, span.peakLiveBytes / 1024.0, span.residentBytes / 1024.0);
+        report += line;
+        total += span.memory;
+        peak = std::max(peak, span.peakLiveBytes);
+    }
+    snprintf(line, sizeof(line), "%-16s %12llu %12llu %14.1f %12.1f %14.1f\n", "total",
+             static_cast<unsigned long long>(total.allocations), static_cast<unsigned long long>(total.frees),
+             total.allocatedBytes / 1024.0, total.liveBytes() / 1024.0, peak / 1024.0);
+    report += line;
+    out << report;
+}
+
+// Write all spans as Chrome trace-event JSON (chrome://tracing, Perfetto)
+void Tracer::writeChromeTrace(std::ostream& out) const {
+    std::string trace = "{\"traceEvents\": [\n";
+    for (size_t i = 0; i < spans.size(); i++) {
+        const auto& span = spans[i];
+        trace += "  {\"name\": \"" + escapeJson(span.name) + "\", \"cat\": \"" + span.category +
+                 "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " + std::to_string(span.startMicros) +
+                 ", \"dur\": " + std::to_string(span.wallMicros) +
+                 ", \"args\": {\"cpu_us\": " + std::to_string(span.cpuMicros);
+        for (const auto& count : span.counts) {
+            trace += ", \"" + std::string(count.first) + "\": " + std::to_string(count.second);
+        }
+        if (counters) {
+            trace += ", \"cycles\": " + std::to_string(span.perf.get(PerfEvent::CYCLES)) +
+                     ", \"instructions\": " + std::to_string(span.perf.get(PerfEvent::INSTRUCTIONS)) +
+                     ", \"branch_misses\": " + std::to_string(span.perf.get(PerfEvent::BRANCH_MISSES)) +
+                     ", \"l1d_misses\": " + std::to_string(span.perf.get(PerfEvent::L1D_MISSES)) +
+                     ", \"llc_misses\": " + std::to_string(span.perf.get(PerfEvent::LLC_MISSES));
+        }
+        if (memoryAccounting) {
+            trace += ", \"allocations\": " + std::to_string(span.memory.allocations) +
+                     ", \"allocated_bytes\": " + std::to_string(span.memory.allocatedBytes) +
+                     ", \"peak_live_bytes\": " + std::to_string(span.peakLiveBytes);
+            if (span.depth == 0) trace += ", \"rss_bytes\": " + std::to_string(span.residentBytes);
+        }
+        trace += "}}";
+        trace += i + 1 < spans.size() ? ",\n" : "\n";
+    }
+    trace += "], \"displayTimeUnit\": \"ms\"}\n";
+    out << trace;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "perf_counters.h"
+#include "memory_stats.h"
+
+// A finished span of work, in microseconds since the tracer was created
+struct TraceSpan {
+    std::string name;
+    const char* category;
+    int depth;                 // 0 for pipeline phases
+    uint64_t startMicros;
+    uint64_t wallMicros;
+    uint64_t cpuMicros;        // This process plus waited-for children
+    std::vector<std::pair<const char*, uint64_t>> counts;
+    PerfSample perf;           // Hardware counter deltas, when counters are attached
+    AllocationSample memory;   // Heap activity, when memory accounting is on
+    int64_t peakLiveBytes;     // Highest live heap during the span
+    uint64_t residentBytes;    // RSS when a top-level span ends
+};
+
+// Records nested spans of compiler work for --time-report and --trace.
+// Spans are begun and ended through TraceScope, which does nothing unless a
+// tracer has been installed on the current thread with setCurrent().
+class Tracer {
+public:
+    Tracer();
+
+    void begin(const char* category, std::string name);
+    void end();
+    void addCount(const char* key, uint64_t value);
+    void setCounters(const PerfCounters* counters) { this->counters = counters; }
+    void setMemoryAccounting(bool enabled) { memoryAccounting = enabled; }
+
+    const std::vector<TraceSpan>& getSpans() const { return spans; }
+    void renderReport(std::ostream& out) const;
+    void renderCounterReport(std::ostream& out) const;
+    void renderMemoryReport(std::ostream& out) const;
+    void writeChromeTrace(std::ostream& out) const;
+
+    static Tracer* current() { return currentTracer; }
+    static void setCurrent(Tracer* tracer) { currentTracer = tracer; }
+
+private:
+    struct OpenSpan {
+        size_t index;          // Slot in spans, filled in when the span ends
+        uint64_t startCpu;
+        PerfSample startPerf;
+        AllocationSample startMemory;
+        int64_t enclosingPeak;  // Peak of the enclosing span, restored at the end
+    };
+
+    uint64_t origin;
+    std::vector<TraceSpan> spans; // In begin order, so parents come before children
+    std::vector<OpenSpan> open;
+    const PerfCounters* counters = nullptr;
+    bool memoryAccounting = false;
+
+    uint64_t nowMicros() const;
+    static uint64_t cpuMicros();
+
+    static thread_local Tracer* currentTracer;
+};
+
+// Span covering the lifetime of the scope, on the current thread's tracer.
+// The name is only built when tracing is on.
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name) : tracer(Tracer::current()) {
+        if (tracer) tracer->begin(category, name);
+    }
+    TraceScope(const char* category, const char* prefix, const std::string& detail) : tracer(Tracer::current()) {
+        if (tracer) tracer->begin(category, std::string(prefix) + detail);
+    }
+    ~TraceScope() {
+        if (tracer) tracer->end();
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    // Attach a count (tokens, nodes, bytes, ...) to the span
+    void addCount(const char* key, uint64_t value) {
+        if (tracer) tracer->addCount(key, value);
+    }
+
+private:
+    Tracer* tracer;
+};
@@ -0,0 +1,16 @@
+#pragma once
+#include <iostream>
+
+// Failed checks so far; each test program returns this from main, so any failure fails the run
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            failures()++;                                                                   \
+        }                                                                                   \
+    } while (0)
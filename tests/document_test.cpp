@@ -0,0 +1,62 @@
+#include <string>
+#include "check.h"
+#include "document.h"
+
+namespace {
+
+// Whether the document reports code at a position
+bool reports(Document& document, DiagnosticCode code, int line, int column) {
+    Diagnostics diagnostics = document.getDiagnostics();
+    for (const auto& entry : diagnostics.getEntries()) {
+        if (entry.code == code && entry.line == line && entry.column == column) return true;
+    }
+    return false;
+}
+
+// Replace the first occurrence of from in the document's text
+void replace(Document& document, const std::string& from, const std::string& to) {
+    size_t start = document.getText().find(from);
+    CHECK(start != std::string::npos);
+    if (start != std::string::npos) document.applyEdit(start, start + from.size(), to);
+}
+
+// An unterminated string stays reported while the rest of the document is edited
+void testLexErrorSurvivesEdits() {
+    Document document("put(1);\nput(\"hello);\nput(2);\n");
+    CHECK(reports(document, DiagnosticCode::UNTERMINATED_STRING, 2, 5));
+    CHECK(document.getLexError() == "Unterminated string literal");
+
+    replace(document, "put(2)", "put(3)");
+    CHECK(reports(document, DiagnosticCode::UNTERMINATED_STRING, 2, 5));
+    replace(document, "put(1)", "declare x <- 1;\nput(x)");
+    CHECK(reports(document, DiagnosticCode::UNTERMINATED_STRING, 3, 5));
+    CHECK(document.getLexError() == "Unterminated string literal");
+
+    replace(document, "hello);", "hello\");");
+    CHECK(!document.getDiagnostics().hasErrors());
+    CHECK(document.getLexError().empty());
+}
+
+// Errors with no statement in front of them, and an unclosed comment at the end
+void testLexErrorsAtTheEnds() {
+    Document document("put(\"x\n");
+    CHECK(reports(document, DiagnosticCode::UNTERMINATED_STRING, 1, 5));
+    document.applyEdit(0, 0, "put(1);\n");
+    CHECK(reports(document, DiagnosticCode::UNTERMINATED_STRING, 2, 5));
+
+    Document commented("put(1);\nput(2);\n/* never closed\n");
+    CHECK(reports(commented, DiagnosticCode::UNTERMINATED_COMMENT, 3, 1));
+    replace(commented, "put(1)", "put(10)");
+    CHECK(reports(commented, DiagnosticCode::UNTERMINATED_COMMENT, 3, 1));
+    replace(commented, "put(2);\n", "");
+    CHECK(reports(commented, DiagnosticCode::UNTERMINATED_COMMENT, 2, 1));
+    CHECK(commented.getDiagnostics().getEntries().size() == 1);
+}
+
+}
+
+int main() {
+    testLexErrorSurvivesEdits();
+    testLexErrorsAtTheEnds();
+    return failures();
+}
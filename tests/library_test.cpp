@@ -0,0 +1,86 @@
+#include <string>
+#include "check.h"
+#include "compiler.h"
+
+namespace {
+
+// The only diagnostic of a failed compile
+void checkSingleError(const CompilerContext& context, DiagnosticCode code, int line, int column) {
+    const auto& entries = context.getDiagnostics().getEntries();
+    CHECK(entries.size() == 1);
+    if (entries.empty()) return;
+    CHECK(entries[0].code == code);
+    CHECK(entries[0].line == line);
+    CHECK(entries[0].column == column);
+}
+
+// An unterminated string or comment is an error of the compile, not an exception out of it
+void testLexErrors() {
+    CompilerContext context;
+    CHECK(!context.compile("put(1);\nput(\"hello);\nput(2);\n"));
+    checkSingleError(context, DiagnosticCode::UNTERMINATED_STRING, 2, 5);
+    CHECK(context.getCpp().empty());
+
+    CHECK(!context.compile("put(1);\n/* never closed\nput(2);\n"));
+    checkSingleError(context, DiagnosticCode::UNTERMINATED_COMMENT, 2, 1);
+}
+
+// A context that failed compiles the next program as if it were new
+void testCompileAfterLexError() {
+    CompilerContext context;
+    CHECK(!context.compile("put(\"hello);\n"));
+    CHECK(context.compile("put(\"hello\");\n"));
+    CHECK(!context.getDiagnostics().hasErrors());
+    CHECK(context.getCpp().find("hello") != std::string::npos);
+}
+
+// Appended diagnostics are deduplicated and capped like reported ones, and keep their token text
+void testAppendKeepsLimitAndDedup() {
+    Diagnostics first;
+    first.setLimit(3);
+    first.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "x", 1, 1));
+
+    Diagnostics second;
+    second.setLimit(2);
+    second.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "x", 1, 1));
+    second.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "y", 2, 1));
+    second.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "z", 3, 1));
+    CHECK(second.getEntries().size() == 2);
+    CHECK(second.getErrorCount() == 3);
+
+    Diagnostics third;
+    third.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "u", 4, 1));
+    third.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "v", 5, 1));
+    third.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "w", 6, 1));
+
+    first.append(second);
+    CHECK(first.getEntries().size() == 2); // x is already there
+    CHECK(first.getErrorCount() == 3);     // z was only counted by second
+    first.append(third);
+    CHECK(first.getEntries().size() == 3);
+    CHECK(first.getErrorCount() == 6);
+    CHECK(first.getMessage(first.getEntries()[1]) == "Undeclared variable: y");
+    CHECK(first.getMessage(first.getEntries()[2]) == "Undeclared variable: u");
+}
+
+// Past the limit, repeats of kept entries are still ignored and new ones are only counted
+void testLimit() {
+    Diagnostics diagnostics;
+    diagnostics.setLimit(1);
+    for (int line = 1; line <= 1000; line++) {
+        diagnostics.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "x", 1, 1));
+        diagnostics.report(DiagnosticCode::UNDECLARED_VARIABLE, Token(TokenType::IDENTIFIER, "y", line + 1, 1));
+    }
+    CHECK(diagnostics.getEntries().size() == 1);
+    CHECK(diagnostics.getErrorCount() == 1001);
+}
+
+}
+
+int main() {
+    testLexErrors();
+    testCompileAfterLexError();
+    testAppendKeepsLimitAndDedup();
+    testLimit();
+    return failures();
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "check.h"
+#include "compile_server.h"
+
+namespace {
+
+// A reply to a compile request
+struct Reply {
+    std::string id;
+    std::string outcome;
+    std::string cpp;
+    std::string diagnostics;
+};
+
+// Socket connected to the server at path, or -1 when it is not listening yet
+int connectTo(const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Ask for the C++ of a source
+void sendSource(int fd, const std::string& id, const std::string& source) {
+    std::string request = "compile " + id + " source " + std::to_string(source.size()) + " 0\n" + source;
+    CHECK(write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+}
+
+// Next reply on the connection; its outcome is empty when the server closed it
+Reply receiveReply(int fd) {
+    std::string header;
+    char c;
+    while (read(fd, &c, 1) == 1 && c != '\n') header += c;
+    std::istringstream fields(header);
+    std::string word;
+    Reply reply;
+    size_t cppSize = 0;
+    size_t diagnosticsSize = 0;
+    if (!(fields >> word >> reply.id >> reply.outcome >> cppSize >> diagnosticsSize) || word != "result") return {};
+    std::string body(cppSize + diagnosticsSize, '\0');
+    for (size_t done = 0; done < body.size();) {
+        ssize_t count = read(fd, &body[done], body.size() - done);
+        if (count <= 0) return {};
+        done += static_cast<size_t>(count);
+    }
+    reply.cpp = body.substr(0, cppSize);
+    reply.diagnostics = body.substr(cppSize);
+    return reply;
+}
+
+// A source the lexer gives up on fails its own request, and the server goes on
+// compiling the next one on the same connection
+void testLexErrorThenCompile(const std::string& socketPath) {
+    int fd = connectTo(socketPath);
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+
+    sendSource(fd, "1", "put(\"hello);\nput(1);\n");
+    Reply failed = receiveReply(fd);
+    CHECK(failed.id == "1");
+    CHECK(failed.outcome == "failed");
+    CHECK(failed.cpp.empty());
+    CHECK(failed.diagnostics.find("Unterminated string literal at line 1, column 5") != std::string::npos);
+
+    sendSource(fd, "2", "put(\"hello\");\n");
+    Reply compiled = receiveReply(fd);
+    CHECK(compiled.id == "2");
+    CHECK(compiled.outcome == "ok");
+    CHECK(compiled.cpp.find("hello") != std::string::npos);
+    close(fd);
+}
+
+}
+
+int main() {
+    // The server stops on a SIGTERM it waits for, so no thread may take it first
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+    ServerOptions options;
+    options.socketPath = "/tmp/pseudo-server-test." + std::to_string(getpid()) + ".sock";
+    options.workers = 2;
+    std::thread server([&options] { runServer(options); });
+
+    // Starting precompiles the runtime header, which takes a few seconds
+    int probe = -1;
+    for (int attempt = 0; attempt < 600 && probe < 0; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        probe = connectTo(options.socketPath);
+    }
+    CHECK(probe >= 0);
+    if (probe >= 0) {
+        close(probe);
+        testLexErrorThenCompile(options.socketPath);
+    }
+
+    kill(getpid(), SIGTERM);
+    server.join();
+    return failures();
+}